@@ -0,0 +1,363 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <boost/thread/mutex.hpp>
+
+#include <openssl/crypto.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(WIN32) || defined(WIN64)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Memory for the precomputed EC tables, the backends (their batch buffers
+// and secret scratch) and the seeds of the search loops.
+//
+// The arena maps 2 MB regions and hands out cache line aligned blocks from
+// them, under a lock: allocations are made when a table is built or a thread
+// starts, never per candidate.  A region is 2 MB pages from hugetlbfs if the
+// host has some reserved, else a 2 MB aligned mapping marked for transparent
+// huge pages, else plain pages, so the tables (about 1.7 MB together) take a
+// TLB entry or two instead of hundreds.
+//
+// Released blocks are zeroed and kept for the next allocation of their size;
+// regions are never unmapped.  With --lock-memory every region is mlock'd,
+// so no seed or key scalar is ever written to swap.  Regions are left out of
+// core dumps where the kernel allows it.
+
+static const size_t ARENA_REGION = 2 * 1024 * 1024;
+static const size_t ARENA_ALIGN = 64;
+
+enum
+{
+    ARENA_HUGETLB,      // explicit 2 MB pages
+    ARENA_THP,          // transparent huge pages, madvise'd
+    ARENA_SMALL,        // plain pages
+    ARENA_KINDS
+};
+
+class CArena
+{
+protected:
+    struct CRegion
+    {
+        char*   pBegin;
+        size_t  nSize;
+        int     nKind;
+        bool    fLocked;
+    };
+
+    boost::mutex                    lock;
+    std::vector<CRegion>            vRegions;
+    std::multimap<size_t, void*>    mapFree;    // released blocks by size
+    char*                           pNext;      // in the last shared region
+    char*                           pEnd;
+    bool                            fLock;
+    bool                            fLockFailed;
+
+    CArena() : pNext(NULL), pEnd(NULL), fLock(false), fLockFailed(false)
+    {
+    }
+
+    CArena(const CArena&); // no implementation
+    CArena& operator=(const CArena&); // no implementation
+
+    static size_t RoundUp(size_t n, size_t nUnit)
+    {
+        return (n + nUnit - 1) / nUnit * nUnit;
+    }
+
+    static bool LockRegion(const CRegion& region)
+    {
+#if defined(WIN32) || defined(WIN64)
+        return VirtualLock(region.pBegin, region.nSize) != 0;
+#else
+        return mlock(region.pBegin, region.nSize) == 0;
+#endif
+    }
+
+    // nSize: a multiple of ARENA_REGION
+    static bool Map(size_t nSize, CRegion& region)
+    {
+        region.nSize = nSize;
+        region.fLocked = false;
+#if defined(WIN32) || defined(WIN64)
+        // large pages need SeLockMemoryPrivilege, which nobody grants us
+        region.pBegin = (char*) VirtualAlloc(NULL, nSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        region.nKind = ARENA_SMALL;
+        return region.pBegin != NULL;
+#else
+#ifdef MAP_HUGETLB
+        void* p = mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            region.pBegin = (char*) p;
+            region.nKind = ARENA_HUGETLB;
+            return true;
+        }
+#endif
+        // a region more, to cut a 2 MB aligned one out of it
+        p = mmap(NULL, nSize + ARENA_REGION, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return false;
+        char* pMapped = (char*) p;
+        char* pAligned = (char*) RoundUp((size_t) pMapped, ARENA_REGION);
+        if (pAligned != pMapped)
+            munmap(pMapped, pAligned - pMapped);
+        if (pMapped + ARENA_REGION != pAligned)
+            munmap(pAligned + nSize, pMapped + ARENA_REGION - pAligned);
+        region.pBegin = pAligned;
+        region.nKind = ARENA_SMALL;
+#ifdef MADV_HUGEPAGE
+        if (madvise(pAligned, nSize, MADV_HUGEPAGE) == 0)
+            region.nKind = ARENA_THP;
+#endif
+#endif
+#ifdef MADV_DONTDUMP
+        madvise(region.pBegin, nSize, MADV_DONTDUMP);
+#endif
+        return true;
+    }
+
+    // Under the lock.
+    void* NewRegion(size_t nSize, bool fShared)
+    {
+        CRegion region;
+        if (!Map(RoundUp(nSize, ARENA_REGION), region))
+            return NULL;
+        if (fLock)
+        {
+            region.fLocked = LockRegion(region);
+            fLockFailed = fLockFailed || !region.fLocked;
+        }
+        vRegions.push_back(region);
+        if (fShared)
+        {
+            pNext = region.pBegin + nSize;
+            pEnd = region.pBegin + region.nSize;
+        }
+        return region.pBegin;
+    }
+
+public:
+    // Never freed: tables and threads may release blocks until the process
+    // exits.
+    static CArena& Instance()
+    {
+        static CArena* pArena = new CArena;
+        return *pArena;
+    }
+
+    // --lock-memory: mlock the regions mapped so far and every later one.
+    // False if the limit (ulimit -l) stopped some of them.
+    bool SetLocked()
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        fLock = true;
+        for (size_t i = 0; i < vRegions.size(); i++)
+            if (!vRegions[i].fLocked)
+            {
+                vRegions[i].fLocked = LockRegion(vRegions[i]);
+                fLockFailed = fLockFailed || !vRegions[i].fLocked;
+            }
+        return !fLockFailed;
+    }
+
+    // Zeroed, ARENA_ALIGN aligned; throws std::bad_alloc.
+    void* Allocate(size_t nSize)
+    {
+        nSize = RoundUp(nSize ? nSize : 1, ARENA_ALIGN);
+        boost::unique_lock<boost::mutex> guard(lock);
+        std::multimap<size_t, void*>::iterator it = mapFree.find(nSize);
+        if (it != mapFree.end())
+        {
+            void* p = it->second;
+            mapFree.erase(it);
+            return p;
+        }
+        if ((size_t) (pEnd - pNext) >= nSize)
+        {
+            void* p = pNext;
+            pNext += nSize;
+            return p;
+        }
+        // big blocks get regions of their own, the rest of the last one
+        // stays in use
+        void* p = NewRegion(nSize, nSize < ARENA_REGION / 2);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void Release(void* p, size_t nSize)
+    {
+        if (!p)
+            return;
+        nSize = RoundUp(nSize ? nSize : 1, ARENA_ALIGN);
+        OPENSSL_cleanse(p, nSize);
+        boost::unique_lock<boost::mutex> guard(lock);
+        mapFree.insert(std::make_pair(nSize, p));
+    }
+
+    // "2 MB pages, 4 MB, locked" and the like.
+    std::string ToString()
+    {
+        static const char* const vKinds[ARENA_KINDS] = { "2 MB pages", "transparent huge pages", "4 KB pages" };
+        boost::unique_lock<boost::mutex> guard(lock);
+        size_t vSizes[ARENA_KINDS] = { 0, 0, 0 };
+        for (size_t i = 0; i < vRegions.size(); i++)
+            vSizes[vRegions[i].nKind] += vRegions[i].nSize;
+        std::string str;
+        char psz[64];
+        for (int i = 0; i < ARENA_KINDS; i++)
+            if (vSizes[i] != 0)
+            {
+                sprintf(psz, "%s%s, %u MB", str.empty() ? "" : "; ", vKinds[i], (unsigned int) (vSizes[i] >> 20));
+                str += psz;
+            }
+        if (str.empty())
+            str = "empty";
+        if (fLock)
+            str += fLockFailed ? ", not all locked (ulimit -l)" : ", locked";
+        return str;
+    }
+};
+
+// std::allocator over the arena, for the vectors of the tables.
+template <class T>
+class CArenaAllocator
+{
+public:
+    typedef T               value_type;
+    typedef T*              pointer;
+    typedef const T*        const_pointer;
+    typedef T&              reference;
+    typedef const T&        const_reference;
+    typedef std::size_t     size_type;
+    typedef std::ptrdiff_t  difference_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef CArenaAllocator<U> other;
+    };
+
+    CArenaAllocator() throw()
+    {
+    }
+
+    template <class U>
+    CArenaAllocator(const CArenaAllocator<U>&) throw()
+    {
+    }
+
+    pointer address(reference x) const
+    {
+        return &x;
+    }
+
+    const_pointer address(const_reference x) const
+    {
+        return &x;
+    }
+
+    pointer allocate(size_type n, const void* = 0)
+    {
+        return (pointer) CArena::Instance().Allocate(n * sizeof(T));
+    }
+
+    void deallocate(pointer p, size_type n)
+    {
+        CArena::Instance().Release(p, n * sizeof(T));
+    }
+
+    size_type max_size() const throw()
+    {
+        return std::numeric_limits<size_type>::max() / sizeof(T);
+    }
+
+    void construct(pointer p, const T& value)
+    {
+        new ((void*) p) T(value);
+    }
+
+    void destroy(pointer p)
+    {
+        p->~T();
+    }
+
+    template <class U>
+    bool operator==(const CArenaAllocator<U>&) const
+    {
+        return true;
+    }
+
+    template <class U>
+    bool operator!=(const CArenaAllocator<U>&) const
+    {
+        return false;
+    }
+};
+
+// A fixed array of a thread from the arena: the seeds of a batch.
+template <class T>
+class CArenaArray
+{
+protected:
+    T*      pData;
+    size_t  nCount;
+
+    CArenaArray(const CArenaArray&); // no implementation
+    CArenaArray& operator=(const CArenaArray&); // no implementation
+
+public:
+    explicit CArenaArray(size_t nCountIn) : nCount(nCountIn)
+    {
+        pData = (T*) CArena::Instance().Allocate(nCount * sizeof(T));
+        for (size_t i = 0; i < nCount; i++)
+            new ((void*) (pData + i)) T();
+    }
+
+    ~CArenaArray()
+    {
+        for (size_t i = 0; i < nCount; i++)
+            pData[i].~T();
+        CArena::Instance().Release(pData, nCount * sizeof(T));
+    }
+
+    operator T*()
+    {
+        return pData;
+    }
+
+    operator const T*() const
+    {
+        return pData;
+    }
+};
+
+// Base of classes whose instances live in the arena (the backends).
+class CArenaObject
+{
+public:
+    static void* operator new(size_t nSize)
+    {
+        return CArena::Instance().Allocate(nSize);
+    }
+
+    static void operator delete(void* p, size_t nSize)
+    {
+        CArena::Instance().Release(p, nSize);
+    }
+};
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef __AUTOTUNE_H__
+#define __AUTOTUNE_H__
+
+#include "Backend.h"
+#include "CpuTopology.h"
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if !defined(WIN32) && !defined(WIN64)
+#include <unistd.h>
+#endif
+
+// --autotune: short trials of the search settings on this host, the fastest
+// kept as a tuning profile that --tuning loads on later runs.
+//
+// One setting at a time, the others fixed at the best so far: backend and
+// batch size on one thread, then the thread count with and without SMT
+// siblings, then the window of the k*G table at that thread count.  Every
+// trial derives accounts like the search does, for a fixed time after a
+// warm-up, so table building and thread start are not counted.
+
+static const double AUTOTUNE_WARMUP_SECONDS = 0.3;
+static const double AUTOTUNE_TRIAL_SECONDS = 1.0;
+
+// host name, CPU features and logical CPUs: a profile is only used where it
+// was made
+inline std::string GetHostID()
+{
+    char pszHost[256] = "";
+#if !defined(WIN32) && !defined(WIN64)
+    gethostname(pszHost, sizeof(pszHost) - 1);
+#else
+    const char* psz = getenv("COMPUTERNAME");
+    if (psz)
+        strncpy(pszHost, psz, sizeof(pszHost) - 1);
+#endif
+    std::string strFeatures = GetCpuFeatures().ToString();
+    for (size_t i = 0; i < strFeatures.size(); i++)
+        if (strFeatures[i] == ' ')
+            strFeatures[i] = ',';
+    return std::string(pszHost) + "/" + strFeatures + "/" + lexical_cast_i(GetCpuTopology().vCpus.size());
+}
+
+// "%h" in a profile path becomes the host name, so one directory can hold a
+// whole fleet's profiles.
+inline std::string expandHostPath(const std::string& strPath)
+{
+    std::string strHost = GetHostID();
+    strHost = strHost.substr(0, strHost.find('/'));
+    std::string str = strPath;
+    for (size_t n = str.find("%h"); n != std::string::npos; n = str.find("%h", n + strHost.size()))
+        str.replace(n, 2, strHost);
+    return str;
+}
+
+struct CTuning
+{
+    std::string     strBackend;
+    unsigned int    nBatch;         // seeds per backend call
+    int             nWindowBits;    // k*G table window
+    unsigned int    nThreads;
+    bool            fSmt;           // false: one pinned thread per core
+    double          dRate;          // accounts/second in the trial
+
+    CTuning() : nBatch(1), nWindowBits(6), nThreads(1), fSmt(true), dRate(0)
+    {
+    }
+
+    std::string ToString() const
+    {
+        return strBackend + ", batch " + lexical_cast_i(nBatch) + ", window " + lexical_cast_i(nWindowBits)
+               + " bits, " + lexical_cast_i(nThreads) + (nThreads == 1 ? " thread" : " threads")
+               + ", smt " + (fSmt ? "on" : "off");
+    }
+
+    bool Save(const std::string& strPath, std::string& msg) const
+    {
+        std::ofstream out(strPath.c_str(), std::ios::trunc);
+        out << "# ripplegen tuning profile, made by --autotune" << std::endl
+            << "host=" << GetHostID() << std::endl
+            << "backend=" << strBackend << std::endl
+            << "batch=" << nBatch << std::endl
+            << "window=" << nWindowBits << std::endl
+            << "threads=" << nThreads << std::endl
+            << "smt=" << (fSmt ? 1 : 0) << std::endl
+            << "rate=" << (uint64) dRate << std::endl;
+        out.close();
+        if (!out)
+        {
+            msg = "Cannot write " + strPath;
+            return false;
+        }
+        return true;
+    }
+
+    bool Load(const std::string& strPath, std::string& msg)
+    {
+        std::ifstream in(strPath.c_str());
+        if (!in)
+        {
+            msg = "Cannot open " + strPath;
+            return false;
+        }
+        std::string strLine, strHost;
+        while (std::getline(in, strLine))
+        {
+            size_t nEquals = strLine.find('=');
+            if (strLine.empty() || strLine[0] == '#' || nEquals == std::string::npos)
+                continue;
+            std::string strKey = strLine.substr(0, nEquals);
+            std::string strValue = strLine.substr(nEquals + 1);
+            if (strKey == "host")
+                strHost = strValue;
+            else if (strKey == "backend")
+                strBackend = strValue;
+            else if (strKey == "batch")
+                nBatch = strtoul(strValue.c_str(), NULL, 10);
+            else if (strKey == "window")
+                nWindowBits = atoi(strValue.c_str());
+            else if (strKey == "threads")
+                nThreads = strtoul(strValue.c_str(), NULL, 10);
+            else if (strKey == "smt")
+                fSmt = atoi(strValue.c_str()) != 0;
+            else if (strKey == "rate")
+                dRate = atof(strValue.c_str());
+        }
+        if (strHost != GetHostID())
+        {
+            msg = strPath + " was made on " + (strHost.empty() ? "an unknown host" : strHost)
+                  + ", run --autotune again here";
+            return false;
+        }
+        std::vector<std::string> vNames = GetCryptoBackends();
+        if (std::find(vNames.begin(), vNames.end(), strBackend) == vNames.end()
+            || nBatch < 1 || nBatch > BACKEND_BATCH || nThreads < 1 || nWindowBits < 4 || nWindowBits > 8)
+        {
+            msg = strPath + " is not a valid tuning profile";
+            return false;
+        }
+        return true;
+    }
+
+    // Backend and table window for every backend made from now on.
+    bool Apply(std::string& msg) const
+    {
+        if (!SelectCryptoBackend(strBackend, msg))
+            return false;
+#ifdef USE_NATIVE_SECP256K1
+        SetGeneratorWindow(nWindowBits);
+#endif
+        return true;
+    }
+};
+
+class CAutotuner
+{
+protected:
+    CCpuTopology                topology;
+    int                         nAccounts;
+    std::vector<std::string>    vBackends;
+
+    static void TrialThread(unsigned int nThread, unsigned int nBatch, int nAccounts,
+                            boost::atomic<bool>* pfStop, boost::atomic<uint64>* pnDone)
+    {
+        boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+        uint128 vSeeds[BACKEND_BATCH];
+        uint160 vAccountIDs[BACKEND_BATCH];
+        uint64 nCounter = (uint64) nThread << 40;
+        while (!*pfStop)
+        {
+            for (unsigned int i = 0; i < nBatch; i++)
+            {
+                nCounter++;
+                memcpy(vSeeds[i].begin(), &nCounter, sizeof(nCounter));
+            }
+            pBackend->SetFamilies(vSeeds, nBatch);
+            for (int nIndex = 0; nIndex < nAccounts; nIndex++)
+                pBackend->GetFamilyAccountIDs(nIndex, vAccountIDs);
+            pnDone->fetch_add(nBatch * nAccounts, boost::memory_order_relaxed);
+        }
+    }
+
+    static double Now()
+    {
+        return (boost::posix_time::microsec_clock::universal_time()
+                - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1))).total_microseconds() / 1e6;
+    }
+
+    void Report(std::ostream& out, const CTuning& tuning)
+    {
+        out << "#   " << tuning.ToString() << ": " << (uint64) tuning.dRate << " accounts/second" << std::endl;
+    }
+
+    // Run one trial and keep it in best if faster.
+    void Try(std::ostream& out, CTuning tuning, CTuning& best)
+    {
+        tuning.dRate = Trial(tuning);
+        Report(out, tuning);
+        if (tuning.dRate > best.dRate)
+            best = tuning;
+    }
+
+public:
+    // strBackend empty: every backend but the reference one.
+    CAutotuner(const CCpuTopology& topologyIn, const std::string& strBackend, int nAccountsIn)
+        : topology(topologyIn), nAccounts(nAccountsIn)
+    {
+        std::vector<std::string> vNames = GetCryptoBackends();
+        for (size_t i = 0; i < vNames.size(); i++)
+            if ((strBackend.empty() || strBackend == "auto") ? (vNames[i] != "openssl" || vNames.size() == 1)
+                                                             : vNames[i] == strBackend)
+                vBackends.push_back(vNames[i]);
+    }
+
+    double Trial(const CTuning& tuning)
+    {
+        std::string msg;
+        if (!tuning.Apply(msg))
+            return 0;
+        {
+            // tables are built once per process, outside the clock
+            boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+        }
+
+        boost::atomic<bool> fStop(false);
+        boost::atomic<uint64> nDone(0);
+        std::vector<boost::thread*> vpThreads;
+        for (unsigned int i = 0; i < tuning.nThreads; i++)
+        {
+            vpThreads.push_back(new boost::thread(TrialThread, i, tuning.nBatch, nAccounts, &fStop, &nDone));
+            if (!tuning.fSmt)
+                PinThread(*vpThreads.back(), topology.vCores[i % topology.vCores.size()]);
+        }
+        boost::this_thread::sleep(boost::posix_time::milliseconds((int) (AUTOTUNE_WARMUP_SECONDS * 1000)));
+        uint64 nStart = nDone;
+        double dStart = Now();
+        boost::this_thread::sleep(boost::posix_time::milliseconds((int) (AUTOTUNE_TRIAL_SECONDS * 1000)));
+        uint64 nEnd = nDone;
+        double dEnd = Now();
+        fStop = true;
+        for (size_t i = 0; i < vpThreads.size(); i++)
+        {
+            vpThreads[i]->join();
+            delete vpThreads[i];
+        }
+        return (nEnd - nStart) / (dEnd - dStart);
+    }
+
+    CTuning Run(std::ostream& out)
+    {
+        out << "# Autotune on " << GetHostID() << " (" << topology.ToString() << ")" << std::endl;
+        CTuning best;
+
+        // backend and batch, one thread
+        for (size_t i = 0; i < vBackends.size(); i++)
+        {
+            CTuning tuning = best;
+            tuning.strBackend = vBackends[i];
+            std::string msg;
+            tuning.Apply(msg);
+            boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+            if (pBackend->GetBatchSize() == 1)
+            {
+                tuning.nBatch = 1;
+                Try(out, tuning, best);
+            }
+            tuning.nBatch = BACKEND_BATCH;
+            Try(out, tuning, best);
+        }
+
+        // threads: powers of two, one per core and one per logical CPU, with
+        // SMT siblings left idle where that is a different choice, none
+        // beyond the cgroup quota
+        unsigned int nLogical = std::min<unsigned int>(topology.vCpus.size(), topology.GetBudget());
+        unsigned int nCores = std::min<unsigned int>(topology.vCores.size(), nLogical);
+        std::vector<unsigned int> vThreads;
+        for (unsigned int n = 2; n < nLogical; n *= 2)
+            vThreads.push_back(n);
+        vThreads.push_back(nCores);
+        vThreads.push_back(nLogical);
+        std::sort(vThreads.begin(), vThreads.end());
+        vThreads.erase(std::unique(vThreads.begin(), vThreads.end()), vThreads.end());
+        CTuning base = best;
+        for (size_t i = 0; i < vThreads.size(); i++)
+        {
+            CTuning tuning = base;
+            tuning.nThreads = vThreads[i];
+            if (tuning.nThreads > 1)
+                Try(out, tuning, best);
+            if (nCores < nLogical && tuning.nThreads <= nCores)
+            {
+                tuning.fSmt = false;
+                Try(out, tuning, best);
+            }
+        }
+
+        // table window at that load, since threads share the caches
+        base = best;
+        for (int nBits = 4; nBits <= 8 && base.strBackend != "openssl"; nBits++)
+        {
+            if (nBits == base.nWindowBits)
+                continue;
+            CTuning tuning = base;
+            tuning.nWindowBits = nBits;
+            Try(out, tuning, best);
+        }
+
+        std::string msg;
+        best.Apply(msg);
+        out << "# Autotune picked " << best.ToString() << ": " << (uint64) best.dRate << " accounts/second" << std::endl
+            << "#" << std::endl;
+        return best;
+    }
+};
+
+#endif
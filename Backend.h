@@ -0,0 +1,673 @@
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include "Arena.h"
+#include "RippleAddress.h"
+#include "Secp256k1.h"
+#include "Secp256k1Ifma.h"
+#include "Ed25519.h"
+
+#include "Digest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+// Crypto backends.
+//
+// Everything the search does per candidate - root key from seed, account key
+// from root key, Hash160 of the account key - goes through a CCryptoBackend,
+// one instance per thread.  Implementations:
+//
+//     openssl     reference, the original key.h code
+//     native      own secp256k1 arithmetic, 64-bit limbs, table based k*G
+//     ifma        native with eight keys at a time on AVX-512 IFMA
+//
+// Ed25519 accounts ("sEd..." seeds) go through the backend too: OpenSSL for
+// the reference, Ed25519.h for native and ifma.
+//
+// One is selected at startup from what the CPU supports, or forced with
+// --backend=<name>.  The binary is built for the baseline architecture;
+// kernels using instruction set extensions must be compiled for their target
+// alone (function target attributes) and only entered when CPUID has them.
+
+struct CCpuFeatures
+{
+    bool fBmi2;
+    bool fAdx;
+    bool fAvx2;
+    bool fAvx512f;
+    bool fAvx512Ifma;
+
+    std::string ToString() const
+    {
+        std::string str;
+        if (fBmi2)       str += " bmi2";
+        if (fAdx)        str += " adx";
+        if (fAvx2)       str += " avx2";
+        if (fAvx512f)    str += " avx512f";
+        if (fAvx512Ifma) str += " avx512ifma";
+        return str.empty() ? "baseline" : str.substr(1);
+    }
+};
+
+inline CCpuFeatures GetCpuFeatures()
+{
+    CCpuFeatures features;
+    memset(&features, 0, sizeof(features));
+
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    unsigned int nMax = regs[0];
+#else
+    unsigned int nMax = __get_cpuid_max(0, NULL);
+#endif
+    if (nMax < 7)
+        return features;
+
+#if defined(_MSC_VER)
+    __cpuid(regs, 1);
+    c = regs[2];
+#else
+    __cpuid_count(1, 0, a, b, c, d);
+#endif
+    // AVX state must be enabled by the OS (OSXSAVE, then XCR0)
+    unsigned long long nXcr0 = 0;
+    if (c & (1u << 27))
+    {
+#if defined(_MSC_VER)
+        nXcr0 = _xgetbv(0);
+#else
+        unsigned int lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        nXcr0 = ((unsigned long long) hi << 32) | lo;
+#endif
+    }
+    bool fAvxState = (nXcr0 & 0x06) == 0x06;
+    bool fAvx512State = (nXcr0 & 0xe6) == 0xe6;
+
+#if defined(_MSC_VER)
+    __cpuidex(regs, 7, 0);
+    b = regs[1];
+#else
+    __cpuid_count(7, 0, a, b, c, d);
+#endif
+    features.fBmi2 = (b & (1u << 8)) != 0;
+    features.fAdx = (b & (1u << 19)) != 0;
+    features.fAvx2 = fAvxState && (b & (1u << 5)) != 0;
+    features.fAvx512f = fAvx512State && (b & (1u << 16)) != 0;
+    features.fAvx512Ifma = features.fAvx512f && (b & (1u << 21)) != 0;
+#endif
+    return features;
+}
+
+// Families per SetSeeds call; the search loops fill batches of this size.
+static const unsigned int BACKEND_BATCH = 8;
+
+// Key types derived from each seed (--key-type), any combination.
+enum
+{
+    KEY_SECP256K1   = 1,
+    KEY_ED25519     = 2,
+};
+
+// "secp256k1", "ed25519" or "both".
+inline bool ParseKeyTypes(const std::string& strKeyType, int& nKeyTypes)
+{
+    if (strKeyType == "secp256k1")
+        nKeyTypes = KEY_SECP256K1;
+    else if (strKeyType == "ed25519")
+        nKeyTypes = KEY_ED25519;
+    else if (strKeyType == "both")
+        nKeyTypes = KEY_SECP256K1 | KEY_ED25519;
+    else
+        return false;
+    return true;
+}
+
+inline std::string KeyTypesToString(int nKeyTypes)
+{
+    if (nKeyTypes == (KEY_SECP256K1 | KEY_ED25519))
+        return "secp256k1 and ed25519";
+    return nKeyTypes == KEY_ED25519 ? "ed25519" : "secp256k1";
+}
+
+// Instances live in the arena (Arena.h), with their batch buffers.
+class CCryptoBackend : public CArenaObject
+{
+protected:
+    std::vector<unsigned char, CArenaAllocator<unsigned char> > vchGenerators;   // batch, 33 bytes each
+    unsigned int nFamilies;
+
+public:
+    CCryptoBackend() : nFamilies(0)
+    {
+    }
+
+    virtual ~CCryptoBackend()
+    {
+    }
+
+    virtual const char* GetName() const = 0;
+
+    // Families per SetSeeds call that pay off; the search loop is built for it.
+    virtual unsigned int GetBatchSize() const
+    {
+        return 1;
+    }
+
+    // --> family seed
+    // <-- compressed root public key ("generator"), kept for GetAccountPublic
+    virtual bool SetSeed(const uint128& seed, unsigned char* pGenerator) = 0;
+
+    // --> compressed root public key, kept for GetAccountPublic
+    virtual bool SetGenerator(const unsigned char* pGenerator) = 0;
+
+    // <-- compressed public key of account nSeq of the current family
+    virtual bool GetAccountPublic(int nSeq, unsigned char* pPublic) = 0;
+
+    virtual void Hash160(const unsigned char* pData, size_t nSize, unsigned char* pHash)
+    {
+        DigestHash160(pData, nSize, pHash);
+    }
+
+    // Account id of account nSeq of the current family.
+    bool GetAccountID(int nSeq, uint160& accountID)
+    {
+        unsigned char pPublic[33];
+        if (!GetAccountPublic(nSeq, pPublic))
+            return false;
+        Hash160(pPublic, sizeof(pPublic), accountID.begin());
+        return true;
+    }
+
+    // Batched forms: the families of up to BACKEND_BATCH seeds, then account
+    // nSeq of each of them, as public keys or account ids.  The defaults take
+    // the families in turn.
+    virtual bool SetSeeds(const uint128* pSeeds, unsigned int nCount)
+    {
+        vchGenerators.resize(33 * nCount);
+        for (unsigned int i = 0; i < nCount; i++)
+            if (!SetSeed(pSeeds[i], &vchGenerators[33 * i]))
+                return false;
+        nFamilies = nCount;
+        return true;
+    }
+
+    // Root public key of family i of the last SetSeeds, 33 bytes: the node
+    // public key of the seed.
+    virtual const unsigned char* GetGenerator(unsigned int i) const
+    {
+        return &vchGenerators[33 * i];
+    }
+
+    // <-- 33 bytes per family
+    virtual bool GetAccountPublics(int nSeq, unsigned char* pPublics)
+    {
+        for (unsigned int i = 0; i < nFamilies; i++)
+        {
+            if (nFamilies > 1 && !SetGenerator(&vchGenerators[33 * i]))
+                return false;
+            if (!GetAccountPublic(nSeq, pPublics + 33 * i))
+                return false;
+        }
+        return true;
+    }
+
+    virtual bool GetAccountIDs(int nSeq, uint160* pAccountIDs)
+    {
+        unsigned char vPublics[BACKEND_BATCH][33];
+        if (nFamilies > BACKEND_BATCH || !GetAccountPublics(nSeq, vPublics[0]))
+            return false;
+        for (unsigned int i = 0; i < nFamilies; i++)
+            Hash160(vPublics[i], 33, pAccountIDs[i].begin());
+        return true;
+    }
+
+    // Throwing forms for the search loops, where a failure is a bug.
+    void SetFamily(const uint128& seed)
+    {
+        unsigned char pGenerator[33];
+        if (!SetSeed(seed, pGenerator))
+            throw std::runtime_error("SetFamily : root key derivation failed");
+    }
+
+    void SetFamilies(const uint128* pSeeds, unsigned int nCount)
+    {
+        if (!SetSeeds(pSeeds, nCount))
+            throw std::runtime_error("SetFamilies : root key derivation failed");
+    }
+
+    void GetFamilyAccountIDs(int nSeq, uint160* pAccountIDs)
+    {
+        if (!GetAccountIDs(nSeq, pAccountIDs))
+            throw std::runtime_error("GetAccountIDs : account key derivation failed");
+    }
+
+    void GetFamilyAccountPublics(int nSeq, unsigned char* pPublics)
+    {
+        if (!GetAccountPublics(nSeq, pPublics))
+            throw std::runtime_error("GetAccountPublics : account key derivation failed");
+    }
+
+    // Families of the last SetSeeds.
+    unsigned int GetFamilyCount() const
+    {
+        return nFamilies;
+    }
+
+    uint160 GetAccountID(int nSeq)
+    {
+        uint160 accountID;
+        if (!GetAccountID(nSeq, accountID))
+            throw std::runtime_error("GetAccountID : account key derivation failed");
+        return accountID;
+    }
+
+    // Ed25519 account public keys of up to BACKEND_BATCH seeds, 33 bytes per
+    // seed.  Independent of the families.  The default is the reference.
+    virtual bool GetEd25519Publics(const uint128* pSeeds, unsigned int nCount, unsigned char* pPublics)
+    {
+        std::vector<unsigned char> vchPublic;
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            if (!GenerateEd25519Key(pSeeds[i], vchPublic))
+                return false;
+            memcpy(pPublics + 33 * i, &vchPublic[0], 33);
+        }
+        return true;
+    }
+
+    bool GetEd25519AccountIDs(const uint128* pSeeds, unsigned int nCount, uint160* pAccountIDs)
+    {
+        unsigned char vPublics[BACKEND_BATCH][33];
+        if (nCount > BACKEND_BATCH || !GetEd25519Publics(pSeeds, nCount, vPublics[0]))
+            return false;
+        for (unsigned int i = 0; i < nCount; i++)
+            Hash160(vPublics[i], 33, pAccountIDs[i].begin());
+        return true;
+    }
+
+    void DeriveEd25519AccountIDs(const uint128* pSeeds, unsigned int nCount, uint160* pAccountIDs)
+    {
+        if (!GetEd25519AccountIDs(pSeeds, nCount, pAccountIDs))
+            throw std::runtime_error("GetEd25519AccountIDs : ed25519 key derivation failed");
+    }
+
+    void DeriveEd25519Publics(const uint128* pSeeds, unsigned int nCount, unsigned char* pPublics)
+    {
+        if (nCount > BACKEND_BATCH || !GetEd25519Publics(pSeeds, nCount, pPublics))
+            throw std::runtime_error("GetEd25519Publics : ed25519 key derivation failed");
+    }
+
+    uint160 GetEd25519AccountID(const uint128& seed)
+    {
+        uint160 accountID;
+        DeriveEd25519AccountIDs(&seed, 1, &accountID);
+        return accountID;
+    }
+};
+
+// The original derivation, kept as the reference every other backend is
+// checked against.
+class COpenSSLBackend : public CCryptoBackend
+{
+protected:
+    CAccountFamily family;
+    std::vector<unsigned char> vchPublic;
+
+public:
+    const char* GetName() const
+    {
+        return "openssl";
+    }
+
+    bool SetSeed(const uint128& seed, unsigned char* pGenerator)
+    {
+        if (!family.SetSeed(seed, vchPublic))
+            return false;
+        memcpy(pGenerator, &vchPublic[0], 33);
+        return true;
+    }
+
+    bool SetGenerator(const unsigned char* pGenerator)
+    {
+        return family.SetGenerator(uchar_vector(pGenerator, pGenerator + 33));
+    }
+
+    bool GetAccountPublic(int nSeq, unsigned char* pPublic)
+    {
+        if (!family.GetPubKey(nSeq, vchPublic))
+            return false;
+        memcpy(pPublic, &vchPublic[0], 33);
+        return true;
+    }
+};
+
+#ifdef USE_NATIVE_SECP256K1
+
+class CNativeBackend : public CCryptoBackend
+{
+protected:
+    const CGeneratorTable&  table;
+    CAffinePoint            vRoots[BACKEND_BATCH];
+    unsigned char           vGeneratorBytes[BACKEND_BATCH][33];
+    unsigned char           vScalars[BACKEND_BATCH][32];    // secret scratch
+
+    // secp256k1 group order, big-endian
+    static bool IsValidScalar(const unsigned char* k32)
+    {
+        static const unsigned char pOrder[32] = {
+            0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xfe,
+            0xba,0xae,0xdc,0xe6, 0xaf,0x48,0xa0,0x3b, 0xbf,0xd2,0x5e,0x8c, 0xd0,0x36,0x41,0x41 };
+        static const unsigned char pZero[32] = { 0 };
+        return memcmp(k32, pOrder, 32) < 0 && memcmp(k32, pZero, 32) != 0;
+    }
+
+    static void PutSeq(unsigned char* p, int nSeq)
+    {
+        p[0] = (unsigned char) (nSeq >> 24);
+        p[1] = (unsigned char) ((nSeq >> 16) & 0xff);
+        p[2] = (unsigned char) ((nSeq >> 8) & 0xff);
+        p[3] = (unsigned char) (nSeq & 0xff);
+    }
+
+    // same as GenerateRootDeterministicKey
+    static void GetRootScalar(const uint128& seed, unsigned char* k32)
+    {
+        unsigned char s[20];
+        unsigned char root512[64];
+        memcpy(s, seed.begin(), 16);
+        int nSeq = 0;
+        do
+        {
+            PutSeq(s + 16, nSeq++);
+            DigestSHA512(s, sizeof(s), root512);
+        } while (!IsValidScalar(root512));
+        memcpy(k32, root512, 32);
+        memset(s, 0, sizeof(s));
+        memset(root512, 0, sizeof(root512));
+    }
+
+    // same as makeHash in GeneratePublicDeterministicKey
+    static void GetAccountScalar(const unsigned char* pGenerator, int nSeq, unsigned char* k32)
+    {
+        unsigned char s[41];
+        unsigned char hash512[64];
+        memcpy(s, pGenerator, 33);
+        PutSeq(s + 33, nSeq);
+        int nSubSeq = 0;
+        do
+        {
+            PutSeq(s + 37, nSubSeq++);
+            DigestSHA512(s, sizeof(s), hash512);
+        } while (!IsValidScalar(hash512));
+        memcpy(k32, hash512, 32);
+    }
+
+    // Root point and generator of slot i from its root scalar.
+    bool SetRoot(unsigned int i, const unsigned char* k32)
+    {
+        CJacobianPoint point;
+        table.Mul(point, k32);
+        if (!gejGetAffine(vRoots[i], point))
+            return false;
+        geGetCompressed(vGeneratorBytes[i], vRoots[i]);
+        return true;
+    }
+
+    bool GetAccount(unsigned int i, const unsigned char* k32, unsigned char* pPublic)
+    {
+        CJacobianPoint point;
+        CAffinePoint account;
+        table.Mul(point, k32);
+        gejAddAffine(point, point, vRoots[i]);
+        if (!gejGetAffine(account, point))
+            return false;
+        geGetCompressed(pPublic, account);
+        return true;
+    }
+
+public:
+    CNativeBackend() : table(CGeneratorTable::Get())
+    {
+    }
+
+    const char* GetName() const
+    {
+        return "native";
+    }
+
+    bool SetSeed(const uint128& seed, unsigned char* pGenerator)
+    {
+        if (!SetSeeds(&seed, 1))
+            return false;
+        memcpy(pGenerator, vGeneratorBytes[0], 33);
+        return true;
+    }
+
+    bool SetGenerator(const unsigned char* pGenerator)
+    {
+        memcpy(vGeneratorBytes[0], pGenerator, 33);
+        nFamilies = 1;
+        return geSetCompressed(vRoots[0], pGenerator);
+    }
+
+    bool GetAccountPublic(int nSeq, unsigned char* pPublic)
+    {
+        unsigned char k32[32];
+        GetAccountScalar(vGeneratorBytes[0], nSeq, k32);
+        return GetAccount(0, k32, pPublic);
+    }
+
+    bool SetSeeds(const uint128* pSeeds, unsigned int nCount)
+    {
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            GetRootScalar(pSeeds[i], vScalars[i]);
+            if (!SetRoot(i, vScalars[i]))
+                return false;
+        }
+        memset(vScalars, 0, sizeof(vScalars));
+        nFamilies = nCount;
+        return true;
+    }
+
+    const unsigned char* GetGenerator(unsigned int i) const
+    {
+        return vGeneratorBytes[i];
+    }
+
+    bool GetAccountPublics(int nSeq, unsigned char* pPublics)
+    {
+        unsigned char k32[32];
+        for (unsigned int i = 0; i < nFamilies; i++)
+        {
+            GetAccountScalar(vGeneratorBytes[i], nSeq, k32);
+            if (!GetAccount(i, k32, pPublics + 33 * i))
+                return false;
+        }
+        return true;
+    }
+
+#ifdef USE_NATIVE_ED25519
+    // The batch through CEd25519Table, one inversion for all of it.
+    bool GetEd25519Publics(const uint128* pSeeds, unsigned int nCount, unsigned char* pPublics)
+    {
+        unsigned char vEncoded[BACKEND_BATCH][32];
+        CEdPoint vPoints[BACKEND_BATCH];
+        if (nCount > BACKEND_BATCH)
+            return false;
+        if (nCount == 0)
+            return true;
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            GetEd25519Secret(pSeeds[i].begin(), vScalars[i]);
+            GetEd25519Scalar(vScalars[i], vScalars[i]);
+        }
+        const CEd25519Table& edTable = CEd25519Table::Get();
+        edTable.Mul(vPoints, vScalars, nCount);
+        CEd25519Table::GetBytes(vEncoded, vPoints, nCount);
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            pPublics[33 * i] = 0xED;
+            memcpy(pPublics + 33 * i + 1, vEncoded[i], 32);
+        }
+        memset(vScalars, 0, sizeof(vScalars));
+        return true;
+    }
+#endif
+};
+
+#ifdef USE_IFMA_SECP256K1
+
+// The native backend with the k*G of a whole batch done in the eight lanes of
+// CIfmaTable::MulG.  Lanes MulG flags go through the scalar code.
+class CIfmaBackend : public CNativeBackend
+{
+protected:
+    const CIfmaTable&   table52;
+    CAffinePoint        vPoints[BACKEND_BATCH];
+
+    // unused lanes repeat lane 0
+    void PadScalars(unsigned int nCount)
+    {
+        for (unsigned int i = nCount; i < BACKEND_BATCH; i++)
+            memcpy(vScalars[i], vScalars[0], 32);
+    }
+
+public:
+    CIfmaBackend() : table52(CIfmaTable::Get())
+    {
+    }
+
+    const char* GetName() const
+    {
+        return "ifma";
+    }
+
+    unsigned int GetBatchSize() const
+    {
+        return BACKEND_BATCH;
+    }
+
+    bool SetSeeds(const uint128* pSeeds, unsigned int nCount)
+    {
+        for (unsigned int i = 0; i < nCount; i++)
+            GetRootScalar(pSeeds[i], vScalars[i]);
+        PadScalars(nCount);
+
+        unsigned int fBad = table52.MulG(vScalars, NULL, vRoots);
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            if (fBad & (1 << i))
+            {
+                if (!SetRoot(i, vScalars[i]))
+                    return false;
+            }
+            else
+                geGetCompressed(vGeneratorBytes[i], vRoots[i]);
+        }
+        memset(vScalars, 0, sizeof(vScalars));
+        nFamilies = nCount;
+        return true;
+    }
+
+    bool GetAccountPublics(int nSeq, unsigned char* pPublics)
+    {
+        for (unsigned int i = 0; i < nFamilies; i++)
+            GetAccountScalar(vGeneratorBytes[i], nSeq, vScalars[i]);
+        PadScalars(nFamilies);
+        for (unsigned int i = nFamilies; i < BACKEND_BATCH; i++)
+            vRoots[i] = vRoots[0];
+
+        unsigned int fBad = table52.MulG(vScalars, vRoots, vPoints);
+        for (unsigned int i = 0; i < nFamilies; i++)
+        {
+            if (fBad & (1 << i))
+            {
+                if (!GetAccount(i, vScalars[i], pPublics + 33 * i))
+                    return false;
+            }
+            else
+                geGetCompressed(pPublics + 33 * i, vPoints[i]);
+        }
+        return true;
+    }
+};
+
+#endif
+
+#endif
+
+// Backend names usable on this CPU, fastest first.
+inline std::vector<std::string> GetCryptoBackends()
+{
+    std::vector<std::string> vNames;
+#ifdef USE_IFMA_SECP256K1
+    if (GetCpuFeatures().fAvx512Ifma)
+        vNames.push_back("ifma");
+#endif
+#ifdef USE_NATIVE_SECP256K1
+    vNames.push_back("native");
+#endif
+    vNames.push_back("openssl");
+    return vNames;
+}
+
+inline std::string& SelectedCryptoBackend()
+{
+    static std::string strBackend;
+    return strBackend;
+}
+
+// "auto" (or empty) picks the fastest backend this CPU supports.
+inline bool SelectCryptoBackend(const std::string& strName, std::string& msg)
+{
+    std::vector<std::string> vNames = GetCryptoBackends();
+    if (strName.empty() || strName == "auto")
+    {
+        SelectedCryptoBackend() = vNames[0];
+        return true;
+    }
+    if (std::find(vNames.begin(), vNames.end(), strName) == vNames.end())
+    {
+        msg = "Unknown or unsupported backend \"" + strName + "\", available:";
+        for (size_t i = 0; i < vNames.size(); i++)
+            msg += " " + vNames[i];
+        return false;
+    }
+    SelectedCryptoBackend() = strName;
+    return true;
+}
+
+// A new instance of the selected backend, owned by the caller (one per thread).
+inline CCryptoBackend* NewCryptoBackend()
+{
+    if (SelectedCryptoBackend().empty())
+    {
+        std::string msg;
+        SelectCryptoBackend("auto", msg);
+    }
+#ifdef USE_IFMA_SECP256K1
+    if (SelectedCryptoBackend() == "ifma")
+        return new CIfmaBackend();
+#endif
+#ifdef USE_NATIVE_SECP256K1
+    if (SelectedCryptoBackend() == "native")
+        return new CNativeBackend();
+#endif
+    return new COpenSSLBackend();
+}
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef __BACKGROUND_H__
+#define __BACKGROUND_H__
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(WIN32) || defined(WIN64)
+#include <windows.h>
+#endif
+
+// --background: search on a busy host without getting in its way.
+//
+// Search threads drop to SCHED_IDLE (or a nice level), so the scheduler
+// runs them only on CPUs nothing else wants.  On top of that a controller
+// thread, at normal priority, paces them: every thread sleeps after its
+// batches so that it works at most a duty fraction of the time.  The duty
+// starts at the target share (--cpu-share) and every BACKGROUND_PERIOD is
+// halved while the rest of the host is busy (the CPU time of other processes
+// in /proc/stat) or CPU pressure is high (/proc/pressure/cpu, the share of
+// time some task waited for a CPU), down to a full stop, and ramps back up
+// by a tenth of the share per period once both are low again.
+//
+// Pressure counts our own threads when they wait behind the host's, so a
+// loaded host sees us back off rather than queue behind it.
+
+static const double BACKGROUND_PERIOD = 0.5;    // seconds between samples
+static const double BACKGROUND_SLICE = 0.01;    // work between sleeps
+static const double BACKGROUND_NAP = 0.1;       // longest sleep, so stops are seen
+static const double BACKGROUND_MIN_DUTY = 0.02; // below this, hold back entirely
+
+class CBackground
+{
+protected:
+    bool                    fEnabled;   // pace the threads
+    bool                    fIdle;      // SCHED_IDLE, else nNice
+    int                     nNice;
+    double                  dShare;     // target duty, (0, 1]
+    double                  dMaxLoad;   // other processes, fraction of the host CPUs
+    double                  dMaxPressure;   // fraction of time
+    boost::atomic<double>   dDuty;
+    boost::function<void(const std::string&)> log;
+    boost::thread           controller;
+    boost::mutex            lock;
+    boost::condition_variable condResume;
+
+    CBackground() : fEnabled(false), fIdle(true), nNice(0), dShare(1), dMaxLoad(1), dMaxPressure(1), dDuty(1)
+    {
+    }
+
+    ~CBackground()
+    {
+        Stop();
+    }
+
+    void SetDuty(double d)
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        dDuty = d;
+        if (d > 0)
+            condResume.notify_all();
+    }
+
+    static double Now()
+    {
+        return (boost::posix_time::microsec_clock::universal_time()
+                - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1))).total_microseconds() / 1e6;
+    }
+
+#if defined(__linux__)
+    // busy and total CPU seconds of the host, all CPUs added
+    static bool ReadHostTimes(double& dBusy, double& dTotal)
+    {
+        std::ifstream in("/proc/stat");
+        std::string strCpu;
+        unsigned long long v[8] = {0};
+        if (!(in >> strCpu) || strCpu != "cpu")
+            return false;
+        for (int i = 0; i < 8 && (in >> v[i]); i++)
+            ;
+        // user nice system idle iowait irq softirq steal
+        double dHz = sysconf(_SC_CLK_TCK);
+        dTotal = (v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7]) / dHz;
+        dBusy = dTotal - (v[3] + v[4]) / dHz;
+        return true;
+    }
+
+    static double ReadOwnTime()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    // "some avg10=.. avg60=.. avg300=.. total=<microseconds>", -1 without PSI
+    static double ReadPressure()
+    {
+        std::ifstream in("/proc/pressure/cpu");
+        std::string strLine;
+        while (std::getline(in, strLine))
+        {
+            size_t n = strLine.find("total=");
+            if (strLine.compare(0, 5, "some ") == 0 && n != std::string::npos)
+                return strtoull(strLine.c_str() + n + 6, NULL, 10) / 1e6;
+        }
+        return -1;
+    }
+#endif
+
+    static std::string Percent(double d)
+    {
+        char psz[32];
+        sprintf(psz, "%.0f%%", 100 * d);
+        return psz;
+    }
+
+    void ControllerThread()
+    {
+        enum { FULL, REDUCED, HELD } state = FULL;
+#if defined(__linux__)
+        double dBusy0 = 0, dTotal0 = 0;
+        bool fHost = ReadHostTimes(dBusy0, dTotal0);
+        double dOwn0 = ReadOwnTime(), dPressure0 = ReadPressure(), dTime0 = Now();
+#endif
+        try
+        {
+            while (true)
+            {
+                boost::this_thread::sleep(boost::posix_time::milliseconds((int) (BACKGROUND_PERIOD * 1000)));
+
+                double dLoad = 0, dPressure = 0;
+#if defined(__linux__)
+                double dBusy = 0, dTotal = 0;
+                fHost = fHost && ReadHostTimes(dBusy, dTotal);
+                double dOwn = ReadOwnTime(), dPressure1 = ReadPressure(), dTime = Now();
+                if (fHost && dTotal > dTotal0)
+                    dLoad = std::max(0.0, (dBusy - dBusy0 - (dOwn - dOwn0)) / (dTotal - dTotal0));
+                if (dPressure0 >= 0 && dPressure1 >= 0 && dTime > dTime0)
+                    dPressure = (dPressure1 - dPressure0) / (dTime - dTime0);
+                dBusy0 = dBusy;
+                dTotal0 = dTotal;
+                dOwn0 = dOwn;
+                dPressure0 = dPressure1;
+                dTime0 = dTime;
+#endif
+
+                // additive increase, multiplicative decrease
+                double d = dDuty;
+                if (dLoad > dMaxLoad || dPressure > dMaxPressure)
+                    d = d / 2 < BACKGROUND_MIN_DUTY ? 0 : d / 2;
+                else
+                    d = std::min(dShare, std::max(d, BACKGROUND_MIN_DUTY) + dShare / 10);
+                SetDuty(d);
+
+                if (!log)
+                    continue;
+                if (d == 0 && state != HELD)
+                {
+                    state = HELD;
+                    log("Background: holding back, host load " + Percent(dLoad) + ", CPU pressure " + Percent(dPressure) + ".");
+                }
+                else if (d > 0 && d < dShare && state == FULL)
+                {
+                    state = REDUCED;
+                    log("Background: slowing down to " + Percent(d) + ", host load " + Percent(dLoad)
+                        + ", CPU pressure " + Percent(dPressure) + ".");
+                }
+                else if (d == dShare && state != FULL)
+                {
+                    state = FULL;
+                    log("Background: back at " + Percent(d) + ".");
+                }
+            }
+        }
+        catch (boost::thread_interrupted&)
+        {
+        }
+    }
+
+public:
+    static CBackground& Instance()
+    {
+        static CBackground background;
+        return background;
+    }
+
+    // strPolicy: "idle" (SCHED_IDLE) or "nice:<n>"; empty for threads at
+    // normal priority, paced only.  Percentages as fractions.
+    bool Start(const std::string& strPolicy, double dShareIn, double dMaxLoadIn, double dMaxPressureIn,
+               boost::function<void(const std::string&)> logIn, std::string& msg)
+    {
+        if (strPolicy.compare(0, 5, "nice:") == 0)
+        {
+            fIdle = false;
+            nNice = atoi(strPolicy.c_str() + 5);
+        }
+        else if (strPolicy.empty())
+        {
+            fIdle = false;
+            nNice = 0;
+        }
+        else if (strPolicy != "idle")
+        {
+            msg = "Unknown background policy \"" + strPolicy + "\", available: idle nice:<n>";
+            return false;
+        }
+        if (!(dShareIn > 0 && dShareIn <= 1) || !(dMaxLoadIn >= 0) || !(dMaxPressureIn >= 0))
+        {
+            msg = "--cpu-share must be in (0, 100], --max-load and --max-pressure at least 0";
+            return false;
+        }
+        fEnabled = true;
+        dShare = dShareIn;
+        dMaxLoad = dMaxLoadIn;
+        dMaxPressure = dMaxPressureIn;
+        dDuty = dShare;
+        log = logIn;
+        controller = boost::thread(&CBackground::ControllerThread, this);
+        return true;
+    }
+
+    // End of the search: no more pacing, held threads resume.
+    void Stop()
+    {
+        if (controller.joinable())
+        {
+            controller.interrupt();
+            controller.join();
+        }
+        SetDuty(1);
+    }
+
+    bool IsEnabled() const
+    {
+        return fEnabled;
+    }
+
+    double GetDuty() const
+    {
+        return dDuty;
+    }
+
+    void WaitWhileHeld()
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        while (dDuty <= 0)
+            condResume.wait(guard);
+    }
+
+    std::string ToString() const
+    {
+        std::ostringstream ss;
+        if (fIdle)
+            ss << "SCHED_IDLE";
+        else if (nNice != 0)
+            ss << "nice " << nNice;
+        else
+            ss << "normal priority";
+        ss << ", " << Percent(dShare) << " CPU share, holding back above " << Percent(dMaxLoad) << " host load or "
+           << Percent(dMaxPressure) << " CPU pressure";
+        return ss.str();
+    }
+
+    // The calling search thread's priority.  False if the system refused.
+    bool Enter() const
+    {
+        if (!fEnabled || (!fIdle && nNice == 0))
+            return true;
+#if defined(__linux__)
+        if (fIdle)
+        {
+            sched_param param;
+            param.sched_priority = 0;
+            if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0)
+                return true;
+        }
+        // per thread on Linux: the controller and main thread keep theirs
+        return setpriority(PRIO_PROCESS, syscall(SYS_gettid), fIdle ? 19 : nNice) == 0;
+#elif defined(WIN32) || defined(WIN64)
+        return SetThreadPriority(GetCurrentThread(), fIdle || nNice >= 15 ? THREAD_PRIORITY_IDLE : THREAD_PRIORITY_LOWEST) != 0;
+#else
+        return false;
+#endif
+    }
+};
+
+// One per search thread, Pace() after every batch: sleeps off the time the
+// duty does not allow, at most BACKGROUND_NAP at a time, or until the
+// controller resumes when held back.  Nothing but a flag test without
+// --background.
+class CPacer
+{
+protected:
+    CBackground&                background;
+    bool                        fEnabled;
+    boost::posix_time::ptime    ptLast;
+    double                      dWork;      // seconds since the last sleep
+    double                      dDebt;      // seconds still to sleep
+
+public:
+    CPacer() : background(CBackground::Instance()), dWork(0), dDebt(0)
+    {
+        fEnabled = background.IsEnabled();
+        background.Enter();
+        if (fEnabled)
+            ptLast = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    void Pace()
+    {
+        if (!fEnabled)
+            return;
+        boost::posix_time::ptime ptNow = boost::posix_time::microsec_clock::universal_time();
+        dWork += (ptNow - ptLast).total_microseconds() / 1e6;
+        ptLast = ptNow;
+        double dDuty = background.GetDuty();
+        if (dDuty <= 0)
+        {
+            background.WaitWhileHeld();
+            ptLast = boost::posix_time::microsec_clock::universal_time();
+            dWork = dDebt = 0;
+            return;
+        }
+        if (dWork >= BACKGROUND_SLICE)
+        {
+            dDebt += dDuty >= 1 ? 0 : dWork * (1 - dDuty) / dDuty;
+            dWork = 0;
+        }
+        if (dDebt > 0)
+        {
+            double dNap = std::min(dDebt, BACKGROUND_NAP);
+            boost::this_thread::sleep(boost::posix_time::microseconds((int64_t) (dNap * 1e6)));
+            dDebt -= dNap;
+            ptLast = boost::posix_time::microsec_clock::universal_time();
+        }
+    }
+};
+
+#endif
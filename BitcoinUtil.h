@@ -6,8 +6,7 @@
 #include <string>
 #include "types.h"
 #include "uint256.h"
-#include <openssl/ripemd.h>
-#include <openssl/sha.h>
+#include "Digest.h"
 
 std::string strprintf(const char* format, ...);
 std::string FormatFullVersion();
@@ -27,10 +26,8 @@ template<typename T1>
 inline uint256 SHA256Hash(const T1 pbegin, const T1 pend)
 {
 	static unsigned char pblank[1];
-	uint256 hash1;
-	SHA256((pbegin == pend ? pblank : (unsigned char*)&pbegin[0]), (pend - pbegin) * sizeof(pbegin[0]), (unsigned char*)&hash1);
 	uint256 hash2;
-	SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+	DigestSHA256d((pbegin == pend ? pblank : (unsigned char*)&pbegin[0]), (pend - pbegin) * sizeof(pbegin[0]), (unsigned char*)&hash2);
 	return hash2;
 }
 
@@ -39,14 +36,14 @@ inline uint256 SHA256Hash(const T1 p1begin, const T1 p1end,
 	const T2 p2begin, const T2 p2end)
 {
 	static unsigned char pblank[1];
+	CDigestContext& ctx = CDigestContext::Thread();
 	uint256 hash1;
-	SHA256_CTX ctx;
-	SHA256_Init(&ctx);
-	SHA256_Update(&ctx, (p1begin == p1end ? pblank : (unsigned char*)&p1begin[0]), (p1end - p1begin) * sizeof(p1begin[0]));
-	SHA256_Update(&ctx, (p2begin == p2end ? pblank : (unsigned char*)&p2begin[0]), (p2end - p2begin) * sizeof(p2begin[0]));
-	SHA256_Final((unsigned char*)&hash1, &ctx);
+	ctx.Init(DIGEST_SHA256);
+	ctx.Update(DIGEST_SHA256, (p1begin == p1end ? pblank : (unsigned char*)&p1begin[0]), (p1end - p1begin) * sizeof(p1begin[0]));
+	ctx.Update(DIGEST_SHA256, (p2begin == p2end ? pblank : (unsigned char*)&p2begin[0]), (p2end - p2begin) * sizeof(p2begin[0]));
+	ctx.Final(DIGEST_SHA256, (unsigned char*)&hash1);
 	uint256 hash2;
-	SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+	ctx.Digest(DIGEST_SHA256, &hash1, sizeof(hash1), (unsigned char*)&hash2);
 	return hash2;
 }
 
@@ -56,24 +53,22 @@ inline uint256 SHA256Hash(const T1 p1begin, const T1 p1end,
 	const T3 p3begin, const T3 p3end)
 {
 	static unsigned char pblank[1];
+	CDigestContext& ctx = CDigestContext::Thread();
 	uint256 hash1;
-	SHA256_CTX ctx;
-	SHA256_Init(&ctx);
-	SHA256_Update(&ctx, (p1begin == p1end ? pblank : (unsigned char*)&p1begin[0]), (p1end - p1begin) * sizeof(p1begin[0]));
-	SHA256_Update(&ctx, (p2begin == p2end ? pblank : (unsigned char*)&p2begin[0]), (p2end - p2begin) * sizeof(p2begin[0]));
-	SHA256_Update(&ctx, (p3begin == p3end ? pblank : (unsigned char*)&p3begin[0]), (p3end - p3begin) * sizeof(p3begin[0]));
-	SHA256_Final((unsigned char*)&hash1, &ctx);
+	ctx.Init(DIGEST_SHA256);
+	ctx.Update(DIGEST_SHA256, (p1begin == p1end ? pblank : (unsigned char*)&p1begin[0]), (p1end - p1begin) * sizeof(p1begin[0]));
+	ctx.Update(DIGEST_SHA256, (p2begin == p2end ? pblank : (unsigned char*)&p2begin[0]), (p2end - p2begin) * sizeof(p2begin[0]));
+	ctx.Update(DIGEST_SHA256, (p3begin == p3end ? pblank : (unsigned char*)&p3begin[0]), (p3end - p3begin) * sizeof(p3begin[0]));
+	ctx.Final(DIGEST_SHA256, (unsigned char*)&hash1);
 	uint256 hash2;
-	SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+	ctx.Digest(DIGEST_SHA256, &hash1, sizeof(hash1), (unsigned char*)&hash2);
 	return hash2;
 }
 
 inline uint160 Hash160(const std::vector<unsigned char>& vch)
 {
-	uint256 hash1;
-	SHA256(&vch[0], vch.size(), (unsigned char*)&hash1);
 	uint160 hash2;
-	RIPEMD160((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+	DigestHash160(vch.empty() ? NULL : &vch[0], vch.size(), (unsigned char*)&hash2);
 	return hash2;
 }
 
@@ -0,0 +1,238 @@
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+#include "Net.h"
+#include "types.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if !defined(WIN32) && !defined(WIN64)
+
+// Authenticated, encrypted line channel for the coordinator protocol.
+//
+// Both ends hold the same 256 bit cluster key (a key file of 64 hex digits,
+// "openssl rand -hex 32" makes one).  A connection opens with a handshake
+// of fresh random nonces, one from each side:
+//
+//     client -> server    "RGC1" <16 byte client nonce>
+//     server -> client    "RGC1" <16 byte server nonce>
+//
+// and each direction gets a key of its own, HMAC-SHA256 of the cluster key
+// over the direction and both nonces.  Every line after that is a frame:
+//
+//     <4 byte length> <AES-256-GCM ciphertext> <16 byte tag>
+//
+// with the length as associated data and the frame number of the direction
+// as nonce.  Nothing is answered before a frame from the peer has opened, so
+// only key holders get a word out of the coordinator; a recorded session
+// cannot be replayed (the other side's nonce is new) and frames cannot be
+// dropped, reordered or moved between directions unnoticed.
+
+static const char CHANNEL_MAGIC[4] = { 'R', 'G', 'C', '1' };
+static const size_t CHANNEL_NONCE = 16;
+static const uint32 CHANNEL_MAX_FRAME = 1 << 20;
+
+// The cluster key: 64 hex digits in a file of its own.
+class CChannelKey
+{
+protected:
+    unsigned char   pKey[32];
+
+    CChannelKey(const CChannelKey&); // no implementation
+    CChannelKey& operator=(const CChannelKey&); // no implementation
+
+public:
+    CChannelKey()
+    {
+        memset(pKey, 0, sizeof(pKey));
+    }
+
+    ~CChannelKey()
+    {
+        OPENSSL_cleanse(pKey, sizeof(pKey));
+    }
+
+    bool Load(const std::string& strPath, std::string& msg)
+    {
+        std::ifstream in(strPath.c_str());
+        std::string strHex;
+        if (!(in >> strHex) || strHex.size() != 64 || strHex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        {
+            msg = strPath + " is not a key file, make one with \"openssl rand -hex 32 > key\"";
+            return false;
+        }
+        for (int i = 0; i < 32; i++)
+            pKey[i] = (unsigned char) strtoul(strHex.substr(2 * i, 2).c_str(), NULL, 16);
+        OPENSSL_cleanse(&strHex[0], strHex.size());
+        return true;
+    }
+
+    // Key of one direction of a connection.
+    void Derive(char chDirection, const unsigned char* pClientNonce, const unsigned char* pServerNonce,
+                unsigned char* pOut) const
+    {
+        unsigned char pData[1 + 2 * CHANNEL_NONCE];
+        pData[0] = (unsigned char) chDirection;
+        memcpy(pData + 1, pClientNonce, CHANNEL_NONCE);
+        memcpy(pData + 1 + CHANNEL_NONCE, pServerNonce, CHANNEL_NONCE);
+        unsigned int nLen = 32;
+        if (!HMAC(EVP_sha256(), pKey, sizeof(pKey), pData, sizeof(pData), pOut, &nLen))
+            throw std::runtime_error("CChannelKey : HMAC failed");
+    }
+};
+
+class CSecureChannel
+{
+protected:
+    int             fd;
+    unsigned char   pSendKey[32];
+    unsigned char   pReceiveKey[32];
+    uint64          nSent;
+    uint64          nReceived;
+
+    CSecureChannel(const CSecureChannel&); // no implementation
+    CSecureChannel& operator=(const CSecureChannel&); // no implementation
+
+    static void GetNonce(uint64 nFrame, unsigned char* p12)
+    {
+        memset(p12, 0, 4);
+        for (int i = 0; i < 8; i++)
+            p12[4 + i] = (unsigned char) (nFrame >> (56 - 8 * i));
+    }
+
+    bool SendHello(unsigned char* pNonce)
+    {
+        unsigned char pHello[sizeof(CHANNEL_MAGIC) + CHANNEL_NONCE];
+        if (RAND_bytes(pNonce, CHANNEL_NONCE) != 1)
+            return false;
+        memcpy(pHello, CHANNEL_MAGIC, sizeof(CHANNEL_MAGIC));
+        memcpy(pHello + sizeof(CHANNEL_MAGIC), pNonce, CHANNEL_NONCE);
+        return WriteAll(fd, std::string((const char*) pHello, sizeof(pHello)));
+    }
+
+    bool ReceiveHello(unsigned char* pNonce)
+    {
+        unsigned char pHello[sizeof(CHANNEL_MAGIC) + CHANNEL_NONCE];
+        if (!ReadAll(fd, pHello, sizeof(pHello)) || memcmp(pHello, CHANNEL_MAGIC, sizeof(CHANNEL_MAGIC)) != 0)
+            return false;
+        memcpy(pNonce, pHello + sizeof(CHANNEL_MAGIC), CHANNEL_NONCE);
+        return true;
+    }
+
+public:
+    CSecureChannel(int fdIn) : fd(fdIn), nSent(0), nReceived(0)
+    {
+        memset(pSendKey, 0, sizeof(pSendKey));
+        memset(pReceiveKey, 0, sizeof(pReceiveKey));
+    }
+
+    ~CSecureChannel()
+    {
+        OPENSSL_cleanse(pSendKey, sizeof(pSendKey));
+        OPENSSL_cleanse(pReceiveKey, sizeof(pReceiveKey));
+    }
+
+    // Server side of the handshake.
+    bool Accept(const CChannelKey& key)
+    {
+        unsigned char pClient[CHANNEL_NONCE], pServer[CHANNEL_NONCE];
+        if (!ReceiveHello(pClient) || !SendHello(pServer))
+            return false;
+        key.Derive('S', pClient, pServer, pSendKey);
+        key.Derive('C', pClient, pServer, pReceiveKey);
+        return true;
+    }
+
+    // Client side of the handshake.
+    bool Connect(const CChannelKey& key)
+    {
+        unsigned char pClient[CHANNEL_NONCE], pServer[CHANNEL_NONCE];
+        if (!SendHello(pClient) || !ReceiveHello(pServer))
+            return false;
+        key.Derive('C', pClient, pServer, pSendKey);
+        key.Derive('S', pClient, pServer, pReceiveKey);
+        return true;
+    }
+
+    // str as one frame.
+    bool Write(const std::string& str)
+    {
+        if (str.size() > CHANNEL_MAX_FRAME)
+            return false;
+        std::vector<unsigned char> vFrame(4 + str.size() + 16);
+        uint32 nSize = (uint32) str.size();
+        for (int i = 0; i < 4; i++)
+            vFrame[i] = (unsigned char) (nSize >> (24 - 8 * i));
+
+        unsigned char pNonce[12];
+        GetNonce(nSent++, pNonce);
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        int nLen = 0;
+        bool fOk = ctx
+            && EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL)
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, sizeof(pNonce), NULL)
+            && EVP_EncryptInit_ex(ctx, NULL, NULL, pSendKey, pNonce)
+            && EVP_EncryptUpdate(ctx, NULL, &nLen, &vFrame[0], 4)
+            && EVP_EncryptUpdate(ctx, &vFrame[4], &nLen, (const unsigned char*) str.data(), (int) str.size())
+            && EVP_EncryptFinal_ex(ctx, &vFrame[4] + nLen, &nLen)
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, &vFrame[4 + str.size()]);
+        if (ctx)
+            EVP_CIPHER_CTX_free(ctx);
+        return fOk && WriteAll(fd, std::string((const char*) &vFrame[0], vFrame.size()));
+    }
+
+    // Next frame, without a trailing newline; false on EOF, error or a
+    // frame that does not open.
+    bool ReadLine(std::string& strLine)
+    {
+        unsigned char pSize[4];
+        if (!ReadAll(fd, pSize, sizeof(pSize)))
+            return false;
+        uint32 nSize = ((uint32) pSize[0] << 24) | ((uint32) pSize[1] << 16) | ((uint32) pSize[2] << 8) | pSize[3];
+        if (nSize > CHANNEL_MAX_FRAME)
+            return false;
+        std::vector<unsigned char> vCipher(nSize + 16);
+        if (!ReadAll(fd, &vCipher[0], vCipher.size()))
+            return false;
+
+        std::vector<unsigned char> vPlain(nSize + 1);
+        unsigned char pNonce[12];
+        GetNonce(nReceived++, pNonce);
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        int nLen = 0;
+        bool fOk = ctx
+            && EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL)
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, sizeof(pNonce), NULL)
+            && EVP_DecryptInit_ex(ctx, NULL, NULL, pReceiveKey, pNonce)
+            && EVP_DecryptUpdate(ctx, NULL, &nLen, pSize, sizeof(pSize))
+            && EVP_DecryptUpdate(ctx, &vPlain[0], &nLen, &vCipher[0], (int) nSize)
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, &vCipher[nSize])
+            && EVP_DecryptFinal_ex(ctx, &vPlain[0] + nLen, &nLen) > 0;
+        if (ctx)
+            EVP_CIPHER_CTX_free(ctx);
+        if (!fOk)
+        {
+            OPENSSL_cleanse(&vPlain[0], vPlain.size());
+            return false;
+        }
+
+        strLine.assign((const char*) &vPlain[0], nSize);
+        OPENSSL_cleanse(&vPlain[0], vPlain.size());
+        if (!strLine.empty() && strLine[strLine.size() - 1] == '\n')
+            strLine.erase(strLine.size() - 1);
+        return true;
+    }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,619 @@
+#ifndef __COORDINATOR_H__
+#define __COORDINATOR_H__
+
+#include "RippleAddress.h"
+#include "Keyspace.h"
+#include "Scheduler.h"
+#include "PatternSet.h"
+#include "Difficulty.h"
+#include "Backend.h"
+#include "Net.h"
+#include "Channel.h"
+#include "Background.h"
+
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
+
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Distributed search with keyspace leases.
+//
+// The coordinator owns the run: the keyspace (seed range and permutation
+// key) and the patterns.  Workers connect over TCP and lease counter
+// ranges of that keyspace, search them with all local threads and report
+// back.  Nothing is exchanged on the hot path; workers only talk to the
+// coordinator between leases and on a few second heartbeat.
+//
+// The coordinator listens on the address it is given only, and every
+// connection is a secure channel under the cluster key (Channel.h): the
+// keyspace key, the patterns and the seeds of hits never cross the network
+// in the clear, and no one without the key gets past the handshake.
+//
+//     HELLO <name> <threads>        -> OK <first> <last> <key> <pattern> [...]
+//     LEASE <size hint>             -> OK <lease> <begin> <end> | WAIT | DONE
+//     PROGRESS <lease> <searched>   -> OK | ERR expired
+//     HIT <lease> <seed hex>        -> OK | ERR <reason>    (a seed of the lease)
+//     DONE <lease> <searched>       -> OK
+//
+// A lease that has not been heard of for LEASE_TTL seconds is given out again
+// in full, so a lost worker costs some repeated work but never leaves a gap.
+
+static const int LEASE_TTL = 60;
+static const int LEASE_HEARTBEAT = 5;
+static const int LEASE_SECONDS = 60;    // workers size leases to about this long
+
+struct CLease
+{
+    uint64      nBegin;
+    uint64      nEnd;
+    uint64      nSearched;
+    std::string strWorker;
+    uint64      nConnection;    // of the worker holding it
+    time_t      tDeadline;
+};
+
+class CLeaseCoordinator
+{
+protected:
+    std::string                             strAddress;
+    int                                     nPort;
+    const CChannelKey&                      key;
+    const CKeyspace&                        keyspace;
+    std::vector<std::string>                vPatterns;
+    CPatternSet                             patterns;
+    double                                  dProbability;   // of a hit per seed
+    boost::function<void (const std::string&)> fnHit;
+
+    boost::mutex                            lockLeases;
+    std::map<uint64, CLease>                mapLeases;
+    std::deque<CChunk>                      dqReissue;
+    uint64                                  nNextLease;
+    uint64                                  nNext;
+    uint64                                  nEnd;
+    uint64                                  nSearchedDone;  // by finished and expired leases
+    uint64                                  nHits;
+    time_t                                  tStart;
+    boost::atomic<bool>                     fDone;
+    int                                     fdListen;
+
+    boost::mutex                            lockWorkers;
+    boost::condition_variable               condWorkers;
+    boost::thread_group                     threads;
+    std::map<int, boost::thread*>           mapWorkers;     // by socket
+    std::vector<boost::thread*>             vFinished;      // to join
+    boost::atomic<uint64>                   nConnections;
+
+    bool Grant(const std::string& strWorker, uint64 nConnection, uint64 nHint, uint64& nLease, CLease& lease)
+    {
+        nHint = std::max<uint64>(nHint, 1);
+        if (!dqReissue.empty())
+        {
+            CChunk& chunk = dqReissue.front();
+            lease.nBegin = chunk.nBegin;
+            lease.nEnd = chunk.nBegin + std::min(nHint, chunk.Size());
+            chunk.nBegin = lease.nEnd;
+            if (chunk.Size() == 0)
+                dqReissue.pop_front();
+        }
+        else if (nNext != nEnd)
+        {
+            lease.nBegin = nNext;
+            lease.nEnd = nNext + std::min(nHint, nEnd - nNext);
+            nNext = lease.nEnd;
+        }
+        else
+        {
+            return false;
+        }
+
+        lease.nSearched = 0;
+        lease.strWorker = strWorker;
+        lease.nConnection = nConnection;
+        lease.tDeadline = time(NULL) + LEASE_TTL;
+        nLease = nNextLease++;
+        mapLeases[nLease] = lease;
+        return true;
+    }
+
+    bool Verify(const std::string& strSeedHex, std::string& strResult)
+    {
+        uint128 seed;
+        if (!seed.SetHex(strSeedHex))
+            return false;
+
+        RippleAddress naSeed;
+        RippleAddress naAccount;
+        naSeed.setSeed(seed);
+        // always the reference derivation, whatever backend the workers run
+        naAccount.setAccountPublic(createGeneratorPublic(naSeed).getAccountPublic(), 0);
+
+        std::vector<int> vTags;
+        if (!patterns.Match(naAccount.getAccountID(), vTags))
+            return false;
+
+        strResult = "master seed:\t\t" + naSeed.humanSeed() + "\n"
+                  + "master seed hex:\t" + naSeed.getSeed().ToString() + "\n"
+                  + "account id:\t\t" + naAccount.humanAccountID() + "\n";
+        return true;
+    }
+
+    // A request of the worker on connection nConnection; leases only answer
+    // to the connection they were granted to.
+    std::string Handle(const std::string& strLine, std::string& strWorker, uint64 nConnection)
+    {
+        std::istringstream ss(strLine);
+        std::string strCommand;
+        ss >> strCommand;
+        std::ostringstream out;
+
+        if (strCommand == "HELLO")
+        {
+            unsigned int nThreads = 0;
+            ss >> strWorker >> nThreads;
+            out << "OK " << keyspace.ToString();
+            for (size_t i = 0; i < vPatterns.size(); i++)
+                out << " " << vPatterns[i];
+            out << "\n";
+
+            boost::unique_lock<boost::mutex> lock(lockLeases);
+            std::cout << "# worker " << strWorker << " joined with " << nThreads << " threads" << std::endl;
+        }
+        else if (strCommand == "LEASE")
+        {
+            uint64 nHint = 0, nLease;
+            ss >> nHint;
+            CLease lease;
+            boost::unique_lock<boost::mutex> lock(lockLeases);
+            if (Grant(strWorker, nConnection, nHint, nLease, lease))
+                out << "OK " << nLease << " " << lease.nBegin << " " << lease.nEnd << "\n";
+            else if (!mapLeases.empty())
+                out << "WAIT\n";
+            else
+            {
+                fDone = true;
+#if !defined(WIN32) && !defined(WIN64)
+                ::shutdown(fdListen, SHUT_RDWR);
+#endif
+                out << "DONE\n";
+            }
+        }
+        else if (strCommand == "PROGRESS" || strCommand == "DONE")
+        {
+            uint64 nLease = 0, nSearched = 0;
+            ss >> nLease >> nSearched;
+            boost::unique_lock<boost::mutex> lock(lockLeases);
+            std::map<uint64, CLease>::iterator it = mapLeases.find(nLease);
+            if (it == mapLeases.end() || it->second.nConnection != nConnection)
+                return "ERR expired\n";
+            it->second.nSearched = std::min(nSearched, it->second.nEnd - it->second.nBegin);
+            it->second.tDeadline = time(NULL) + LEASE_TTL;
+            if (strCommand == "DONE")
+            {
+                nSearchedDone += it->second.nSearched;
+                mapLeases.erase(it);
+            }
+            out << "OK\n";
+        }
+        else if (strCommand == "HIT")
+        {
+            uint64 nLease = 0, nCounter = 0;
+            std::string strSeedHex, strResult;
+            ss >> nLease >> strSeedHex;
+            uint128 seed;
+            if (!seed.SetHex(strSeedHex) || !keyspace.CounterOf(seed, nCounter))
+                return "ERR seed outside the keyspace\n";
+            {
+                // only the holder of the lease, only a seed it was given
+                boost::unique_lock<boost::mutex> lock(lockLeases);
+                std::map<uint64, CLease>::const_iterator it = mapLeases.find(nLease);
+                if (it == mapLeases.end() || it->second.nConnection != nConnection)
+                    return "ERR expired\n";
+                if (nCounter < it->second.nBegin || nCounter >= it->second.nEnd)
+                    return "ERR seed outside the lease\n";
+            }
+            if (!Verify(strSeedHex, strResult))
+                return "ERR hit does not match\n";
+
+            boost::unique_lock<boost::mutex> lock(lockLeases);
+            nHits++;
+            std::cout << strResult << std::endl;
+            if (fnHit)
+                fnHit(strResult);
+            out << "OK\n";
+        }
+        else
+        {
+            return "ERR unknown command\n";
+        }
+
+        return out.str();
+    }
+
+    void ServeWorker(int fd)
+    {
+        CSecureChannel channel(fd);
+        std::string strLine;
+        std::string strWorker = "?";
+        uint64 nConnection = ++nConnections;
+        if (channel.Accept(key))
+        {
+            while (channel.ReadLine(strLine))
+            {
+                if (!strLine.empty() && !channel.Write(Handle(strLine, strWorker, nConnection)))
+                    break;
+            }
+        }
+        OPENSSL_cleanse(&strLine[0], strLine.size());
+
+        // leaves mapWorkers
+        boost::unique_lock<boost::mutex> lock(lockWorkers);
+        std::map<int, boost::thread*>::iterator it = mapWorkers.find(fd);
+        if (it != mapWorkers.end())
+        {
+            vFinished.push_back(it->second);
+            mapWorkers.erase(it);
+        }
+        close(fd);
+        condWorkers.notify_all();
+    }
+
+    // Join the worker threads that are done.
+    void ReapWorkers()
+    {
+        std::vector<boost::thread*> vJoin;
+        {
+            boost::unique_lock<boost::mutex> lock(lockWorkers);
+            vJoin.swap(vFinished);
+        }
+        for (size_t i = 0; i < vJoin.size(); i++)
+        {
+            threads.remove_thread(vJoin[i]);
+            vJoin[i]->join();
+            delete vJoin[i];
+        }
+    }
+
+    // Expire silent leases and print merged statistics.
+    void ReaperThread()
+    {
+        int nTick = 0;
+        while (!fDone)
+        {
+            boost::this_thread::sleep(boost::posix_time::seconds(1));
+
+            boost::unique_lock<boost::mutex> lock(lockLeases);
+            time_t tNow = time(NULL);
+            uint64 nSearched = nSearchedDone;
+            for (std::map<uint64, CLease>::iterator it = mapLeases.begin(); it != mapLeases.end(); )
+            {
+                if (it->second.tDeadline < tNow)
+                {
+                    std::cout << "# lease " << it->first << " of " << it->second.strWorker
+                              << " expired, reissuing" << std::endl;
+                    nSearchedDone += it->second.nSearched;
+                    nSearched += it->second.nSearched;
+                    dqReissue.push_back(CChunk(it->second.nBegin, it->second.nEnd));
+                    mapLeases.erase(it++);
+                }
+                else
+                {
+                    nSearched += it->second.nSearched;
+                    ++it;
+                }
+            }
+
+            if (++nTick % 10 == 0)
+            {
+                uint64 nSecs = std::max<uint64>(1, tNow - tStart);
+                double dRate = std::max(1.0, 1.0 * nSearched / nSecs);
+                double dEta50 = getEta50(dProbability);
+                std::cout << "# " << mapLeases.size() << " active leases, searched " << nSearched
+                          << ", " << (nSearched / nSecs) << " seeds/second, " << nHits << " hits, P(found) "
+                          << 100 * getFoundProbability(dProbability, nSearched) << "%, 50% "
+                          << (nSearched >= dEta50 ? std::string("reached") : "in " + formatDuration((dEta50 - nSearched) / dRate))
+                          << std::endl;
+            }
+        }
+    }
+
+public:
+    CLeaseCoordinator(const std::string& strAddressIn, int nPortIn, const CChannelKey& keyIn, const CKeyspace& keyspaceIn,
+                      const std::vector<std::string>& vPatternsIn, boost::function<void (const std::string&)> fnHitIn)
+        : strAddress(strAddressIn), nPort(nPortIn), key(keyIn), keyspace(keyspaceIn), vPatterns(vPatternsIn), fnHit(fnHitIn),
+          nNextLease(1), nNext(0), nEnd(keyspaceIn.Size()), nSearchedDone(0), nHits(0),
+          tStart(time(NULL)), fDone(false), fdListen(-1), nConnections(0)
+    {
+        for (size_t i = 0; i < vPatterns.size(); i++)
+            patterns.Add(vPatterns[i], i);
+        patterns.Finish();
+        dProbability = getPatternSetProbability(vPatterns);
+    }
+
+    // Serve workers until the keyspace is exhausted.
+    int Run()
+    {
+#if defined(WIN32) || defined(WIN64)
+        std::cout << "# Coordinator mode is not supported on this platform." << std::endl;
+        return -1;
+#else
+        fdListen = ListenTcp(strAddress, nPort);
+        if (fdListen < 0)
+        {
+            std::cout << "# Cannot listen on " << strAddress << " port " << nPort << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        std::cout << "# Coordinating run " << keyspace.GetRange() << " on " << strAddress << " port " << nPort << "." << std::endl
+                  << "#" << std::endl;
+
+        boost::thread reaper(boost::bind(&CLeaseCoordinator::ReaperThread, this));
+        while (!fDone)
+        {
+            int fd = accept(fdListen, NULL, NULL);
+            if (fd < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            ReapWorkers();
+
+            // a peer silent for a lease's lifetime is gone, or never was a worker
+            timeval tv;
+            tv.tv_sec = LEASE_TTL;
+            tv.tv_usec = 0;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+            boost::unique_lock<boost::mutex> lock(lockWorkers);
+            boost::thread* pThread = new boost::thread(boost::bind(&CLeaseCoordinator::ServeWorker, this, fd));
+            threads.add_thread(pThread);
+            mapWorkers[fd] = pThread;
+        }
+        fDone = true;
+        reaper.join();
+
+        // Replies already on their way still go out; every worker thread
+        // then reads EOF and is joined before this object can go away.
+        {
+            boost::unique_lock<boost::mutex> lock(lockWorkers);
+            for (std::map<int, boost::thread*>::iterator it = mapWorkers.begin(); it != mapWorkers.end(); ++it)
+                ::shutdown(it->first, SHUT_RD);
+            while (!mapWorkers.empty())
+                condWorkers.wait(lock);
+        }
+        ReapWorkers();
+        threads.join_all();
+        close(fdListen);
+        return 0;
+#endif
+    }
+};
+
+class CLeaseWorker
+{
+protected:
+    std::string                 strHost;
+    int                         nPort;
+    const CChannelKey&          key;
+    unsigned int                nThreads;
+    CKeyspace                   keyspace;
+    CPatternSet                 patterns;
+
+    boost::mutex                lockHits;
+    boost::condition_variable   condHits;
+    std::vector<std::string>    vHits;      // seed hex, waiting to be sent
+    boost::atomic<uint64>       nSearched;
+
+    void SearchThread(unsigned int n, CChunkScheduler* pScheduler)
+    {
+        boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+        CPacer pacer;
+        RippleAddress naSeed;
+        std::vector<int> vTags;
+        CChunk chunk;
+        CArenaArray<uint128> vSeeds(BACKEND_BATCH);
+        uint160 vAccountIDs[BACKEND_BATCH];
+
+        while (pScheduler->Next(n, chunk))
+        {
+            boost::posix_time::ptime ptStart = boost::posix_time::microsec_clock::universal_time();
+            for (uint64 c = chunk.nBegin; c != chunk.nEnd && !pScheduler->IsStopped(); )
+            {
+                unsigned int nBatch = (unsigned int) std::min<uint64>(BACKEND_BATCH, chunk.nEnd - c);
+                keyspace.SeedsAt(c, nBatch, vSeeds);
+                c += nBatch;
+                pBackend->SetFamilies(vSeeds, nBatch);
+                pBackend->GetFamilyAccountIDs(0, vAccountIDs);
+
+                for (unsigned int i = 0; i < nBatch; i++)
+                {
+                    vTags.clear();
+                    if (patterns.Match(vAccountIDs[i], vTags))
+                    {
+                        naSeed.setSeed(vSeeds[i]);
+                        boost::unique_lock<boost::mutex> lock(lockHits);
+                        vHits.push_back(naSeed.getSeed().GetHex());
+                        condHits.notify_all();
+                    }
+                }
+                pacer.Pace();
+            }
+            nSearched += chunk.Size();
+            pScheduler->Report(n, chunk.Size(),
+                (boost::posix_time::microsec_clock::universal_time() - ptStart).total_microseconds() / 1e6);
+        }
+    }
+
+    bool Request(CSecureChannel& channel, const std::string& strRequest, std::string& strReply)
+    {
+        return channel.Write(strRequest + "\n") && channel.ReadLine(strReply);
+    }
+
+    // Send queued hits, then a heartbeat.  False once the lease is lost.
+    bool Flush(CSecureChannel& channel, uint64 nLease, bool fHeartbeat)
+    {
+        std::vector<std::string> vSend;
+        {
+            boost::unique_lock<boost::mutex> lock(lockHits);
+            vSend.swap(vHits);
+        }
+        std::string strReply;
+        for (size_t i = 0; i < vSend.size(); i++)
+        {
+            std::ostringstream ss;
+            ss << "HIT " << nLease << " " << vSend[i];
+            if (!Request(channel, ss.str(), strReply))
+                return false;
+            if (strReply != "OK")
+                std::cout << "# coordinator rejected hit " << vSend[i] << ": " << strReply << std::endl;
+        }
+        if (!fHeartbeat)
+            return true;
+
+        std::ostringstream ss;
+        ss << "PROGRESS " << nLease << " " << nSearched;
+        return Request(channel, ss.str(), strReply) && strReply == "OK";
+    }
+
+public:
+    CLeaseWorker(const std::string& strHostIn, int nPortIn, const CChannelKey& keyIn, unsigned int nThreadsIn)
+        : strHost(strHostIn), nPort(nPortIn), key(keyIn), nThreads(nThreadsIn), nSearched(0)
+    {
+    }
+
+    // Lease and search until the coordinator has nothing left.
+    int Run()
+    {
+#if defined(WIN32) || defined(WIN64)
+        std::cout << "# Worker mode is not supported on this platform." << std::endl;
+        return -1;
+#else
+        int fd = ConnectTcp(strHost, nPort);
+        if (fd < 0)
+        {
+            std::cout << "# Cannot connect to " << strHost << ":" << nPort << std::endl;
+            return -1;
+        }
+        CSecureChannel channel(fd);
+        if (!channel.Connect(key))
+        {
+            std::cout << "# Handshake with " << strHost << ":" << nPort << " failed" << std::endl;
+            close(fd);
+            return -1;
+        }
+
+        char szHost[256] = "worker";
+        gethostname(szHost, sizeof(szHost) - 1);
+        std::ostringstream hello;
+        hello << "HELLO " << szHost << "/" << getpid() << " " << nThreads;
+
+        std::string strReply;
+        if (!Request(channel, hello.str(), strReply))
+        {
+            std::cout << "# Coordinator hung up, is --cluster-key the coordinator's?" << std::endl;
+            close(fd);
+            return -1;
+        }
+        if (strReply.compare(0, 3, "OK ") != 0)
+        {
+            std::cout << "# Coordinator refused us: " << strReply << std::endl;
+            close(fd);
+            return -1;
+        }
+
+        std::istringstream ss(strReply.substr(3));
+        std::string strFirst, strLast, strKey, strPattern;
+        ss >> strFirst >> strLast >> strKey;
+        if (!keyspace.SetString(strFirst + " " + strLast + " " + strKey))
+        {
+            std::cout << "# Coordinator sent a bad keyspace: " << strReply << std::endl;
+            close(fd);
+            return -1;
+        }
+        for (int nTag = 0; ss >> strPattern; nTag++)
+            patterns.Add(strPattern, nTag);
+        patterns.Finish();
+
+        std::cout << "# Joined run " << keyspace.GetRange() << " with " << patterns.Size() << " pattern"
+                  << (patterns.Size() == 1 ? "" : "s") << "." << std::endl
+                  << "#" << std::endl;
+
+        uint64 nHint = 4096 * nThreads;
+        while (true)
+        {
+            std::ostringstream lease;
+            lease << "LEASE " << nHint;
+            if (!Request(channel, lease.str(), strReply))
+                break;
+            if (strReply == "DONE")
+                break;
+            if (strReply == "WAIT")
+            {
+                boost::this_thread::sleep(boost::posix_time::seconds(LEASE_HEARTBEAT));
+                continue;
+            }
+
+            uint64 nLease = 0, nBegin = 0, nEnd = 0;
+            std::istringstream ls(strReply.substr(strReply.compare(0, 3, "OK ") == 0 ? 3 : 0));
+            if (!(ls >> nLease >> nBegin >> nEnd))
+                break;
+
+            nSearched = 0;
+            CChunkScheduler scheduler(nThreads, nBegin, nEnd);
+            boost::thread_group threads;
+            for (unsigned int i = 0; i < nThreads; i++)
+                threads.create_thread(boost::bind(&CLeaseWorker::SearchThread, this, i, &scheduler));
+
+            // Heartbeat until all threads finished the lease.
+            boost::posix_time::ptime ptStart = boost::posix_time::microsec_clock::universal_time();
+            boost::posix_time::ptime ptBeat = ptStart;
+            bool fLost = false;
+            while (nSearched < nEnd - nBegin && !scheduler.IsStopped())
+            {
+                {
+                    boost::unique_lock<boost::mutex> lock(lockHits);
+                    if (vHits.empty())
+                        condHits.timed_wait(lock, boost::posix_time::milliseconds(500));
+                }
+                boost::posix_time::ptime ptNow = boost::posix_time::microsec_clock::universal_time();
+                bool fBeat = (ptNow - ptBeat).total_seconds() >= LEASE_HEARTBEAT;
+                if (fBeat)
+                    ptBeat = ptNow;
+                if (!Flush(channel, nLease, fBeat))
+                {
+                    fLost = true;
+                    scheduler.Stop();
+                }
+            }
+            threads.join_all();
+            if (fLost || !Flush(channel, nLease, false))
+            {
+                std::cout << "# Lost lease " << nLease << std::endl;
+                continue;
+            }
+
+            std::ostringstream done;
+            done << "DONE " << nLease << " " << nSearched;
+            if (!Request(channel, done.str(), strReply))
+                break;
+
+            // size the next lease to take about LEASE_SECONDS
+            double dSecs = (boost::posix_time::microsec_clock::universal_time() - ptStart).total_microseconds() / 1e6;
+            if (dSecs > 0)
+                nHint = std::max<uint64>(1024, static_cast<uint64>((nEnd - nBegin) / dSecs * LEASE_SECONDS));
+        }
+
+        close(fd);
+        return 0;
+#endif
+    }
+};
+
+#endif
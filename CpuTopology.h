@@ -0,0 +1,231 @@
+#ifndef __CPU_TOPOLOGY_H__
+#define __CPU_TOPOLOGY_H__
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The logical CPUs this process may run on, grouped by physical core, so a
+// search can leave SMT siblings idle and pin one thread per core.  Outside
+// Linux every CPU counts as its own core and threads are not pinned.
+//
+// In a container the affinity mask (the cpuset) can still list every CPU of
+// the host while the CPU controller of the cgroup only grants a few CPUs'
+// worth of time: threads beyond that quota are throttled, so the budget is
+// the smaller of the two.
+
+struct CCpuTopology
+{
+    std::vector<int> vCpus;     // usable logical CPUs
+    std::vector<int> vCores;    // the first usable logical CPU of each core
+    double dQuota;              // CPUs granted by the cgroup, 0 for no limit
+    std::string strQuota;       // where dQuota comes from
+
+    CCpuTopology() : dQuota(0)
+    {
+    }
+
+    // Threads worth running: the CPUs in the mask, capped by the quota
+    // rounded up.
+    unsigned int GetBudget() const
+    {
+        unsigned int nBudget = vCpus.size();
+        if (dQuota > 0)
+            nBudget = std::min(nBudget, (unsigned int) std::ceil(dQuota - 0.01));
+        return std::max(1u, nBudget);
+    }
+
+    std::string ToString() const
+    {
+        char psz[64];
+        sprintf(psz, "%u logical, %u cores", (unsigned int) vCpus.size(), (unsigned int) vCores.size());
+        return psz;
+    }
+
+    std::string GetBudgetString() const
+    {
+        char psz[128];
+        if (dQuota > 0)
+            sprintf(psz, "%u thread%s (%u CPUs in the affinity mask, %s quota of %.2f CPUs)", GetBudget(),
+                    GetBudget() == 1 ? "" : "s", (unsigned int) vCpus.size(), strQuota.c_str(), dQuota);
+        else
+            sprintf(psz, "%u thread%s (%u CPUs in the affinity mask, no cgroup quota)", GetBudget(),
+                    GetBudget() == 1 ? "" : "s", (unsigned int) vCpus.size());
+        return psz;
+    }
+};
+
+#if defined(__linux__)
+inline int readCpuTopologyValue(int nCpu, const char* pszName)
+{
+    char pszPath[128];
+    sprintf(pszPath, "/sys/devices/system/cpu/cpu%d/topology/%s", nCpu, pszName);
+    FILE* file = fopen(pszPath, "r");
+    if (file == NULL)
+        return -1;
+    int n = -1;
+    if (fscanf(file, "%d", &n) != 1)
+        n = -1;
+    fclose(file);
+    return n;
+}
+
+// Quota of one cgroup directory in CPUs, 0 if none: "<quota> <period>" or
+// "max <period>" in cpu.max (v2), cpu.cfs_quota_us and cpu.cfs_period_us
+// (v1, -1 for none).
+inline double readCgroupQuota(const std::string& strDir, bool fV2)
+{
+    double dQuota = -1, dPeriod = 0;
+    if (fV2)
+    {
+        std::ifstream in((strDir + "/cpu.max").c_str());
+        std::string strQuota;
+        if (!(in >> strQuota >> dPeriod) || strQuota == "max")
+            return 0;
+        dQuota = atof(strQuota.c_str());
+    }
+    else
+    {
+        std::ifstream inQuota((strDir + "/cpu.cfs_quota_us").c_str());
+        std::ifstream inPeriod((strDir + "/cpu.cfs_period_us").c_str());
+        if (!(inQuota >> dQuota) || !(inPeriod >> dPeriod))
+            return 0;
+    }
+    return dQuota > 0 && dPeriod > 0 ? dQuota / dPeriod : 0;
+}
+
+// The tightest CPU quota on the path from this process's cgroup up to the
+// root of its hierarchy, as mounted here (the path may name a directory
+// outside a container's view, which then only sees its own cgroup at the
+// mount point).
+inline double readCgroupQuota(std::string& strSource)
+{
+    // "0::/path" for v2, "<n>:cpu,cpuacct:/path" for the v1 CPU controller
+    std::string strV2, strV1;
+    bool fV2 = false, fV1 = false;
+    std::ifstream inCgroup("/proc/self/cgroup");
+    std::string strLine;
+    while (std::getline(inCgroup, strLine))
+    {
+        size_t nColon1 = strLine.find(':'), nColon2 = strLine.find(':', nColon1 + 1);
+        if (nColon1 == std::string::npos || nColon2 == std::string::npos)
+            continue;
+        std::string strControllers = "," + strLine.substr(nColon1 + 1, nColon2 - nColon1 - 1) + ",";
+        if (strLine.compare(0, nColon1, "0") == 0 && strControllers == ",,")
+        {
+            strV2 = strLine.substr(nColon2 + 1);
+            fV2 = true;
+        }
+        else if (strControllers.find(",cpu,") != std::string::npos)
+        {
+            strV1 = strLine.substr(nColon2 + 1);
+            fV1 = true;
+        }
+    }
+
+    // "<id> <parent> <dev> <root> <mount point> ... - <type> <source> <options>"
+    double dQuota = 0;
+    std::ifstream inMounts("/proc/self/mountinfo");
+    while (std::getline(inMounts, strLine))
+    {
+        size_t nDash = strLine.find(" - ");
+        if (nDash == std::string::npos)
+            continue;
+        std::istringstream left(strLine.substr(0, nDash)), right(strLine.substr(nDash + 3));
+        std::string strId, strParent, strDev, strRoot, strMount, strType, strFrom, strOptions;
+        left >> strId >> strParent >> strDev >> strRoot >> strMount;
+        right >> strType >> strFrom >> strOptions;
+        bool fMountV2 = strType == "cgroup2" && fV2;
+        bool fMountV1 = strType == "cgroup" && fV1 && ("," + strOptions + ",").find(",cpu,") != std::string::npos;
+        if (!fMountV2 && !fMountV1)
+            continue;
+
+        std::string strPath = fMountV2 ? strV2 : strV1;
+        if (strRoot != "/" && strPath.compare(0, strRoot.size(), strRoot) == 0)
+            strPath = strPath.substr(strRoot.size());
+        std::string strDir = strMount + (strPath == "/" ? "" : strPath);
+        std::ifstream probe((strDir + (fMountV2 ? "/cpu.max" : "/cpu.cfs_quota_us")).c_str());
+        if (!probe)
+            strDir = strMount;
+        while (true)
+        {
+            double d = readCgroupQuota(strDir, fMountV2);
+            if (d > 0 && (dQuota == 0 || d < dQuota))
+            {
+                dQuota = d;
+                strSource = fMountV2 ? "cgroup v2 cpu.max" : "cgroup v1 cfs";
+            }
+            size_t nSlash = strDir.rfind('/');
+            if (strDir.size() <= strMount.size() || nSlash == std::string::npos)
+                break;
+            strDir = strDir.substr(0, nSlash);
+        }
+    }
+    return dQuota;
+}
+#endif
+
+inline CCpuTopology GetCpuTopology()
+{
+    CCpuTopology topology;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        std::map<std::pair<int, int>, int> mapCores;   // (package, core) -> first cpu
+        for (int nCpu = 0; nCpu < CPU_SETSIZE; nCpu++)
+        {
+            if (!CPU_ISSET(nCpu, &set))
+                continue;
+            topology.vCpus.push_back(nCpu);
+            std::pair<int, int> core(readCpuTopologyValue(nCpu, "physical_package_id"),
+                                     readCpuTopologyValue(nCpu, "core_id"));
+            if (core.second < 0)
+                core = std::make_pair(-1, nCpu);    // unknown: a core of its own
+            if (mapCores.insert(std::make_pair(core, nCpu)).second)
+                topology.vCores.push_back(nCpu);
+        }
+    }
+    topology.dQuota = readCgroupQuota(topology.strQuota);
+#endif
+    if (topology.vCpus.empty())
+    {
+        unsigned int nCpus = std::max(1u, boost::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < nCpus; i++)
+        {
+            topology.vCpus.push_back(i);
+            topology.vCores.push_back(i);
+        }
+    }
+    return topology;
+}
+
+// Keep a thread on one logical CPU; false where unsupported.
+inline bool PinThread(boost::thread& thread, int nCpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(nCpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+#endif
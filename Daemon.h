@@ -0,0 +1,574 @@
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include "RippleAddress.h"
+#include "Keyspace.h"
+#include "Scheduler.h"
+#include "PatternSet.h"
+#include "Difficulty.h"
+#include "Backend.h"
+#include "Net.h"
+#include "Background.h"
+
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/atomic.hpp>
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if !defined(WIN32) && !defined(WIN64)
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+// Long running vanity service.
+//
+// One worker pool derives candidates without pause and checks every candidate
+// against the union of the patterns of all running jobs, so a single EC
+// derivation serves every job at once.  Jobs are managed over a Unix domain
+// socket with a line based protocol, one request per line:
+//
+//     SUBMIT <pattern> [<pattern> ...]    -> OK <job> <token>
+//     SUBMIT_INDEX <path>                 -> OK <job> <token>    (compile-patterns output)
+//     STATUS [<job>]                      -> OK <n>, then n job lines
+//     CANCEL <job> <token>                -> OK <job>
+//     RESULTS <job> <token> [<first>]     -> OK <n>, then n hit lines
+//     SHUTDOWN                            -> OK
+//
+// A job line is "<job> <running|cancelled|full> <hits> <searched> <patterns>
+// <P(found) so far> <seconds to 50%>" (the odds of any of the job's patterns,
+// -1 once the 50% mark has passed), a hit line is "<seed> <seed hex>
+// <account id>".  Errors answer "ERR <reason>".
+//
+// RESULTS answers at most DAEMON_RESULTS_PAGE hits from <first> (0) on.  A
+// job stops searching when cancelled or at DAEMON_MAX_HITS hits ("full"),
+// and a stopped job is dropped once RESULTS has answered a short page (fewer
+// than DAEMON_RESULTS_PAGE hits, so the client has seen the last one), or
+// DAEMON_RETENTION seconds after it stopped.  At most DAEMON_MAX_JOBS jobs
+// are kept.
+//
+// The socket is only open to its owner (mode 0600) and only clients running
+// as the daemon's user are served.  The seeds of a job go only to whoever
+// has the random token SUBMIT answered with, so the clients of a front end
+// sharing that user cannot read each other's results.
+
+static const size_t DAEMON_MAX_JOBS = 1024;
+static const size_t DAEMON_MAX_HITS = 10000;        // per job
+static const size_t DAEMON_RESULTS_PAGE = 1000;
+static const time_t DAEMON_RETENTION = 3600;        // seconds
+
+struct CJobHit
+{
+    std::string strSeed;
+    std::string strSeedHex;
+    std::string strAccountID;
+};
+
+struct CJob
+{
+    int                         nId;
+    std::vector<std::string>    vPatterns;
+    bool                        fCancelled;
+    time_t                      nStopped;           // 0 while searching
+    uint64                      nSearchedAtSubmit;
+    double                      dProbability;       // per candidate
+    std::vector<CJobHit>        vHits;
+    boost::shared_ptr<const CPatternIndex> pIndex;  // SUBMIT_INDEX jobs
+    std::string                 strToken;           // for RESULTS and CANCEL, hex
+};
+
+class CVanityDaemon
+{
+protected:
+    std::string                             strSocketPath;
+    unsigned int                            nThreads;
+    const CKeyspace&                        keyspace;
+    CChunkScheduler                         scheduler;
+
+    boost::mutex                            lockJobs;
+    boost::condition_variable               condJobs;
+    std::map<int, CJob>                     mapJobs;
+    int                                     nNextJob;
+    boost::shared_ptr<const CPatternSet>    pPatterns;  // union of the running jobs
+
+    boost::atomic<uint64>                   nSearched;
+    boost::atomic<bool>                     fShutdown;
+    int                                     fdListen;
+
+    boost::mutex                            lockClients;
+    boost::condition_variable               condClients;
+    std::map<int, boost::thread*>           mapClients;     // by socket
+    std::vector<boost::thread*>             vFinished;      // to join
+
+    static std::string NewToken()
+    {
+        uint128 token;
+        if (RAND_bytes(token.begin(), token.size()) != 1)
+            throw std::runtime_error("CVanityDaemon : entropy pool not seeded");
+        return token.GetHex();
+    }
+
+    // The job of a RESULTS or CANCEL request with its token.  Caller holds
+    // lockJobs.
+    std::map<int, CJob>::iterator FindJob(std::istringstream& ss, std::string& msg)
+    {
+        int nJob;
+        std::string strToken;
+        if (!(ss >> nJob >> strToken))
+        {
+            msg = "needs a job id and its token";
+            return mapJobs.end();
+        }
+        std::map<int, CJob>::iterator it = mapJobs.find(nJob);
+        if (it == mapJobs.end() || strToken.size() != it->second.strToken.size()
+            || CRYPTO_memcmp(strToken.data(), it->second.strToken.data(), strToken.size()) != 0)
+        {
+            // the same answer either way: job ids are not secret, seeds are
+            msg = "no such job or wrong token";
+            return mapJobs.end();
+        }
+        return it;
+    }
+
+    // Drop the jobs stopped more than DAEMON_RETENTION ago.  Caller holds
+    // lockJobs.
+    void Expire()
+    {
+        time_t nNow = time(NULL);
+        for (std::map<int, CJob>::iterator it = mapJobs.begin(); it != mapJobs.end(); )
+        {
+            if (it->second.nStopped != 0 && nNow - it->second.nStopped >= DAEMON_RETENTION)
+                mapJobs.erase(it++);
+            else
+                ++it;
+        }
+    }
+
+    // Take a job out of the search.  Caller holds lockJobs.
+    void Stop(CJob& job)
+    {
+        if (job.nStopped == 0)
+            job.nStopped = time(NULL);
+        job.pIndex.reset();
+        Republish();
+    }
+
+    // A new job under the next id, or false if DAEMON_MAX_JOBS are kept.
+    // Caller holds lockJobs.
+    bool AddJob(CJob& job)
+    {
+        Expire();
+        if (mapJobs.size() >= DAEMON_MAX_JOBS)
+            return false;
+        job.nId = nNextJob++;
+        job.fCancelled = false;
+        job.nStopped = 0;
+        job.nSearchedAtSubmit = nSearched;
+        mapJobs[job.nId] = job;
+        Republish();
+        return true;
+    }
+
+    // Rebuild the pattern union.  Caller holds lockJobs.
+    void Republish()
+    {
+        boost::shared_ptr<CPatternSet> pNew = boost::make_shared<CPatternSet>();
+        for (std::map<int, CJob>::const_iterator it = mapJobs.begin(); it != mapJobs.end(); ++it)
+        {
+            if (it->second.nStopped != 0)
+                continue;
+            if (it->second.pIndex)
+                pNew->AddIndex(it->second.pIndex, it->first);
+            else
+                for (size_t i = 0; i < it->second.vPatterns.size(); i++)
+                    pNew->Add(it->second.vPatterns[i], it->first);
+        }
+        pNew->Finish();
+        pPatterns = pNew;
+        condJobs.notify_all();
+    }
+
+    // Current pattern union; parks the caller while there is nothing to search.
+    boost::shared_ptr<const CPatternSet> WaitForPatterns()
+    {
+        boost::unique_lock<boost::mutex> lock(lockJobs);
+        while (!fShutdown && (!pPatterns || pPatterns->Empty()))
+            condJobs.wait(lock);
+        return fShutdown ? boost::shared_ptr<const CPatternSet>() : pPatterns;
+    }
+
+    void Record(std::vector<int>& vTags, const CJobHit& hit)
+    {
+        std::sort(vTags.begin(), vTags.end());
+        vTags.erase(std::unique(vTags.begin(), vTags.end()), vTags.end());
+
+        boost::unique_lock<boost::mutex> lock(lockJobs);
+        for (size_t i = 0; i < vTags.size(); i++)
+        {
+            std::map<int, CJob>::iterator it = mapJobs.find(vTags[i]);
+            if (it == mapJobs.end() || it->second.nStopped != 0)
+                continue;
+            it->second.vHits.push_back(hit);
+            std::cout << "# job " << it->first << ": " << hit.strAccountID << std::endl;
+            if (it->second.vHits.size() >= DAEMON_MAX_HITS)
+            {
+                std::cout << "# job " << it->first << ": " << DAEMON_MAX_HITS << " hits, stopping" << std::endl;
+                Stop(it->second);
+            }
+        }
+    }
+
+    void WorkerThread(unsigned int n)
+    {
+        boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+        CPacer pacer;
+        RippleAddress naSeed;
+        RippleAddress naAccount;
+        std::vector<int> vTags;
+        CChunk chunk;
+        CArenaArray<uint128> vSeeds(BACKEND_BATCH);
+        uint160 vAccountIDs[BACKEND_BATCH];
+
+        while (!fShutdown)
+        {
+            boost::shared_ptr<const CPatternSet> pSet = WaitForPatterns();
+            if (!pSet || !scheduler.Next(n, chunk))
+                break;
+
+            boost::posix_time::ptime ptStart = boost::posix_time::microsec_clock::universal_time();
+            for (uint64 c = chunk.nBegin; c != chunk.nEnd; )
+            {
+                unsigned int nBatch = (unsigned int) std::min<uint64>(BACKEND_BATCH, chunk.nEnd - c);
+                keyspace.SeedsAt(c, nBatch, vSeeds);
+                c += nBatch;
+                pBackend->SetFamilies(vSeeds, nBatch);
+                pBackend->GetFamilyAccountIDs(0, vAccountIDs);
+
+                for (unsigned int i = 0; i < nBatch; i++)
+                {
+                    vTags.clear();
+                    if (pSet->Match(vAccountIDs[i], vTags))
+                    {
+                        naSeed.setSeed(vSeeds[i]);
+                        naAccount.setAccountID(vAccountIDs[i]);
+                        CJobHit hit;
+                        hit.strSeed = naSeed.humanSeed();
+                        hit.strSeedHex = naSeed.getSeed().ToString();
+                        hit.strAccountID = naAccount.humanAccountID();
+                        Record(vTags, hit);
+                    }
+                }
+                pacer.Pace();
+            }
+            nSearched += chunk.Size();
+            scheduler.Report(n, chunk.Size(),
+                (boost::posix_time::microsec_clock::universal_time() - ptStart).total_microseconds() / 1e6);
+        }
+    }
+
+    // Candidates per second of the whole pool.
+    double GetRate()
+    {
+        double dRate = 0;
+        for (unsigned int i = 0; i < nThreads; i++)
+            dRate += scheduler.GetRate(i);
+        return dRate;
+    }
+
+    static std::string JobLine(const CJob& job, uint64 nSearchedNow, double dRate)
+    {
+        std::ostringstream ss;
+        uint64 nSearchedJob = nSearchedNow - job.nSearchedAtSubmit;
+        ss << job.nId << " " << (job.fCancelled ? "cancelled" : job.nStopped != 0 ? "full" : "running") << " "
+           << job.vHits.size() << " " << nSearchedJob << " ";
+        for (size_t i = 0; i < job.vPatterns.size(); i++)
+            ss << (i ? "," : "") << job.vPatterns[i];
+
+        double dEta50 = getEta50(job.dProbability);
+        ss << " " << getFoundProbability(job.dProbability, nSearchedJob) << " "
+           << (nSearchedJob >= dEta50 ? -1 : (dEta50 - nSearchedJob) / std::max(dRate, 1.0));
+        return ss.str();
+    }
+
+    std::string Handle(const std::string& strLine)
+    {
+        std::istringstream ss(strLine);
+        std::string strCommand;
+        ss >> strCommand;
+        std::ostringstream out;
+
+        if (strCommand == "SUBMIT")
+        {
+            CJob job;
+            std::string strPattern, msg;
+            while (ss >> strPattern)
+            {
+                if (!isPatternValid(strPattern, msg))
+                    return "ERR " + msg + "\n";
+                job.vPatterns.push_back(strPattern);
+            }
+            if (job.vPatterns.empty())
+                return "ERR SUBMIT needs at least one pattern\n";
+
+            job.strToken = NewToken();
+            job.dProbability = getPatternSetProbability(job.vPatterns);
+            boost::unique_lock<boost::mutex> lock(lockJobs);
+            if (!AddJob(job))
+                return "ERR too many jobs\n";
+            out << "OK " << job.nId << " " << job.strToken << "\n";
+        }
+        else if (strCommand == "SUBMIT_INDEX")
+        {
+            // mapped, not parsed: a job switch costs an mmap
+            CJob job;
+            std::string strPath, msg;
+            if (!(ss >> strPath))
+                return "ERR SUBMIT_INDEX needs an index path\n";
+            job.pIndex = CPatternIndex::OpenShared(strPath, msg);
+            if (!job.pIndex)
+                return "ERR " + msg + "\n";
+            job.vPatterns.push_back("index:" + strPath);
+
+            job.strToken = NewToken();
+            job.dProbability = job.pIndex->GetProbability();
+            boost::unique_lock<boost::mutex> lock(lockJobs);
+            if (!AddJob(job))
+                return "ERR too many jobs\n";
+            out << "OK " << job.nId << " " << job.strToken << "\n";
+        }
+        else if (strCommand == "STATUS")
+        {
+            int nJob;
+            double dRate = GetRate();
+            boost::unique_lock<boost::mutex> lock(lockJobs);
+            Expire();
+            std::vector<std::string> vLines;
+            if (ss >> nJob)
+            {
+                std::map<int, CJob>::const_iterator it = mapJobs.find(nJob);
+                if (it == mapJobs.end())
+                    return "ERR no such job\n";
+                vLines.push_back(JobLine(it->second, nSearched, dRate));
+            }
+            else
+            {
+                for (std::map<int, CJob>::const_iterator it = mapJobs.begin(); it != mapJobs.end(); ++it)
+                    vLines.push_back(JobLine(it->second, nSearched, dRate));
+            }
+            out << "OK " << vLines.size() << "\n";
+            for (size_t i = 0; i < vLines.size(); i++)
+                out << vLines[i] << "\n";
+        }
+        else if (strCommand == "CANCEL")
+        {
+            std::string msg;
+            boost::unique_lock<boost::mutex> lock(lockJobs);
+            std::map<int, CJob>::iterator it = FindJob(ss, msg);
+            if (it == mapJobs.end())
+                return "ERR CANCEL " + msg + "\n";
+            it->second.fCancelled = true;
+            Stop(it->second);
+            out << "OK " << it->first << "\n";
+        }
+        else if (strCommand == "RESULTS")
+        {
+            std::string msg;
+            boost::unique_lock<boost::mutex> lock(lockJobs);
+            std::map<int, CJob>::iterator it = FindJob(ss, msg);
+            if (it == mapJobs.end())
+                return "ERR RESULTS " + msg + "\n";
+            size_t nFirst = 0;
+            if (!(ss >> nFirst))
+                nFirst = 0;
+            const std::vector<CJobHit>& vHits = it->second.vHits;
+            nFirst = std::min(nFirst, vHits.size());
+            size_t nEnd = std::min(vHits.size(), nFirst + DAEMON_RESULTS_PAGE);
+            out << "OK " << nEnd - nFirst << "\n";
+            for (size_t i = nFirst; i < nEnd; i++)
+                out << vHits[i].strSeed << " " << vHits[i].strSeedHex << " " << vHits[i].strAccountID << "\n";
+            // a stopped job gets no more hits: gone with the short page
+            // that tells the client it has them all
+            if (it->second.nStopped != 0 && nEnd - nFirst < DAEMON_RESULTS_PAGE)
+                mapJobs.erase(it);
+        }
+        else if (strCommand == "SHUTDOWN")
+        {
+            Shutdown();
+            out << "OK\n";
+        }
+        else
+        {
+            return "ERR unknown command\n";
+        }
+
+        return out.str();
+    }
+
+#if !defined(WIN32) && !defined(WIN64)
+    void ServeClient(int fd)
+    {
+        CLineReader reader(fd);
+        std::string strLine;
+        while (reader.ReadLine(strLine))
+        {
+            if (strLine.empty())
+                continue;
+            if (!WriteAll(fd, Handle(strLine)))
+                break;
+        }
+
+        // closed under the lock: the number must not be reused before it
+        // leaves mapClients
+        boost::unique_lock<boost::mutex> lock(lockClients);
+        std::map<int, boost::thread*>::iterator it = mapClients.find(fd);
+        if (it != mapClients.end())
+        {
+            vFinished.push_back(it->second);
+            mapClients.erase(it);
+        }
+        close(fd);
+        condClients.notify_all();
+    }
+
+    // Join the client threads that are done.
+    void ReapClients()
+    {
+        std::vector<boost::thread*> vJoin;
+        {
+            boost::unique_lock<boost::mutex> lock(lockClients);
+            vJoin.swap(vFinished);
+        }
+        for (size_t i = 0; i < vJoin.size(); i++)
+        {
+            vJoin[i]->join();
+            delete vJoin[i];
+        }
+    }
+
+    // Clients of other users are turned away.
+    static bool IsOwnUser(int fd)
+    {
+#ifdef SO_PEERCRED
+        struct ucred cred;
+        socklen_t nSize = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &nSize) != 0)
+            return false;
+        return cred.uid == getuid() || cred.uid == 0;
+#else
+        uid_t uid;
+        gid_t gid;
+        if (getpeereid(fd, &uid, &gid) != 0)
+            return false;
+        return uid == getuid() || uid == 0;
+#endif
+    }
+#endif
+
+public:
+    CVanityDaemon(const std::string& strSocketPathIn, unsigned int nThreadsIn, const CKeyspace& keyspaceIn)
+        : strSocketPath(strSocketPathIn), nThreads(nThreadsIn), keyspace(keyspaceIn),
+          scheduler(nThreadsIn, 0, keyspaceIn.Size()), nNextJob(1), nSearched(0),
+          fShutdown(false), fdListen(-1)
+    {
+    }
+
+    void Shutdown()
+    {
+        boost::unique_lock<boost::mutex> lock(lockJobs);
+        fShutdown = true;
+        scheduler.Stop();
+        condJobs.notify_all();
+#if !defined(WIN32) && !defined(WIN64)
+        if (fdListen >= 0)
+            ::shutdown(fdListen, SHUT_RDWR);
+#endif
+    }
+
+    // Serve until a client sends SHUTDOWN.
+    int Run()
+    {
+#if defined(WIN32) || defined(WIN64)
+        std::cout << "# Daemon mode needs Unix domain sockets." << std::endl;
+        return -1;
+#else
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strSocketPath.size() >= sizeof(addr.sun_path))
+        {
+            std::cout << "# Socket path too long: " << strSocketPath << std::endl;
+            return -1;
+        }
+        strncpy(addr.sun_path, strSocketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        fdListen = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(strSocketPath.c_str());
+        // owner only from the start: no window with the process umask
+        mode_t nMask = umask(077);
+        bool fBound = fdListen >= 0 && bind(fdListen, (sockaddr*) &addr, sizeof(addr)) == 0;
+        umask(nMask);
+        if (!fBound || chmod(strSocketPath.c_str(), 0600) != 0 || listen(fdListen, 16) != 0)
+        {
+            std::cout << "# Cannot listen on " << strSocketPath << ": " << strerror(errno) << std::endl;
+            if (fdListen >= 0)
+                close(fdListen);
+            return -1;
+        }
+
+        std::cout << "# Listening on " << strSocketPath << " with " << nThreads << " thread"
+                  << (nThreads == 1 ? "" : "s") << "." << std::endl
+                  << "#" << std::endl;
+
+        boost::thread_group workers;
+        for (unsigned int i = 0; i < nThreads; i++)
+            workers.create_thread(boost::bind(&CVanityDaemon::WorkerThread, this, i));
+
+        while (!fShutdown)
+        {
+            int fd = accept(fdListen, NULL, NULL);
+            if (fd < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            ReapClients();
+            if (!IsOwnUser(fd))
+            {
+                close(fd);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(lockClients);
+            mapClients[fd] = new boost::thread(boost::bind(&CVanityDaemon::ServeClient, this, fd));
+        }
+
+        Shutdown();
+        {
+            // clients still connected are cut off, then waited for
+            boost::unique_lock<boost::mutex> lock(lockClients);
+            for (std::map<int, boost::thread*>::iterator it = mapClients.begin(); it != mapClients.end(); ++it)
+                ::shutdown(it->first, SHUT_RDWR);
+            while (!mapClients.empty())
+                condClients.wait(lock);
+        }
+        ReapClients();
+        CBackground::Instance().Stop();
+        workers.join_all();
+        close(fdListen);
+        unlink(strSocketPath.c_str());
+        return 0;
+#endif
+    }
+};
+
+#endif
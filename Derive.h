@@ -0,0 +1,299 @@
+#ifndef __DERIVE_H__
+#define __DERIVE_H__
+
+#include "RippleAddress.h"
+#include "Scheduler.h"
+#include "Backend.h"
+
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Bulk derivation and verification ("ripplegen derive").
+//
+// Input is read in blocks of DERIVE_BLOCK rows.  While the worker pool derives
+// one block through a chunk scheduler, the main thread reads the next one;
+// each row owns its output slot, so output order always matches input order.
+//
+// Derive rows: one seed per line, hex or human ("s..."); prints
+//     <seed> <seed hex> <index> <account id>
+// for each requested index of each --key-type.  An ed25519 account has no
+// index: its row shows its "sEd..." seed and index 0.  "sEd..." input seeds
+// are ed25519 whatever --key-type says.
+//
+// Verify rows: result files as written by the search (master seed / master
+// seed hex / account id / account index blocks), or derive output itself.
+// Mismatches and unparsable records are printed, then a summary line.
+
+static const size_t DERIVE_BLOCK = 65536;
+
+struct CDeriveRow
+{
+    std::string strInput;       // the record, for error messages
+    uint128     seed;
+    bool        fEd25519;       // an "sEd..." seed
+    bool        fValid;
+    int         nIndex;         // verify: index claimed by the record
+    std::string strAccountID;   // verify: account claimed by the record
+    std::string strOutput;
+    bool        fMismatch;
+};
+
+class CBulkDeriver
+{
+protected:
+    unsigned int        nThreads;
+    std::vector<int>    vIndexes;
+    int                 nKeyTypes;
+    bool                fVerify;
+    uint64              nRows;
+    uint64              nMismatches;
+    std::string         strPending;
+    bool                fPending;
+
+    // fEd25519 is set for an "sEd..." seed and left alone for hex.
+    static bool ParseSeed(const std::string& strSeed, uint128& seed, bool& fEd25519)
+    {
+        if (strSeed.size() == 2 * seed.size() && strSeed.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos)
+        {
+            seed.SetHex(strSeed);
+            return true;
+        }
+
+        fEd25519 = parseEd25519Seed(strSeed, seed);
+        if (fEd25519)
+            return true;
+
+        RippleAddress naSeed;
+        if (!naSeed.SetString(strSeed, VER_FAMILY_SEED) || naSeed.vchData.size() != seed.size())
+            return false;
+        seed = naSeed.getSeed();
+        return true;
+    }
+
+    bool NextLine(std::istream& in, std::string& strLine)
+    {
+        if (fPending)
+        {
+            strLine = strPending;
+            fPending = false;
+            return true;
+        }
+        if (!std::getline(in, strLine))
+            return false;
+        if (!strLine.empty() && strLine[strLine.size() - 1] == '\r')
+            strLine.erase(strLine.size() - 1);
+        return true;
+    }
+
+    void PushBack(const std::string& strLine)
+    {
+        strPending = strLine;
+        fPending = true;
+    }
+
+    static std::string Field(const std::string& strLine)
+    {
+        std::istringstream ss(strLine.substr(strLine.find(':') + 1));
+        std::string strField;
+        ss >> strField;
+        return strField;
+    }
+
+    // Next record of the input; false at end of input.
+    bool ReadRow(std::istream& in, CDeriveRow& row)
+    {
+        std::string strLine;
+        row.fValid = false;
+        row.fEd25519 = false;
+        row.fMismatch = false;
+        row.nIndex = 0;
+        row.strAccountID.clear();
+        row.strOutput.clear();
+
+        while (NextLine(in, strLine))
+        {
+            if (strLine.empty() || strLine[0] == '#')
+                continue;
+
+            row.strInput = strLine;
+            if (strLine.compare(0, 11, "master seed") == 0)
+            {
+                // result block: "master seed" and/or "master seed hex", then
+                // "account id" and an optional "account index"
+                row.fValid = ParseSeed(Field(strLine), row.seed, row.fEd25519);
+                while (NextLine(in, strLine))
+                {
+                    if (strLine.compare(0, 16, "master seed hex:") == 0 && row.strAccountID.empty())
+                        row.fValid = ParseSeed(Field(strLine), row.seed, row.fEd25519);
+                    else if (strLine.compare(0, 11, "account id:") == 0 && row.strAccountID.empty())
+                        row.strAccountID = Field(strLine);
+                    else if (strLine.compare(0, 14, "account index:") == 0)
+                        row.nIndex = atoi(Field(strLine).c_str());
+                    else
+                    {
+                        PushBack(strLine);
+                        break;
+                    }
+                }
+                row.fValid = row.fValid && !row.strAccountID.empty();
+                return true;
+            }
+
+            std::istringstream ss(strLine);
+            std::string strSeed;
+            ss >> strSeed;
+            row.fValid = ParseSeed(strSeed, row.seed, row.fEd25519);
+            if (fVerify)
+            {
+                // derive output: <seed> <seed hex> <index> <account id>
+                std::string strHex;
+                row.fValid = row.fValid && (ss >> strHex >> row.nIndex >> row.strAccountID);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void Process(CDeriveRow& row, CCryptoBackend& backend)
+    {
+        if (!row.fValid)
+        {
+            row.fMismatch = fVerify;
+            row.strOutput = "# unparsable: " + row.strInput + "\n";
+            return;
+        }
+
+        RippleAddress naSeed;
+        RippleAddress naAccount;
+        naSeed.setSeed(row.seed);
+        int nRowKeyTypes = row.fEd25519 ? KEY_ED25519 : nKeyTypes;
+
+        if (fVerify)
+        {
+            if (row.fEd25519)
+                naAccount.setAccountID(backend.GetEd25519AccountID(row.seed));
+            else
+            {
+                backend.SetFamily(row.seed);
+                naAccount.setAccountID(backend.GetAccountID(row.nIndex));
+            }
+            std::string strAccountID = naAccount.humanAccountID();
+            if (strAccountID != row.strAccountID)
+            {
+                row.fMismatch = true;
+                row.strOutput = "MISMATCH " + (row.fEd25519 ? humanEd25519Seed(row.seed) : naSeed.humanSeed()) + " "
+                              + lexical_cast_i(row.nIndex) + " expected " + row.strAccountID + " derived " + strAccountID + "\n";
+            }
+            return;
+        }
+
+        if (nRowKeyTypes & KEY_SECP256K1)
+        {
+            std::string strPrefix = naSeed.humanSeed() + " " + naSeed.getSeed().GetHex() + " ";
+            backend.SetFamily(row.seed);
+            for (size_t i = 0; i < vIndexes.size(); i++)
+            {
+                naAccount.setAccountID(backend.GetAccountID(vIndexes[i]));
+                row.strOutput += strPrefix + lexical_cast_i(vIndexes[i]) + " " + naAccount.humanAccountID() + "\n";
+            }
+        }
+        if (nRowKeyTypes & KEY_ED25519)
+        {
+            naAccount.setAccountID(backend.GetEd25519AccountID(row.seed));
+            row.strOutput += humanEd25519Seed(row.seed) + " " + naSeed.getSeed().GetHex() + " 0 " + naAccount.humanAccountID() + "\n";
+        }
+    }
+
+    void WorkerThread(unsigned int n, CChunkScheduler* pScheduler, std::vector<CDeriveRow>* pvRows)
+    {
+        boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+        CChunk chunk;
+        while (pScheduler->Next(n, chunk))
+        {
+            boost::posix_time::ptime ptStart = boost::posix_time::microsec_clock::universal_time();
+            for (uint64 i = chunk.nBegin; i != chunk.nEnd; i++)
+                Process((*pvRows)[i], *pBackend);
+            pScheduler->Report(n, chunk.Size(),
+                (boost::posix_time::microsec_clock::universal_time() - ptStart).total_microseconds() / 1e6);
+        }
+    }
+
+    size_t ReadBlock(std::istream& in, std::vector<CDeriveRow>& vRows)
+    {
+        vRows.resize(DERIVE_BLOCK);
+        size_t nRead = 0;
+        while (nRead < vRows.size() && ReadRow(in, vRows[nRead]))
+            nRead++;
+        vRows.resize(nRead);
+        return nRead;
+    }
+
+public:
+    CBulkDeriver(unsigned int nThreadsIn, const std::vector<int>& vIndexesIn, int nKeyTypesIn, bool fVerifyIn)
+        : nThreads(nThreadsIn), vIndexes(vIndexesIn), nKeyTypes(nKeyTypesIn), fVerify(fVerifyIn), nRows(0),
+          nMismatches(0), fPending(false)
+    {
+        if (vIndexes.empty())
+            vIndexes.push_back(0);
+    }
+
+    // "0,3,8-15" -> 0 3 8 9 ... 15
+    static bool ParseIndexes(const std::string& strSpec, std::vector<int>& vIndexes)
+    {
+        std::istringstream ss(strSpec);
+        std::string strItem;
+        while (std::getline(ss, strItem, ','))
+        {
+            int nFirst, nLast;
+            char cDash;
+            std::istringstream item(strItem);
+            if (!(item >> nFirst) || nFirst < 0)
+                return false;
+            nLast = nFirst;
+            if (item >> cDash && (cDash != '-' || !(item >> nLast) || nLast < nFirst))
+                return false;
+            for (int i = nFirst; i <= nLast; i++)
+                vIndexes.push_back(i);
+        }
+        return !vIndexes.empty();
+    }
+
+    // Returns the number of mismatches (verify) or 0.
+    uint64 Run(std::istream& in, std::ostream& out)
+    {
+        std::vector<CDeriveRow> vRows, vNext;
+        ReadBlock(in, vRows);
+        while (!vRows.empty())
+        {
+            CChunkScheduler scheduler(nThreads, 0, vRows.size(), 64);
+            boost::thread_group workers;
+            for (unsigned int i = 0; i < nThreads; i++)
+                workers.create_thread(boost::bind(&CBulkDeriver::WorkerThread, this, i, &scheduler, &vRows));
+
+            ReadBlock(in, vNext);
+            workers.join_all();
+
+            for (size_t i = 0; i < vRows.size(); i++)
+            {
+                out << vRows[i].strOutput;
+                if (vRows[i].fMismatch)
+                    nMismatches++;
+            }
+            out.flush();
+            nRows += vRows.size();
+            vRows.swap(vNext);
+        }
+
+        if (fVerify)
+            out << "# verified " << nRows << " records, " << nMismatches << " mismatch"
+                << (nMismatches == 1 ? "" : "es") << std::endl;
+        return nMismatches;
+    }
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef __DIFFICULTY_H__
+#define __DIFFICULTY_H__
+
+#include "base58.h"
+
+#include "Digest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Exact match probabilities for account id prefixes.
+//
+// An account id is base58check(0x00 || hash160), so with V the 192-bit value
+// hash160 || checksum it reads
+//
+//     'r' x (1 + leading zero bytes of V)  then  base58(V) without leading 'r'
+//
+// A prefix is therefore a set of V intervals: one per possible digit count of
+// base58(V), cut to the values with the right number of leading zero bytes.
+// V is uniform, so the probability is the total interval length over 2^192.
+// This accounts for the fixed 'r', for accounts of different lengths and for
+// the skewed leading digits (the second character of a 34 character account
+// is one of "pshnaf39wBUDNEGHJKLM4PQ", never anything after 'Q').  Only the
+// checksums of the two hashes at each interval boundary are not modelled.
+
+static const int ACCOUNT_VALUE_BITS = 192;
+static const int ACCOUNT_VALUE_DIGITS = 33;     // 58^33 > 2^192
+
+typedef std::pair<CBigNum, CBigNum> CValueInterval;    // [first, end)
+
+// V of an account id, big-endian.
+inline void getAccountValue(const uint160& accountID, unsigned char* p24)
+{
+    unsigned char pData[21];
+    unsigned char hash2[32];
+    pData[0] = 0;   // VER_ACCOUNT_ID
+    memcpy(pData + 1, accountID.begin(), 20);
+    DigestSHA256d(pData, sizeof(pData), hash2);
+    memcpy(p24, accountID.begin(), 20);
+    memcpy(p24 + 20, hash2, 4);
+}
+
+// V (below 2^192) as 24 big-endian bytes.
+inline void putValueBytes(unsigned char* p24, const CBigNum& bn)
+{
+    uint256 value = CBigNum(bn).getuint256();     // big-endian, right aligned
+    memcpy(p24, value.begin() + 8, 24);
+}
+
+// A V interval as the bytes candidates are compared with.
+struct CValueBounds
+{
+    unsigned char pFirst[24];   // big-endian, inclusive
+    unsigned char pLast[24];
+};
+
+inline CValueBounds getValueBounds(const CValueInterval& interval)
+{
+    CValueBounds bounds;
+    putValueBytes(bounds.pFirst, interval.first);
+    putValueBytes(bounds.pLast, interval.second - 1);
+    return bounds;
+}
+
+// Whether the V of an account id is inside: a few byte compares, the checksum
+// only for a hash160 on an edge of the interval.
+inline bool isInValueBounds(const uint160& accountID, const CValueBounds& bounds)
+{
+    const unsigned char* p = accountID.begin();
+    int nFirst = memcmp(p, bounds.pFirst, 20);
+    if (nFirst < 0)
+        return false;
+    int nLast = memcmp(p, bounds.pLast, 20);
+    if (nLast > 0)
+        return false;
+    if (nFirst > 0 && nLast < 0)
+        return true;
+
+    unsigned char pValue[24];
+    getAccountValue(accountID, pValue);
+    return memcmp(pValue, bounds.pFirst, 24) >= 0 && memcmp(pValue, bounds.pLast, 24) <= 0;
+}
+
+inline double bignumToDouble(const CBigNum& bn)
+{
+    std::string strHex = bn.GetHex();
+    double d = 0;
+    for (size_t i = 0; i < strHex.size(); i++)
+        d = d * 16 + (strHex[i] <= '9' ? strHex[i] - '0' : strHex[i] - 'a' + 10);
+    return d;
+}
+
+// V intervals of the accounts starting with pattern.  False if pattern is not
+// an account id prefix at all; an impossible prefix gives no intervals.
+inline bool getAccountIntervals(const std::string& pattern, std::vector<CValueInterval>& vIntervals)
+{
+    if (pattern.empty() || pattern[0] != ALPHABET[0])
+        return false;
+
+    size_t nLeading = pattern.find_first_not_of(ALPHABET[0]);
+    if (nLeading == std::string::npos)
+        nLeading = pattern.size();
+    std::string strDigits = pattern.substr(nLeading);
+
+    // values with exactly nLeading - 1 leading zero bytes, or at least that
+    // many if nothing follows the 'r's
+    int nZeroBytes = nLeading - 1;
+    if (8 * nZeroBytes >= ACCOUNT_VALUE_BITS)
+        return true;
+    CBigNum bnZoneEnd = CBigNum(1) << (ACCOUNT_VALUE_BITS - 8 * nZeroBytes);
+    CBigNum bnZoneBegin = strDigits.empty() ? CBigNum(0) : CBigNum(1) << (ACCOUNT_VALUE_BITS - 8 * nZeroBytes - 8);
+
+    CBigNum bn58 = 58;
+    CBigNum bnDigits = 0;
+    CBigNum bnChar;
+    for (size_t i = 0; i < strDigits.size(); i++)
+    {
+        const char* p = strchr(ALPHABET, strDigits[i]);
+        if (strDigits[i] == '\0' || p == NULL)
+            return false;
+        bnChar.setuint(p - ALPHABET);
+        bnDigits = bnDigits * bn58 + bnChar;
+    }
+
+    if (strDigits.empty())
+    {
+        vIntervals.push_back(CValueInterval(bnZoneBegin, bnZoneEnd));
+        return true;
+    }
+
+    CBigNum bnScale = 1;
+    CBigNum bnNext = bnDigits + 1;
+    for (int nLength = strDigits.size(); nLength <= ACCOUNT_VALUE_DIGITS; nLength++, bnScale *= bn58)
+    {
+        CBigNum bnEnd = bnNext * bnScale;
+        if (bnEnd <= bnZoneBegin)
+            continue;
+        CBigNum bnFirst = bnDigits * bnScale;
+        if (bnFirst >= bnZoneEnd)
+            break;      // longer accounts only start higher
+        vIntervals.push_back(CValueInterval(std::max(bnFirst, bnZoneBegin), std::min(bnEnd, bnZoneEnd)));
+    }
+    return true;
+}
+
+// Probability that an account matches at least one of the patterns.
+inline double getPatternSetProbability(const std::vector<std::string>& vPatterns)
+{
+    std::vector<CValueInterval> vIntervals;
+    for (size_t i = 0; i < vPatterns.size(); i++)
+        getAccountIntervals(vPatterns[i], vIntervals);
+    std::sort(vIntervals.begin(), vIntervals.end());
+
+    // overlapping patterns ("rp", "rpp") must not be counted twice
+    CBigNum bnTotal = 0;
+    CBigNum bnCovered = 0;
+    for (size_t i = 0; i < vIntervals.size(); i++)
+    {
+        CBigNum bnFirst = std::max(vIntervals[i].first, bnCovered);
+        if (bnFirst < vIntervals[i].second)
+        {
+            bnTotal += vIntervals[i].second - bnFirst;
+            bnCovered = vIntervals[i].second;
+        }
+    }
+    return bignumToDouble(bnTotal) / ldexp(1.0, ACCOUNT_VALUE_BITS);
+}
+
+inline double getPatternProbability(const std::string& pattern)
+{
+    return getPatternSetProbability(std::vector<std::string>(1, pattern));
+}
+
+// Probability of at least one match after nCandidates accounts.
+inline double getFoundProbability(double dProbability, double nCandidates)
+{
+    if (dProbability >= 1)
+        return nCandidates > 0 ? 1 : 0;
+    return -expm1(nCandidates * log1p(-dProbability));
+}
+
+// Accounts to search for a 50% chance of a match.
+inline double getEta50(double dProbability)
+{
+    if (dProbability <= 0)
+        return HUGE_VAL;
+    if (dProbability >= 1)
+        return 1;
+    return ceil(log(0.5) / log1p(-dProbability));
+}
+
+inline std::string formatDuration(double dSeconds)
+{
+    const char* unit = "seconds";
+    if (dSeconds > 100) {
+        unit = "minutes";
+        dSeconds /= 60;
+
+        if (dSeconds > 100) {
+            unit = "hours";
+            dSeconds /= 60;
+
+            if (dSeconds > 48) {
+                unit = "days";
+                dSeconds /= 24;
+
+                if (dSeconds > 730) {
+                    unit = "years";
+                    dSeconds /= 365.25;
+                }
+            }
+        }
+    }
+
+    char sz[64];
+    snprintf(sz, sizeof(sz), "%.4g %s", dSeconds, unit);
+    return sz;
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __DIGEST_H__
+#define __DIGEST_H__
+
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/provider.h>
+#endif
+
+#include <boost/thread/tss.hpp>
+
+#include <cstddef>
+#include <stdexcept>
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new      EVP_MD_CTX_create
+#define EVP_MD_CTX_free     EVP_MD_CTX_destroy
+#endif
+
+// SHA-256, SHA-512 and RIPEMD-160 for every hash outside the backends' own
+// code: seeds, checksums and the reference derivation.
+//
+// The one-shot SHA256() and friends of OpenSSL 3 fetch the algorithm from the
+// provider and set up a context on every call, which costs more than hashing
+// the few dozen bytes we give them.  Here the algorithms are fetched once per
+// process and every thread keeps one context per algorithm, reset with
+// EVP_DigestInit_ex between messages.
+//
+// RIPEMD-160 came in the legacy provider only up to OpenSSL 3.0.6; if the
+// default provider does not have it, the legacy one is loaded for it.
+
+enum
+{
+    DIGEST_SHA256,
+    DIGEST_SHA512,
+    DIGEST_RIPEMD160,
+    DIGEST_COUNT
+};
+
+class CDigestAlgorithms
+{
+protected:
+    const EVP_MD*   vpMD[DIGEST_COUNT];
+
+    CDigestAlgorithms()
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        vpMD[DIGEST_SHA256] = EVP_MD_fetch(NULL, "SHA256", NULL);
+        vpMD[DIGEST_SHA512] = EVP_MD_fetch(NULL, "SHA512", NULL);
+        vpMD[DIGEST_RIPEMD160] = EVP_MD_fetch(NULL, "RIPEMD160", NULL);
+        if (!vpMD[DIGEST_RIPEMD160])
+        {
+            // loading a provider stops the default one from loading on its
+            // own, so both, though the fetches above have loaded it already
+            OSSL_PROVIDER_load(NULL, "default");
+            OSSL_PROVIDER_load(NULL, "legacy");
+            vpMD[DIGEST_RIPEMD160] = EVP_MD_fetch(NULL, "RIPEMD160", NULL);
+        }
+#else
+        vpMD[DIGEST_SHA256] = EVP_sha256();
+        vpMD[DIGEST_SHA512] = EVP_sha512();
+        vpMD[DIGEST_RIPEMD160] = EVP_ripemd160();
+#endif
+        for (int i = 0; i < DIGEST_COUNT; i++)
+            if (!vpMD[i])
+                throw std::runtime_error("CDigestAlgorithms : digest not available from OpenSSL");
+    }
+
+public:
+    // Never freed: threads may hash until the process exits.
+    static const CDigestAlgorithms& Instance()
+    {
+        static CDigestAlgorithms algorithms;
+        return algorithms;
+    }
+
+    const EVP_MD* Get(int nDigest) const
+    {
+        return vpMD[nDigest];
+    }
+};
+
+// The digest contexts of one thread.
+class CDigestContext
+{
+protected:
+    const CDigestAlgorithms&    algorithms;
+    EVP_MD_CTX*                 vpCtx[DIGEST_COUNT];
+
+    CDigestContext(const CDigestContext&); // no implementation
+    CDigestContext& operator=(const CDigestContext&); // no implementation
+
+public:
+    CDigestContext() : algorithms(CDigestAlgorithms::Instance())
+    {
+        for (int i = 0; i < DIGEST_COUNT; i++)
+            vpCtx[i] = NULL;
+        for (int i = 0; i < DIGEST_COUNT; i++)
+            if (!(vpCtx[i] = EVP_MD_CTX_new()))
+            {
+                this->~CDigestContext();
+                throw std::runtime_error("CDigestContext : EVP_MD_CTX_new failed");
+            }
+    }
+
+    ~CDigestContext()
+    {
+        for (int i = 0; i < DIGEST_COUNT; i++)
+            if (vpCtx[i])
+                EVP_MD_CTX_free(vpCtx[i]);
+    }
+
+    static CDigestContext& Thread()
+    {
+        static boost::thread_specific_ptr<CDigestContext> context;
+        if (!context.get())
+            context.reset(new CDigestContext);
+        return *context;
+    }
+
+    // Incremental form: Init, any number of Update, Final.
+    void Init(int nDigest)
+    {
+        if (!EVP_DigestInit_ex(vpCtx[nDigest], algorithms.Get(nDigest), NULL))
+            throw std::runtime_error("CDigestContext : EVP_DigestInit_ex failed");
+    }
+
+    void Update(int nDigest, const void* pData, size_t nSize)
+    {
+        if (!EVP_DigestUpdate(vpCtx[nDigest], pData, nSize))
+            throw std::runtime_error("CDigestContext : EVP_DigestUpdate failed");
+    }
+
+    void Final(int nDigest, unsigned char* pHash)
+    {
+        if (!EVP_DigestFinal_ex(vpCtx[nDigest], pHash, NULL))
+            throw std::runtime_error("CDigestContext : EVP_DigestFinal_ex failed");
+    }
+
+    void Digest(int nDigest, const void* pData, size_t nSize, unsigned char* pHash)
+    {
+        Init(nDigest);
+        Update(nDigest, pData, nSize);
+        Final(nDigest, pHash);
+    }
+};
+
+inline void DigestSHA256(const void* pData, size_t nSize, unsigned char* pHash)
+{
+    CDigestContext::Thread().Digest(DIGEST_SHA256, pData, nSize, pHash);
+}
+
+inline void DigestSHA512(const void* pData, size_t nSize, unsigned char* pHash)
+{
+    CDigestContext::Thread().Digest(DIGEST_SHA512, pData, nSize, pHash);
+}
+
+inline void DigestRIPEMD160(const void* pData, size_t nSize, unsigned char* pHash)
+{
+    CDigestContext::Thread().Digest(DIGEST_RIPEMD160, pData, nSize, pHash);
+}
+
+// RIPEMD-160 of SHA-256: the account id of a public key.
+inline void DigestHash160(const void* pData, size_t nSize, unsigned char* pHash)
+{
+    CDigestContext& context = CDigestContext::Thread();
+    unsigned char hash1[32];
+    context.Digest(DIGEST_SHA256, pData, nSize, hash1);
+    context.Digest(DIGEST_RIPEMD160, hash1, sizeof(hash1), pHash);
+}
+
+// SHA-256 twice: the base58 checksum.
+inline void DigestSHA256d(const void* pData, size_t nSize, unsigned char* pHash)
+{
+    CDigestContext& context = CDigestContext::Thread();
+    unsigned char hash1[32];
+    context.Digest(DIGEST_SHA256, pData, nSize, hash1);
+    context.Digest(DIGEST_SHA256, hash1, sizeof(hash1), pHash);
+}
+
+#endif
@@ -0,0 +1,475 @@
+#ifndef __ED25519_H__
+#define __ED25519_H__
+
+#include "types.h"
+#include "Arena.h"
+#include "Digest.h"
+
+#include <boost/thread/once.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include <openssl/crypto.h>
+
+// Native Ed25519 public keys for the search loop.
+//
+// An "sEd..." seed gives one account: its secret key is the first half of
+// SHA-512 of the 16 seed bytes, expanded as RFC 8032 says (SHA-512 again,
+// the first half clamped to the scalar a), and the account public key is
+// 0xED followed by the encoded point a*B.  No family, no account index.
+//
+// Field elements mod 2^255 - 19 as five 51-bit limbs, extended twisted
+// Edwards points, and a*B from a table of signed 4-bit windows: 64 windows of
+// the multiples 1..8, 60 KB, built once per process.  A batch of scalars
+// walks the table window by window and shares one inversion for the encoding.
+//
+// a*B runs in constant time, as the scalars are secret keys: every entry of
+// a window is read and the digit's picked with masks, its sign applied the
+// same way, and a zero digit adds the identity (the formulas are complete).
+// Nothing here is meant for signing.
+
+#if defined(__SIZEOF_INT128__)
+#define USE_NATIVE_ED25519 1
+#endif
+
+#ifdef USE_NATIVE_ED25519
+
+typedef unsigned __int128 ed_wide;     // column sums of a product
+
+static const uint64 ED25519_MASK = (1ull << 51) - 1;
+
+// Little-endian 51-bit limbs.  Products come back carried, limbs below 2^52;
+// sums and differences do not, and stay below 2^55 if their inputs are
+// products or sums of products, which is all the point formulas need and all
+// efMul and efSqr can take.
+struct CEdElement
+{
+    uint64 n[5];
+};
+
+inline void efSetInt(CEdElement& r, uint64 a)
+{
+    r.n[0] = a;
+    r.n[1] = r.n[2] = r.n[3] = r.n[4] = 0;
+}
+
+inline void efCarry(CEdElement& r)
+{
+    uint64 c;
+    c = r.n[0] >> 51; r.n[0] &= ED25519_MASK; r.n[1] += c;
+    c = r.n[1] >> 51; r.n[1] &= ED25519_MASK; r.n[2] += c;
+    c = r.n[2] >> 51; r.n[2] &= ED25519_MASK; r.n[3] += c;
+    c = r.n[3] >> 51; r.n[3] &= ED25519_MASK; r.n[4] += c;
+    c = r.n[4] >> 51; r.n[4] &= ED25519_MASK; r.n[0] += 19 * c;
+}
+
+inline void efAdd(CEdElement& r, const CEdElement& a, const CEdElement& b)
+{
+    for (int i = 0; i < 5; i++)
+        r.n[i] = a.n[i] + b.n[i];
+}
+
+// a + 8p - b, b below 2^54
+inline void efSub(CEdElement& r, const CEdElement& a, const CEdElement& b)
+{
+    r.n[0] = a.n[0] + 0x3FFFFFFFFFFF68ull - b.n[0];
+    for (int i = 1; i < 5; i++)
+        r.n[i] = a.n[i] + 0x3FFFFFFFFFFFF8ull - b.n[i];
+}
+
+inline void efNeg(CEdElement& r, const CEdElement& a)
+{
+    CEdElement zero;
+    efSetInt(zero, 0);
+    efSub(r, zero, a);
+    efCarry(r);
+}
+
+// The five 128-bit column sums back to limbs.
+inline void efReduce(CEdElement& r, ed_wide r0, ed_wide r1, ed_wide r2, ed_wide r3, ed_wide r4)
+{
+    r1 += r0 >> 51;
+    r2 += r1 >> 51;
+    r3 += r2 >> 51;
+    r4 += r3 >> 51;
+    ed_wide c = ((ed_wide) ((uint64) r0 & ED25519_MASK)) + 19 * (r4 >> 51);
+    r.n[0] = (uint64) c & ED25519_MASK;
+    r.n[1] = ((uint64) r1 & ED25519_MASK) + (uint64) (c >> 51);
+    r.n[2] = (uint64) r2 & ED25519_MASK;
+    r.n[3] = (uint64) r3 & ED25519_MASK;
+    r.n[4] = (uint64) r4 & ED25519_MASK;
+}
+
+// r may alias a or b.
+inline void efMul(CEdElement& r, const CEdElement& a, const CEdElement& b)
+{
+    uint64 a0 = a.n[0], a1 = a.n[1], a2 = a.n[2], a3 = a.n[3], a4 = a.n[4];
+    uint64 b0 = b.n[0], b1 = b.n[1], b2 = b.n[2], b3 = b.n[3], b4 = b.n[4];
+    uint64 b1_19 = 19 * b1, b2_19 = 19 * b2, b3_19 = 19 * b3, b4_19 = 19 * b4;
+
+    ed_wide r0 = (ed_wide) a0 * b0 + (ed_wide) a1 * b4_19 + (ed_wide) a2 * b3_19
+                 + (ed_wide) a3 * b2_19 + (ed_wide) a4 * b1_19;
+    ed_wide r1 = (ed_wide) a0 * b1 + (ed_wide) a1 * b0 + (ed_wide) a2 * b4_19
+                 + (ed_wide) a3 * b3_19 + (ed_wide) a4 * b2_19;
+    ed_wide r2 = (ed_wide) a0 * b2 + (ed_wide) a1 * b1 + (ed_wide) a2 * b0
+                 + (ed_wide) a3 * b4_19 + (ed_wide) a4 * b3_19;
+    ed_wide r3 = (ed_wide) a0 * b3 + (ed_wide) a1 * b2 + (ed_wide) a2 * b1
+                 + (ed_wide) a3 * b0 + (ed_wide) a4 * b4_19;
+    ed_wide r4 = (ed_wide) a0 * b4 + (ed_wide) a1 * b3 + (ed_wide) a2 * b2
+                 + (ed_wide) a3 * b1 + (ed_wide) a4 * b0;
+    efReduce(r, r0, r1, r2, r3, r4);
+}
+
+inline void efSqr(CEdElement& r, const CEdElement& a)
+{
+    uint64 a0 = a.n[0], a1 = a.n[1], a2 = a.n[2], a3 = a.n[3], a4 = a.n[4];
+    uint64 d0 = 2 * a0, d1 = 2 * a1, d2_19 = 38 * a2, a3_19 = 19 * a3, a4_19 = 19 * a4, d4_19 = 2 * a4_19;
+
+    ed_wide r0 = (ed_wide) a0 * a0 + (ed_wide) d4_19 * a1 + (ed_wide) d2_19 * a3;
+    ed_wide r1 = (ed_wide) d0 * a1 + (ed_wide) d4_19 * a2 + (ed_wide) a3 * a3_19;
+    ed_wide r2 = (ed_wide) d0 * a2 + (ed_wide) a1 * a1 + (ed_wide) d4_19 * a3;
+    ed_wide r3 = (ed_wide) d0 * a3 + (ed_wide) d1 * a2 + (ed_wide) a4 * a4_19;
+    ed_wide r4 = (ed_wide) d0 * a4 + (ed_wide) d1 * a3 + (ed_wide) a2 * a2;
+    efReduce(r, r0, r1, r2, r3, r4);
+}
+
+inline void efSqrN(CEdElement& r, const CEdElement& a, int n)
+{
+    efSqr(r, a);
+    while (--n > 0)
+        efSqr(r, r);
+}
+
+// r = a^(p - 2), the addition chain of the reference implementation.
+inline void efInv(CEdElement& r, const CEdElement& a)
+{
+    CEdElement t0, t1, t2, t3;
+    efSqr(t0, a);                   // 2
+    efSqrN(t1, t0, 2);              // 8
+    efMul(t1, a, t1);               // 9
+    efMul(t0, t0, t1);              // 11
+    efSqr(t2, t0);                  // 22
+    efMul(t1, t1, t2);              // 2^5 - 1
+    efSqrN(t2, t1, 5);
+    efMul(t1, t2, t1);              // 2^10 - 1
+    efSqrN(t2, t1, 10);
+    efMul(t2, t2, t1);              // 2^20 - 1
+    efSqrN(t3, t2, 20);
+    efMul(t2, t3, t2);              // 2^40 - 1
+    efSqrN(t2, t2, 10);
+    efMul(t1, t2, t1);              // 2^50 - 1
+    efSqrN(t2, t1, 50);
+    efMul(t2, t2, t1);              // 2^100 - 1
+    efSqrN(t3, t2, 100);
+    efMul(t2, t3, t2);              // 2^200 - 1
+    efSqrN(t2, t2, 50);
+    efMul(t1, t2, t1);              // 2^250 - 1
+    efSqrN(t1, t1, 5);              // 2^255 - 2^5
+    efMul(r, t1, t0);               // 2^255 - 21
+}
+
+// Fully reduced, 32 bytes little-endian.
+inline void efGetBytes(unsigned char* p32, const CEdElement& a)
+{
+    CEdElement t = a;
+    efCarry(t);
+    efCarry(t);
+    // t < 2^255 + small; adding 19 carries out of bit 255 exactly when t >= p
+    t.n[0] += 19;
+    efCarry(t);
+    // t + 19 mod 2^255, plus 2^255 - 19: t mod p, offset by 2^255
+    t.n[0] += (1ull << 51) - 19;
+    for (int i = 1; i < 5; i++)
+        t.n[i] += (1ull << 51) - 1;
+    for (int i = 0; i < 4; i++)
+    {
+        t.n[i + 1] += t.n[i] >> 51;
+        t.n[i] &= ED25519_MASK;
+    }
+    t.n[4] &= ED25519_MASK;
+
+    uint64 w[4];
+    w[0] = t.n[0] | (t.n[1] << 51);
+    w[1] = (t.n[1] >> 13) | (t.n[2] << 38);
+    w[2] = (t.n[2] >> 26) | (t.n[3] << 25);
+    w[3] = (t.n[3] >> 39) | (t.n[4] << 12);
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 8; j++)
+            p32[8 * i + j] = (unsigned char) (w[i] >> (8 * j));
+}
+
+// 32 bytes little-endian, bit 255 ignored.
+inline void efSetBytes(CEdElement& r, const unsigned char* p32)
+{
+    uint64 w[4];
+    for (int i = 0; i < 4; i++)
+    {
+        w[i] = 0;
+        for (int j = 7; j >= 0; j--)
+            w[i] = (w[i] << 8) | p32[8 * i + j];
+    }
+    r.n[0] = w[0] & ED25519_MASK;
+    r.n[1] = ((w[0] >> 51) | (w[1] << 13)) & ED25519_MASK;
+    r.n[2] = ((w[1] >> 38) | (w[2] << 26)) & ED25519_MASK;
+    r.n[3] = ((w[2] >> 25) | (w[3] << 39)) & ED25519_MASK;
+    r.n[4] = (w[3] >> 12) & ED25519_MASK;
+}
+
+// Extended coordinates: x = X/Z, y = Y/Z, xy = T/Z.
+struct CEdPoint
+{
+    CEdElement x, y, z, t;
+};
+
+// An affine point ready for addition: y + x, y - x, 2dxy.
+struct CEdNiels
+{
+    CEdElement yplusx, yminusx, xy2d;
+};
+
+inline void epSetIdentity(CEdPoint& r)
+{
+    efSetInt(r.x, 0);
+    efSetInt(r.y, 1);
+    efSetInt(r.z, 1);
+    efSetInt(r.t, 0);
+}
+
+// r = a where fMask is all ones, r where it is 0.
+inline void efCmov(CEdElement& r, const CEdElement& a, uint64 fMask)
+{
+    for (int i = 0; i < 5; i++)
+        r.n[i] ^= (r.n[i] ^ a.n[i]) & fMask;
+}
+
+// r = a + b.  The formulas are complete: no special cases, the identity
+// included.  r may alias a.
+inline void epAddNiels(CEdPoint& r, const CEdPoint& a, const CEdNiels& b)
+{
+    CEdElement A, B, C, D, E, F, G, H;
+    efSub(A, a.y, a.x);
+    efAdd(B, a.y, a.x);
+    efMul(A, A, b.yminusx);
+    efMul(B, B, b.yplusx);
+    efMul(C, a.t, b.xy2d);
+    efAdd(D, a.z, a.z);
+    efSub(E, B, A);
+    efAdd(H, B, A);
+    efSub(F, D, C);
+    efAdd(G, D, C);
+    efMul(r.x, E, F);
+    efMul(r.y, G, H);
+    efMul(r.t, E, H);
+    efMul(r.z, F, G);
+}
+
+// The encoding of a, given 1/Z: y with the sign of x in bit 255.
+inline void epGetBytes(unsigned char* p32, const CEdPoint& a, const CEdElement& zi)
+{
+    CEdElement x, y;
+    unsigned char px[32];
+    efMul(x, a.x, zi);
+    efMul(y, a.y, zi);
+    efGetBytes(px, x);
+    efGetBytes(p32, y);
+    p32[31] |= (unsigned char) ((px[0] & 1) << 7);
+}
+
+// a*B with signed 4-bit windows: table[w][j - 1] = j * 16^w * B, j 1..8.
+// Wider windows mean fewer additions but more entries to scan per window;
+// 4 bits was the fastest.
+class CEd25519Table
+{
+protected:
+    std::vector<CEdNiels, CArenaAllocator<CEdNiels> > vTable;
+
+    static const int BITS = 4;
+    static const int WINDOWS = 255 / BITS + 1;      // the top digit fits too
+    static const int ENTRIES = 1 << (BITS - 1);
+
+    static void GetNiels(CEdNiels& r, const CEdPoint& a, const CEdElement& d2)
+    {
+        CEdElement zi, x, y;
+        efInv(zi, a.z);
+        efMul(x, a.x, zi);
+        efMul(y, a.y, zi);
+        efAdd(r.yplusx, y, x);
+        efSub(r.yminusx, y, x);
+        efCarry(r.yplusx);
+        efCarry(r.yminusx);
+        efMul(r.xy2d, x, y);
+        efMul(r.xy2d, r.xy2d, d2);
+    }
+
+    static void Build(CEd25519Table* pTable)
+    {
+        // x of the base point, big-endian; y is 4/5 and d is -121665/121666
+        static const unsigned char pBx[32] = {
+            0x21,0x69,0x36,0xd3, 0xcd,0x6e,0x53,0xfe, 0xc0,0xa4,0xe2,0x31, 0xfd,0xd6,0xdc,0x5c,
+            0x69,0x2c,0xc7,0x60, 0x95,0x25,0xa7,0xb2, 0xc9,0x56,0x2d,0x60, 0x8f,0x25,0xd5,0x1a };
+        unsigned char pLE[32];
+        for (int i = 0; i < 32; i++)
+            pLE[i] = pBx[31 - i];
+
+        CEdElement d2, t;
+        efSetInt(t, 121666);
+        efInv(t, t);
+        efSetInt(d2, 121665);
+        efMul(d2, d2, t);
+        efNeg(d2, d2);
+        efAdd(d2, d2, d2);
+
+        CEdPoint base;
+        efSetBytes(base.x, pLE);
+        efSetInt(t, 5);
+        efInv(t, t);
+        efSetInt(base.y, 4);
+        efMul(base.y, base.y, t);
+        efSetInt(base.z, 1);
+        efMul(base.t, base.x, base.y);
+
+        pTable->vTable.resize(WINDOWS * ENTRIES);
+        CEdNiels niels;
+        GetNiels(niels, base, d2);
+        for (int w = 0; w < WINDOWS; w++)
+        {
+            // niels is 2^(BITS w) * B
+            CEdPoint acc;
+            epSetIdentity(acc);
+            for (int j = 0; j < ENTRIES; j++)
+            {
+                epAddNiels(acc, acc, niels);
+                GetNiels(pTable->vTable[ENTRIES * w + j], acc, d2);
+            }
+            epAddNiels(acc, acc, pTable->vTable[ENTRIES * w + ENTRIES - 1]);
+            GetNiels(niels, acc, d2);
+        }
+    }
+
+    static CEd25519Table& Instance()
+    {
+        static CEd25519Table table;
+        return table;
+    }
+
+    static void Init()
+    {
+        Build(&Instance());
+    }
+
+    // Digits of a little-endian scalar below 2^255, each in
+    // [-ENTRIES, ENTRIES].
+    static void GetDigits(signed char* pDigits, const unsigned char* a32)
+    {
+        int nCarry = 0;
+        for (int i = 0; i < WINDOWS; i++)
+        {
+            int nBit = BITS * i;
+            int n = a32[nBit / 8] | (nBit / 8 < 31 ? a32[nBit / 8 + 1] << 8 : 0);
+            int v = ((n >> (nBit % 8)) & ((1 << BITS) - 1)) + nCarry;
+            nCarry = i < WINDOWS - 1 ? (v + ENTRIES) >> BITS : 0;
+            pDigits[i] = (signed char) (v - (nCarry << BITS));
+        }
+    }
+
+    // r = c * 2^(BITS w) * B from window w, without a branch or a table index
+    // that depends on c.
+    void Select(CEdNiels& r, int w, int c) const
+    {
+        uint64 fNeg = 0 - (uint64) ((unsigned int) c >> 31);
+        uint64 nAbs = (uint64) ((c ^ (int) fNeg) - (int) fNeg);
+        efSetInt(r.yplusx, 1);
+        efSetInt(r.yminusx, 1);
+        efSetInt(r.xy2d, 0);
+        const CEdNiels* pWindow = &vTable[ENTRIES * w];
+        for (int j = 0; j < ENTRIES; j++)
+        {
+            uint64 fPick = 0 - (((nAbs ^ (uint64) (j + 1)) - 1) >> 63);
+            efCmov(r.yplusx, pWindow[j].yplusx, fPick);
+            efCmov(r.yminusx, pWindow[j].yminusx, fPick);
+            efCmov(r.xy2d, pWindow[j].xy2d, fPick);
+        }
+
+        // -(x, y) = (-x, y): y + x and y - x swap, 2dxy changes sign
+        CEdElement t = r.yplusx, neg;
+        efCmov(r.yplusx, r.yminusx, fNeg);
+        efCmov(r.yminusx, t, fNeg);
+        efNeg(neg, r.xy2d);
+        efCmov(r.xy2d, neg, fNeg);
+    }
+
+public:
+    static const CEd25519Table& Get()
+    {
+        static boost::once_flag once = BOOST_ONCE_INIT;
+        boost::call_once(&CEd25519Table::Init, once);
+        return Instance();
+    }
+
+    // pPoints[i] = a_i * B for nCount little-endian scalars below 2^255, the
+    // batch a window at a time so each part of the table is read once.
+    void Mul(CEdPoint* pPoints, const unsigned char (*pScalars)[32], unsigned int nCount) const
+    {
+        std::vector<signed char> vDigits(WINDOWS * nCount);
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            GetDigits(&vDigits[WINDOWS * i], pScalars[i]);
+            epSetIdentity(pPoints[i]);
+        }
+        CEdNiels niels;
+        for (int w = 0; w < WINDOWS; w++)
+        {
+            for (unsigned int i = 0; i < nCount; i++)
+            {
+                Select(niels, w, vDigits[WINDOWS * i + w]);
+                epAddNiels(pPoints[i], pPoints[i], niels);
+            }
+        }
+        OPENSSL_cleanse(&vDigits[0], vDigits.size());
+        OPENSSL_cleanse(&niels, sizeof(niels));
+    }
+
+    // The encodings of nCount points, with one inversion for all of them.
+    static void GetBytes(unsigned char (*pEncoded)[32], const CEdPoint* pPoints, unsigned int nCount)
+    {
+        std::vector<CEdElement> vProducts(nCount);
+        CEdElement inv, zi;
+        vProducts[0] = pPoints[0].z;
+        for (unsigned int i = 1; i < nCount; i++)
+            efMul(vProducts[i], vProducts[i - 1], pPoints[i].z);
+        efInv(inv, vProducts[nCount - 1]);
+        for (unsigned int i = nCount - 1; i > 0; i--)
+        {
+            efMul(zi, inv, vProducts[i - 1]);
+            efMul(inv, inv, pPoints[i].z);
+            epGetBytes(pEncoded[i], pPoints[i], zi);
+        }
+        epGetBytes(pEncoded[0], pPoints[0], inv);
+    }
+};
+
+#endif
+
+// The clamped scalar of an Ed25519 secret key, little-endian (RFC 8032 5.1.5).
+inline void GetEd25519Scalar(const unsigned char* pSecret32, unsigned char* a32)
+{
+    unsigned char hash[64];
+    DigestSHA512(pSecret32, 32, hash);
+    memcpy(a32, hash, 32);
+    a32[0] &= 248;
+    a32[31] &= 127;
+    a32[31] |= 64;
+    OPENSSL_cleanse(hash, sizeof(hash));
+}
+
+// The secret key of an "sEd..." seed: the first half of SHA-512 of it.
+inline void GetEd25519Secret(const unsigned char* pSeed16, unsigned char* pSecret32)
+{
+    unsigned char hash[64];
+    DigestSHA512(pSeed16, 16, hash);
+    memcpy(pSecret32, hash, 32);
+    OPENSSL_cleanse(hash, sizeof(hash));
+}
+
+#endif
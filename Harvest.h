@@ -0,0 +1,1049 @@
+#ifndef __HARVEST_H__
+#define __HARVEST_H__
+
+#include "Difficulty.h"
+#include "PatternIndex.h"
+#include "RippleAddress.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#if !defined(WIN32) && !defined(WIN64)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#include <windows.h>
+#endif
+
+// Near-miss harvest (--harvest): every account a search derives that
+// matches a broad filter (a compiled pattern index, say every 4 letter word
+// or the prefixes orders usually ask for) is kept, so later orders can be
+// filled from stock ("ripplegen harvest-query") before any search.
+//
+// Search threads buffer their records and hand them to the process wide
+// sink, which writes them out as segment files: sorted by account id, never
+// changed once renamed into the directory, so any number of searches can add
+// to one directory while queries read it.
+//
+//     header          magic, version, byte order, counts, section offsets,
+//                     segment nonce, key id
+//     blocks          per HARVEST_BLOCK_RECORDS records: first account id,
+//                     record count, offset and sizes of its data
+//     data            per block: the records, account ids front coded
+//                     against the previous one (shared byte count, then the
+//                     rest) and the account index as a varint, then the
+//                     seeds, AES-256-GCM encrypted, and the GCM tag
+//
+// The block table is the prefix index: a query for a pattern binary searches
+// it for the account id ranges of the pattern's intervals and decodes only
+// those blocks.  Hash outputs and ciphertext do not compress, so front
+// coding the sorted ids (which share the prefixes of the filter) is what
+// shrinks a segment.
+//
+// Seeds are encrypted with a 256 bit key from a key file ("ripplegen
+// harvest-key"), the nonce being the segment's random one and the block
+// number; the id and index part of the block is the associated data, so a
+// seed cannot be moved to another account unnoticed.  Account ids and
+// indexes stay readable: stock can be counted without the key.
+
+static const char HARVEST_MAGIC[8] = { 'R', 'G', 'H', 'A', 'R', 'V', '\r', '\n' };
+static const uint32 HARVEST_VERSION = 1;
+static const uint32 HARVEST_BYTE_ORDER = 0x01020304;
+static const uint32 HARVEST_BLOCK_RECORDS = 256;
+static const size_t HARVEST_SEGMENT_RECORDS = 1 << 16;  // records per segment at most
+static const size_t HARVEST_THREAD_RECORDS = 1024;      // buffered per thread
+static const int HARVEST_FLUSH_SECONDS = 60;            // longest a record waits
+static const char* HARVEST_SUFFIX = ".rgh";
+static const char* HARVEST_CLAIMED = "claimed.txt";
+static const char* HARVEST_LOCK = "claimed.lock";
+
+struct CHarvestRecord
+{
+    uint160     accountID;
+    uint128     seed;
+    uint32      nIndex;
+
+    void ClearSeed()
+    {
+        OPENSSL_cleanse(seed.begin(), seed.size());
+    }
+
+    bool operator<(const CHarvestRecord& b) const
+    {
+        int n = memcmp(accountID.begin(), b.accountID.begin(), 20);
+        return n != 0 ? n < 0 : nIndex < b.nIndex;
+    }
+};
+
+struct CHarvestHeader
+{
+    char            pMagic[8];
+    uint32          nVersion;
+    uint32          nByteOrder;
+    uint32          nBlockRecords;
+    uint32          nBlocks;
+    uint64          nRecords;
+    uint64          nOffsetBlocks;
+    uint64          nOffsetData;
+    uint64          nFileSize;
+    unsigned char   pNonce[8];
+    unsigned char   pKeyID[8];      // SHA-256 of the key, first bytes
+};
+
+struct CHarvestBlock
+{
+    unsigned char   pFirst[20];
+    uint32          nRecords;
+    uint64          nOffset;
+    uint32          nRecordsSize;   // id and index part
+    uint32          nSize;          // all of it: records, seeds, tag
+};
+
+// The seed encryption key: 64 hex digits in a file of its own.
+class CHarvestKey
+{
+protected:
+    unsigned char   pKey[32];
+    unsigned char   pID[8];
+
+    CHarvestKey(const CHarvestKey&); // no implementation
+    CHarvestKey& operator=(const CHarvestKey&); // no implementation
+
+    static void GetNonce(const unsigned char* pNonce8, uint32 nBlock, unsigned char* p12)
+    {
+        memcpy(p12, pNonce8, 8);
+        p12[8] = (unsigned char) (nBlock >> 24);
+        p12[9] = (unsigned char) ((nBlock >> 16) & 0xff);
+        p12[10] = (unsigned char) ((nBlock >> 8) & 0xff);
+        p12[11] = (unsigned char) (nBlock & 0xff);
+    }
+
+public:
+    CHarvestKey()
+    {
+        memset(pKey, 0, sizeof(pKey));
+        memset(pID, 0, sizeof(pID));
+    }
+
+    ~CHarvestKey()
+    {
+        OPENSSL_cleanse(pKey, sizeof(pKey));
+    }
+
+    // A new random key to strPath, readable by its owner only; an existing
+    // file is never overwritten.
+    static bool Create(const std::string& strPath, std::string& msg)
+    {
+        unsigned char pNew[32];
+        if (RAND_bytes(pNew, sizeof(pNew)) != 1)
+        {
+            msg = "Entropy pool not seeded";
+            return false;
+        }
+        std::string strHex = uchar_vector(pNew, sizeof(pNew)).getHex() + "\n";
+        OPENSSL_cleanse(pNew, sizeof(pNew));
+#if !defined(WIN32) && !defined(WIN64)
+        int fd = open(strPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+        bool fExists = fd < 0 && errno == EEXIST;
+        bool fWritten = false;
+        if (fd >= 0)
+        {
+            fWritten = write(fd, strHex.data(), strHex.size()) == (ssize_t) strHex.size();
+            fWritten = close(fd) == 0 && fWritten;
+            if (!fWritten)
+                unlink(strPath.c_str());
+        }
+#else
+        FILE* file = fopen(strPath.c_str(), "r");
+        bool fExists = file != NULL;
+        bool fWritten = false;
+        if (file)
+            fclose(file);
+        else if ((file = fopen(strPath.c_str(), "w")) != NULL)
+        {
+            fWritten = fwrite(strHex.data(), 1, strHex.size(), file) == strHex.size();
+            fWritten = fclose(file) == 0 && fWritten;
+        }
+#endif
+        OPENSSL_cleanse(&strHex[0], strHex.size());
+        if (!fWritten)
+        {
+            msg = "Cannot create " + strPath + (fExists ? ", it exists already" : "");
+            return false;
+        }
+        return true;
+    }
+
+    bool Load(const std::string& strPath, std::string& msg)
+    {
+        std::ifstream in(strPath.c_str());
+        std::string strHex;
+        if (!(in >> strHex) || strHex.size() != 64 || strHex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        {
+            msg = strPath + " is not a harvest key, make one with \"ripplegen harvest-key\"";
+            return false;
+        }
+        for (int i = 0; i < 32; i++)
+            pKey[i] = (unsigned char) strtoul(strHex.substr(2 * i, 2).c_str(), NULL, 16);
+        OPENSSL_cleanse(&strHex[0], strHex.size());
+        unsigned char hash[32];
+        DigestSHA256(pKey, sizeof(pKey), hash);
+        memcpy(pID, hash, sizeof(pID));
+        return true;
+    }
+
+    const unsigned char* GetID() const
+    {
+        return pID;
+    }
+
+    // nSize bytes of pPlain to pCipher and a 16 byte tag, with pAAD as
+    // associated data.
+    bool Seal(const unsigned char* pNonce8, uint32 nBlock, const unsigned char* pAAD, size_t nAAD,
+              const unsigned char* pPlain, size_t nSize, unsigned char* pCipher, unsigned char* pTag) const
+    {
+        unsigned char pNonce[12];
+        GetNonce(pNonce8, nBlock, pNonce);
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        int nLen = 0;
+        bool fOk = ctx
+            && EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL)
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, sizeof(pNonce), NULL)
+            && EVP_EncryptInit_ex(ctx, NULL, NULL, pKey, pNonce)
+            && EVP_EncryptUpdate(ctx, NULL, &nLen, pAAD, (int) nAAD)
+            && EVP_EncryptUpdate(ctx, pCipher, &nLen, pPlain, (int) nSize)
+            && EVP_EncryptFinal_ex(ctx, pCipher + nLen, &nLen)
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, pTag);
+        if (ctx)
+            EVP_CIPHER_CTX_free(ctx);
+        return fOk;
+    }
+
+    // False if the tag does not check out: another key, or a damaged file.
+    bool Open(const unsigned char* pNonce8, uint32 nBlock, const unsigned char* pAAD, size_t nAAD,
+              const unsigned char* pCipher, size_t nSize, const unsigned char* pTag, unsigned char* pPlain) const
+    {
+        unsigned char pNonce[12];
+        GetNonce(pNonce8, nBlock, pNonce);
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        int nLen = 0;
+        bool fOk = ctx
+            && EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL)
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, sizeof(pNonce), NULL)
+            && EVP_DecryptInit_ex(ctx, NULL, NULL, pKey, pNonce)
+            && EVP_DecryptUpdate(ctx, NULL, &nLen, pAAD, (int) nAAD)
+            && EVP_DecryptUpdate(ctx, pPlain, &nLen, pCipher, (int) nSize)
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, (void*) pTag)
+            && EVP_DecryptFinal_ex(ctx, pPlain + nLen, &nLen) > 0;
+        if (ctx)
+            EVP_CIPHER_CTX_free(ctx);
+        if (!fOk)
+            OPENSSL_cleanse(pPlain, nSize);
+        return fOk;
+    }
+};
+
+// One segment file, mapped read only.
+class CHarvestSegment
+{
+protected:
+    std::string                 strPath;
+    const char*                 pData;
+    size_t                      nSize;
+    std::vector<char>           vData;      // no mmap
+    const CHarvestHeader*       pHeader;
+    const CHarvestBlock*        pBlocks;
+
+    CHarvestSegment(const CHarvestSegment&);
+    CHarvestSegment& operator=(const CHarvestSegment&);
+
+    bool Fail(std::string& msg, const char* pszWhy)
+    {
+        msg = strPath + ": " + pszWhy;
+        return false;
+    }
+
+    static void PutVarint(std::string& str, uint32 n)
+    {
+        while (n >= 0x80)
+        {
+            str += (char) ((n & 0x7f) | 0x80);
+            n >>= 7;
+        }
+        str += (char) n;
+    }
+
+    static bool GetVarint(const unsigned char*& p, const unsigned char* pEnd, uint32& n)
+    {
+        n = 0;
+        for (int nShift = 0; p < pEnd && nShift < 35; nShift += 7)
+        {
+            n |= (uint32) (*p & 0x7f) << nShift;
+            if (!(*p++ & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    // The records of block b, seeds decrypted if pKey is given (else zero).
+    bool DecodeBlock(uint32 b, const CHarvestKey* pKey, std::vector<CHarvestRecord>& vRecords, std::string& msg)
+    {
+        const CHarvestBlock& block = pBlocks[b];
+        const unsigned char* pStart = (const unsigned char*) pData + pHeader->nOffsetData + block.nOffset;
+        const unsigned char* p = pStart;
+        const unsigned char* pEnd = pStart + block.nRecordsSize;
+        vRecords.resize(block.nRecords);
+        unsigned char pPrevious[20] = { 0 };
+        for (uint32 i = 0; i < block.nRecords; i++)
+        {
+            unsigned int nShared = p < pEnd ? *p++ : 21;
+            if (nShared > 20 || pEnd - p < (ptrdiff_t) (20 - nShared))
+                return Fail(msg, "corrupt harvest block");
+            memcpy(pPrevious + nShared, p, 20 - nShared);
+            p += 20 - nShared;
+            memcpy(vRecords[i].accountID.begin(), pPrevious, 20);
+            if (!GetVarint(p, pEnd, vRecords[i].nIndex))
+                return Fail(msg, "corrupt harvest block");
+            vRecords[i].ClearSeed();
+        }
+        if (!pKey)
+            return true;
+
+        const unsigned char* pCipher = pEnd;
+        std::vector<unsigned char> vPlain(16 * block.nRecords);
+        if (!pKey->Open(pHeader->pNonce, b, pStart, block.nRecordsSize,
+                        pCipher, vPlain.size(), pCipher + vPlain.size(), &vPlain[0]))
+            return Fail(msg, "seeds do not decrypt, the file is damaged");
+        for (uint32 i = 0; i < block.nRecords; i++)
+            memcpy(vRecords[i].seed.begin(), &vPlain[16 * i], 16);
+        OPENSSL_cleanse(&vPlain[0], vPlain.size());
+        return true;
+    }
+
+public:
+    CHarvestSegment() : pData(NULL), nSize(0), pHeader(NULL), pBlocks(NULL)
+    {
+    }
+
+    ~CHarvestSegment()
+    {
+#if !defined(WIN32) && !defined(WIN64)
+        if (pData && vData.empty())
+            munmap((void*) pData, nSize);
+#endif
+    }
+
+    // vRecords (sorted here) to a segment image in vBuffer.
+    static bool Build(std::vector<CHarvestRecord>& vRecords, const CHarvestKey& key,
+                      std::vector<char>& vBuffer, std::string& msg)
+    {
+        std::sort(vRecords.begin(), vRecords.end());
+
+        CHarvestHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.pMagic, HARVEST_MAGIC, sizeof(header.pMagic));
+        header.nVersion = HARVEST_VERSION;
+        header.nByteOrder = HARVEST_BYTE_ORDER;
+        header.nBlockRecords = HARVEST_BLOCK_RECORDS;
+        header.nBlocks = (uint32) ((vRecords.size() + HARVEST_BLOCK_RECORDS - 1) / HARVEST_BLOCK_RECORDS);
+        header.nRecords = vRecords.size();
+        memcpy(header.pKeyID, key.GetID(), sizeof(header.pKeyID));
+        if (RAND_bytes(header.pNonce, sizeof(header.pNonce)) != 1)
+        {
+            msg = "Entropy pool not seeded";
+            return false;
+        }
+
+        std::vector<CHarvestBlock> vBlocks(header.nBlocks);
+        std::string strData;
+        std::vector<unsigned char> vPlain, vCipher;
+        for (uint32 b = 0; b < header.nBlocks; b++)
+        {
+            size_t nFirst = (size_t) b * HARVEST_BLOCK_RECORDS;
+            size_t nEnd = std::min(vRecords.size(), nFirst + HARVEST_BLOCK_RECORDS);
+            CHarvestBlock& block = vBlocks[b];
+            memcpy(block.pFirst, vRecords[nFirst].accountID.begin(), 20);
+            block.nRecords = (uint32) (nEnd - nFirst);
+            block.nOffset = strData.size();
+
+            std::string strRecords;
+            vPlain.resize(16 * block.nRecords);
+            for (size_t i = nFirst; i < nEnd; i++)
+            {
+                const unsigned char* pID = vRecords[i].accountID.begin();
+                unsigned int nShared = 0;
+                if (i > nFirst)
+                    while (nShared < 20 && pID[nShared] == vRecords[i - 1].accountID.begin()[nShared])
+                        nShared++;
+                strRecords += (char) nShared;
+                strRecords.append((const char*) pID + nShared, 20 - nShared);
+                PutVarint(strRecords, vRecords[i].nIndex);
+                memcpy(&vPlain[16 * (i - nFirst)], vRecords[i].seed.begin(), 16);
+            }
+            vCipher.resize(vPlain.size() + 16);
+            bool fSealed = key.Seal(header.pNonce, b, (const unsigned char*) strRecords.data(), strRecords.size(),
+                                    &vPlain[0], vPlain.size(), &vCipher[0], &vCipher[vPlain.size()]);
+            OPENSSL_cleanse(&vPlain[0], vPlain.size());
+            if (!fSealed)
+            {
+                msg = "Cannot encrypt the harvested seeds";
+                return false;
+            }
+            block.nRecordsSize = (uint32) strRecords.size();
+            block.nSize = (uint32) (strRecords.size() + vCipher.size());
+            strData += strRecords;
+            strData.append((const char*) &vCipher[0], vCipher.size());
+        }
+
+        header.nOffsetBlocks = sizeof(header);
+        header.nOffsetData = header.nOffsetBlocks + vBlocks.size() * sizeof(CHarvestBlock);
+        header.nFileSize = header.nOffsetData + strData.size();
+
+        vBuffer.clear();
+        vBuffer.reserve(header.nFileSize);
+        vBuffer.insert(vBuffer.end(), (const char*) &header, (const char*) &header + sizeof(header));
+        if (!vBlocks.empty())
+            vBuffer.insert(vBuffer.end(), (const char*) &vBlocks[0], (const char*) &vBlocks[0] + vBlocks.size() * sizeof(CHarvestBlock));
+        vBuffer.insert(vBuffer.end(), strData.begin(), strData.end());
+        return true;
+    }
+
+    bool Open(const std::string& strPathIn, std::string& msg)
+    {
+        strPath = strPathIn;
+#if !defined(WIN32) && !defined(WIN64)
+        int fd = open(strPath.c_str(), O_RDONLY);
+        if (fd < 0)
+            return Fail(msg, strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CHarvestHeader))
+        {
+            close(fd);
+            return Fail(msg, "not a harvest segment");
+        }
+        nSize = st.st_size;
+        void* p = mmap(NULL, nSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return Fail(msg, strerror(errno));
+        pData = (const char*) p;
+#else
+        std::ifstream in(strPath.c_str(), std::ios::binary);
+        vData.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (vData.size() < sizeof(CHarvestHeader))
+            return Fail(msg, "not a harvest segment");
+        pData = &vData[0];
+        nSize = vData.size();
+#endif
+        pHeader = (const CHarvestHeader*) pData;
+        if (memcmp(pHeader->pMagic, HARVEST_MAGIC, sizeof(pHeader->pMagic)) != 0)
+            return Fail(msg, "not a harvest segment");
+        if (pHeader->nVersion != HARVEST_VERSION || pHeader->nByteOrder != HARVEST_BYTE_ORDER)
+            return Fail(msg, "harvest segment of another version or architecture");
+        if (pHeader->nFileSize != nSize
+            || pHeader->nOffsetBlocks != sizeof(CHarvestHeader)
+            || pHeader->nOffsetBlocks + (uint64) pHeader->nBlocks * sizeof(CHarvestBlock) != pHeader->nOffsetData
+            || pHeader->nOffsetData > nSize)
+            return Fail(msg, "truncated or corrupt harvest segment");
+        pBlocks = (const CHarvestBlock*) (pData + pHeader->nOffsetBlocks);
+        uint64 nDataSize = nSize - pHeader->nOffsetData;
+        uint64 nRecords = 0;
+        for (uint32 b = 0; b < pHeader->nBlocks; b++)
+        {
+            nRecords += pBlocks[b].nRecords;
+            // nOffset comes from the file: no sum with it, it could wrap
+            if (pBlocks[b].nRecordsSize > pBlocks[b].nSize
+                || pBlocks[b].nSize != pBlocks[b].nRecordsSize + 16 * (uint64) pBlocks[b].nRecords + 16
+                || pBlocks[b].nOffset > nDataSize
+                || pBlocks[b].nSize > nDataSize - pBlocks[b].nOffset)
+                return Fail(msg, "truncated or corrupt harvest segment");
+        }
+        if (nRecords != pHeader->nRecords)
+            return Fail(msg, "truncated or corrupt harvest segment");
+        return true;
+    }
+
+    const std::string& GetPath() const
+    {
+        return strPath;
+    }
+
+    uint64 Size() const
+    {
+        return pHeader->nRecords;
+    }
+
+    bool IsKey(const CHarvestKey& key) const
+    {
+        return memcmp(pHeader->pKeyID, key.GetID(), sizeof(pHeader->pKeyID)) == 0;
+    }
+
+    // Append the records whose account id is in [pLow, pHigh] (20 bytes,
+    // inclusive) to vFound.
+    bool Find(const unsigned char* pLow, const unsigned char* pHigh, const CHarvestKey* pKey,
+              std::vector<CHarvestRecord>& vFound, std::string& msg)
+    {
+        // the last block starting at or before pLow may hold it
+        uint32 nBegin = 0, nEnd = pHeader->nBlocks;
+        while (nBegin < nEnd)
+        {
+            uint32 nMid = nBegin + (nEnd - nBegin) / 2;
+            if (memcmp(pBlocks[nMid].pFirst, pLow, 20) <= 0)
+                nBegin = nMid + 1;
+            else
+                nEnd = nMid;
+        }
+        std::vector<CHarvestRecord> vRecords;
+        for (uint32 b = nBegin == 0 ? 0 : nBegin - 1; b < pHeader->nBlocks && memcmp(pBlocks[b].pFirst, pHigh, 20) <= 0; b++)
+        {
+            if (!DecodeBlock(b, NULL, vRecords, msg))
+                return false;
+            bool fAny = false;
+            for (size_t i = 0; i < vRecords.size() && !fAny; i++)
+                fAny = memcmp(vRecords[i].accountID.begin(), pLow, 20) >= 0 && memcmp(vRecords[i].accountID.begin(), pHigh, 20) <= 0;
+            if (!fAny)
+                continue;
+            // the seeds only for blocks with something to give
+            if (pKey && !DecodeBlock(b, pKey, vRecords, msg))
+                return false;
+            for (size_t i = 0; i < vRecords.size(); i++)
+                if (memcmp(vRecords[i].accountID.begin(), pLow, 20) >= 0 && memcmp(vRecords[i].accountID.begin(), pHigh, 20) <= 0)
+                    vFound.push_back(vRecords[i]);
+            for (size_t i = 0; i < vRecords.size(); i++)
+                vRecords[i].ClearSeed();
+        }
+        return true;
+    }
+};
+
+inline std::string getHarvestPath(const std::string& strDir, const std::string& strName)
+{
+    return strDir.empty() || strDir[strDir.size() - 1] == '/' ? strDir + strName : strDir + "/" + strName;
+}
+
+#if !defined(WIN32) && !defined(WIN64)
+// All n bytes at p to fd, then to the disk.
+inline bool writeHarvestSynced(int fd, const char* p, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t nWritten = write(fd, p, n);
+        if (nWritten < 0 && errno == EINTR)
+            continue;
+        if (nWritten <= 0)
+            return false;
+        p += nWritten;
+        n -= nWritten;
+    }
+    return fsync(fd) == 0;
+}
+
+// The entries of strDir (files created or renamed into it) to the disk.
+inline bool syncHarvestDir(const std::string& strDir)
+{
+    int fd = open(strDir.empty() ? "." : strDir.c_str(), O_RDONLY);
+    bool fSynced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+    return fSynced;
+}
+#else
+// All n bytes at p to file, then to the disk.
+inline bool writeHarvestSynced(FILE* file, const char* p, size_t n)
+{
+    return fwrite(p, 1, n, file) == n && fflush(file) == 0 && _commit(_fileno(file)) == 0;
+}
+#endif
+
+// Every segment of a harvest directory, and the accounts already handed out
+// (HARVEST_CLAIMED, one account id per line, appended to).  Queries that
+// claim hold an exclusive lock on HARVEST_LOCK from before they read the
+// claims until they exit, so two of them never hand out the same account.
+class CHarvestStock
+{
+protected:
+    std::string                                     strDir;
+    std::vector<boost::shared_ptr<CHarvestSegment> > vSegments;
+    std::set<std::string>                           setClaimed;
+#if !defined(WIN32) && !defined(WIN64)
+    int                                             fdLock;
+#else
+    HANDLE                                          hLock;
+#endif
+
+    CHarvestStock(const CHarvestStock&); // no implementation
+    CHarvestStock& operator=(const CHarvestStock&); // no implementation
+
+    void ReadClaimed()
+    {
+        setClaimed.clear();
+        std::ifstream in(getHarvestPath(strDir, HARVEST_CLAIMED).c_str());
+        std::string strAccount;
+        while (in >> strAccount)
+            setClaimed.insert(strAccount);
+    }
+
+public:
+#if !defined(WIN32) && !defined(WIN64)
+    CHarvestStock() : fdLock(-1)
+    {
+    }
+
+    ~CHarvestStock()
+    {
+        if (fdLock >= 0)
+            close(fdLock);
+    }
+#else
+    CHarvestStock() : hLock(INVALID_HANDLE_VALUE)
+    {
+    }
+
+    ~CHarvestStock()
+    {
+        if (hLock != INVALID_HANDLE_VALUE)
+            CloseHandle(hLock);
+    }
+#endif
+
+    bool Open(const std::string& strDirIn, std::string& msg)
+    {
+        strDir = strDirIn;
+        std::vector<std::string> vNames;
+#if !defined(WIN32) && !defined(WIN64)
+        DIR* pDir = opendir(strDir.c_str());
+        if (!pDir)
+        {
+            msg = strDir + ": " + strerror(errno);
+            return false;
+        }
+        while (struct dirent* pEntry = readdir(pDir))
+            vNames.push_back(pEntry->d_name);
+        closedir(pDir);
+#else
+        WIN32_FIND_DATAA data;
+        HANDLE hFind = FindFirstFileA(getHarvestPath(strDir, "*").c_str(), &data);
+        if (hFind == INVALID_HANDLE_VALUE)
+        {
+            msg = "Cannot read " + strDir;
+            return false;
+        }
+        do
+            vNames.push_back(data.cFileName);
+        while (FindNextFileA(hFind, &data));
+        FindClose(hFind);
+#endif
+        std::sort(vNames.begin(), vNames.end());
+        size_t nSuffix = strlen(HARVEST_SUFFIX);
+        for (size_t i = 0; i < vNames.size(); i++)
+        {
+            if (vNames[i].size() <= nSuffix || vNames[i].compare(vNames[i].size() - nSuffix, nSuffix, HARVEST_SUFFIX) != 0)
+                continue;
+            boost::shared_ptr<CHarvestSegment> pSegment(new CHarvestSegment());
+            if (!pSegment->Open(getHarvestPath(strDir, vNames[i]), msg))
+                return false;
+            vSegments.push_back(pSegment);
+        }
+        ReadClaimed();
+        return true;
+    }
+
+    // Before Find and Claim: wait for other claiming queries to finish, then
+    // read the claims again.  Held until the stock is destroyed.
+    bool Lock(std::string& msg)
+    {
+        std::string strPath = getHarvestPath(strDir, HARVEST_LOCK);
+#if !defined(WIN32) && !defined(WIN64)
+        if (fdLock < 0)
+        {
+            fdLock = open(strPath.c_str(), O_RDWR | O_CREAT, 0600);
+            if (fdLock < 0 || flock(fdLock, LOCK_EX) != 0)
+            {
+                msg = "Cannot lock " + strPath + ": " + strerror(errno);
+                return false;
+            }
+        }
+#else
+        if (hLock == INVALID_HANDLE_VALUE)
+        {
+            OVERLAPPED overlapped;
+            memset(&overlapped, 0, sizeof(overlapped));
+            hLock = CreateFileA(strPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (hLock == INVALID_HANDLE_VALUE || !LockFileEx(hLock, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped))
+            {
+                msg = "Cannot lock " + strPath;
+                return false;
+            }
+        }
+#endif
+        ReadClaimed();
+        return true;
+    }
+
+    size_t Segments() const
+    {
+        return vSegments.size();
+    }
+
+    uint64 Size() const
+    {
+        uint64 n = 0;
+        for (size_t i = 0; i < vSegments.size(); i++)
+            n += vSegments[i]->Size();
+        return n;
+    }
+
+    size_t Claimed() const
+    {
+        return setClaimed.size();
+    }
+
+    // False if a segment was written with another key.
+    bool CheckKey(const CHarvestKey& key, std::string& msg) const
+    {
+        for (size_t i = 0; i < vSegments.size(); i++)
+            if (!vSegments[i]->IsKey(key))
+            {
+                msg = vSegments[i]->GetPath() + " was written with another harvest key";
+                return false;
+            }
+        return true;
+    }
+
+    // Up to nMax unclaimed accounts starting with pattern (all if nMax is
+    // 0), with their seeds if pKey is given; nTotal counts every one in
+    // stock.
+    bool Find(const std::string& pattern, size_t nMax, const CHarvestKey* pKey,
+              std::vector<CHarvestRecord>& vFound, uint64& nTotal, std::string& msg)
+    {
+        std::vector<CValueInterval> vIntervals;
+        if (!getAccountIntervals(pattern, vIntervals) || vIntervals.empty()
+            || pattern.find_first_not_of(ALPHABET) != std::string::npos)
+        {
+            msg = "No account id starts with \"" + pattern + "\"";
+            return false;
+        }
+        nTotal = 0;
+        std::vector<CHarvestRecord> vCandidates;
+        for (size_t i = 0; i < vIntervals.size(); i++)
+        {
+            unsigned char pFirst[24], pLast[24];
+            putValueBytes(pFirst, vIntervals[i].first);
+            putValueBytes(pLast, vIntervals[i].second - 1);
+            for (size_t j = 0; j < vSegments.size(); j++)
+                if (!vSegments[j]->Find(pFirst, pLast, pKey, vCandidates, msg))
+                    return false;
+        }
+
+        // the interval edges are V values, checksum included: the text
+        // decides there
+        RippleAddress naAccount;
+        for (size_t i = 0; i < vCandidates.size(); i++)
+        {
+            naAccount.setAccountID(vCandidates[i].accountID);
+            std::string strAccount = naAccount.humanAccountID();
+            if (strAccount.compare(0, pattern.size(), pattern) != 0 || setClaimed.count(strAccount))
+                continue;
+            nTotal++;
+            if (nMax == 0 || vFound.size() < nMax)
+                vFound.push_back(vCandidates[i]);
+        }
+        for (size_t i = 0; i < vCandidates.size(); i++)
+            vCandidates[i].ClearSeed();
+        return true;
+    }
+
+    // Mark accounts handed out, so no later query gives them again.  Under
+    // Lock; the claims are on disk (fsync'd) when this returns true, and
+    // their seeds must not be shown before.
+    bool Claim(const std::vector<CHarvestRecord>& vRecords, std::string& msg)
+    {
+        std::string strPath = getHarvestPath(strDir, HARVEST_CLAIMED);
+        std::vector<std::string> vAccounts;
+        std::string strLines;
+        RippleAddress naAccount;
+        for (size_t i = 0; i < vRecords.size(); i++)
+        {
+            naAccount.setAccountID(vRecords[i].accountID);
+            vAccounts.push_back(naAccount.humanAccountID());
+            strLines += vAccounts.back() + "\n";
+        }
+#if !defined(WIN32) && !defined(WIN64)
+        struct stat st;
+        bool fNew = stat(strPath.c_str(), &st) != 0;
+        int fd = open(strPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+        bool fWritten = fd >= 0 && writeHarvestSynced(fd, strLines.data(), strLines.size());
+        if (fd >= 0)
+            fWritten = close(fd) == 0 && fWritten;
+        // the new file's directory entry too
+        fWritten = fWritten && (!fNew || syncHarvestDir(strDir));
+#else
+        FILE* file = fopen(strPath.c_str(), "ab");
+        bool fWritten = file != NULL && writeHarvestSynced(file, strLines.data(), strLines.size());
+        if (file)
+            fWritten = fclose(file) == 0 && fWritten;
+#endif
+        if (!fWritten)
+        {
+            msg = "Cannot write " + strPath;
+            return false;
+        }
+        setClaimed.insert(vAccounts.begin(), vAccounts.end());
+        return true;
+    }
+};
+
+// The process wide sink of the search threads.
+class CHarvest
+{
+protected:
+    bool                                    fEnabled;
+    std::string                             strDir;
+    boost::shared_ptr<const CPatternIndex>  pFilter;
+    CHarvestKey                             key;
+    boost::function<void(const std::string&)> log;
+
+    boost::mutex                            lock;
+    std::vector<CHarvestRecord>             vRecords;
+    time_t                                  nLastWrite;
+    boost::mutex                            lockWrite;
+    uint64                                  nHarvested;
+    uint64                                  nSegments;
+    uint64                                  nBytes;
+
+    CHarvest() : fEnabled(false), nLastWrite(0), nHarvested(0), nSegments(0), nBytes(0)
+    {
+    }
+
+    // Records to a new segment, written next to its final name, synced and
+    // renamed into place, then the directory synced: on disk before they
+    // count as harvested.  Kept for the next try if that fails.
+    void Write(std::vector<CHarvestRecord>& vWrite)
+    {
+        boost::unique_lock<boost::mutex> guardWrite(lockWrite);
+        std::vector<char> vBuffer;
+        std::string msg;
+        char pszName[96];
+        time_t nNow = time(NULL);
+        struct tm tmNow = *gmtime(&nNow);
+#if !defined(WIN32) && !defined(WIN64)
+        int nPid = getpid();
+#else
+        int nPid = _getpid();
+#endif
+        sprintf(pszName, "harvest-%04d%02d%02d-%02d%02d%02d-%d-%llu%s", tmNow.tm_year + 1900, tmNow.tm_mon + 1,
+                tmNow.tm_mday, tmNow.tm_hour, tmNow.tm_min, tmNow.tm_sec, nPid, (unsigned long long) nSegments, HARVEST_SUFFIX);
+        std::string strPath = getHarvestPath(strDir, pszName);
+        std::string strTemp = getHarvestPath(strDir, std::string(".") + pszName + ".tmp");
+
+        bool fWritten = CHarvestSegment::Build(vWrite, key, vBuffer, msg);
+        if (fWritten)
+        {
+#if !defined(WIN32) && !defined(WIN64)
+            int fd = open(strTemp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            fWritten = fd >= 0 && writeHarvestSynced(fd, &vBuffer[0], vBuffer.size());
+            if (fd >= 0)
+                fWritten = close(fd) == 0 && fWritten;
+            fWritten = fWritten && rename(strTemp.c_str(), strPath.c_str()) == 0 && syncHarvestDir(strDir);
+#else
+            FILE* file = fopen(strTemp.c_str(), "wb");
+            fWritten = file != NULL && writeHarvestSynced(file, &vBuffer[0], vBuffer.size());
+            if (file)
+                fWritten = fclose(file) == 0 && fWritten;
+            fWritten = fWritten && rename(strTemp.c_str(), strPath.c_str()) == 0;
+#endif
+            if (!fWritten)
+            {
+                remove(strTemp.c_str());
+                remove(strPath.c_str());
+                msg = "Cannot write " + strPath;
+            }
+        }
+        if (!fWritten)
+        {
+            if (log)
+                log("Harvest: " + msg + ", keeping " + lexical_cast_i(vWrite.size()) + " accounts for the next try.");
+            boost::unique_lock<boost::mutex> guard(lock);
+            vRecords.insert(vRecords.end(), vWrite.begin(), vWrite.end());
+        }
+        else
+        {
+            nSegments++;
+            nBytes += vBuffer.size();
+        }
+        for (size_t i = 0; i < vWrite.size(); i++)
+            vWrite[i].ClearSeed();
+        vWrite.clear();
+    }
+
+public:
+    static CHarvest& Instance()
+    {
+        static CHarvest harvest;
+        return harvest;
+    }
+
+    // strFilter: a compiled pattern index ("ripplegen compile-patterns").
+    bool Open(const std::string& strDirIn, const std::string& strFilter, const std::string& strKey,
+              boost::function<void(const std::string&)> logIn, std::string& msg)
+    {
+        if (strFilter.empty() || strKey.empty())
+        {
+            msg = "--harvest needs --harvest-filter=<compiled patterns> and --harvest-key=<key file>";
+            return false;
+        }
+        pFilter = CPatternIndex::OpenShared(strFilter, msg);
+        if (!pFilter || !key.Load(strKey, msg))
+            return false;
+#if !defined(WIN32) && !defined(WIN64)
+        if (mkdir(strDirIn.c_str(), 0700) != 0 && errno != EEXIST)
+#else
+        if (_mkdir(strDirIn.c_str()) != 0 && errno != EEXIST)
+#endif
+        {
+            msg = "Cannot create " + strDirIn + ": " + strerror(errno);
+            return false;
+        }
+        CHarvestStock stock;
+        if (!stock.Open(strDirIn, msg) || !stock.CheckKey(key, msg))
+            return false;
+        strDir = strDirIn;
+        log = logIn;
+        nLastWrite = time(NULL);
+        fEnabled = true;
+        return true;
+    }
+
+    bool IsEnabled() const
+    {
+        return fEnabled;
+    }
+
+    const CPatternIndex& GetFilter() const
+    {
+        return *pFilter;
+    }
+
+    // A thread's records; a segment is written once enough are in or the
+    // oldest has waited HARVEST_FLUSH_SECONDS.
+    void Put(std::vector<CHarvestRecord>& vThread)
+    {
+        std::vector<CHarvestRecord> vWrite;
+        {
+            boost::unique_lock<boost::mutex> guard(lock);
+            vRecords.insert(vRecords.end(), vThread.begin(), vThread.end());
+            nHarvested += vThread.size();
+            if (vRecords.size() >= HARVEST_SEGMENT_RECORDS || time(NULL) >= nLastWrite + HARVEST_FLUSH_SECONDS)
+            {
+                vWrite.swap(vRecords);
+                nLastWrite = time(NULL);
+            }
+        }
+        for (size_t i = 0; i < vThread.size(); i++)
+            vThread[i].ClearSeed();
+        vThread.clear();
+        if (!vWrite.empty())
+            Write(vWrite);
+    }
+
+    // The rest, at the end of the search.
+    void Flush()
+    {
+        std::vector<CHarvestRecord> vWrite;
+        {
+            boost::unique_lock<boost::mutex> guard(lock);
+            vWrite.swap(vRecords);
+        }
+        if (!vWrite.empty())
+            Write(vWrite);
+    }
+
+    std::string ToString() const
+    {
+        return strDir + ", " + lexical_cast_i(pFilter->Size()) + " filter patterns, 1 in "
+               + lexical_cast_i((uint64) (1 / std::max(pFilter->GetProbability(), 1e-300))) + " accounts kept";
+    }
+
+    std::string GetStats() const
+    {
+        return lexical_cast_i(nHarvested) + " accounts harvested to " + lexical_cast_i(nSegments)
+               + (nSegments == 1 ? " segment (" : " segments (")
+               + lexical_cast_i(nBytes) + " bytes) in " + strDir;
+    }
+};
+
+// One per search thread: candidates through the filter into a buffer, handed
+// to the sink when full or old.  Nothing but a flag test without --harvest.
+class CHarvester
+{
+protected:
+    CHarvest&                       harvest;
+    bool                            fEnabled;
+    std::vector<CHarvestRecord>     vBuffer;
+    time_t                          nFirst;     // oldest record buffered
+
+    CHarvester(const CHarvester&);
+    CHarvester& operator=(const CHarvester&);
+
+public:
+    CHarvester() : harvest(CHarvest::Instance()), nFirst(0)
+    {
+        fEnabled = harvest.IsEnabled();
+    }
+
+    ~CHarvester()
+    {
+        if (!vBuffer.empty())
+            harvest.Put(vBuffer);
+    }
+
+    bool IsEnabled() const
+    {
+        return fEnabled;
+    }
+
+    void Add(const uint128& seed, int nIndex, const uint160& accountID)
+    {
+        if (!harvest.GetFilter().Match(accountID))
+            return;
+        if (vBuffer.empty())
+            nFirst = time(NULL);
+        CHarvestRecord record;
+        record.accountID = accountID;
+        record.seed = seed;
+        record.nIndex = (uint32) nIndex;
+        vBuffer.push_back(record);
+    }
+
+    // After each batch.
+    void Tick()
+    {
+        if (!vBuffer.empty() && (vBuffer.size() >= HARVEST_THREAD_RECORDS || time(NULL) >= nFirst + HARVEST_FLUSH_SECONDS))
+            harvest.Put(vBuffer);
+    }
+};
+
+#endif
@@ -0,0 +1,440 @@
+#ifndef __KEYSPACE_H__
+#define __KEYSPACE_H__
+
+#include "uint256.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <boost/thread/tss.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Per-thread AES-128 ECB contexts for the keyspace permutation, rekeyed
+// when a thread moves to another keyspace.
+class CKeyspaceCipher
+{
+protected:
+    EVP_CIPHER_CTX* ctx;
+    uint128         key;
+    bool            fKeyed;
+
+    CKeyspaceCipher(const CKeyspaceCipher&); // no implementation
+    CKeyspaceCipher& operator=(const CKeyspaceCipher&); // no implementation
+
+public:
+    CKeyspaceCipher() : fKeyed(false)
+    {
+        if (!(ctx = EVP_CIPHER_CTX_new()))
+            throw std::runtime_error("CKeyspaceCipher : EVP_CIPHER_CTX_new failed");
+    }
+
+    ~CKeyspaceCipher()
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        OPENSSL_cleanse(key.begin(), key.size());
+    }
+
+    static CKeyspaceCipher& Thread()
+    {
+        static boost::thread_specific_ptr<CKeyspaceCipher> cipher;
+        if (!cipher.get())
+            cipher.reset(new CKeyspaceCipher);
+        return *cipher;
+    }
+
+    // nBlocks blocks of 16 bytes in place.
+    void Encrypt(const uint128& keyIn, unsigned char* pBlocks, unsigned int nBlocks)
+    {
+        if (!fKeyed || key != keyIn)
+        {
+            if (!EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, keyIn.begin(), NULL))
+                throw std::runtime_error("CKeyspaceCipher : EVP_EncryptInit_ex failed");
+            EVP_CIPHER_CTX_set_padding(ctx, 0);
+            key = keyIn;
+            fKeyed = true;
+        }
+        int nLen = 0;
+        if (!EVP_EncryptUpdate(ctx, pBlocks, &nLen, pBlocks, (int) (16 * nBlocks)))
+            throw std::runtime_error("CKeyspaceCipher : EVP_EncryptUpdate failed");
+    }
+};
+
+// A keyspace maps a 64-bit counter onto a family seed inside an interval
+// [first, last] of 128-bit seed values:
+//
+//     seed = first + P(counter)
+//
+// P is a permutation of [0, span) keyed by a secret drawn at random once per
+// run: AES-128 itself when the interval is every seed, else a ten round
+// Feistel network with an AES-128 round function over the smallest even
+// number of bits that holds span - 1, walked until it lands below span.
+// A hex seed prefix (-s) and a human seed prefix both select the interval.
+// Distinct counters always give distinct seeds, so threads (or hosts) working
+// on disjoint counter ranges can never search the same seed twice; without
+// the key a seed says nothing about the seeds of other counters, so the hits
+// handed out of one run do not give away the others.
+class CKeyspace
+{
+protected:
+    uint128 first;
+    uint128 span;       // number of seeds, zero meaning all 2^128
+    uint128 key;        // of the permutation, secret
+    uint64  nMaxHi;     // span - 1 as two words
+    uint64  nMaxLo;
+    int     nHalf;      // bits per Feistel half, 0 for plain AES
+
+    static const int FEISTEL_ROUNDS = 10;
+    static const unsigned int KEYSPACE_BATCH = 16;
+
+    // Big-endian arithmetic on 16 byte values, returns the carry / borrow.
+    static unsigned int Add(uint128& a, const uint128& b)
+    {
+        unsigned int nCarry = 0;
+        for (int i = a.size() - 1; i >= 0; i--)
+        {
+            unsigned int nSum = a.begin()[i] + b.begin()[i] + nCarry;
+            a.begin()[i] = static_cast<unsigned char>(nSum & 0xff);
+            nCarry = nSum >> 8;
+        }
+        return nCarry;
+    }
+
+    static unsigned int Sub(uint128& a, const uint128& b)
+    {
+        unsigned int nBorrow = 0;
+        for (int i = a.size() - 1; i >= 0; i--)
+        {
+            int nDiff = a.begin()[i] - b.begin()[i] - nBorrow;
+            nBorrow = nDiff < 0;
+            a.begin()[i] = static_cast<unsigned char>(nDiff & 0xff);
+        }
+        return nBorrow;
+    }
+
+    static uint128 FromUint64(uint64 n)
+    {
+        uint128 ret;
+        for (int i = 0; i < 8; i++)
+            ret.begin()[ret.size() - 1 - i] = static_cast<unsigned char>((n >> (8 * i)) & 0xff);
+        return ret;
+    }
+
+    static uint64 GetWord(const unsigned char* p)
+    {
+        uint64 n = 0;
+        for (int i = 0; i < 8; i++)
+            n = (n << 8) | p[i];
+        return n;
+    }
+
+    static void PutWord(unsigned char* p, uint64 n)
+    {
+        for (int i = 7; i >= 0; i--, n >>= 8)
+            p[i] = static_cast<unsigned char>(n & 0xff);
+    }
+
+    void Randomize()
+    {
+        if (RAND_bytes(key.begin(), key.size()) != 1)
+            throw std::runtime_error("CKeyspace : entropy pool not seeded");
+    }
+
+    // After every change of span.
+    void SetSpan()
+    {
+        nHalf = 0;
+        nMaxHi = nMaxLo = ~(uint64) 0;
+        if (span.isZero())
+            return;
+        uint128 max = span;
+        Sub(max, FromUint64(1));
+        nMaxHi = GetWord(max.begin());
+        nMaxLo = GetWord(max.begin() + 8);
+        int nBits = 0;
+        for (uint64 n = nMaxHi; n != 0; n >>= 1)
+            nBits++;
+        if (nBits != 0)
+            nBits += 64;
+        else
+            for (uint64 n = nMaxLo; n != 0; n >>= 1)
+                nBits++;
+        nHalf = std::max(1, (nBits + 1) / 2);
+    }
+
+    // One pass of the Feistel network over nCount values of 2 nHalf bits,
+    // or of its inverse.
+    void Feistel(uint64* pHi, uint64* pLo, unsigned int nCount, CKeyspaceCipher& cipher, bool fInverse = false) const
+    {
+        uint64 vL[KEYSPACE_BATCH], vR[KEYSPACE_BATCH];
+        unsigned char vBlocks[KEYSPACE_BATCH][16];
+        uint64 nMask = nHalf == 64 ? ~(uint64) 0 : ((uint64) 1 << nHalf) - 1;
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            vR[i] = pLo[i] & nMask;
+            vL[i] = nHalf == 64 ? pHi[i] : ((pLo[i] >> nHalf) | (nHalf > 32 ? pHi[i] << (64 - nHalf) : 0)) & nMask;
+        }
+        for (int nRound = 0; nRound < FEISTEL_ROUNDS; nRound++)
+        {
+            int r = fInverse ? FEISTEL_ROUNDS - 1 - nRound : nRound;
+            for (unsigned int i = 0; i < nCount; i++)
+            {
+                memset(vBlocks[i], 0, 8);
+                vBlocks[i][0] = static_cast<unsigned char>(r);
+                PutWord(vBlocks[i] + 8, fInverse ? vL[i] : vR[i]);
+            }
+            cipher.Encrypt(key, vBlocks[0], nCount);
+            for (unsigned int i = 0; i < nCount; i++)
+            {
+                if (fInverse)
+                {
+                    uint64 n = vR[i] ^ (GetWord(vBlocks[i]) & nMask);
+                    vR[i] = vL[i];
+                    vL[i] = n;
+                }
+                else
+                {
+                    uint64 n = vL[i] ^ (GetWord(vBlocks[i]) & nMask);
+                    vL[i] = vR[i];
+                    vR[i] = n;
+                }
+            }
+        }
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            pLo[i] = nHalf == 64 ? vR[i] : vR[i] | (vL[i] << nHalf);
+            pHi[i] = nHalf == 64 ? vL[i] : nHalf > 32 ? vL[i] >> (64 - nHalf) : 0;
+        }
+        OPENSSL_cleanse(vBlocks, sizeof(vBlocks));
+    }
+
+    // Up to KEYSPACE_BATCH seeds, the counters below span.
+    void Permute(uint64 nCounter, unsigned int nCount, uint128* pSeeds, CKeyspaceCipher& cipher) const
+    {
+        uint64 vHi[KEYSPACE_BATCH], vLo[KEYSPACE_BATCH];
+        unsigned int vSlot[KEYSPACE_BATCH];
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            vHi[i] = 0;
+            vLo[i] = nCounter + i;
+            vSlot[i] = i;
+            // a counter past the span would walk forever
+            if (nMaxHi == 0 && nMaxLo != ~(uint64) 0)
+                vLo[i] %= nMaxLo + 1;
+        }
+        if (nHalf == 0)
+        {
+            unsigned char vBlocks[KEYSPACE_BATCH][16];
+            for (unsigned int i = 0; i < nCount; i++)
+            {
+                PutWord(vBlocks[i], 0);
+                PutWord(vBlocks[i] + 8, vLo[i]);
+            }
+            cipher.Encrypt(key, vBlocks[0], nCount);
+            for (unsigned int i = 0; i < nCount; i++)
+                memcpy(pSeeds[i].begin(), vBlocks[i], 16);
+            OPENSSL_cleanse(vBlocks, sizeof(vBlocks));
+            return;
+        }
+
+        // cycle walking: the values past span - 1 go round again
+        unsigned int nPending = nCount;
+        while (nPending != 0)
+        {
+            Feistel(vHi, vLo, nPending, cipher);
+            unsigned int nLeft = 0;
+            for (unsigned int i = 0; i < nPending; i++)
+            {
+                if (vHi[i] < nMaxHi || (vHi[i] == nMaxHi && vLo[i] <= nMaxLo))
+                {
+                    uint128 pos;
+                    PutWord(pos.begin(), vHi[i]);
+                    PutWord(pos.begin() + 8, vLo[i]);
+                    pSeeds[vSlot[i]] = first;
+                    Add(pSeeds[vSlot[i]], pos);
+                }
+                else
+                {
+                    vHi[nLeft] = vHi[i];
+                    vLo[nLeft] = vLo[i];
+                    vSlot[nLeft] = vSlot[i];
+                    nLeft++;
+                }
+            }
+            nPending = nLeft;
+        }
+        OPENSSL_cleanse(vHi, sizeof(vHi));
+        OPENSSL_cleanse(vLo, sizeof(vLo));
+    }
+
+public:
+    // All seeds.
+    CKeyspace()
+    {
+        SetSpan();
+        Randomize();
+    }
+
+    // Seeds starting with the given bytes.
+    CKeyspace(const std::vector<unsigned char>& vchPrefix)
+    {
+        size_t nPrefix = std::min<size_t>(vchPrefix.size(), first.size());
+        std::copy(vchPrefix.begin(), vchPrefix.begin() + nPrefix, first.begin());
+        if (nPrefix != 0)
+            span.begin()[nPrefix - 1] = 1;  // 2^(8 * free bytes), zero if nothing is fixed
+        SetSpan();
+        Randomize();
+    }
+
+    uint128 GetFirst() const
+    {
+        return first;
+    }
+
+    uint128 GetLast() const
+    {
+        uint128 last = first;
+        Add(last, span);
+        Sub(last, FromUint64(1));
+        return last;
+    }
+
+    // Narrow to the seeds also inside [firstIn, lastIn].  False if nothing
+    // is left, in which case the keyspace is unchanged.
+    bool Intersect(const uint128& firstIn, const uint128& lastIn)
+    {
+        uint128 newFirst = std::max(first, firstIn);
+        uint128 newLast = std::min(GetLast(), lastIn);
+        if (newFirst > newLast)
+            return false;
+
+        first = newFirst;
+        span = newLast;
+        Sub(span, newFirst);
+        Add(span, FromUint64(1));
+        SetSpan();
+        Randomize();
+        return true;
+    }
+
+    // Number of distinct counters, saturated to 2^64 - 1.
+    uint64 Size() const
+    {
+        for (int i = 0; i < 8; i++)
+            if (span.isZero() || span.begin()[i] != 0)
+                return 0xffffffffffffffffull;
+
+        uint64 nSize = 0;
+        for (int i = 8; i < 16; i++)
+            nSize = (nSize << 8) | span.begin()[i];
+        return nSize;
+    }
+
+    // The seeds of counters nCounter .. nCounter + nCount - 1, below Size().
+    void SeedsAt(uint64 nCounter, unsigned int nCount, uint128* pSeeds) const
+    {
+        CKeyspaceCipher& cipher = CKeyspaceCipher::Thread();
+        while (nCount != 0)
+        {
+            unsigned int n = std::min(nCount, KEYSPACE_BATCH);
+            Permute(nCounter, n, pSeeds, cipher);
+            nCounter += n;
+            pSeeds += n;
+            nCount -= n;
+        }
+    }
+
+    uint128 SeedAt(uint64 nCounter) const
+    {
+        uint128 seed;
+        SeedsAt(nCounter, 1, &seed);
+        return seed;
+    }
+
+    // The counter of seed, P run backwards; false if the seed is outside
+    // the keyspace or beyond the 64-bit counters.  For checking seeds
+    // others report, not for search loops.
+    bool CounterOf(const uint128& seed, uint64& nCounter) const
+    {
+        uint128 pos = seed;
+        if (Sub(pos, first) != 0)
+            return false;
+        uint64 nHi = GetWord(pos.begin());
+        uint64 nLo = GetWord(pos.begin() + 8);
+        if (nHi > nMaxHi || (nHi == nMaxHi && nLo > nMaxLo))
+            return false;
+        if (nHalf == 0)
+        {
+            unsigned char pBlock[16];
+            memcpy(pBlock, pos.begin(), 16);
+            EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+            int nLen = 0;
+            bool fOk = ctx
+                && EVP_DecryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, key.begin(), NULL)
+                && EVP_CIPHER_CTX_set_padding(ctx, 0)
+                && EVP_DecryptUpdate(ctx, pBlock, &nLen, pBlock, 16);
+            if (ctx)
+                EVP_CIPHER_CTX_free(ctx);
+            if (!fOk)
+                throw std::runtime_error("CKeyspace : AES decryption failed");
+            nHi = GetWord(pBlock);
+            nLo = GetWord(pBlock + 8);
+            OPENSSL_cleanse(pBlock, sizeof(pBlock));
+        }
+        else
+        {
+            // cycle walking backwards: out of range values go round again
+            CKeyspaceCipher& cipher = CKeyspaceCipher::Thread();
+            do
+                Feistel(&nHi, &nLo, 1, cipher, true);
+            while (nHi > nMaxHi || (nHi == nMaxHi && nLo > nMaxLo));
+        }
+        if (nHi != 0)
+            return false;
+        nCounter = nLo;
+        return true;
+    }
+
+    // "<first> <last> <key>" in hex.  A keyspace read back from this string
+    // yields the same seeds for the same counters, so it is as secret as
+    // they are.
+    std::string ToString() const
+    {
+        return first.GetHex() + " " + GetLast().GetHex() + " " + key.GetHex();
+    }
+
+    // "<first> <last>" in hex, for the logs.
+    std::string GetRange() const
+    {
+        return first.GetHex() + " " + GetLast().GetHex();
+    }
+
+    bool SetString(const std::string& str)
+    {
+        std::istringstream ss(str);
+        std::string strFirst, strLast, strKey;
+        if (!(ss >> strFirst >> strLast >> strKey))
+            return false;
+
+        uint128 firstIn, lastIn;
+        firstIn.SetHex(strFirst);
+        lastIn.SetHex(strLast);
+        if (firstIn > lastIn)
+            return false;
+        first = firstIn;
+        span = lastIn;
+        Sub(span, firstIn);
+        Add(span, FromUint64(1));
+        SetSpan();
+        key.SetHex(strKey);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef __LIVE_PATTERNS_H__
+#define __LIVE_PATTERNS_H__
+
+#include "PatternIndex.h"
+#include "PatternSet.h"
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// The pattern file of a search (-f), followed while the search runs: one
+// pattern per line, optionally with a quota, the number of hits after which
+// the pattern is done.
+//
+//     rXRP            no limit
+//     rBob 3          three hits
+//
+// Each version is compiled to an in-memory pattern index (PatternIndex.h) and
+// published through one atomic pointer.  The search threads never lock: once
+// per batch each announces the generation it has seen, then loads the
+// pointer, and a replaced version is freed once every thread has announced a
+// later generation (quiescent-state RCU).  A pattern that reaches its quota is
+// left out of the next version, so it stops costing lookups right away.
+// Hit counts are kept by pattern text, across reloads.
+
+struct CLiveQuota
+{
+    boost::atomic<uint64>   nQuota;     // 0: no limit
+    boost::atomic<uint64>   nHits;
+
+    CLiveQuota() : nQuota(0), nHits(0)
+    {
+    }
+};
+
+struct CLivePatternSet
+{
+    CPatternIndex               index;
+    std::vector<CLiveQuota*>    vQuotas;    // by pattern id of the index
+};
+
+class CLivePatterns
+{
+protected:
+    std::string                     strPath;
+    uint64                          nDefaultQuota;
+
+    boost::mutex                    lock;       // writers
+    std::map<std::string, CLiveQuota*> mapQuotas;
+    std::vector<std::string>        vPatterns;  // the file, in order
+    std::vector<std::pair<uint64, const CLivePatternSet*> > vRetired;
+    size_t                          nActive;
+    double                          dProbability;
+
+    boost::atomic<const CLivePatternSet*> pCurrent;
+    boost::atomic<uint64>           nGeneration;
+    boost::scoped_array<boost::atomic<uint64> > pSeen;  // per reader, ~0 when idle
+    unsigned int                    nReaders;
+    boost::atomic<unsigned int>     nRegistered;
+
+    boost::atomic<bool>             fStale;     // a quota was reached
+    boost::mutex                    lockWake;
+    boost::condition_variable       condWake;
+
+#if defined(__linux__)
+    int                             fdWatch;
+    std::string                     strFileName;
+#endif
+
+    CLivePatterns(const CLivePatterns&);
+    CLivePatterns& operator=(const CLivePatterns&);
+
+    static bool Full(const CLiveQuota* pQuota)
+    {
+        uint64 nQuota = pQuota->nQuota;
+        return nQuota != 0 && pQuota->nHits >= nQuota;
+    }
+
+    bool Parse(std::vector<std::pair<std::string, uint64> >& vLines, std::string& msg)
+    {
+        std::ifstream in(strPath.c_str());
+        if (!in)
+        {
+            msg = "Cannot open " + strPath + ".";
+            return false;
+        }
+        std::string strLine;
+        for (int nLine = 1; std::getline(in, strLine); nLine++)
+        {
+            std::istringstream line(strLine);
+            std::string strPattern, strQuota, strExtra;
+            line >> strPattern >> strQuota >> strExtra;
+            if (strPattern.empty() || strPattern[0] == '#')
+                continue;
+            std::string strWhy;
+            if (!isPatternValid(strPattern, strWhy))
+            {
+                msg = strPath + ":" + lexical_cast_i(nLine) + ": " + strWhy;
+                return false;
+            }
+            uint64 nQuota = nDefaultQuota;
+            if (!strQuota.empty())
+            {
+                char* pEnd;
+                nQuota = strtoull(strQuota.c_str(), &pEnd, 10);
+                if (*pEnd != '\0' || strQuota[0] == '-' || !strExtra.empty())
+                {
+                    msg = strPath + ":" + lexical_cast_i(nLine) + ": expected \"<pattern> [quota]\".";
+                    return false;
+                }
+            }
+            vLines.push_back(std::make_pair(strPattern, nQuota));
+        }
+        if (vLines.empty())
+        {
+            msg = "No patterns in " + strPath + ".";
+            return false;
+        }
+        return true;
+    }
+
+    // Compile the patterns still short of their quota and swap them in.
+    bool Publish(std::string& msg)
+    {
+        std::vector<std::string> vActive;
+        CLivePatternSet* pSet = new CLivePatternSet();
+        for (size_t i = 0; i < vPatterns.size(); i++)
+        {
+            CLiveQuota* pQuota = mapQuotas[vPatterns[i]];
+            if (Full(pQuota))
+                continue;
+            vActive.push_back(vPatterns[i]);
+            pSet->vQuotas.push_back(pQuota);
+        }
+
+        std::vector<char> vBuffer;
+        uint64 nSkipped;
+        if (!CPatternIndex::Build(vActive, vBuffer, nSkipped, msg) || !pSet->index.Assign(vBuffer, msg))
+        {
+            delete pSet;
+            return false;
+        }
+        nActive = vActive.size();
+        dProbability = pSet->index.GetProbability();
+
+        const CLivePatternSet* pOld = pCurrent.exchange(pSet);
+        uint64 nRetired = ++nGeneration;
+        if (pOld)
+            vRetired.push_back(std::make_pair(nRetired, pOld));
+        return true;
+    }
+
+public:
+    CLivePatterns() : nDefaultQuota(0), nActive(0), dProbability(0), pCurrent(NULL),
+                      nGeneration(0), nReaders(0), nRegistered(0), fStale(false)
+    {
+#if defined(__linux__)
+        fdWatch = -1;
+#endif
+    }
+
+    ~CLivePatterns()
+    {
+#if defined(__linux__)
+        if (fdWatch >= 0)
+            close(fdWatch);
+#endif
+        delete pCurrent.load();
+        for (size_t i = 0; i < vRetired.size(); i++)
+            delete vRetired[i].second;
+        for (std::map<std::string, CLiveQuota*>::iterator it = mapQuotas.begin(); it != mapQuotas.end(); ++it)
+            delete it->second;
+    }
+
+    // The one followed by this process's search.
+    static CLivePatterns& Instance()
+    {
+        static CLivePatterns live;
+        return live;
+    }
+
+    // Load strPathIn for up to nReadersIn search threads; patterns without a
+    // quota of their own get nDefaultQuotaIn.
+    bool Open(const std::string& strPathIn, uint64 nDefaultQuotaIn, unsigned int nReadersIn, std::string& msg)
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        strPath = strPathIn;
+        nDefaultQuota = nDefaultQuotaIn;
+        nReaders = nReadersIn;
+        pSeen.reset(new boost::atomic<uint64>[nReaders]);
+        for (unsigned int i = 0; i < nReaders; i++)
+            pSeen[i] = ~(uint64) 0;
+
+#if defined(__linux__)
+        // the directory, not the file: editors replace the file by renaming
+        size_t nSlash = strPath.rfind('/');
+        std::string strDir = nSlash == std::string::npos ? "." : strPath.substr(0, nSlash + 1);
+        strFileName = nSlash == std::string::npos ? strPath : strPath.substr(nSlash + 1);
+        fdWatch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fdWatch >= 0 && inotify_add_watch(fdWatch, strDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            close(fdWatch);
+            fdWatch = -1;
+        }
+#endif
+        guard.unlock();
+        return Reload(msg);
+    }
+
+    // Read the file again.  On error the current set stays.
+    bool Reload(std::string& msg)
+    {
+        std::vector<std::pair<std::string, uint64> > vLines;
+        if (!Parse(vLines, msg))
+            return false;
+
+        boost::unique_lock<boost::mutex> guard(lock);
+        vPatterns.clear();
+        for (size_t i = 0; i < vLines.size(); i++)
+        {
+            CLiveQuota*& pQuota = mapQuotas[vLines[i].first];
+            if (pQuota == NULL)
+                pQuota = new CLiveQuota();
+            else if (std::find(vPatterns.begin(), vPatterns.end(), vLines[i].first) != vPatterns.end())
+                continue;
+            pQuota->nQuota = vLines[i].second;
+            vPatterns.push_back(vLines[i].first);
+        }
+        return Publish(msg);
+    }
+
+    // The file was written since the last call (Linux only; elsewhere use
+    // SIGHUP).
+    bool Changed()
+    {
+        bool fChanged = false;
+#if defined(__linux__)
+        if (fdWatch < 0)
+            return false;
+        char pEvents[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        ssize_t n;
+        while ((n = read(fdWatch, pEvents, sizeof(pEvents))) > 0)
+        {
+            for (char* p = pEvents; p < pEvents + n; )
+            {
+                const struct inotify_event* pEvent = (const struct inotify_event*) p;
+                if (pEvent->len > 0 && strFileName == pEvent->name)
+                    fChanged = true;
+                p += sizeof(struct inotify_event) + pEvent->len;
+            }
+        }
+#endif
+        return fChanged;
+    }
+
+    // Wait up to nMilliseconds for a quota to be reached, then republish
+    // without the satisfied patterns.  Appends the patterns done since.
+    void Update(unsigned int nMilliseconds, std::vector<std::string>& vDone)
+    {
+        {
+            boost::unique_lock<boost::mutex> guard(lockWake);
+            if (!fStale)
+                condWake.timed_wait(guard, boost::posix_time::milliseconds(nMilliseconds));
+        }
+        if (fStale.exchange(false))
+        {
+            boost::unique_lock<boost::mutex> guard(lock);
+            const CLivePatternSet* pSet = pCurrent;
+            for (size_t i = 0; i < pSet->vQuotas.size(); i++)
+                if (Full(pSet->vQuotas[i]))
+                    vDone.push_back(pSet->index.GetPattern(i));
+            std::string msg;
+            if (!vDone.empty())
+                Publish(msg);
+        }
+        Reclaim();
+    }
+
+    // Free the versions no reader can still hold.
+    void Reclaim()
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        uint64 nOldest = ~(uint64) 0;
+        for (unsigned int i = 0; i < nReaders; i++)
+            nOldest = std::min<uint64>(nOldest, pSeen[i]);
+        size_t nKept = 0;
+        for (size_t i = 0; i < vRetired.size(); i++)
+        {
+            if (vRetired[i].first <= nOldest)
+                delete vRetired[i].second;
+            else
+                vRetired[nKept++] = vRetired[i];
+        }
+        vRetired.resize(nKept);
+    }
+
+    size_t Size()
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        return vPatterns.size();
+    }
+
+    // Patterns still searched for; 0 when every quota is met.
+    size_t Active()
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        return nActive;
+    }
+
+    double GetProbability()
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        return dProbability;
+    }
+
+    // The patterns still searched for.
+    void GetActive(std::vector<std::string>& vActive)
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        vActive.clear();
+        const CLivePatternSet* pSet = pCurrent;
+        for (uint32 i = 0; pSet && i < pSet->index.Size(); i++)
+            vActive.push_back(pSet->index.GetPattern(i));
+    }
+
+    // Reader side, one slot per search thread.
+
+    unsigned int Register()
+    {
+        unsigned int nReader = nRegistered++;
+        if (nReader >= nReaders)
+            throw std::runtime_error("Too many readers of the pattern set");
+        return nReader;
+    }
+
+    void Unregister(unsigned int nReader)
+    {
+        pSeen[nReader] = ~(uint64) 0;
+    }
+
+    // A quiescent point: nothing loaded before it is used after it.
+    const CLivePatternSet* Enter(unsigned int nReader)
+    {
+        pSeen[nReader] = nGeneration.load();
+        return pCurrent.load();
+    }
+
+    // Count a hit for the patterns accountID matches in pSet; false if every
+    // one of them had already reached its quota.
+    bool Claim(const CLivePatternSet* pSet, const uint160& accountID, std::vector<uint32>& vMatches)
+    {
+        vMatches.clear();
+        pSet->index.GetMatches(accountID, vMatches);
+        bool fClaimed = false;
+        for (size_t i = 0; i < vMatches.size(); i++)
+        {
+            CLiveQuota* pQuota = pSet->vQuotas[vMatches[i]];
+            uint64 nQuota = pQuota->nQuota;
+            uint64 nHits = pQuota->nHits;
+            while ((nQuota == 0 || nHits < nQuota) && !pQuota->nHits.compare_exchange_weak(nHits, nHits + 1))
+                ;
+            if (nQuota != 0 && nHits >= nQuota)
+                continue;
+            fClaimed = true;
+            if (nQuota != 0 && nHits + 1 == nQuota)
+            {
+                fStale = true;
+                condWake.notify_one();
+            }
+        }
+        return fClaimed;
+    }
+};
+
+#endif
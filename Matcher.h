@@ -0,0 +1,203 @@
+#ifndef __MATCHER_H__
+#define __MATCHER_H__
+
+#include "Backend.h"
+#include "Difficulty.h"
+#include "LivePatterns.h"
+#include "PatternIndex.h"
+#include "Profile.h"
+#include "RippleAddress.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Policies for the templated search loop (LoopThread in ripplegen.cpp).
+//
+// An address policy says what is derived per candidate and how it is shown:
+//
+//     typedef ... Value;
+//     static void Derive(CCryptoBackend&, int nSeq, Value* pValues);     one per family of the batch
+//     template <class TProfiler>
+//     static void Derive(CCryptoBackend&, int nSeq, Value* pValues, TProfiler&);  the same, marking its stages
+//     static std::string ToString(const Value&);
+//
+// A matcher policy is built from the pattern and tests one value:
+//
+//     explicit Matcher(const std::string& pattern);
+//     void Refresh();                     once per batch, before matching it
+//     bool Match(const Value&) const;
+//     bool Claim(const Value&);           a match is reported only if claimed
+//
+// Every combination is a separate instance, picked once at startup, so the
+// inner loop has no mode checks and the policy calls inline.
+
+struct CAccountIDAddress
+{
+    typedef uint160 Value;
+
+    static void Derive(CCryptoBackend& backend, int nSeq, uint160* pAccountIDs)
+    {
+        backend.GetFamilyAccountIDs(nSeq, pAccountIDs);
+    }
+
+    // --profile: the account keys and their hash160 timed apart
+    template <class TProfiler>
+    static void Derive(CCryptoBackend& backend, int nSeq, uint160* pAccountIDs, TProfiler& profiler)
+    {
+        unsigned char vPublics[BACKEND_BATCH][33];
+        backend.GetFamilyAccountPublics(nSeq, vPublics[0]);
+        profiler.Mark(PROFILE_ACCOUNT);
+        for (unsigned int i = 0; i < backend.GetFamilyCount(); i++)
+            backend.Hash160(vPublics[i], 33, pAccountIDs[i].begin());
+        profiler.Mark(PROFILE_HASH160);
+    }
+
+    static std::string ToString(const uint160& accountID)
+    {
+        RippleAddress naAccount;
+        naAccount.setAccountID(accountID);
+        return naAccount.humanAccountID();
+    }
+};
+
+// Compares the human form, whatever the address type.  The reference matcher.
+template <class TAddress>
+class CStringMatcher
+{
+protected:
+    std::string strPattern;
+
+public:
+    explicit CStringMatcher(const std::string& pattern) : strPattern(pattern)
+    {
+    }
+
+    void Refresh()
+    {
+    }
+
+    bool Match(const typename TAddress::Value& value) const
+    {
+        return TAddress::ToString(value).compare(0, strPattern.size(), strPattern) == 0;
+    }
+
+    bool Claim(const typename TAddress::Value&)
+    {
+        return true;
+    }
+};
+
+// Account id prefix as intervals of V = hash160 || checksum (see
+// Difficulty.h), so a candidate is a few byte compares instead of a base58
+// encoding.  The checksum is only computed for a hash160 on an interval edge.
+class CIntervalMatcher
+{
+protected:
+    std::vector<CValueBounds> vBounds;
+
+public:
+    explicit CIntervalMatcher(const std::string& pattern)
+    {
+        std::vector<CValueInterval> vIntervals;
+        getAccountIntervals(pattern, vIntervals);
+        for (size_t i = 0; i < vIntervals.size(); i++)
+            vBounds.push_back(getValueBounds(vIntervals[i]));
+    }
+
+    void Refresh()
+    {
+    }
+
+    bool Match(const uint160& accountID) const
+    {
+        for (size_t i = 0; i < vBounds.size(); i++)
+            if (isInValueBounds(accountID, vBounds[i]))
+                return true;
+        return false;
+    }
+
+    bool Claim(const uint160&)
+    {
+        return true;
+    }
+};
+
+// A compiled pattern dictionary; the "pattern" is the index file, mapped once
+// per process and shared by every thread.
+class CIndexMatcher
+{
+protected:
+    boost::shared_ptr<const CPatternIndex> pIndex;
+
+public:
+    explicit CIndexMatcher(const std::string& strPath)
+    {
+        std::string msg;
+        pIndex = CPatternIndex::OpenShared(strPath, msg);
+        if (!pIndex)
+            throw std::runtime_error(msg);
+    }
+
+    // an index already loaded, shared with other searches (libripplegen)
+    explicit CIndexMatcher(const boost::shared_ptr<const CPatternIndex>& pIndexIn) : pIndex(pIndexIn)
+    {
+    }
+
+    void Refresh()
+    {
+    }
+
+    bool Match(const uint160& accountID) const
+    {
+        return pIndex->Match(accountID);
+    }
+
+    bool Claim(const uint160&)
+    {
+        return true;
+    }
+};
+
+// The pattern file followed by the search (LivePatterns.h); the "pattern" is
+// its path.  Each batch sees the version current when it started.
+class CLiveMatcher
+{
+protected:
+    CLivePatterns&          live;
+    unsigned int            nReader;
+    const CLivePatternSet*  pSet;
+    std::vector<uint32>     vMatches;
+
+    CLiveMatcher(const CLiveMatcher&);
+    CLiveMatcher& operator=(const CLiveMatcher&);
+
+public:
+    explicit CLiveMatcher(const std::string&) : live(CLivePatterns::Instance()), pSet(NULL)
+    {
+        nReader = live.Register();
+    }
+
+    ~CLiveMatcher()
+    {
+        live.Unregister(nReader);
+    }
+
+    void Refresh()
+    {
+        pSet = live.Enter(nReader);
+    }
+
+    bool Match(const uint160& accountID) const
+    {
+        return pSet->index.Match(accountID);
+    }
+
+    bool Claim(const uint160& accountID)
+    {
+        return live.Claim(pSet, accountID, vMatches);
+    }
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef __NET_H__
+#define __NET_H__
+
+#include <string>
+
+#if !defined(WIN32) && !defined(WIN64)
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdio>
+
+// Minimal blocking helpers for the line based control protocols (daemon,
+// coordinator).  None of this is on the search hot path.
+
+// Buffered line reader over a connected socket.
+class CLineReader
+{
+protected:
+    int fd;
+    std::string strBuffer;
+
+public:
+    CLineReader(int fdIn) : fd(fdIn)
+    {
+    }
+
+    // Next line without its terminator; false on EOF or error.
+    bool ReadLine(std::string& strLine)
+    {
+        size_t nEol;
+        while ((nEol = strBuffer.find('\n')) == std::string::npos)
+        {
+            char buf[4096];
+            ssize_t nRead = read(fd, buf, sizeof(buf));
+            if (nRead < 0 && errno == EINTR)
+                continue;
+            if (nRead <= 0)
+                return false;
+            strBuffer.append(buf, nRead);
+        }
+        strLine = strBuffer.substr(0, nEol);
+        strBuffer.erase(0, nEol + 1);
+        if (!strLine.empty() && strLine[strLine.size() - 1] == '\r')
+            strLine.erase(strLine.size() - 1);
+        return true;
+    }
+};
+
+inline bool WriteAll(int fd, const std::string& str)
+{
+    size_t nDone = 0;
+    while (nDone < str.size())
+    {
+        ssize_t nWritten = write(fd, str.data() + nDone, str.size() - nDone);
+        if (nWritten < 0 && errno == EINTR)
+            continue;
+        if (nWritten <= 0)
+            return false;
+        nDone += nWritten;
+    }
+    return true;
+}
+
+inline bool ReadAll(int fd, void* p, size_t nSize)
+{
+    size_t nDone = 0;
+    while (nDone < nSize)
+    {
+        ssize_t nRead = read(fd, (char*) p + nDone, nSize - nDone);
+        if (nRead < 0 && errno == EINTR)
+            continue;
+        if (nRead <= 0)
+            return false;
+        nDone += nRead;
+    }
+    return true;
+}
+
+// Listening TCP socket on strAddress (a host name or numeric address,
+// "0.0.0.0" or "::" for every interface), -1 on failure.
+inline int ListenTcp(const std::string& strAddress, int nPort)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    char szPort[16];
+    snprintf(szPort, sizeof(szPort), "%d", nPort);
+
+    addrinfo* pResult = NULL;
+    if (strAddress.empty() || getaddrinfo(strAddress.c_str(), szPort, &hints, &pResult) != 0)
+    {
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo* p = pResult; p != NULL; p = p->ai_next)
+    {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd < 0)
+            continue;
+        int nOne = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &nOne, sizeof(nOne));
+        if (bind(fd, p->ai_addr, p->ai_addrlen) == 0 && listen(fd, 64) == 0)
+            break;
+        int nError = errno;
+        close(fd);
+        errno = nError;
+        fd = -1;
+    }
+    freeaddrinfo(pResult);
+    return fd;
+}
+
+// Connected TCP socket to host:port, -1 on failure.
+inline int ConnectTcp(const std::string& strHost, int nPort)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char szPort[16];
+    snprintf(szPort, sizeof(szPort), "%d", nPort);
+
+    addrinfo* pResult = NULL;
+    if (getaddrinfo(strHost.c_str(), szPort, &hints, &pResult) != 0)
+        return -1;
+
+    int fd = -1;
+    for (addrinfo* p = pResult; p != NULL; p = p->ai_next)
+    {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(pResult);
+
+    if (fd >= 0)
+    {
+        int nOne = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nOne, sizeof(nOne));
+    }
+    return fd;
+}
+
+#endif
+
+#endif
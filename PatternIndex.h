@@ -0,0 +1,459 @@
+#ifndef __PATTERN_INDEX_H__
+#define __PATTERN_INDEX_H__
+
+#include "Difficulty.h"
+
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#if !defined(WIN32) && !defined(WIN64)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Precompiled pattern dictionary ("ripplegen compile-patterns").
+//
+// Every pattern becomes its V intervals (Difficulty.h), written once to a
+// versioned file that the search maps read-only: no parsing at startup, and
+// every thread and process using the same file shares its pages.  The same
+// image can also be built and kept in memory (LivePatterns.h).
+//
+//     header          magic, version, byte order, counts, section offsets,
+//                     P(match) of the whole set
+//     intervals       sorted by first (then widest first): first, last
+//                     (inclusive, 24 bytes big-endian), parent, pattern id
+//     patterns        nPatterns + 1 offsets into the string section
+//     buckets         2^16 + 1 entries: first interval whose first value has
+//                     top 16 bits >= the bucket number
+//     strings         the pattern texts
+//
+// Account id prefixes give nested or disjoint intervals, never partly
+// overlapping ones, so "parent" (the closest enclosing interval) chains all
+// the intervals holding a value: a lookup is a binary search inside one
+// bucket, then a walk up the chain.
+
+static const char PATTERN_INDEX_MAGIC[8] = { 'R', 'G', 'P', 'I', 'D', 'X', '\r', '\n' };
+static const uint32 PATTERN_INDEX_VERSION = 1;
+static const uint32 PATTERN_INDEX_BYTE_ORDER = 0x01020304;
+static const uint32 PATTERN_INDEX_BUCKET_BITS = 16;
+static const uint32 PATTERN_INDEX_NONE = 0xffffffff;
+
+struct CPatternIndexHeader
+{
+    char    pMagic[8];
+    uint32  nVersion;
+    uint32  nByteOrder;
+    uint32  nBucketBits;
+    uint32  nReserved;
+    uint64  nIntervals;
+    uint64  nPatterns;
+    uint64  nOffsetIntervals;
+    uint64  nOffsetBuckets;
+    uint64  nOffsetPatterns;
+    uint64  nOffsetStrings;
+    uint64  nFileSize;
+    double  dProbability;
+};
+
+struct CIndexInterval
+{
+    unsigned char   pFirst[24];
+    unsigned char   pLast[24];
+    uint32          nParent;
+    uint32          nPattern;
+
+    bool operator<(const CIndexInterval& b) const
+    {
+        int n = memcmp(pFirst, b.pFirst, 24);
+        if (n != 0)
+            return n < 0;
+        n = memcmp(pLast, b.pLast, 24);
+        if (n != 0)
+            return n > 0;
+        return nPattern < b.nPattern;
+    }
+};
+
+class CPatternIndex
+{
+protected:
+    const char*                 pData;
+    size_t                      nSize;
+    std::vector<char>           vData;      // no mmap
+    const CPatternIndexHeader*  pHeader;
+    const CIndexInterval*       pIntervals;
+    const uint32*               pBuckets;
+    const uint64*               pPatterns;
+    const char*                 pStrings;
+
+    CPatternIndex(const CPatternIndex&);
+    CPatternIndex& operator=(const CPatternIndex&);
+
+    bool Fail(std::string& msg, const std::string& strPath, const char* pszWhy)
+    {
+        msg = strPath + ": " + pszWhy;
+        return false;
+    }
+
+    // last - first + 1 of a 24 byte big-endian interval, as a fraction of 2^192
+    static double GetIntervalFraction(const CIndexInterval& interval)
+    {
+        unsigned char pDiff[24];
+        int nBorrow = 0;
+        for (int i = 23; i >= 0; i--)
+        {
+            int n = interval.pLast[i] - interval.pFirst[i] - nBorrow;
+            nBorrow = n < 0;
+            pDiff[i] = (unsigned char) (n + 256 * nBorrow);
+        }
+        double d = 0;
+        for (int i = 0; i < 24; i++)
+            d = d * 256 + pDiff[i];
+        return (d + 1) / ldexp(1.0, ACCOUNT_VALUE_BITS);
+    }
+
+    static void Append(std::vector<char>& vBuffer, const void* p, size_t n)
+    {
+        vBuffer.insert(vBuffer.end(), (const char*) p, (const char*) p + n);
+    }
+
+    // Last interval whose first value is <= p24, or PATTERN_INDEX_NONE.
+    uint32 Lookup(const unsigned char* p24) const
+    {
+        uint32 nBucket = (p24[0] << 8) | p24[1];
+        const CIndexInterval* pBegin = pIntervals + pBuckets[nBucket];
+        const CIndexInterval* pEnd = pIntervals + pBuckets[nBucket + 1];
+        while (pBegin < pEnd)
+        {
+            const CIndexInterval* pMid = pBegin + (pEnd - pBegin) / 2;
+            if (memcmp(pMid->pFirst, p24, 24) <= 0)
+                pBegin = pMid + 1;
+            else
+                pEnd = pMid;
+        }
+        return pBegin == pIntervals ? PATTERN_INDEX_NONE : (uint32) (pBegin - pIntervals - 1);
+    }
+
+    // Innermost interval holding p24.
+    uint32 Find(const unsigned char* p24) const
+    {
+        uint32 i = Lookup(p24);
+        while (i != PATTERN_INDEX_NONE && memcmp(pIntervals[i].pLast, p24, 24) < 0)
+            i = pIntervals[i].nParent;
+        return i;
+    }
+
+public:
+    CPatternIndex() : pData(NULL), nSize(0), pHeader(NULL)
+    {
+    }
+
+    ~CPatternIndex()
+    {
+#if !defined(WIN32) && !defined(WIN64)
+        if (pData && vData.empty())
+            munmap((void*) pData, nSize);
+#endif
+    }
+
+    // Patterns to the index image in vBuffer.  Invalid patterns are skipped
+    // and counted in nSkipped.
+    static bool Build(const std::vector<std::string>& vPatterns, std::vector<char>& vBuffer,
+                      uint64& nSkipped, std::string& msg)
+    {
+        std::vector<CIndexInterval> vIntervals;
+        std::vector<CValueInterval> vValues;
+        std::vector<uint64> vOffsets(1, 0);
+        std::string strStrings;
+        nSkipped = 0;
+        for (size_t i = 0; i < vPatterns.size(); i++)
+        {
+            // same rules as isPatternValid: an account id prefix some
+            // account can have
+            vValues.clear();
+            if (!getAccountIntervals(vPatterns[i], vValues) || vValues.empty()
+                || vPatterns[i].find_first_not_of(ALPHABET) != std::string::npos)
+            {
+                nSkipped++;
+                continue;
+            }
+            uint32 nPattern = vOffsets.size() - 1;
+            strStrings += vPatterns[i];
+            vOffsets.push_back(strStrings.size());
+
+            for (size_t j = 0; j < vValues.size(); j++)
+            {
+                CIndexInterval interval;
+                putValueBytes(interval.pFirst, vValues[j].first);
+                putValueBytes(interval.pLast, vValues[j].second - 1);
+                interval.nParent = PATTERN_INDEX_NONE;
+                interval.nPattern = nPattern;
+                vIntervals.push_back(interval);
+            }
+        }
+        if (vIntervals.size() >= PATTERN_INDEX_NONE)
+        {
+            msg = "Too many patterns for one index";
+            return false;
+        }
+        std::sort(vIntervals.begin(), vIntervals.end());
+
+        // closest enclosing interval, from a stack of the open ones; the
+        // outermost intervals are disjoint and add up to P(match)
+        std::vector<uint32> vOpen;
+        double dProbability = 0;
+        for (uint32 i = 0; i < vIntervals.size(); i++)
+        {
+            while (!vOpen.empty() && memcmp(vIntervals[vOpen.back()].pLast, vIntervals[i].pFirst, 24) < 0)
+                vOpen.pop_back();
+            if (!vOpen.empty())
+            {
+                if (memcmp(vIntervals[i].pLast, vIntervals[vOpen.back()].pLast, 24) > 0)
+                {
+                    msg = "Pattern intervals overlap without nesting";
+                    return false;
+                }
+                vIntervals[i].nParent = vOpen.back();
+            }
+            else
+                dProbability += GetIntervalFraction(vIntervals[i]);
+            vOpen.push_back(i);
+        }
+
+        uint32 nBuckets = 1 << PATTERN_INDEX_BUCKET_BITS;
+        std::vector<uint32> vBuckets(nBuckets + 1);
+        uint32 nInterval = 0;
+        for (uint32 b = 0; b <= nBuckets; b++)
+        {
+            while (nInterval < vIntervals.size()
+                   && (uint32) ((vIntervals[nInterval].pFirst[0] << 8) | vIntervals[nInterval].pFirst[1]) < b)
+                nInterval++;
+            vBuckets[b] = nInterval;
+        }
+
+        CPatternIndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.pMagic, PATTERN_INDEX_MAGIC, sizeof(header.pMagic));
+        header.nVersion = PATTERN_INDEX_VERSION;
+        header.nByteOrder = PATTERN_INDEX_BYTE_ORDER;
+        header.nBucketBits = PATTERN_INDEX_BUCKET_BITS;
+        header.nIntervals = vIntervals.size();
+        header.nPatterns = vOffsets.size() - 1;
+        header.nOffsetIntervals = sizeof(header);
+        header.nOffsetPatterns = header.nOffsetIntervals + vIntervals.size() * sizeof(CIndexInterval);
+        header.nOffsetBuckets = header.nOffsetPatterns + vOffsets.size() * sizeof(uint64);
+        header.nOffsetStrings = header.nOffsetBuckets + vBuckets.size() * sizeof(uint32);
+        header.nFileSize = header.nOffsetStrings + strStrings.size();
+        header.dProbability = dProbability;
+
+        vBuffer.clear();
+        vBuffer.reserve(header.nFileSize);
+        Append(vBuffer, &header, sizeof(header));
+        if (!vIntervals.empty())
+            Append(vBuffer, &vIntervals[0], vIntervals.size() * sizeof(CIndexInterval));
+        Append(vBuffer, &vOffsets[0], vOffsets.size() * sizeof(uint64));
+        Append(vBuffer, &vBuckets[0], vBuckets.size() * sizeof(uint32));
+        Append(vBuffer, strStrings.data(), strStrings.size());
+        return true;
+    }
+
+    // Patterns to intervals to strPath.
+    static bool Compile(const std::vector<std::string>& vPatterns, const std::string& strPath,
+                        uint64& nSkipped, std::string& msg)
+    {
+        std::vector<char> vBuffer;
+        if (!Build(vPatterns, vBuffer, nSkipped, msg))
+            return false;
+
+        // written next to the target and renamed over it, so a search that
+        // has the old file mapped keeps a consistent copy
+        std::string strTemp = strPath + ".tmp";
+        std::ofstream out(strTemp.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(&vBuffer[0], vBuffer.size());
+        if (!out)
+        {
+            msg = "Cannot write " + strTemp;
+            return false;
+        }
+        out.close();
+        if (!out || rename(strTemp.c_str(), strPath.c_str()) != 0)
+        {
+            msg = "Cannot write " + strPath;
+            return false;
+        }
+        return true;
+    }
+
+    bool Open(const std::string& strPath, std::string& msg)
+    {
+#if !defined(WIN32) && !defined(WIN64)
+        int fd = open(strPath.c_str(), O_RDONLY);
+        if (fd < 0)
+            return Fail(msg, strPath, strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CPatternIndexHeader))
+        {
+            close(fd);
+            return Fail(msg, strPath, "not a pattern index");
+        }
+        nSize = st.st_size;
+        void* p = mmap(NULL, nSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return Fail(msg, strPath, strerror(errno));
+        pData = (const char*) p;
+#else
+        std::ifstream in(strPath.c_str(), std::ios::binary);
+        vData.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (vData.size() < sizeof(CPatternIndexHeader))
+            return Fail(msg, strPath, "not a pattern index");
+        pData = &vData[0];
+        nSize = vData.size();
+#endif
+        return Validate(strPath, msg);
+    }
+
+    // An image from Build, kept in memory; vBuffer is emptied.
+    bool Assign(std::vector<char>& vBuffer, std::string& msg)
+    {
+        vData.swap(vBuffer);
+        if (vData.size() < sizeof(CPatternIndexHeader))
+            return Fail(msg, "pattern set", "not a pattern index");
+        pData = &vData[0];
+        nSize = vData.size();
+        return Validate("pattern set", msg);
+    }
+
+protected:
+    bool Validate(const std::string& strPath, std::string& msg)
+    {
+        pHeader = (const CPatternIndexHeader*) pData;
+        if (memcmp(pHeader->pMagic, PATTERN_INDEX_MAGIC, sizeof(pHeader->pMagic)) != 0)
+            return Fail(msg, strPath, "not a pattern index");
+        if (pHeader->nVersion != PATTERN_INDEX_VERSION)
+            return Fail(msg, strPath, "unsupported pattern index version, recompile it");
+        if (pHeader->nByteOrder != PATTERN_INDEX_BYTE_ORDER || pHeader->nBucketBits != PATTERN_INDEX_BUCKET_BITS)
+            return Fail(msg, strPath, "pattern index built for another architecture, recompile it");
+        // the counts are bounded by the file size before any product or sum
+        // of them is formed, so none of these can wrap
+        if (pHeader->nFileSize != nSize
+            || pHeader->nIntervals >= PATTERN_INDEX_NONE
+            || pHeader->nIntervals > nSize / sizeof(CIndexInterval)
+            || pHeader->nPatterns >= PATTERN_INDEX_NONE
+            || pHeader->nPatterns >= nSize / sizeof(uint64)
+            || pHeader->nOffsetIntervals != sizeof(CPatternIndexHeader)
+            || pHeader->nOffsetIntervals + pHeader->nIntervals * sizeof(CIndexInterval) != pHeader->nOffsetPatterns
+            || pHeader->nOffsetPatterns + (pHeader->nPatterns + 1) * sizeof(uint64) != pHeader->nOffsetBuckets
+            || pHeader->nOffsetBuckets + ((1 << PATTERN_INDEX_BUCKET_BITS) + 1) * sizeof(uint32) != pHeader->nOffsetStrings
+            || pHeader->nOffsetStrings > nSize)
+            return Fail(msg, strPath, "truncated or corrupt pattern index");
+
+        pIntervals = (const CIndexInterval*) (pData + pHeader->nOffsetIntervals);
+        pBuckets = (const uint32*) (pData + pHeader->nOffsetBuckets);
+        pPatterns = (const uint64*) (pData + pHeader->nOffsetPatterns);
+        pStrings = pData + pHeader->nOffsetStrings;
+
+        // Lookup, Find and GetPattern trust these: buckets bound the binary
+        // search, parents come before their children so every chain ends,
+        // and pattern ids and string offsets stay inside their sections
+        if (pBuckets[0] != 0 || pBuckets[1 << PATTERN_INDEX_BUCKET_BITS] != pHeader->nIntervals)
+            return Fail(msg, strPath, "truncated or corrupt pattern index");
+        for (uint32 b = 0; b < (1 << PATTERN_INDEX_BUCKET_BITS); b++)
+            if (pBuckets[b] > pBuckets[b + 1])
+                return Fail(msg, strPath, "corrupt pattern index buckets");
+        for (uint32 i = 0; i < pHeader->nIntervals; i++)
+            if ((pIntervals[i].nParent != PATTERN_INDEX_NONE && pIntervals[i].nParent >= i)
+                || pIntervals[i].nPattern >= pHeader->nPatterns)
+                return Fail(msg, strPath, "corrupt pattern index intervals");
+        if (pPatterns[0] != 0 || pPatterns[pHeader->nPatterns] != nSize - pHeader->nOffsetStrings)
+            return Fail(msg, strPath, "truncated or corrupt pattern index");
+        for (uint64 i = 0; i < pHeader->nPatterns; i++)
+            if (pPatterns[i] > pPatterns[i + 1])
+                return Fail(msg, strPath, "corrupt pattern index strings");
+        return true;
+    }
+
+public:
+    // One mapping per file for the whole process, kept while anyone uses it.
+    static boost::shared_ptr<const CPatternIndex> OpenShared(const std::string& strPath, std::string& msg)
+    {
+        static boost::mutex lockShared;
+        static std::map<std::string, boost::weak_ptr<const CPatternIndex> > mapShared;
+
+        boost::unique_lock<boost::mutex> lock(lockShared);
+        boost::shared_ptr<const CPatternIndex> pIndex = mapShared[strPath].lock();
+        if (pIndex)
+            return pIndex;
+        boost::shared_ptr<CPatternIndex> pNew(new CPatternIndex());
+        if (!pNew->Open(strPath, msg))
+            return boost::shared_ptr<const CPatternIndex>();
+        mapShared[strPath] = pNew;
+        return pNew;
+    }
+
+    uint64 Size() const
+    {
+        return pHeader->nPatterns;
+    }
+
+    double GetProbability() const
+    {
+        return pHeader->dProbability;
+    }
+
+    std::string GetPattern(uint32 nPattern) const
+    {
+        return std::string(pStrings + pPatterns[nPattern], pStrings + pPatterns[nPattern + 1]);
+    }
+
+    bool Match(const uint160& accountID) const
+    {
+        // every V with this hash160 first: [hash160 || 0, hash160 || ffffffff]
+        unsigned char pLow[24], pHigh[24];
+        memcpy(pLow, accountID.begin(), 20);
+        memcpy(pHigh, accountID.begin(), 20);
+        memset(pLow + 20, 0, 4);
+        memset(pHigh + 20, 0xff, 4);
+
+        uint32 i = Lookup(pHigh);
+        while (i != PATTERN_INDEX_NONE && memcmp(pIntervals[i].pLast, pLow, 24) < 0)
+            i = pIntervals[i].nParent;
+        if (i == PATTERN_INDEX_NONE)
+            return false;
+        if (memcmp(pIntervals[i].pFirst, pLow, 24) <= 0 && memcmp(pIntervals[i].pLast, pHigh, 24) >= 0)
+            return true;
+
+        // an interval edge falls inside: the checksum decides
+        unsigned char pValue[24];
+        getAccountValue(accountID, pValue);
+        return Find(pValue) != PATTERN_INDEX_NONE;
+    }
+
+    // Append the ids of every pattern accountID matches.
+    bool GetMatches(const uint160& accountID, std::vector<uint32>& vPatternIDs) const
+    {
+        unsigned char pValue[24];
+        getAccountValue(accountID, pValue);
+        bool fFound = false;
+        for (uint32 i = Find(pValue); i != PATTERN_INDEX_NONE; i = pIntervals[i].nParent)
+        {
+            vPatternIDs.push_back(pIntervals[i].nPattern);
+            fFound = true;
+        }
+        return fFound;
+    }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef __PATTERN_SET_H__
+#define __PATTERN_SET_H__
+
+#include "Difficulty.h"
+#include "PatternIndex.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// isPatternValid can be changed depending on encoding being used.
+bool isPatternValid(const std::string& pattern, std::string& msg)
+{
+    if (pattern.size() == 0) {
+        msg = "Pattern cannot be empty.";
+        return false;
+    }
+    if (pattern[0] != 'r') {
+        msg = "Pattern must begin with an 'r'.";
+        return false;
+    }
+    size_t nBad = pattern.find_first_not_of(ALPHABET);
+    if (nBad != std::string::npos) {
+        msg = std::string("Pattern contains '") + pattern[nBad] + "', which is not a base58 character.";
+        return false;
+    }
+    if (getPatternProbability(pattern) == 0) {
+        msg = "No account id starts with \"" + pattern + "\".";
+        return false;
+    }
+    return true;
+}
+
+// A set of account id prefixes, each tagged with the id of whoever asked for
+// it (a job, a line of the input file).  The search loops check a candidate
+// account id against the V intervals of every prefix (Difficulty.h), sorted
+// by their start: one binary search, then a walk back over the intervals
+// that can still reach it.  Each compiled pattern index (PatternIndex.h) is
+// added whole.  Add only appends: Finish sorts once every pattern is in, and
+// must be called before Match.
+class CPatternSet
+{
+protected:
+    typedef std::pair<std::string, int> Entry;
+    typedef std::pair<boost::shared_ptr<const CPatternIndex>, int> IndexEntry;
+
+    struct CTaggedBounds
+    {
+        CValueBounds    bounds;
+        unsigned char   pMaxLast[24];   // highest pLast up to here
+        int             nTag;
+    };
+
+    std::vector<Entry>          vEntries;   // sorted by prefix
+    std::vector<CTaggedBounds>  vBounds;    // sorted by pFirst
+    std::vector<IndexEntry>     vIndexes;
+
+    static bool FirstLess(const CTaggedBounds& a, const CTaggedBounds& b)
+    {
+        return memcmp(a.bounds.pFirst, b.bounds.pFirst, 24) < 0;
+    }
+
+    static bool AccountLess(const uint160& accountID, const CTaggedBounds& b)
+    {
+        return memcmp(accountID.begin(), b.bounds.pFirst, 20) < 0;
+    }
+
+public:
+    void Add(const std::string& strPattern, int nTag)
+    {
+        vEntries.push_back(Entry(strPattern, nTag));
+
+        std::vector<CValueInterval> vIntervals;
+        getAccountIntervals(strPattern, vIntervals);
+        for (size_t i = 0; i < vIntervals.size(); i++)
+        {
+            CTaggedBounds tagged;
+            tagged.bounds = getValueBounds(vIntervals[i]);
+            tagged.nTag = nTag;
+            vBounds.push_back(tagged);
+        }
+    }
+
+    // Sort what Add appended and chain the highest ends, in one pass.
+    void Finish()
+    {
+        std::sort(vEntries.begin(), vEntries.end());
+        std::stable_sort(vBounds.begin(), vBounds.end(), FirstLess);
+        for (size_t i = 0; i < vBounds.size(); i++)
+        {
+            const unsigned char* pMax = i == 0 || memcmp(vBounds[i].bounds.pLast, vBounds[i - 1].pMaxLast, 24) > 0
+                                        ? vBounds[i].bounds.pLast : vBounds[i - 1].pMaxLast;
+            memmove(vBounds[i].pMaxLast, pMax, 24);
+        }
+    }
+
+    void AddIndex(const boost::shared_ptr<const CPatternIndex>& pIndex, int nTag)
+    {
+        vIndexes.push_back(IndexEntry(pIndex, nTag));
+    }
+
+    bool Empty() const
+    {
+        return vEntries.empty() && vIndexes.empty();
+    }
+
+    size_t Size() const
+    {
+        return vEntries.size();
+    }
+
+    // Append the tags of every prefix and index matching the account id.
+    bool Match(const uint160& accountID, std::vector<int>& vTags) const
+    {
+        bool bFound = false;
+        std::vector<CTaggedBounds>::const_iterator it = std::upper_bound(vBounds.begin(), vBounds.end(), accountID, AccountLess);
+        while (it != vBounds.begin())
+        {
+            --it;
+            if (memcmp(it->pMaxLast, accountID.begin(), 20) < 0)
+                break;      // nothing further down reaches it
+            if (isInValueBounds(accountID, it->bounds))
+            {
+                vTags.push_back(it->nTag);
+                bFound = true;
+            }
+        }
+        for (size_t i = 0; i < vIndexes.size(); i++)
+        {
+            if (vIndexes[i].first->Match(accountID))
+            {
+                vTags.push_back(vIndexes[i].second);
+                bFound = true;
+            }
+        }
+        return bFound;
+    }
+};
+
+#endif
@@ -0,0 +1,503 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "types.h"
+
+#include <boost/thread.hpp>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// --profile: where the time of the search loop goes.
+//
+// The loop is a template over a profiler policy.  CNoProfiler, the default,
+// is empty and inline, so the instance built with it is the same code as
+// without a profiler.  CStageProfiler samples one batch in every so many: it
+// reads the time stamp counter at every stage boundary of that batch and
+// adds the difference to the stage, with a log2 histogram of the stage's time
+// per account.  Batches not sampled cost a counter decrement.
+//
+// Where the kernel allows it (perf_event_paranoid 2 or lower, a PMU the
+// guest can see), every search thread also counts its cycles, instructions,
+// cache misses and branch misses with perf_event_open, for the IPC and the
+// misses per account of the whole run, sampled or not.
+//
+// Threads add their numbers to CProfile every PROFILE_FLUSH samples and when
+// they end; the report is printed at the end of the search and on SIGUSR1.
+
+enum
+{
+    PROFILE_SEEDS,          // keyspace counter to seed
+    PROFILE_FAMILY,         // root keys: SHA-512 and k*G
+    PROFILE_ACCOUNT,        // account keys: SHA-512, k*G and the root added
+    PROFILE_ED25519,        // ed25519 keys: SHA-512 twice and a*B
+    PROFILE_HASH160,        // SHA-256 and RIPEMD-160 of the public keys
+    PROFILE_HARVEST,        // --harvest filter
+    PROFILE_MATCH,          // matcher
+    PROFILE_REPORT,         // hits: base58 and output
+    PROFILE_STAGES
+};
+
+static const char* const PROFILE_STAGE_NAMES[PROFILE_STAGES] = {
+    "seeds", "root keys", "account keys", "ed25519 keys", "hash160", "harvest", "match", "hits"
+};
+
+static const int PROFILE_BUCKETS = 40;          // log2 of nanoseconds per account
+static const unsigned int PROFILE_FLUSH = 256;  // samples between flushes
+static const unsigned int PROFILE_DEFAULT_RATE = 64;
+
+enum
+{
+    PROFILE_CYCLES,
+    PROFILE_INSTRUCTIONS,
+    PROFILE_CACHE_MISSES,
+    PROFILE_BRANCH_MISSES,
+    PROFILE_COUNTERS
+};
+
+inline uint64 ReadTimeStamp()
+{
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return (uint64) (boost::posix_time::microsec_clock::universal_time()
+                     - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1))).total_microseconds() * 1000;
+#endif
+}
+
+// What a profiler adds up.
+struct CProfileStats
+{
+    uint64  vTicks[PROFILE_STAGES];
+    uint64  vHistogram[PROFILE_STAGES][PROFILE_BUCKETS];
+    uint64  nSamples;
+    uint64  nSampledAccounts;
+    uint64  nAccounts;              // sampled or not
+    uint64  vCounters[PROFILE_COUNTERS];
+    bool    fCounters;
+
+    CProfileStats()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+
+    void Add(const CProfileStats& stats)
+    {
+        for (int i = 0; i < PROFILE_STAGES; i++)
+        {
+            vTicks[i] += stats.vTicks[i];
+            for (int j = 0; j < PROFILE_BUCKETS; j++)
+                vHistogram[i][j] += stats.vHistogram[i][j];
+        }
+        nSamples += stats.nSamples;
+        nSampledAccounts += stats.nSampledAccounts;
+        nAccounts += stats.nAccounts;
+        for (int i = 0; i < PROFILE_COUNTERS; i++)
+            vCounters[i] += stats.vCounters[i];
+        fCounters = fCounters || stats.fCounters;
+    }
+};
+
+// Hardware counters of the calling thread, user space only.
+class CPerfCounters
+{
+protected:
+    int     vFds[PROFILE_COUNTERS];
+    uint64  vLast[PROFILE_COUNTERS];
+
+    CPerfCounters(const CPerfCounters&); // no implementation
+    CPerfCounters& operator=(const CPerfCounters&); // no implementation
+
+#if defined(__linux__)
+    static int Open(unsigned long long nConfig, int nGroup)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = nConfig;
+        attr.disabled = nGroup == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, nGroup, 0);
+    }
+#endif
+
+public:
+    CPerfCounters()
+    {
+        for (int i = 0; i < PROFILE_COUNTERS; i++)
+        {
+            vFds[i] = -1;
+            vLast[i] = 0;
+        }
+    }
+
+    ~CPerfCounters()
+    {
+        for (int i = 0; i < PROFILE_COUNTERS; i++)
+            if (vFds[i] >= 0)
+                close(vFds[i]);
+    }
+
+    // False, with errno, if the kernel refuses (paranoid setting, no PMU).
+    bool Start()
+    {
+#if defined(__linux__)
+        static const unsigned long long vConfigs[PROFILE_COUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for (int i = 0; i < PROFILE_COUNTERS; i++)
+        {
+            vFds[i] = Open(vConfigs[i], i == 0 ? -1 : vFds[0]);
+            if (vFds[i] < 0)
+            {
+                int nError = errno;
+                for (int j = 0; j < i; j++)
+                {
+                    close(vFds[j]);
+                    vFds[j] = -1;
+                }
+                errno = nError;
+                return false;
+            }
+        }
+        ioctl(vFds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+#else
+        errno = ENOSYS;
+        return false;
+#endif
+    }
+
+    bool IsOpen() const
+    {
+        return vFds[0] >= 0;
+    }
+
+    // Adds what was counted since the last call.
+    void Read(uint64* pCounters)
+    {
+        for (int i = 0; i < PROFILE_COUNTERS && IsOpen(); i++)
+        {
+            uint64 n = 0;
+            if (read(vFds[i], &n, sizeof(n)) != (ssize_t) sizeof(n))
+                continue;
+            pCounters[i] += n - vLast[i];
+            vLast[i] = n;
+        }
+    }
+};
+
+// The numbers of every thread, and the report.
+class CProfile
+{
+protected:
+    bool            fEnabled;
+    unsigned int    nRate;          // one batch in nRate is sampled
+    double          dTicksPerNs;
+    std::string     strCounters;    // why there are no counters
+    boost::posix_time::ptime ptStart;
+    mutable boost::mutex lock;
+    CProfileStats   stats;
+
+    CProfile() : fEnabled(false), nRate(PROFILE_DEFAULT_RATE), dTicksPerNs(1)
+    {
+    }
+
+    // TSC ticks per nanosecond, against the wall clock.
+    static double Calibrate()
+    {
+        boost::posix_time::ptime pt0 = boost::posix_time::microsec_clock::universal_time();
+        uint64 n0 = ReadTimeStamp();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+        uint64 n1 = ReadTimeStamp();
+        double dNs = (boost::posix_time::microsec_clock::universal_time() - pt0).total_microseconds() * 1000.0;
+        return dNs > 0 && n1 > n0 ? (n1 - n0) / dNs : 1;
+    }
+
+    static std::string FormatNs(double dNs)
+    {
+        char psz[32];
+        if (dNs >= 1e6)
+            sprintf(psz, "%.1f ms", dNs / 1e6);
+        else if (dNs >= 1e3)
+            sprintf(psz, "%.1f us", dNs / 1e3);
+        else
+            sprintf(psz, "%.0f ns", dNs);
+        return psz;
+    }
+
+    // Upper bound of the bucket the fraction dPart of the samples is in.
+    static double Percentile(const uint64* pHistogram, double dPart)
+    {
+        uint64 nTotal = 0;
+        for (int i = 0; i < PROFILE_BUCKETS; i++)
+            nTotal += pHistogram[i];
+        uint64 nSeen = 0;
+        for (int i = 0; i < PROFILE_BUCKETS; i++)
+        {
+            nSeen += pHistogram[i];
+            if (nTotal != 0 && nSeen >= dPart * nTotal)
+                return std::ldexp(1.0, i);
+        }
+        return 0;
+    }
+
+public:
+    static CProfile& Instance()
+    {
+        static CProfile profile;
+        return profile;
+    }
+
+    // nRateIn: one batch in so many is timed, 0 for the default.
+    void Start(unsigned int nRateIn)
+    {
+        fEnabled = true;
+        nRate = nRateIn ? nRateIn : PROFILE_DEFAULT_RATE;
+        dTicksPerNs = Calibrate();
+        ptStart = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    bool IsEnabled() const
+    {
+        return fEnabled;
+    }
+
+    unsigned int GetRate() const
+    {
+        return nRate;
+    }
+
+    double GetTicksPerNs() const
+    {
+        return dTicksPerNs;
+    }
+
+    void Add(const CProfileStats& threadStats)
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        stats.Add(threadStats);
+    }
+
+    // First failure of a thread to open its counters.
+    void SetCountersError(const std::string& strError)
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        if (strCounters.empty())
+            strCounters = strError;
+    }
+
+    std::string ToString() const
+    {
+        std::ostringstream ss;
+        ss << "one batch in " << nRate << ", TSC " << std::fixed;
+        ss.precision(2);
+        ss << dTicksPerNs << " GHz";
+        return ss.str();
+    }
+
+    void Report(std::ostream& out) const
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        double dSeconds = (boost::posix_time::microsec_clock::universal_time() - ptStart).total_microseconds() / 1e6;
+        uint64 nTotal = 0;
+        for (int i = 0; i < PROFILE_STAGES; i++)
+            nTotal += stats.vTicks[i];
+
+        out << "# Profile: " << stats.nSamples << " batches sampled, " << stats.nSampledAccounts << " of "
+            << stats.nAccounts << " accounts, " << ToString() << std::endl;
+        if (stats.nSampledAccounts == 0 || nTotal == 0)
+        {
+            out << "#" << std::endl;
+            return;
+        }
+        char psz[160];
+        sprintf(psz, "#    %-14s %6s %11s %10s %10s", "stage", "share", "per account", "p50", "p99");
+        out << psz << std::endl;
+        for (int i = 0; i < PROFILE_STAGES; i++)
+        {
+            if (stats.vTicks[i] == 0)
+                continue;
+            sprintf(psz, "#    %-14s %5.1f%% %11s %10s %10s", PROFILE_STAGE_NAMES[i], 100.0 * stats.vTicks[i] / nTotal,
+                    FormatNs(stats.vTicks[i] / dTicksPerNs / stats.nSampledAccounts).c_str(),
+                    FormatNs(Percentile(stats.vHistogram[i], 0.5)).c_str(),
+                    FormatNs(Percentile(stats.vHistogram[i], 0.99)).c_str());
+            out << psz << std::endl;
+        }
+        sprintf(psz, "#    %-14s %6s %11s", "total", "", FormatNs(nTotal / dTicksPerNs / stats.nSampledAccounts).c_str());
+        out << psz << std::endl;
+
+        // where the time per account of the busiest stage falls
+        int nTop = 0;
+        for (int i = 1; i < PROFILE_STAGES; i++)
+            if (stats.vTicks[i] > stats.vTicks[nTop])
+                nTop = i;
+        uint64 nMax = 0;
+        for (int j = 0; j < PROFILE_BUCKETS; j++)
+            nMax = std::max(nMax, stats.vHistogram[nTop][j]);
+        out << "# Histogram of " << PROFILE_STAGE_NAMES[nTop] << " per account:" << std::endl;
+        for (int j = 0; j < PROFILE_BUCKETS; j++)
+        {
+            if (stats.vHistogram[nTop][j] == 0)
+                continue;
+            int nBar = (int) (40 * stats.vHistogram[nTop][j] / nMax);
+            sprintf(psz, "#    < %-9s %10llu %s", FormatNs(std::ldexp(1.0, j)).c_str(),
+                    (unsigned long long) stats.vHistogram[nTop][j], std::string(nBar, '*').c_str());
+            out << psz << std::endl;
+        }
+
+        if (stats.fCounters && stats.vCounters[PROFILE_CYCLES] != 0)
+        {
+            sprintf(psz, "# Counters: IPC %.2f, %.1f cache misses and %.1f branch misses per account, %.2f GHz per thread",
+                    (double) stats.vCounters[PROFILE_INSTRUCTIONS] / stats.vCounters[PROFILE_CYCLES],
+                    (double) stats.vCounters[PROFILE_CACHE_MISSES] / std::max<uint64>(stats.nAccounts, 1),
+                    (double) stats.vCounters[PROFILE_BRANCH_MISSES] / std::max<uint64>(stats.nAccounts, 1),
+                    dSeconds > 0 ? stats.vCounters[PROFILE_CYCLES] / dSeconds / 1e9 : 0.0);
+            out << psz << std::endl;
+        }
+        else
+            out << "# Counters: not available" << (strCounters.empty() ? "" : " (" + strCounters + ")") << std::endl;
+        out << "#" << std::endl;
+    }
+};
+
+// The profiler policy of a search loop without --profile.
+class CNoProfiler
+{
+public:
+    void Begin(unsigned int)
+    {
+    }
+
+    bool IsSampling() const
+    {
+        return false;
+    }
+
+    void Mark(int)
+    {
+    }
+
+    void End()
+    {
+    }
+};
+
+// One per search thread with --profile.  Begin(nAccounts) before a batch,
+// Mark(stage) after each stage of a sampled one, End() after it.
+class CStageProfiler
+{
+protected:
+    CProfile&       profile;
+    CPerfCounters   counters;
+    CProfileStats   stats;
+    unsigned int    nRate;
+    unsigned int    nCountdown;
+    unsigned int    nUnflushed;
+    bool            fSampling;
+    double          dTicksPerNs;
+    uint64          nLast;
+    uint64          nBatchAccounts;
+    uint64          vBatchTicks[PROFILE_STAGES];
+
+    void Flush()
+    {
+        counters.Read(stats.vCounters);
+        stats.fCounters = counters.IsOpen();
+        profile.Add(stats);
+        stats.Clear();
+        nUnflushed = 0;
+    }
+
+public:
+    CStageProfiler() : profile(CProfile::Instance()), nUnflushed(0), fSampling(false), nLast(0), nBatchAccounts(0)
+    {
+        nRate = profile.GetRate();
+        dTicksPerNs = profile.GetTicksPerNs();
+        // threads do not sample the same batches
+        nCountdown = (unsigned int) (ReadTimeStamp() % nRate);
+        if (!counters.Start())
+            profile.SetCountersError(std::string("perf_event_open: ") + strerror(errno));
+    }
+
+    ~CStageProfiler()
+    {
+        Flush();
+    }
+
+    void Begin(unsigned int nAccounts)
+    {
+        stats.nAccounts += nAccounts;
+        fSampling = nCountdown-- == 0;
+        if (!fSampling)
+            return;
+        nCountdown = nRate - 1;
+        nBatchAccounts = nAccounts;
+        memset(vBatchTicks, 0, sizeof(vBatchTicks));
+        nLast = ReadTimeStamp();
+    }
+
+    bool IsSampling() const
+    {
+        return fSampling;
+    }
+
+    // The time since the last mark goes to nStage.
+    void Mark(int nStage)
+    {
+        if (!fSampling)
+            return;
+        uint64 nNow = ReadTimeStamp();
+        vBatchTicks[nStage] += nNow - nLast;
+        nLast = nNow;
+    }
+
+    void End()
+    {
+        if (!fSampling || nBatchAccounts == 0)
+            return;
+        fSampling = false;
+        for (int i = 0; i < PROFILE_STAGES; i++)
+        {
+            if (vBatchTicks[i] == 0)
+                continue;
+            stats.vTicks[i] += vBatchTicks[i];
+            double dNs = vBatchTicks[i] / dTicksPerNs / nBatchAccounts;
+            int nBucket = 0;
+            while (nBucket < PROFILE_BUCKETS - 1 && std::ldexp(1.0, nBucket) <= dNs)
+                nBucket++;
+            stats.vHistogram[i][nBucket]++;
+        }
+        stats.nSamples++;
+        stats.nSampledAccounts += nBatchAccounts;
+        if (++nUnflushed >= PROFILE_FLUSH)
+            Flush();
+    }
+};
+
+#endif
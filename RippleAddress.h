@@ -27,6 +27,11 @@ public:
     uint128 getSeed() const;
     const std::vector<unsigned char>& getAccountPublic() const;
     void setAccountPublic(const uchar_vector& generator, int seq);
+    void setAccountPublic(CAccountFamily& family, int seq);
+    void setAccountPublic(const std::vector<unsigned char>& vchPublic);
+    std::string humanAccountPublic() const;
+    void setNodePublic(const std::vector<unsigned char>& vchPublic);
+    std::string humanNodePublic() const;
 	std::vector<unsigned char> getAccountPublic(const uchar_vector& generator, int seq);
 	std::vector<unsigned char> getAccountPrivate(const uchar_vector& generator, int seq);
     uint160 getAccountID() const;
@@ -45,7 +50,7 @@ uint128 RippleAddress::getSeed() const
     return uint128(vchData);
 }
 
-static RippleAddress createGeneratorPublic(const RippleAddress& naSeed)
+inline RippleAddress createGeneratorPublic(const RippleAddress& naSeed)
 {
     CKey            ckSeed(naSeed.getSeed());
     RippleAddress   naNew;
@@ -64,6 +69,53 @@ void RippleAddress::setAccountPublic(const uchar_vector& generator, int seq)
     SetData(VER_ACCOUNT_PUBLIC, pubkey.GetPubKey());
 }
 
+void RippleAddress::setAccountPublic(CAccountFamily& family, int seq)
+{
+    std::vector<unsigned char> vchPubKey;
+    if (!family.GetPubKey(seq, vchPubKey))
+        throw std::runtime_error("setAccountPublic : account key derivation failed");
+    SetData(VER_ACCOUNT_PUBLIC, vchPubKey);
+}
+
+void RippleAddress::setAccountPublic(const std::vector<unsigned char>& vchPublic)
+{
+    SetData(VER_ACCOUNT_PUBLIC, vchPublic);
+}
+
+std::string RippleAddress::humanAccountPublic() const
+{
+    switch (nVersion) {
+    case VER_NONE:
+        throw std::runtime_error("unset source - humanAccountPublic");
+
+    case VER_ACCOUNT_PUBLIC:
+        return ToString();
+
+    default:
+        throw std::runtime_error(str(boost::format("bad source: %d") % int(nVersion)));
+    }
+}
+
+// The root public key of a seed, as a validator key.
+void RippleAddress::setNodePublic(const std::vector<unsigned char>& vchPublic)
+{
+    SetData(VER_NODE_PUBLIC, vchPublic);
+}
+
+std::string RippleAddress::humanNodePublic() const
+{
+    switch (nVersion) {
+    case VER_NONE:
+        throw std::runtime_error("unset source - humanNodePublic");
+
+    case VER_NODE_PUBLIC:
+        return ToString();
+
+    default:
+        throw std::runtime_error(str(boost::format("bad source: %d") % int(nVersion)));
+    }
+}
+
 std::vector<unsigned char> RippleAddress::getAccountPublic(const uchar_vector& generator, int seq)
 {
 	CKey    pubkey(generator, seq);
@@ -138,4 +190,30 @@ std::string RippleAddress::humanSeed() const
     }
 }
 
+// Ed25519 seeds ("sEd..."): the same 16 bytes behind a three byte prefix,
+// which the one byte versions above cannot hold.
+static const unsigned char ED25519_SEED_PREFIX[3] = { 0x01, 0xE1, 0x4B };
+
+inline std::string humanEd25519Seed(const uint128& seed)
+{
+    std::vector<unsigned char> vch(ED25519_SEED_PREFIX, ED25519_SEED_PREFIX + 3);
+    vch.insert(vch.end(), seed.begin(), seed.end());
+    std::string str = EncodeBase58Check(vch);
+    memset(&vch[0], 0, vch.size());
+    return str;
+}
+
+// False unless str is an "sEd..." seed.
+inline bool parseEd25519Seed(const std::string& str, uint128& seed)
+{
+    std::vector<unsigned char> vch;
+    DecodeBase58Check(str, vch);
+    bool success = vch.size() == 3 + 16 && memcmp(&vch[0], ED25519_SEED_PREFIX, 3) == 0;
+    if (success)
+        memcpy(seed.begin(), &vch[3], 16);
+    if (!vch.empty())
+        memset(&vch[0], 0, vch.size());
+    return success;
+}
+
 #endif
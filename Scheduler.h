@@ -0,0 +1,233 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include "types.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/atomic.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+// A half open range of keyspace counters handed to one worker at a time.
+struct CChunk
+{
+    uint64 nBegin;
+    uint64 nEnd;
+
+    CChunk() : nBegin(0), nEnd(0)
+    {
+    }
+
+    CChunk(uint64 nBeginIn, uint64 nEndIn) : nBegin(nBeginIn), nEnd(nEndIn)
+    {
+    }
+
+    uint64 Size() const
+    {
+        return nEnd - nBegin;
+    }
+};
+
+// Work-stealing chunk scheduler.
+//
+// Every worker owns a deque of chunks.  It pops from the front of its own
+// deque, refills it from the shared range when empty and, once the shared
+// range is exhausted, steals half of the queue of the busiest worker.  The
+// chunk size of each worker follows its measured throughput so that every
+// chunk takes roughly dTargetSeconds: slow cores (E-cores, noisy neighbours)
+// carve small chunks and fast cores large ones, and the tail of a finite
+// range is split evenly between whoever is still idle.
+class CChunkScheduler
+{
+protected:
+    enum { PREFETCH_CHUNKS = 2 };
+
+    struct CWorker
+    {
+        boost::mutex        lock;
+        std::deque<CChunk>  dqChunks;
+        uint64              nChunkSize;
+        double              dRate;          // candidates per second, smoothed
+        char                pad[64];        // keep workers off each other's cache lines
+    };
+
+    boost::mutex            lockRange;
+    uint64                  nNext;
+    uint64                  nEnd;
+    uint64                  nMinChunk;
+    uint64                  nMaxChunk;
+    double                  dTargetSeconds;
+    std::vector<CWorker*>   vpWorkers;
+    boost::atomic<bool>     fStopped;
+
+    // Carve up to nCount chunks of nSize from the shared range.
+    bool Carve(CWorker& worker, uint64 nSize, unsigned int nCount)
+    {
+        std::vector<CChunk> vChunks;
+        {
+            boost::unique_lock<boost::mutex> lock(lockRange);
+            for (unsigned int i = 0; i < nCount && nNext != nEnd; i++)
+            {
+                uint64 nTake = std::min(nSize, nEnd - nNext);
+                vChunks.push_back(CChunk(nNext, nNext + nTake));
+                nNext += nTake;
+            }
+        }
+        if (vChunks.empty())
+            return false;
+
+        boost::unique_lock<boost::mutex> lock(worker.lock);
+        worker.dqChunks.insert(worker.dqChunks.end(), vChunks.begin(), vChunks.end());
+        return true;
+    }
+
+    // Move half of the busiest worker's queue into ours.  A lone queued chunk
+    // is split in two.  Only one worker lock is ever held at a time.
+    bool Steal(unsigned int nThief)
+    {
+        unsigned int nVictim = nThief;
+        size_t nBest = 0;
+        uint64 nBestWork = 0;
+        for (unsigned int i = 0; i < vpWorkers.size(); i++)
+        {
+            if (i == nThief)
+                continue;
+            boost::unique_lock<boost::mutex> lock(vpWorkers[i]->lock);
+            uint64 nWork = 0;
+            for (size_t j = 0; j < vpWorkers[i]->dqChunks.size(); j++)
+                nWork += vpWorkers[i]->dqChunks[j].Size();
+            if (nWork > nBestWork)
+            {
+                nVictim = i;
+                nBestWork = nWork;
+                nBest = vpWorkers[i]->dqChunks.size();
+            }
+        }
+        if (nVictim == nThief || nBest == 0)
+            return false;
+
+        std::vector<CChunk> vStolen;
+        {
+            CWorker& victim = *vpWorkers[nVictim];
+            boost::unique_lock<boost::mutex> lock(victim.lock);
+            size_t nQueued = victim.dqChunks.size();
+            if (nQueued == 0)
+                return false;
+            if (nQueued == 1)
+            {
+                CChunk& last = victim.dqChunks.back();
+                if (last.Size() < 2)
+                {
+                    vStolen.push_back(last);
+                    victim.dqChunks.pop_back();
+                }
+                else
+                {
+                    uint64 nMid = last.nBegin + last.Size() / 2;
+                    vStolen.push_back(CChunk(nMid, last.nEnd));
+                    last.nEnd = nMid;
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < nQueued / 2; i++)
+                {
+                    vStolen.push_back(victim.dqChunks.back());
+                    victim.dqChunks.pop_back();
+                }
+                std::reverse(vStolen.begin(), vStolen.end());
+            }
+        }
+
+        CWorker& thief = *vpWorkers[nThief];
+        boost::unique_lock<boost::mutex> lock(thief.lock);
+        thief.dqChunks.insert(thief.dqChunks.end(), vStolen.begin(), vStolen.end());
+        return true;
+    }
+
+public:
+    CChunkScheduler(unsigned int nWorkers, uint64 nBegin, uint64 nEndIn,
+                    uint64 nInitialChunk = 1024, double dTargetSecondsIn = 0.25)
+        : nNext(nBegin), nEnd(nEndIn), nMinChunk(16), nMaxChunk(1ull << 24),
+          dTargetSeconds(dTargetSecondsIn), fStopped(false)
+    {
+        for (unsigned int i = 0; i < nWorkers; i++)
+        {
+            CWorker* pWorker = new CWorker;
+            pWorker->nChunkSize = nInitialChunk;
+            pWorker->dRate = 0;
+            vpWorkers.push_back(pWorker);
+        }
+    }
+
+    ~CChunkScheduler()
+    {
+        for (size_t i = 0; i < vpWorkers.size(); i++)
+            delete vpWorkers[i];
+    }
+
+    // Fetch the next chunk for worker nWorker.  Returns false once the range
+    // is exhausted and no queued work is left anywhere, or after Stop().
+    bool Next(unsigned int nWorker, CChunk& chunk)
+    {
+        CWorker& worker = *vpWorkers[nWorker];
+        while (!fStopped)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(worker.lock);
+                if (!worker.dqChunks.empty())
+                {
+                    chunk = worker.dqChunks.front();
+                    worker.dqChunks.pop_front();
+                    return true;
+                }
+            }
+
+            uint64 nSize;
+            {
+                boost::unique_lock<boost::mutex> lock(worker.lock);
+                nSize = worker.nChunkSize;
+            }
+            if (!Carve(worker, nSize, PREFETCH_CHUNKS) && !Steal(nWorker))
+                return false;
+        }
+        return false;
+    }
+
+    // Feed back how long the last chunk took, so the next ones are sized to
+    // this worker's speed.
+    void Report(unsigned int nWorker, uint64 nDone, double dSeconds)
+    {
+        if (nDone == 0 || dSeconds <= 0)
+            return;
+
+        CWorker& worker = *vpWorkers[nWorker];
+        double dRate = nDone / dSeconds;
+
+        boost::unique_lock<boost::mutex> lock(worker.lock);
+        worker.dRate = worker.dRate == 0 ? dRate : 0.7 * worker.dRate + 0.3 * dRate;
+        uint64 nSize = static_cast<uint64>(worker.dRate * dTargetSeconds);
+        worker.nChunkSize = std::max(nMinChunk, std::min(nMaxChunk, nSize));
+    }
+
+    double GetRate(unsigned int nWorker)
+    {
+        boost::unique_lock<boost::mutex> lock(vpWorkers[nWorker]->lock);
+        return vpWorkers[nWorker]->dRate;
+    }
+
+    void Stop()
+    {
+        fStopped = true;
+    }
+
+    bool IsStopped() const
+    {
+        return fStopped;
+    }
+};
+
+#endif
@@ -0,0 +1,426 @@
+#ifndef __SCORE_H__
+#define __SCORE_H__
+
+#include "RippleAddress.h"
+#include "uint256.h"
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Best-effort search (--score): instead of waiting for an exact pattern, each
+// candidate's leading base58 digits get a score and the best K accounts found
+// are kept, so a fixed time budget always ends with the best it could buy.
+//
+// Every search thread keeps its own top K and, when that changes, publishes a
+// copy through an atomic pointer slot.  The reporter takes the copies out of
+// the slots, merges them into the overall top K and prints what got in.  The
+// hot path only scores and compares against the thread's K-th best; nothing
+// is locked or shared until a candidate gets into a thread's top K.
+
+// digits scored, the leading "r" included
+static const int SCORE_DIGITS = 16;
+
+// The leading SCORE_DIGITS characters of an account id's "r..." form.
+//
+// They come from hash160 || 0000 in place of hash160 || checksum: the checksum
+// only reaches the first sixteen digits through a carry, about once in 2^67.
+inline void getLeadingDigits(const uint160& accountID, char* pDigits)
+{
+    const unsigned char* p = accountID.begin();
+    int nZeros = 0;
+    while (nZeros < 20 && p[nZeros] == 0)
+        nZeros++;
+
+    // 192 bits as six 32-bit limbs, most significant first, divided by 58^5
+    // for five digits at a time
+    uint32 pLimbs[6];
+    for (int i = 0; i < 5; i++)
+        pLimbs[i] = ((uint32) p[4 * i] << 24) | ((uint32) p[4 * i + 1] << 16) | ((uint32) p[4 * i + 2] << 8) | p[4 * i + 3];
+    pLimbs[5] = 0;
+    char pAll[35];
+    int nAll = 0;
+    for (int nRound = 0; nRound < 7; nRound++)
+    {
+        uint64 nRest = 0;
+        for (int i = 0; i < 6; i++)
+        {
+            uint64 n = (nRest << 32) | pLimbs[i];
+            pLimbs[i] = (uint32) (n / 656356768);   // 58^5
+            nRest = n % 656356768;
+        }
+        for (int j = 0; j < 5; j++)
+        {
+            pAll[nAll++] = ALPHABET[nRest % 58];
+            nRest /= 58;
+        }
+    }
+    while (nAll > 0 && pAll[nAll - 1] == ALPHABET[0])
+        nAll--;
+
+    // one "r" for the version byte and one per leading zero byte
+    int n = 0;
+    for (int i = 0; i <= nZeros && n < SCORE_DIGITS; i++)
+        pDigits[n++] = ALPHABET[0];
+    while (n < SCORE_DIGITS && nAll > 0)
+        pDigits[n++] = pAll[--nAll];
+    while (n < SCORE_DIGITS)
+        pDigits[n++] = ALPHABET[0];
+}
+
+// A scoring function of the leading digits; higher is better, 0 or less is
+// never kept.
+class CScorer
+{
+public:
+    virtual ~CScorer()
+    {
+    }
+
+    virtual double Score(const char* pDigits) const = 0;
+};
+
+// Longest run of one character after the "r".
+class CRepeatScorer : public CScorer
+{
+public:
+    double Score(const char* pDigits) const
+    {
+        int nBest = 1, nRun = 1;
+        for (int i = 2; i < SCORE_DIGITS; i++)
+        {
+            nRun = pDigits[i] == pDigits[i - 1] ? nRun + 1 : 1;
+            nBest = std::max(nBest, nRun);
+        }
+        return nBest;
+    }
+};
+
+inline char lowerDigit(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// Characters of a target the address starts with, ignoring case, plus a
+// fraction for those in the same case.
+inline double scorePrefix(const char* pDigits, int nStart, const std::string& str)
+{
+    int nSame = 0, nExact = 0;
+    while (nSame < (int) str.size() && nStart + nSame < SCORE_DIGITS
+           && lowerDigit(pDigits[nStart + nSame]) == lowerDigit(str[nSame]))
+    {
+        nExact += pDigits[nStart + nSame] == str[nSame];
+        nSame++;
+    }
+    return nSame + (double) nExact / (SCORE_DIGITS + 1);
+}
+
+// How far the address follows one target, "match:rXRPL".
+class CMatchScorer : public CScorer
+{
+protected:
+    std::string strTarget;
+
+public:
+    explicit CMatchScorer(const std::string& strTargetIn) : strTarget(strTargetIn)
+    {
+    }
+
+    double Score(const char* pDigits) const
+    {
+        return scorePrefix(pDigits, 0, strTarget);
+    }
+};
+
+// Longest word of a dictionary the address starts with after the "r",
+// ignoring case, "words:<path>".
+class CWordsScorer : public CScorer
+{
+protected:
+    std::vector<std::string> vWords;    // lower case, sorted
+
+public:
+    bool Load(const std::string& strPath, std::string& msg)
+    {
+        std::ifstream in(strPath.c_str());
+        if (!in)
+        {
+            msg = "Cannot open " + strPath;
+            return false;
+        }
+        std::string strAlphabet = ALPHABET;
+        for (size_t i = 0; i < strAlphabet.size(); i++)
+            strAlphabet[i] = lowerDigit(strAlphabet[i]);
+        std::string strLine;
+        while (std::getline(in, strLine))
+        {
+            size_t nBegin = strLine.find_first_not_of(" \t\r");
+            if (nBegin == std::string::npos || strLine[nBegin] == '#')
+                continue;
+            std::string strWord = strLine.substr(nBegin, strLine.find_last_not_of(" \t\r") + 1 - nBegin);
+            for (size_t i = 0; i < strWord.size(); i++)
+                strWord[i] = lowerDigit(strWord[i]);
+            // words no address can spell
+            if (strWord.find_first_not_of(strAlphabet) == std::string::npos)
+                vWords.push_back(strWord);
+        }
+        std::sort(vWords.begin(), vWords.end());
+        vWords.erase(std::unique(vWords.begin(), vWords.end()), vWords.end());
+        if (vWords.empty())
+        {
+            msg = "No usable words in " + strPath;
+            return false;
+        }
+        return true;
+    }
+
+    double Score(const char* pDigits) const
+    {
+        char pLower[SCORE_DIGITS];
+        for (int i = 0; i < SCORE_DIGITS; i++)
+            pLower[i] = lowerDigit(pDigits[i]);
+
+        // narrow the range of words sharing a longer and longer prefix
+        std::vector<std::string>::const_iterator itBegin = vWords.begin(), itEnd = vWords.end();
+        int nBest = 0;
+        for (int n = 1; n < SCORE_DIGITS && itBegin != itEnd; n++)
+        {
+            std::string strPrefix(pLower + 1, n);
+            itBegin = std::lower_bound(itBegin, itEnd, strPrefix);
+            std::string strNext = strPrefix;
+            strNext[n - 1]++;
+            itEnd = std::lower_bound(itBegin, itEnd, strNext);
+            if (itBegin != itEnd && *itBegin == strPrefix)
+                nBest = n;
+        }
+        return nBest == 0 ? 0 : scorePrefix(pDigits, 1, std::string(pLower + 1, nBest));
+    }
+};
+
+// "repeat", "match:<target>" or "words:<path>"; NULL and a message if unknown.
+inline CScorer* NewScorer(const std::string& strSpec, std::string& msg)
+{
+    if (strSpec == "repeat")
+        return new CRepeatScorer();
+    if (strSpec.compare(0, 6, "match:") == 0 && strSpec.size() > 6)
+        return new CMatchScorer(strSpec.substr(6));
+    if (strSpec.compare(0, 6, "words:") == 0)
+    {
+        CWordsScorer* pScorer = new CWordsScorer();
+        if (!pScorer->Load(strSpec.substr(6), msg))
+        {
+            delete pScorer;
+            return NULL;
+        }
+        return pScorer;
+    }
+    msg = "Unknown score \"" + strSpec + "\", available: repeat match:<target> words:<path>";
+    return NULL;
+}
+
+struct CScoreEntry
+{
+    double      dScore;
+    uint160     accountID;
+    std::string strRecord;  // as a hit would print it
+
+    bool operator<(const CScoreEntry& other) const
+    {
+        return dScore > other.dScore;   // best first
+    }
+};
+
+typedef std::vector<CScoreEntry> CScoreList;
+
+class CScoreBoard
+{
+protected:
+    CScorer*                                        pScorer;
+    unsigned int                                    nTop;
+    boost::scoped_array<boost::atomic<CScoreList*> > pSlots;    // per thread, owned by whoever takes it out
+    unsigned int                                    nSlots;
+    boost::atomic<unsigned int>                     nRegistered;
+    CScoreList                                      vBest;      // reporter side, best first
+
+    CScoreBoard(const CScoreBoard&);
+    CScoreBoard& operator=(const CScoreBoard&);
+
+public:
+    CScoreBoard() : pScorer(NULL), nTop(0), nSlots(0), nRegistered(0)
+    {
+    }
+
+    ~CScoreBoard()
+    {
+        for (unsigned int i = 0; i < nSlots; i++)
+            delete pSlots[i].load();
+        delete pScorer;
+    }
+
+    // The one of this process's search.
+    static CScoreBoard& Instance()
+    {
+        static CScoreBoard board;
+        return board;
+    }
+
+    bool Open(const std::string& strSpec, unsigned int nTopIn, unsigned int nThreads, std::string& msg)
+    {
+        pScorer = NewScorer(strSpec, msg);
+        if (pScorer == NULL)
+            return false;
+        nTop = nTopIn;
+        nSlots = nThreads;
+        pSlots.reset(new boost::atomic<CScoreList*>[nSlots]);
+        for (unsigned int i = 0; i < nSlots; i++)
+            pSlots[i] = NULL;
+        return true;
+    }
+
+    const CScorer& GetScorer() const
+    {
+        return *pScorer;
+    }
+
+    unsigned int GetTop() const
+    {
+        return nTop;
+    }
+
+    // Search thread side.
+
+    unsigned int Register()
+    {
+        unsigned int nSlot = nRegistered++;
+        if (nSlot >= nSlots)
+            throw std::runtime_error("Too many score board threads");
+        return nSlot;
+    }
+
+    // Replace what the thread published last, if not yet collected.
+    void Publish(unsigned int nSlot, const CScoreList& vList)
+    {
+        delete pSlots[nSlot].exchange(new CScoreList(vList));
+    }
+
+    // Reporter side: merge what the threads published since the last call,
+    // appending the entries that got into the overall top K.
+    void Collect(CScoreList& vNew)
+    {
+        size_t nFirst = vNew.size();
+        for (unsigned int i = 0; i < nSlots; i++)
+        {
+            CScoreList* pList = pSlots[i].exchange(NULL);
+            if (pList == NULL)
+                continue;
+            for (size_t j = 0; j < pList->size(); j++)
+            {
+                const CScoreEntry& entry = (*pList)[j];
+                if (vBest.size() >= nTop && !(entry.dScore > vBest.back().dScore))
+                    continue;
+                bool fKnown = false;
+                for (size_t k = 0; k < vBest.size() && !fKnown; k++)
+                    fKnown = vBest[k].accountID == entry.accountID;
+                if (fKnown)
+                    continue;
+                vBest.insert(std::upper_bound(vBest.begin(), vBest.end(), entry), entry);
+                if (vBest.size() > nTop)
+                    vBest.pop_back();
+                vNew.push_back(entry);
+            }
+            delete pList;
+        }
+
+        // only those still in after the whole merge
+        size_t nKept = nFirst;
+        for (size_t i = nFirst; i < vNew.size(); i++)
+        {
+            bool fIn = false;
+            for (size_t k = 0; k < vBest.size() && !fIn; k++)
+                fIn = vBest[k].accountID == vNew[i].accountID;
+            if (fIn)
+                vNew[nKept++] = vNew[i];
+        }
+        vNew.resize(nKept);
+        std::stable_sort(vNew.begin() + nFirst, vNew.end());
+    }
+
+    const CScoreList& GetBest() const
+    {
+        return vBest;
+    }
+
+    // 1-based rank of an account in the overall top K, 0 if out
+    size_t GetRank(const uint160& accountID) const
+    {
+        for (size_t i = 0; i < vBest.size(); i++)
+            if (vBest[i].accountID == accountID)
+                return i + 1;
+        return 0;
+    }
+};
+
+// Matcher policy (Matcher.h) of --score: matches what beats the thread's K-th
+// best.  Matches are kept in the thread's top K instead of being reported
+// (see reportHit in ripplegen.cpp).
+class CScoreMatcher
+{
+protected:
+    CScoreBoard&    board;
+    const CScorer&  scorer;
+    unsigned int    nSlot;
+    CScoreList      vTop;       // best first, at most K
+    double          dFloor;     // score to beat
+
+    CScoreMatcher(const CScoreMatcher&);
+    CScoreMatcher& operator=(const CScoreMatcher&);
+
+public:
+    explicit CScoreMatcher(const std::string&)
+        : board(CScoreBoard::Instance()), scorer(board.GetScorer()), dFloor(0)
+    {
+        nSlot = board.Register();
+    }
+
+    void Refresh()
+    {
+    }
+
+    bool Match(const uint160& accountID) const
+    {
+        char pDigits[SCORE_DIGITS];
+        getLeadingDigits(accountID, pDigits);
+        return scorer.Score(pDigits) > dFloor;
+    }
+
+    bool Claim(const uint160&)
+    {
+        return true;
+    }
+
+    void Keep(const uint160& accountID, const std::string& strRecord)
+    {
+        char pDigits[SCORE_DIGITS];
+        getLeadingDigits(accountID, pDigits);
+        CScoreEntry entry;
+        entry.dScore = scorer.Score(pDigits);
+        entry.accountID = accountID;
+        entry.strRecord = strRecord;
+        vTop.insert(std::upper_bound(vTop.begin(), vTop.end(), entry), entry);
+        if (vTop.size() > board.GetTop())
+            vTop.pop_back();
+        if (vTop.size() == board.GetTop())
+            dFloor = vTop.back().dScore;
+        board.Publish(nSlot, vTop);
+    }
+};
+
+#endif
@@ -0,0 +1,627 @@
+#ifndef __SECP256K1_H__
+#define __SECP256K1_H__
+
+#include "types.h"
+#include "Arena.h"
+
+#include <boost/thread/once.hpp>
+
+#include <openssl/crypto.h>
+
+#include <cstring>
+#include <vector>
+
+// Native secp256k1 arithmetic for the search loop.
+//
+// Only what deriving public keys needs: field elements mod p as four 64-bit
+// limbs, Jacobian points, and k*G from a precomputed table of fixed windows
+// (6 bits by default: 43 windows of 63 affine points, 170 KB, built once per
+// process).  No scalar arithmetic mod n is needed since every key is a
+// multiple of G.
+//
+// k*G of a secret k runs in constant time: the field arithmetic has no data
+// dependent branches, CGeneratorTable::Mul reads every entry of a window and
+// picks the digit's with masks, and a zero digit is added and masked out like
+// any other.  The other point operations branch on their inputs and serve
+// public data only (split-key offsets, table building).  Nothing here is
+// meant for signing.
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#define USE_NATIVE_SECP256K1 1
+#elif defined(__SIZEOF_INT128__)
+#define USE_NATIVE_SECP256K1 1
+#endif
+
+#ifdef USE_NATIVE_SECP256K1
+
+static const uint64 SECP256K1_C = 0x1000003D1ull;     // 2^256 - p
+
+// 64x64 -> 128 bit product, returns the low half.
+inline uint64 mul64(uint64 a, uint64 b, uint64& hi)
+{
+#if defined(_MSC_VER)
+    return _umul128(a, b, &hi);
+#else
+    unsigned __int128 r = (unsigned __int128) a * b;
+    hi = (uint64) (r >> 64);
+    return (uint64) r;
+#endif
+}
+
+// a + b + carry, carry out in carry.
+inline uint64 addc64(uint64 a, uint64 b, uint64& carry)
+{
+    uint64 r = a + carry;
+    uint64 c = r < carry;
+    r += b;
+    carry = c + (r < b);
+    return r;
+}
+
+// a - b - borrow, borrow out in borrow.
+inline uint64 subb64(uint64 a, uint64 b, uint64& borrow)
+{
+    uint64 t = a - b;
+    uint64 c = a < b;
+    uint64 r = t - borrow;
+    c += t < borrow;
+    borrow = c;
+    return r;
+}
+
+// (c0, c1, c2) += a * b
+inline void mulacc64(uint64& c0, uint64& c1, uint64& c2, uint64 a, uint64 b)
+{
+    uint64 hi, lo = mul64(a, b, hi);
+    c0 += lo;
+    hi += c0 < lo;
+    c1 += hi;
+    c2 += c1 < hi;
+}
+
+// Field element, little-endian limbs, any value below 2^256 (not necessarily
+// below p until feNormalize).
+struct CFieldElement
+{
+    uint64 n[4];
+};
+
+inline void feSetInt(CFieldElement& r, uint64 a)
+{
+    r.n[0] = a;
+    r.n[1] = r.n[2] = r.n[3] = 0;
+}
+
+inline void feSetBytes(CFieldElement& r, const unsigned char* p32)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint64 w = 0;
+        for (int j = 0; j < 8; j++)
+            w = (w << 8) | p32[8 * (3 - i) + j];
+        r.n[i] = w;
+    }
+}
+
+// Caller normalizes first.
+inline void feGetBytes(unsigned char* p32, const CFieldElement& a)
+{
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 8; j++)
+            p32[8 * (3 - i) + j] = (unsigned char) (a.n[i] >> (56 - 8 * j));
+}
+
+// Reduce to [0, p).
+inline void feNormalize(CFieldElement& r)
+{
+    if (r.n[3] == ~0ull && r.n[2] == ~0ull && r.n[1] == ~0ull && r.n[0] >= 0xFFFFFFFEFFFFFC2Full)
+    {
+        r.n[0] -= 0xFFFFFFFEFFFFFC2Full;
+        r.n[1] = r.n[2] = r.n[3] = 0;
+    }
+}
+
+inline bool feIsZero(const CFieldElement& a)
+{
+    CFieldElement t = a;
+    feNormalize(t);
+    return (t.n[0] | t.n[1] | t.n[2] | t.n[3]) == 0;
+}
+
+inline bool feEqual(const CFieldElement& a, const CFieldElement& b)
+{
+    CFieldElement x = a, y = b;
+    feNormalize(x);
+    feNormalize(y);
+    return memcmp(x.n, y.n, sizeof(x.n)) == 0;
+}
+
+// r += carry * 2^256, folded back as carry * C.  The first fold carries out
+// at most 1 and the second never, so both always run: no branch on the value.
+inline void feFold(CFieldElement& r, uint64 carry)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        uint64 hi, lo = mul64(carry, SECP256K1_C, hi);
+        carry = 0;
+        r.n[0] = addc64(r.n[0], lo, carry);
+        r.n[1] = addc64(r.n[1], hi, carry);
+        r.n[2] = addc64(r.n[2], 0, carry);
+        r.n[3] = addc64(r.n[3], 0, carry);
+    }
+}
+
+inline void feAdd(CFieldElement& r, const CFieldElement& a, const CFieldElement& b)
+{
+    uint64 carry = 0;
+    for (int i = 0; i < 4; i++)
+        r.n[i] = addc64(a.n[i], b.n[i], carry);
+    feFold(r, carry);
+}
+
+inline void feSub(CFieldElement& r, const CFieldElement& a, const CFieldElement& b)
+{
+    uint64 borrow = 0;
+    for (int i = 0; i < 4; i++)
+        r.n[i] = subb64(a.n[i], b.n[i], borrow);
+    // wrapped by 2^256: subtract C (adding p), twice at most, always twice
+    for (int i = 0; i < 2; i++)
+    {
+        uint64 b2 = 0;
+        r.n[0] = subb64(r.n[0], SECP256K1_C & (0 - borrow), b2);
+        r.n[1] = subb64(r.n[1], 0, b2);
+        r.n[2] = subb64(r.n[2], 0, b2);
+        r.n[3] = subb64(r.n[3], 0, b2);
+        borrow = b2;
+    }
+}
+
+// r = a where fMask is all ones, r where it is 0.
+inline void feCmov(CFieldElement& r, const CFieldElement& a, uint64 fMask)
+{
+    for (int i = 0; i < 4; i++)
+        r.n[i] ^= (r.n[i] ^ a.n[i]) & fMask;
+}
+
+// 512-bit t -> r, using 2^256 = C (mod p).
+inline void feReduce(CFieldElement& r, const uint64* t)
+{
+    uint64 c0 = 0, c1 = 0, c2 = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        mulacc64(c0, c1, c2, t[4 + i], SECP256K1_C);
+        c0 += t[i];
+        uint64 k = c0 < t[i];
+        c1 += k;
+        c2 += c1 < k;
+        r.n[i] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    feFold(r, c0);
+}
+
+inline void feMul(CFieldElement& r, const CFieldElement& a, const CFieldElement& b)
+{
+    uint64 t[8];
+    uint64 c0 = 0, c1 = 0, c2 = 0;
+    for (int k = 0; k < 7; k++)
+    {
+        for (int i = (k < 4 ? 0 : k - 3); i <= (k < 4 ? k : 3); i++)
+            mulacc64(c0, c1, c2, a.n[i], b.n[k - i]);
+        t[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    t[7] = c0;
+    feReduce(r, t);
+}
+
+inline void feSqr(CFieldElement& r, const CFieldElement& a)
+{
+    feMul(r, a, a);
+}
+
+// a^e for a big-endian 32 byte exponent, 4-bit fixed window.
+inline void fePow(CFieldElement& r, const CFieldElement& a, const unsigned char* e32)
+{
+    CFieldElement vPow[16];
+    feSetInt(vPow[0], 1);
+    vPow[1] = a;
+    for (int i = 2; i < 16; i++)
+        feMul(vPow[i], vPow[i - 1], a);
+
+    CFieldElement x;
+    feSetInt(x, 1);
+    for (int i = 0; i < 64; i++)
+    {
+        if (i)
+            for (int j = 0; j < 4; j++)
+                feSqr(x, x);
+        int nDigit = (e32[i / 2] >> (i & 1 ? 0 : 4)) & 0xf;
+        if (nDigit)
+            feMul(x, x, vPow[nDigit]);
+    }
+    r = x;
+}
+
+inline void feInv(CFieldElement& r, const CFieldElement& a)
+{
+    static const unsigned char pMinus2[32] = {
+        0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff,
+        0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xfe, 0xff,0xff,0xfc,0x2d };
+    fePow(r, a, pMinus2);
+}
+
+// Square root if a is a square (p = 3 mod 4), false otherwise.
+inline bool feSqrt(CFieldElement& r, const CFieldElement& a)
+{
+    static const unsigned char pPlus1Div4[32] = {
+        0x3f,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff,
+        0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xbf,0xff,0xff,0x0c };
+    CFieldElement x, x2;
+    fePow(x, a, pPlus1Div4);
+    feSqr(x2, x);
+    r = x;
+    return feEqual(x2, a);
+}
+
+struct CAffinePoint
+{
+    CFieldElement x, y;
+};
+
+struct CJacobianPoint
+{
+    CFieldElement x, y, z;
+    bool fInfinity;
+};
+
+inline void gejSetInfinity(CJacobianPoint& r)
+{
+    r.fInfinity = true;
+}
+
+inline void gejSetAffine(CJacobianPoint& r, const CAffinePoint& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    feSetInt(r.z, 1);
+    r.fInfinity = false;
+}
+
+// r = 2a (a = 0 curve, dbl-2009-l)
+inline void gejDouble(CJacobianPoint& r, const CJacobianPoint& a)
+{
+    if (a.fInfinity || feIsZero(a.y))
+    {
+        r.fInfinity = true;
+        return;
+    }
+    CFieldElement A, B, C, D, E, F, t;
+    feSqr(A, a.x);
+    feSqr(B, a.y);
+    feSqr(C, B);
+    feAdd(t, a.x, B);
+    feSqr(D, t);
+    feSub(D, D, A);
+    feSub(D, D, C);
+    feAdd(D, D, D);
+    feAdd(E, A, A);
+    feAdd(E, E, A);
+    feSqr(F, E);
+
+    feMul(r.z, a.y, a.z);
+    feAdd(r.z, r.z, r.z);
+    feSub(r.x, F, D);
+    feSub(r.x, r.x, D);
+    feSub(t, D, r.x);
+    feMul(r.y, E, t);
+    feAdd(C, C, C);
+    feAdd(C, C, C);
+    feAdd(C, C, C);
+    feSub(r.y, r.y, C);
+    r.fInfinity = false;
+}
+
+// r = a + b, b affine.  r may alias a.
+inline void gejAddAffine(CJacobianPoint& r, const CJacobianPoint& a, const CAffinePoint& b)
+{
+    if (a.fInfinity)
+    {
+        gejSetAffine(r, b);
+        return;
+    }
+    CFieldElement Z2, U2, S2, H, R, H2, H3, V, t;
+    feSqr(Z2, a.z);
+    feMul(U2, b.x, Z2);
+    feMul(S2, b.y, Z2);
+    feMul(S2, S2, a.z);
+    feSub(H, U2, a.x);
+    feSub(R, S2, a.y);
+    if (feIsZero(H))
+    {
+        if (feIsZero(R))
+            gejDouble(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    feSqr(H2, H);
+    feMul(H3, H2, H);
+    feMul(V, a.x, H2);
+
+    feMul(r.z, a.z, H);
+    feSqr(t, R);
+    feSub(t, t, H3);
+    feSub(t, t, V);
+    feSub(t, t, V);
+    feSub(V, V, t);
+    feMul(V, V, R);
+    feMul(H3, H3, a.y);
+    feSub(r.y, V, H3);
+    r.x = t;
+    r.fInfinity = false;
+}
+
+// r = a + b without branches, for a not at infinity and a != +-b: the sums
+// of CGeneratorTable::Mul.  r may alias a.
+inline void gejAddAffineDistinct(CJacobianPoint& r, const CJacobianPoint& a, const CAffinePoint& b)
+{
+    CFieldElement Z2, U2, S2, H, R, H2, H3, V, t;
+    feSqr(Z2, a.z);
+    feMul(U2, b.x, Z2);
+    feMul(S2, b.y, Z2);
+    feMul(S2, S2, a.z);
+    feSub(H, U2, a.x);
+    feSub(R, S2, a.y);
+    feSqr(H2, H);
+    feMul(H3, H2, H);
+    feMul(V, a.x, H2);
+
+    feMul(r.z, a.z, H);
+    feSqr(t, R);
+    feSub(t, t, H3);
+    feSub(t, t, V);
+    feSub(t, t, V);
+    feSub(V, V, t);
+    feMul(V, V, R);
+    feMul(H3, H3, a.y);
+    feSub(r.y, V, H3);
+    r.x = t;
+    r.fInfinity = false;
+}
+
+// False for the point at infinity.
+inline bool gejGetAffine(CAffinePoint& r, const CJacobianPoint& a)
+{
+    if (a.fInfinity)
+        return false;
+    CFieldElement zi, zi2, zi3;
+    feInv(zi, a.z);
+    feSqr(zi2, zi);
+    feMul(zi3, zi2, zi);
+    feMul(r.x, a.x, zi2);
+    feMul(r.y, a.y, zi3);
+    feNormalize(r.x);
+    feNormalize(r.y);
+    return true;
+}
+
+inline void geGetCompressed(unsigned char* p33, const CAffinePoint& a)
+{
+    p33[0] = 0x02 | (unsigned char) (a.y.n[0] & 1);
+    feGetBytes(p33 + 1, a.x);
+}
+
+inline bool geSetCompressed(CAffinePoint& r, const unsigned char* p33)
+{
+    if (p33[0] != 0x02 && p33[0] != 0x03)
+        return false;
+    feSetBytes(r.x, p33 + 1);
+    CFieldElement x = r.x, rhs, seven;
+    feNormalize(x);
+    if (memcmp(x.n, r.x.n, sizeof(x.n)) != 0)
+        return false;   // x >= p
+
+    feSqr(rhs, r.x);
+    feMul(rhs, rhs, r.x);
+    feSetInt(seven, 7);
+    feAdd(rhs, rhs, seven);
+    if (!feSqrt(r.y, rhs))
+        return false;
+    feNormalize(r.y);
+    if ((r.y.n[0] & 1) != (uint64) (p33[0] & 1))
+    {
+        CFieldElement zero;
+        feSetInt(zero, 0);
+        feSub(r.y, zero, r.y);
+        feNormalize(r.y);
+    }
+    return true;
+}
+
+// Window width of the k*G tables, process wide and set before the first
+// backend is made (--autotune tries them).  Narrower windows cost more
+// additions, wider ones more entries to scan per window: 4 bits is 64
+// additions over 15 entries each, 8 bits 32 over 255.
+static const int GENERATOR_WINDOW_MIN = 4;
+static const int GENERATOR_WINDOW_MAX = 8;
+static const int GENERATOR_WINDOW_DEFAULT = 6;
+
+inline int& GeneratorWindowSetting()
+{
+    static int nBits = GENERATOR_WINDOW_DEFAULT;
+    return nBits;
+}
+
+inline int GetGeneratorWindow()
+{
+    return GeneratorWindowSetting();
+}
+
+inline bool SetGeneratorWindow(int nBits)
+{
+    if (nBits < GENERATOR_WINDOW_MIN || nBits > GENERATOR_WINDOW_MAX)
+        return false;
+    GeneratorWindowSetting() = nBits;
+    return true;
+}
+
+// Bits [nBit, nBit + nBits) of a big-endian 256 bit scalar, nBits <= 8.
+inline unsigned int getScalarBits(const unsigned char* k32, int nBit, int nBits)
+{
+    int nByte = 31 - nBit / 8;
+    if (nByte < 0)
+        return 0;
+    unsigned int n = k32[nByte];
+    if (nByte > 0)
+        n |= k32[nByte - 1] << 8;
+    return (n >> (nBit % 8)) & ((1 << nBits) - 1);
+}
+
+// k*G from nBits wide windows: table[w][j - 1] = j * 2^(nBits w) * G.
+class CGeneratorTable
+{
+protected:
+    int nBits;
+    int nWindows;
+    int nEntries;       // per window, 2^nBits - 1
+    std::vector<CAffinePoint, CArenaAllocator<CAffinePoint> > vTable;
+
+    static void Build(CGeneratorTable* pTable, int nBits)
+    {
+        static const unsigned char pG[33] = { 0x02,
+            0x79,0xbe,0x66,0x7e, 0xf9,0xdc,0xbb,0xac, 0x55,0xa0,0x62,0x95, 0xce,0x87,0x0b,0x07,
+            0x02,0x9b,0xfc,0xdb, 0x2d,0xce,0x28,0xd9, 0x59,0xf2,0x81,0x5b, 0x16,0xf8,0x17,0x98 };
+
+        pTable->nBits = nBits;
+        pTable->nWindows = (256 + nBits - 1) / nBits;
+        pTable->nEntries = (1 << nBits) - 1;
+        pTable->vTable.resize(pTable->nWindows * pTable->nEntries);
+        CAffinePoint base;
+        geSetCompressed(base, pG);
+        for (int w = 0; w < pTable->nWindows; w++)
+        {
+            CJacobianPoint acc;
+            gejSetInfinity(acc);
+            for (int j = 0; j < pTable->nEntries; j++)
+            {
+                gejAddAffine(acc, acc, base);
+                gejGetAffine(pTable->vTable[pTable->nEntries * w + j], acc);
+            }
+            gejAddAffine(acc, acc, base);  // 2^nBits * base
+            gejGetAffine(base, acc);
+        }
+    }
+
+    static CGeneratorTable& Instance(int nBits)
+    {
+        static CGeneratorTable vTables[GENERATOR_WINDOW_MAX + 1];
+        return vTables[nBits];
+    }
+
+    template <int BITS>
+    static void Init()
+    {
+        Build(&Instance(BITS), BITS);
+    }
+
+    template <int BITS>
+    static const CGeneratorTable& GetBits()
+    {
+        static boost::once_flag once = BOOST_ONCE_INIT;
+        boost::call_once(&CGeneratorTable::Init<BITS>, once);
+        return Instance(BITS);
+    }
+
+public:
+    static const CGeneratorTable& Get(int nBits = GetGeneratorWindow())
+    {
+        switch (nBits)
+        {
+        case 4: return GetBits<4>();
+        case 5: return GetBits<5>();
+        case 6: return GetBits<6>();
+        case 7: return GetBits<7>();
+        default: return GetBits<8>();
+        }
+    }
+
+    // r = k*G for a secret k < n, big-endian, in constant time; infinity for
+    // k = 0.  No partial sum of the windows below w is +-j * 2^(nBits w) * G
+    // (it is below 2^(nBits w) and k < n), so the additions need no checks.
+    void Mul(CJacobianPoint& r, const unsigned char* k32) const
+    {
+        CJacobianPoint sum, t;
+        CAffinePoint entry;
+        CFieldElement one;
+        memset(&sum, 0, sizeof(sum));
+        feSetInt(one, 1);
+        uint64 fEmpty = ~0ull;      // sum still 0
+        for (int w = 0; w < nWindows; w++)
+        {
+            uint64 c = getScalarBits(k32, nBits * w, nBits);
+            const CAffinePoint* pWindow = &vTable[nEntries * w];
+            entry = pWindow[0];
+            for (int j = 1; j < nEntries; j++)
+            {
+                uint64 fPick = 0 - (((c ^ (j + 1)) - 1) >> 63);
+                feCmov(entry.x, pWindow[j].x, fPick);
+                feCmov(entry.y, pWindow[j].y, fPick);
+            }
+
+            // sum + entry, or entry alone while the sum is 0; dropped if the
+            // digit is 0
+            gejAddAffineDistinct(t, sum, entry);
+            feCmov(t.x, entry.x, fEmpty);
+            feCmov(t.y, entry.y, fEmpty);
+            feCmov(t.z, one, fEmpty);
+            uint64 fAdd = ((c - 1) >> 63) - 1;
+            feCmov(sum.x, t.x, fAdd);
+            feCmov(sum.y, t.y, fAdd);
+            feCmov(sum.z, t.z, fAdd);
+            fEmpty &= ~fAdd;
+        }
+        r = sum;
+        r.fInfinity = fEmpty != 0;
+        OPENSSL_cleanse(&sum, sizeof(sum));
+        OPENSSL_cleanse(&t, sizeof(t));
+        OPENSSL_cleanse(&entry, sizeof(entry));
+    }
+
+    // r = k*G for a public k (split-key offsets), big-endian: one table read
+    // and addition per nonzero digit.  Infinity for k = 0.
+    void MulPublic(CJacobianPoint& r, const unsigned char* k32) const
+    {
+        gejSetInfinity(r);
+        for (int w = 0; w < nWindows; w++)
+        {
+            unsigned int c = getScalarBits(k32, nBits * w, nBits);
+            if (c)
+                gejAddAffine(r, r, vTable[nEntries * w + c - 1]);
+        }
+    }
+
+    int GetWindowBits() const
+    {
+        return nBits;
+    }
+
+    int GetWindows() const
+    {
+        return nWindows;
+    }
+
+    const CAffinePoint& At(int w, int j) const
+    {
+        return vTable[nEntries * w + j - 1];
+    }
+};
+
+#endif
+
+#endif
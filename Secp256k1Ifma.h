@@ -0,0 +1,435 @@
+#ifndef __SECP256K1_IFMA_H__
+#define __SECP256K1_IFMA_H__
+
+#include "Secp256k1.h"
+
+// Eight lane secp256k1 arithmetic on AVX-512 IFMA (vpmadd52luq/huq).
+//
+// A field element is five 52-bit limbs per lane, one candidate per lane, so a
+// batch of eight keys goes through k*G together: every entry of a window is
+// broadcast and kept by the lanes whose digit it is (the keys are secret, so
+// no lane's digit picks the memory read), additions run on all lanes with a
+// blend for lanes whose window is zero, and the final inversion is one vector
+// exponentiation.
+//
+// The comb starts from a fixed point Q instead of infinity and subtracts it at
+// the end, so every lane does the same work.  A lane that hits an exceptional
+// addition (equal or opposite points, probability ~2^-256) is flagged and
+// redone by the caller with the scalar code, which keeps results exact.
+//
+// Everything here is compiled for avx512f+avx512ifma alone and must only be
+// entered after CPUID reported both.
+
+#if defined(USE_NATIVE_SECP256K1) && (defined(__x86_64__) || defined(_M_X64)) \
+    && (defined(_MSC_VER) || (defined(__GNUC__) && (__GNUC__ >= 8 || defined(__clang__))))
+#define USE_IFMA_SECP256K1 1
+#endif
+
+#ifdef USE_IFMA_SECP256K1
+
+// GCC 12 reports _mm512_undefined_epi32() inside its own intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#define IFMA_TARGET
+#define IFMA_INLINE __forceinline
+#else
+#define IFMA_TARGET __attribute__((target("avx512f,avx512ifma")))
+#define IFMA_INLINE inline __attribute__((always_inline, target("avx512f,avx512ifma")))
+#endif
+
+static const uint64 FE52_MASK = 0xFFFFFFFFFFFFFull;
+static const uint64 FE52_R = 0x1000003D10ull;     // 2^260 mod p
+
+// Eight field elements, radix 2^52, limbs below 2^52, value below 2^260.
+struct CFieldVec
+{
+    __m512i n[5];
+};
+
+// Scalar element from 52-bit limbs (value below 2^260).
+inline void fe52ToFe(CFieldElement& r, const uint64* l)
+{
+    r.n[0] = l[0] | (l[1] << 52);
+    r.n[1] = (l[1] >> 12) | (l[2] << 40);
+    r.n[2] = (l[2] >> 24) | (l[3] << 28);
+    r.n[3] = (l[3] >> 36) | (l[4] << 16);
+    feFold(r, l[4] >> 48);
+    feNormalize(r);
+}
+
+inline void feToFe52(uint64* l, const CFieldElement& a)
+{
+    l[0] = a.n[0] & FE52_MASK;
+    l[1] = ((a.n[0] >> 52) | (a.n[1] << 12)) & FE52_MASK;
+    l[2] = ((a.n[1] >> 40) | (a.n[2] << 24)) & FE52_MASK;
+    l[3] = ((a.n[2] >> 28) | (a.n[3] << 36)) & FE52_MASK;
+    l[4] = a.n[3] >> 16;
+}
+
+IFMA_INLINE void fvSet(CFieldVec& r, const uint64* l)
+{
+    for (int i = 0; i < 5; i++)
+        r.n[i] = _mm512_set1_epi64((long long) l[i]);
+}
+
+// Carry to 52-bit limbs, folding what passes 2^260 back in as R.
+IFMA_INLINE void fvCarry(CFieldVec& r)
+{
+    const __m512i vMask = _mm512_set1_epi64(FE52_MASK);
+    const __m512i vR = _mm512_set1_epi64(FE52_R);
+    for (;;)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            r.n[i + 1] = _mm512_add_epi64(r.n[i + 1], _mm512_srli_epi64(r.n[i], 52));
+            r.n[i] = _mm512_and_si512(r.n[i], vMask);
+        }
+        __m512i vTop = _mm512_srli_epi64(r.n[4], 52);
+        r.n[4] = _mm512_and_si512(r.n[4], vMask);
+        r.n[0] = _mm512_madd52lo_epu64(r.n[0], vTop, vR);
+        r.n[1] = _mm512_madd52hi_epu64(r.n[1], vTop, vR);
+        if ((_mm512_cmpgt_epu64_mask(r.n[0], vMask) | _mm512_cmpgt_epu64_mask(r.n[1], vMask)) == 0)
+            return;
+    }
+}
+
+IFMA_INLINE void fvAdd(CFieldVec& r, const CFieldVec& a, const CFieldVec& b)
+{
+    for (int i = 0; i < 5; i++)
+        r.n[i] = _mm512_add_epi64(a.n[i], b.n[i]);
+    fvCarry(r);
+}
+
+// a - b as a + 32p - b; every limb of 32p is at least 2^52.
+IFMA_INLINE void fvSub(CFieldVec& r, const CFieldVec& a, const CFieldVec& b)
+{
+    static const uint64 p32[5] = { 0x1FFFFDFFFFF85E0ull, 0x1FFFFFFFFFFFFE0ull, 0x1FFFFFFFFFFFFE0ull,
+                                   0x1FFFFFFFFFFFFE0ull, 0x1FFFFFFFFFFFE0ull };
+    for (int i = 0; i < 5; i++)
+        r.n[i] = _mm512_sub_epi64(_mm512_add_epi64(a.n[i], _mm512_set1_epi64((long long) p32[i])), b.n[i]);
+    fvCarry(r);
+}
+
+IFMA_INLINE void fvMul(CFieldVec& r, const CFieldVec& a, const CFieldVec& b)
+{
+    const __m512i vMask = _mm512_set1_epi64(FE52_MASK);
+    const __m512i vR = _mm512_set1_epi64(FE52_R);
+    __m512i t[10];
+    for (int i = 0; i < 10; i++)
+        t[i] = _mm512_setzero_si512();
+    for (int i = 0; i < 5; i++)
+        for (int j = 0; j < 5; j++)
+        {
+            t[i + j] = _mm512_madd52lo_epu64(t[i + j], a.n[i], b.n[j]);
+            t[i + j + 1] = _mm512_madd52hi_epu64(t[i + j + 1], a.n[i], b.n[j]);
+        }
+
+    // the high half must be in 52-bit limbs before it is multiplied by R
+    for (int i = 0; i < 9; i++)
+    {
+        t[i + 1] = _mm512_add_epi64(t[i + 1], _mm512_srli_epi64(t[i], 52));
+        t[i] = _mm512_and_si512(t[i], vMask);
+    }
+
+    __m512i vTop = _mm512_setzero_si512();
+    for (int i = 0; i < 5; i++)
+    {
+        t[i] = _mm512_madd52lo_epu64(t[i], t[i + 5], vR);
+        if (i < 4)
+            t[i + 1] = _mm512_madd52hi_epu64(t[i + 1], t[i + 5], vR);
+        else
+            vTop = _mm512_madd52hi_epu64(vTop, t[i + 5], vR);
+    }
+    t[0] = _mm512_madd52lo_epu64(t[0], vTop, vR);
+    t[1] = _mm512_madd52hi_epu64(t[1], vTop, vR);
+
+    for (int i = 0; i < 5; i++)
+        r.n[i] = t[i];
+    fvCarry(r);
+}
+
+// Lanes equal to zero mod p.
+IFMA_INLINE __mmask8 fvIsZero(const CFieldVec& a)
+{
+    static const uint64 p[5] = { 0xFFFFEFFFFFC2Full, FE52_MASK, FE52_MASK, FE52_MASK, 0xFFFFFFFFFFFFull };
+    const __m512i vMask = _mm512_set1_epi64(FE52_MASK);
+    const __m512i vMask48 = _mm512_set1_epi64(0xFFFFFFFFFFFFull);
+    const __m512i vC = _mm512_set1_epi64(SECP256K1_C);
+
+    // below 2^256 the representation is unique and 0, p are the only zeros
+    CFieldVec t = a;
+    for (;;)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            t.n[i + 1] = _mm512_add_epi64(t.n[i + 1], _mm512_srli_epi64(t.n[i], 52));
+            t.n[i] = _mm512_and_si512(t.n[i], vMask);
+        }
+        __m512i vTop = _mm512_srli_epi64(t.n[4], 48);
+        t.n[4] = _mm512_and_si512(t.n[4], vMask48);
+        if (_mm512_test_epi64_mask(vTop, vTop) == 0)
+            break;
+        t.n[0] = _mm512_madd52lo_epu64(t.n[0], vTop, vC);
+        t.n[1] = _mm512_madd52hi_epu64(t.n[1], vTop, vC);
+    }
+
+    __mmask8 fZero = 0xff, fP = 0xff;
+    for (int i = 0; i < 5; i++)
+    {
+        fZero &= _mm512_cmpeq_epi64_mask(t.n[i], _mm512_setzero_si512());
+        fP &= _mm512_cmpeq_epi64_mask(t.n[i], _mm512_set1_epi64((long long) p[i]));
+    }
+    return fZero | fP;
+}
+
+IFMA_INLINE void fvBlend(CFieldVec& r, __mmask8 fMask, const CFieldVec& a)
+{
+    for (int i = 0; i < 5; i++)
+        r.n[i] = _mm512_mask_blend_epi64(fMask, r.n[i], a.n[i]);
+}
+
+// a^e, e big-endian, 4-bit fixed window.
+IFMA_INLINE void fvPow(CFieldVec& r, const CFieldVec& a, const unsigned char* e32)
+{
+    static const uint64 one[5] = { 1, 0, 0, 0, 0 };
+    CFieldVec vPow[16];
+    fvSet(vPow[0], one);
+    vPow[1] = a;
+    for (int i = 2; i < 16; i++)
+        fvMul(vPow[i], vPow[i - 1], a);
+
+    CFieldVec x;
+    fvSet(x, one);
+    for (int i = 0; i < 64; i++)
+    {
+        if (i)
+            for (int j = 0; j < 4; j++)
+                fvMul(x, x, x);
+        int nDigit = (e32[i / 2] >> (i & 1 ? 0 : 4)) & 0xf;
+        if (nDigit)
+            fvMul(x, x, vPow[nDigit]);
+    }
+    r = x;
+}
+
+struct CJacobianVec
+{
+    CFieldVec x, y, z;
+};
+
+// r += (x2, y2) on the lanes in fMask; lanes in the returned mask hit an
+// exceptional case (H = 0) and hold garbage.
+IFMA_INLINE __mmask8 gjvAddAffine(CJacobianVec& r, const CFieldVec& x2, const CFieldVec& y2, __mmask8 fMask)
+{
+    CFieldVec Z2, U2, S2, H, R, H2, H3, V, t;
+    fvMul(Z2, r.z, r.z);
+    fvMul(U2, x2, Z2);
+    fvMul(S2, y2, Z2);
+    fvMul(S2, S2, r.z);
+    fvSub(H, U2, r.x);
+    fvSub(R, S2, r.y);
+    __mmask8 fBad = fvIsZero(H) & fMask;
+
+    fvMul(H2, H, H);
+    fvMul(H3, H2, H);
+    fvMul(V, r.x, H2);
+
+    CJacobianVec s;
+    fvMul(s.z, r.z, H);
+    fvMul(t, R, R);
+    fvSub(t, t, H3);
+    fvSub(t, t, V);
+    fvSub(s.x, t, V);
+    fvSub(V, V, s.x);
+    fvMul(V, V, R);
+    fvMul(H3, H3, r.y);
+    fvSub(s.y, V, H3);
+
+    fvBlend(r.x, fMask, s.x);
+    fvBlend(r.y, fMask, s.y);
+    fvBlend(r.z, fMask, s.z);
+    return fBad;
+}
+
+// CGeneratorTable in 52-bit limbs: entry nEntries * w + j - 1 =
+// j * 2^(nBits w) * G, same window width.
+class CIfmaTable
+{
+protected:
+    int nBits;
+    int nWindows;
+    int nEntries;
+    std::vector<uint64, CArenaAllocator<uint64> > vLimbs;   // x[5] y[5] per entry
+    uint64 pQ[10];                  // start point Q
+    uint64 pMinusQ[10];
+
+    static CIfmaTable& Instance(int nBits)
+    {
+        static CIfmaTable vTables[GENERATOR_WINDOW_MAX + 1];
+        return vTables[nBits];
+    }
+
+    template <int BITS>
+    static void Init()
+    {
+        CIfmaTable& table = Instance(BITS);
+        const CGeneratorTable& scalar = CGeneratorTable::Get(BITS);
+        table.nBits = BITS;
+        table.nWindows = scalar.GetWindows();
+        table.nEntries = (1 << BITS) - 1;
+        table.vLimbs.resize(table.nWindows * table.nEntries * 10);
+        for (int w = 0; w < table.nWindows; w++)
+            for (int j = 1; j <= table.nEntries; j++)
+            {
+                uint64* p = &table.vLimbs[10 * (table.nEntries * w + j - 1)];
+                feToFe52(p, scalar.At(w, j).x);
+                feToFe52(p + 5, scalar.At(w, j).y);
+            }
+
+        // Q = the unit of the top window (2^248 G for 8 bits): no partial
+        // sum of the windows below it can equal +-Q
+        CAffinePoint q = scalar.At(table.nWindows - 1, 1);
+        feToFe52(table.pQ, q.x);
+        feToFe52(table.pQ + 5, q.y);
+        CFieldElement zero;
+        feSetInt(zero, 0);
+        feSub(q.y, zero, q.y);
+        feNormalize(q.y);
+        feToFe52(table.pMinusQ, q.x);
+        feToFe52(table.pMinusQ + 5, q.y);
+    }
+
+    template <int BITS>
+    static const CIfmaTable& GetBits()
+    {
+        static boost::once_flag once = BOOST_ONCE_INIT;
+        boost::call_once(&CIfmaTable::Init<BITS>, once);
+        return Instance(BITS);
+    }
+
+public:
+    static const CIfmaTable& Get(int nBits = GetGeneratorWindow())
+    {
+        switch (nBits)
+        {
+        case 4: return GetBits<4>();
+        case 5: return GetBits<5>();
+        case 6: return GetBits<6>();
+        case 7: return GetBits<7>();
+        default: return GetBits<8>();
+        }
+    }
+
+    // Eight k*G (+ addend), big-endian scalars, to affine.  Returns the lanes
+    // the caller must redo with scalar code.
+    IFMA_TARGET __mmask8 MulG(const unsigned char (*pk)[32], const CAffinePoint* pAddends, CAffinePoint* pOut) const
+    {
+        CJacobianVec acc;
+        static const uint64 one[5] = { 1, 0, 0, 0, 0 };
+        fvSet(acc.x, pQ);
+        fvSet(acc.y, pQ + 5);
+        fvSet(acc.z, one);
+
+        __mmask8 fBad = 0;
+        const long long* pBase = (const long long*) &vLimbs[0];
+        CFieldVec x2, y2;
+        for (int w = 0; w < nWindows; w++)
+        {
+            // the scalars are secret: every entry of the window is read and
+            // each lane keeps its digit's, no gather by digit
+            long long vDigit[8];
+            for (int j = 0; j < 8; j++)
+                vDigit[j] = getScalarBits(pk[j], nBits * w, nBits);
+            __m512i vDigits = _mm512_loadu_si512(vDigit);
+            __mmask8 fMask = _mm512_test_epi64_mask(vDigits, vDigits);
+
+            const long long* pWindow = pBase + 10 * nEntries * w;
+            for (int i = 0; i < 5; i++)
+            {
+                x2.n[i] = _mm512_set1_epi64(pWindow[i]);
+                y2.n[i] = _mm512_set1_epi64(pWindow[5 + i]);
+            }
+            for (int j = 2; j <= nEntries; j++)
+            {
+                const long long* pEntry = pWindow + 10 * (j - 1);
+                __mmask8 fPick = _mm512_cmpeq_epi64_mask(vDigits, _mm512_set1_epi64(j));
+                for (int i = 0; i < 5; i++)
+                {
+                    x2.n[i] = _mm512_mask_set1_epi64(x2.n[i], fPick, pEntry[i]);
+                    y2.n[i] = _mm512_mask_set1_epi64(y2.n[i], fPick, pEntry[5 + i]);
+                }
+            }
+            fBad |= gjvAddAffine(acc, x2, y2, fMask);
+        }
+
+        fvSet(x2, pMinusQ);
+        fvSet(y2, pMinusQ + 5);
+        fBad |= gjvAddAffine(acc, x2, y2, 0xff);
+
+        if (pAddends)
+        {
+            uint64 l[2][5][8];
+            for (int j = 0; j < 8; j++)
+            {
+                uint64 lx[5], ly[5];
+                feToFe52(lx, pAddends[j].x);
+                feToFe52(ly, pAddends[j].y);
+                for (int i = 0; i < 5; i++)
+                {
+                    l[0][i][j] = lx[i];
+                    l[1][i][j] = ly[i];
+                }
+            }
+            for (int i = 0; i < 5; i++)
+            {
+                x2.n[i] = _mm512_loadu_si512(l[0][i]);
+                y2.n[i] = _mm512_loadu_si512(l[1][i]);
+            }
+            fBad |= gjvAddAffine(acc, x2, y2, 0xff);
+        }
+
+        static const unsigned char pMinus2[32] = {
+            0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff,
+            0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xff, 0xff,0xff,0xff,0xfe, 0xff,0xff,0xfc,0x2d };
+        CFieldVec zi, zi2, zi3;
+        fvPow(zi, acc.z, pMinus2);
+        fvMul(zi2, zi, zi);
+        fvMul(zi3, zi2, zi);
+        fvMul(x2, acc.x, zi2);
+        fvMul(y2, acc.y, zi3);
+
+        uint64 lx[5][8], ly[5][8];
+        for (int i = 0; i < 5; i++)
+        {
+            _mm512_storeu_si512(lx[i], x2.n[i]);
+            _mm512_storeu_si512(ly[i], y2.n[i]);
+        }
+        for (int j = 0; j < 8; j++)
+        {
+            uint64 px[5], py[5];
+            for (int i = 0; i < 5; i++)
+            {
+                px[i] = lx[i][j];
+                py[i] = ly[i][j];
+            }
+            fe52ToFe(pOut[j].x, px);
+            fe52ToFe(pOut[j].y, py);
+        }
+        return fBad;
+    }
+};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef __SEEDPREFIX_H__
+#define __SEEDPREFIX_H__
+
+#include "RippleAddress.h"
+#include "bignum.h"
+
+#include <cstring>
+#include <string>
+
+// Human seed vanity ("--seed-prefix=sh8i9...").
+//
+// A human seed is base58check(0x21 || seed || checksum), always 29 characters.
+// Read as a number it is
+//
+//     V = 0x21 * 2^160 + seed * 2^32 + checksum
+//
+// so the encodings starting with a given prefix are one interval of V, and
+// dividing out the 2^32 checksum gives one interval of seeds.  Only the two
+// boundary seeds depend on their checksum; they are checked and trimmed, so
+// every seed in the returned interval starts with the prefix by construction
+// and the search never tests the seed encoding at all.
+
+static const int HUMAN_SEED_LENGTH = 29;
+
+inline bool humanSeedHasPrefix(const uint128& seed, const std::string& strPrefix)
+{
+    RippleAddress naSeed;
+    naSeed.setSeed(seed);
+    return naSeed.humanSeed().compare(0, strPrefix.size(), strPrefix) == 0;
+}
+
+// Seeds [first, last] whose human encoding starts with strPrefix.  False with
+// a message if there are none.
+inline bool getHumanSeedInterval(const std::string& strPrefix, uint128& first, uint128& last, std::string& msg)
+{
+    if (strPrefix.size() > (size_t) HUMAN_SEED_LENGTH)
+    {
+        msg = "Seed prefix is longer than a seed";
+        return false;
+    }
+
+    CBigNum bn58 = 58;
+    CBigNum bnPrefix = 0;
+    CBigNum bnChar;
+    for (size_t i = 0; i < strPrefix.size(); i++)
+    {
+        const char* p = strchr(ALPHABET, strPrefix[i]);
+        if (strPrefix[i] == '\0' || p == NULL)
+        {
+            msg = std::string("Seed prefix contains '") + strPrefix[i] + "', which is not a base58 character";
+            return false;
+        }
+        bnChar.setuint(p - ALPHABET);
+        bnPrefix = bnPrefix * bn58 + bnChar;
+    }
+
+    CBigNum bnScale = 1;
+    for (size_t i = strPrefix.size(); i < (size_t) HUMAN_SEED_LENGTH; i++)
+        bnScale *= bn58;
+
+    // [lo, hi) in V, clipped to the values a seed can take
+    CBigNum bnMin = CBigNum(VER_FAMILY_SEED) << 160;
+    CBigNum bnEnd = CBigNum(VER_FAMILY_SEED + 1) << 160;
+    CBigNum bnLo = bnPrefix * bnScale;
+    CBigNum bnHi = bnLo + bnScale;
+    if (bnLo < bnMin)
+        bnLo = bnMin;
+    if (bnHi > bnEnd)
+        bnHi = bnEnd;
+    if (bnLo >= bnHi)
+    {
+        msg = "No seed starts with \"" + strPrefix + "\" (seeds start with 's')";
+        return false;
+    }
+
+    first.SetHex(((bnLo - bnMin) >> 32).GetHex());
+    last.SetHex(((bnHi - bnMin - 1) >> 32).GetHex());
+
+    // the boundary seeds straddle the edge unless their checksum says otherwise
+    if (!humanSeedHasPrefix(first, strPrefix))
+    {
+        if (first == last)
+        {
+            msg = "No seed starts with \"" + strPrefix + "\"";
+            return false;
+        }
+        ++first;
+    }
+    if (!humanSeedHasPrefix(last, strPrefix))
+    {
+        if (first == last)
+        {
+            msg = "No seed starts with \"" + strPrefix + "\"";
+            return false;
+        }
+        --last;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef __SPLIT_KEY_H__
+#define __SPLIT_KEY_H__
+
+#include "Secp256k1.h"
+#include "uchar_vector.h"
+#include "uint256.h"
+#include "Digest.h"
+
+#include <openssl/rand.h>
+
+#include <cstring>
+#include <string>
+
+// Split-key search (--split-key): the customer keeps the private key d of a
+// public key P = d*G, and we look for an offset k such that the account of
+// P + k*G matches.  The customer's account key is then d + k (mod n).  It is
+// the rootPub + h*G step of GeneratePublicDeterministicKey with an h of our
+// choosing, and no secret ever reaches the search.
+//
+// Offsets are a random 255 bit base plus the 64 bit counter of the chunk
+// scheduler, so they never wrap mod n.  A walk starts with one k*G from the
+// generator table, then each next candidate is one addition of G, and every
+// batch of points is made affine with a single inversion (Montgomery's trick)
+// instead of the two scalar multiplications of the seed path.
+
+#ifdef USE_NATIVE_SECP256K1
+
+// points made affine together
+static const unsigned int SPLIT_KEY_BATCH = 256;
+
+class CSplitKey
+{
+protected:
+    CAffinePoint    base;           // P
+    unsigned char   pBase[32];      // offset of counter 0, big-endian
+    bool            fSet;
+
+public:
+    CSplitKey() : fSet(false)
+    {
+        memset(pBase, 0, sizeof(pBase));
+    }
+
+    // 33 byte compressed or 65 byte uncompressed public key in hex; draws a
+    // new offset base.
+    bool SetPublicKey(const std::string& strHex, std::string& msg)
+    {
+        uchar_vector vch;
+        if (strHex.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos)
+            vch.setHex(strHex);
+        unsigned char p33[33];
+        if (vch.size() == 33)
+            memcpy(p33, &vch[0], 33);
+        else if (vch.size() == 65 && vch[0] == 0x04)
+        {
+            p33[0] = 0x02 | (vch[64] & 1);
+            memcpy(p33 + 1, &vch[1], 32);
+        }
+        else
+        {
+            msg = "The split key must be a public key in hex, 33 bytes compressed or 65 uncompressed";
+            return false;
+        }
+        if (!geSetCompressed(base, p33))
+        {
+            msg = "The split key is not a point on secp256k1";
+            return false;
+        }
+        if (vch.size() == 65)
+        {
+            unsigned char y32[32];
+            feGetBytes(y32, base.y);
+            if (memcmp(y32, &vch[33], 32) != 0)
+            {
+                msg = "The split key is not a point on secp256k1";
+                return false;
+            }
+        }
+
+        if (RAND_bytes(pBase, sizeof(pBase)) != 1)
+        {
+            msg = "Entropy pool not seeded";
+            return false;
+        }
+        pBase[0] &= 0x7f;
+        fSet = true;
+        return true;
+    }
+
+    bool IsSet() const
+    {
+        return fSet;
+    }
+
+    const CAffinePoint& GetBase() const
+    {
+        return base;
+    }
+
+    std::string GetPublicKey() const
+    {
+        unsigned char p33[33];
+        geGetCompressed(p33, base);
+        return uchar_vector(p33, p33 + 33).getHex();
+    }
+
+    // k of a counter, big-endian
+    void GetOffset(uint64 nCounter, unsigned char* k32) const
+    {
+        memcpy(k32, pBase, 32);
+        uint64 carry = nCounter;
+        for (int i = 31; i >= 0 && carry != 0; i--)
+        {
+            uint64 n = k32[i] + (carry & 0xff);
+            k32[i] = (unsigned char) n;
+            carry = (carry >> 8) + (n >> 8);
+        }
+    }
+
+    std::string GetOffsetHex(uint64 nCounter) const
+    {
+        unsigned char k32[32];
+        GetOffset(nCounter, k32);
+        return uchar_vector(k32, k32 + 32).getHex();
+    }
+};
+
+// One per search thread: the public keys P + k*G of consecutive counters.
+class CSplitKeyWalker
+{
+protected:
+    const CSplitKey&        key;
+    const CGeneratorTable&  table;
+    CAffinePoint            generator;
+    CJacobianPoint          point;      // P + GetOffset(nCounter)*G
+    uint64                  nCounter;
+    CJacobianPoint          vPoints[SPLIT_KEY_BATCH];
+    CFieldElement           vProducts[SPLIT_KEY_BATCH];
+
+public:
+    explicit CSplitKeyWalker(const CSplitKey& keyIn)
+        : key(keyIn), table(CGeneratorTable::Get()), nCounter(0)
+    {
+        generator = table.At(0, 1);
+        gejSetInfinity(point);
+    }
+
+    void Seek(uint64 nCounterIn)
+    {
+        unsigned char k32[32];
+        key.GetOffset(nCounterIn, k32);
+        table.MulPublic(point, k32);
+        gejAddAffine(point, point, key.GetBase());
+        nCounter = nCounterIn;
+    }
+
+    uint64 GetCounter() const
+    {
+        return nCounter;
+    }
+
+    // Compressed public keys of the next nCount (<= SPLIT_KEY_BATCH)
+    // counters.  False if one is the point at infinity, which only happens
+    // when k is minus the customer's key.
+    bool Next(unsigned int nCount, unsigned char (*pPublics)[33])
+    {
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            vPoints[i] = point;
+            if (point.fInfinity)
+            {
+                Seek(nCounter + nCount);
+                return false;
+            }
+            gejAddAffine(point, point, generator);
+        }
+        nCounter += nCount;
+
+        // 1/z of every point from one inversion of their product
+        vProducts[0] = vPoints[0].z;
+        for (unsigned int i = 1; i < nCount; i++)
+            feMul(vProducts[i], vProducts[i - 1], vPoints[i].z);
+        CFieldElement inv, zi, zi2, zi3;
+        feInv(inv, vProducts[nCount - 1]);
+        for (unsigned int i = nCount; i-- > 0; )
+        {
+            if (i > 0)
+            {
+                feMul(zi, inv, vProducts[i - 1]);
+                feMul(inv, inv, vPoints[i].z);
+            }
+            else
+                zi = inv;
+            CAffinePoint affine;
+            feSqr(zi2, zi);
+            feMul(zi3, zi2, zi);
+            feMul(affine.x, vPoints[i].x, zi2);
+            feMul(affine.y, vPoints[i].y, zi3);
+            feNormalize(affine.x);
+            feNormalize(affine.y);
+            geGetCompressed(pPublics[i], affine);
+        }
+        return true;
+    }
+
+    // Hash160 through the thread's digest contexts: the one-shot SHA256()
+    // and RIPEMD160() of OpenSSL 3 cost more than the point arithmetic here.
+    static void GetAccountID(const unsigned char* pPublic, uint160& accountID)
+    {
+        DigestHash160(pPublic, 33, accountID.begin());
+    }
+};
+
+#endif
+
+#endif
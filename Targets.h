@@ -0,0 +1,535 @@
+#ifndef __TARGETS_H__
+#define __TARGETS_H__
+
+#include "Difficulty.h"
+#include "Matcher.h"
+#include "RippleAddress.h"
+
+#include "Digest.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+// What a search matches (--targets), any combination of
+//
+//     account     the account id, "r..." (the default)
+//     public      the account public key, "a..."
+//     node        the node public key, "n...": the root public key of the
+//                 seed, as rippled derives validator keys from
+//                 validation_seed
+//     xaddress    the X-address of the account id (XLS-5d), "X..." on
+//                 mainnet and "T..." on testnet, with the tag of --x-tag
+//                 or none
+//
+// A pattern's first letter says which target it is for.  The node key is
+// known once SetSeeds has made the root key, so a node-only search skips the
+// account key derivation entirely; with several targets every candidate is
+// matched against all of them from the same keys.
+//
+// Public keys are base58check(version || 33 byte key), so like account ids
+// (Difficulty.h) a prefix is a set of intervals of V = version || key ||
+// checksum, here 38 bytes.  V never has leading zero bytes, and the key
+// always starts with 02 or 03, which bounds the values V takes.
+//
+// An X-address is base58check(network || account id || tag flag || tag as 8
+// little-endian bytes), where only the account id varies in a search.  Its
+// V intervals become account id intervals: every id strictly inside matches
+// whatever its checksum, and only ids on an edge are encoded, as in
+// CIntervalMatcher.  Candidates cost the same compares as classic addresses.
+
+enum
+{
+    TARGET_ACCOUNT  = 1,
+    TARGET_PUBLIC   = 2,
+    TARGET_NODE     = 4,
+    TARGET_XADDRESS = 8,
+};
+
+static const int KEY_VALUE_BYTES = 38;
+static const int KEY_VALUE_DIGITS = 52;     // 58^52 > 2^304
+static const int XADDRESS_VALUE_BYTES = 35;
+static const int XADDRESS_VALUE_DIGITS = 48;    // 58^48 > 2^280
+static const unsigned char XADDRESS_MAINNET[2] = { 0x05, 0x44 };
+static const unsigned char XADDRESS_TESTNET[2] = { 0x04, 0x93 };
+
+inline int getPatternTarget(const std::string& pattern)
+{
+    if (pattern.empty())
+        return 0;
+    if (pattern[0] == 'r')
+        return TARGET_ACCOUNT;
+    if (pattern[0] == 'a')
+        return TARGET_PUBLIC;
+    if (pattern[0] == 'n')
+        return TARGET_NODE;
+    if (pattern[0] == 'X' || pattern[0] == 'T')
+        return TARGET_XADDRESS;
+    return 0;
+}
+
+// "account,public,node,xaddress" in any order and combination.
+inline bool parseTargets(const std::string& str, int& nTargets, std::string& msg)
+{
+    nTargets = 0;
+    size_t nBegin = 0;
+    while (nBegin <= str.size())
+    {
+        size_t nEnd = str.find(',', nBegin);
+        if (nEnd == std::string::npos)
+            nEnd = str.size();
+        std::string strTarget = str.substr(nBegin, nEnd - nBegin);
+        if (strTarget == "account")
+            nTargets |= TARGET_ACCOUNT;
+        else if (strTarget == "public")
+            nTargets |= TARGET_PUBLIC;
+        else if (strTarget == "node")
+            nTargets |= TARGET_NODE;
+        else if (strTarget == "xaddress")
+            nTargets |= TARGET_XADDRESS;
+        else
+        {
+            msg = "Unknown target \"" + strTarget + "\", available: account public node xaddress";
+            return false;
+        }
+        nBegin = nEnd + 1;
+    }
+    return true;
+}
+
+inline std::string targetName(int nTarget)
+{
+    return nTarget == TARGET_ACCOUNT ? "account id" : nTarget == TARGET_PUBLIC ? "account public key"
+           : nTarget == TARGET_NODE ? "node public key" : "X-address";
+}
+
+inline std::string targetsToString(int nTargets)
+{
+    std::string str;
+    for (int nTarget = TARGET_ACCOUNT; nTarget <= TARGET_XADDRESS; nTarget <<= 1)
+        if (nTargets & nTarget)
+            str += ", " + targetName(nTarget) + (nTarget == TARGET_XADDRESS ? "es" : "s");
+    return str.empty() ? str : str.substr(2);
+}
+
+inline int getKeyVersion(int nTarget)
+{
+    return nTarget == TARGET_NODE ? VER_NODE_PUBLIC : VER_ACCOUNT_PUBLIC;
+}
+
+// V of a compressed public key, big-endian.
+inline void getKeyValue(int nVersion, const unsigned char* pKey, unsigned char* p38)
+{
+    unsigned char hash2[32];
+    p38[0] = (unsigned char) nVersion;
+    memcpy(p38 + 1, pKey, 33);
+    DigestSHA256d(p38, 34, hash2);
+    memcpy(p38 + 34, hash2, 4);
+}
+
+// nBytes big-endian bytes of bn (below 2^(8 nBytes)).
+inline void putValueBytes(unsigned char* p, size_t nBytes, const CBigNum& bn)
+{
+    std::vector<unsigned char> vch = bn.getvch();   // little-endian
+    memset(p, 0, nBytes);
+    for (size_t i = 0; i < vch.size() && i < nBytes; i++)
+        p[nBytes - 1 - i] = vch[i];
+}
+
+// The V a key of nVersion can take: the 02 and 03 zones.
+inline void getKeyZones(int nVersion, std::vector<CValueInterval>& vZones)
+{
+    for (int nPrefix = 2; nPrefix <= 3; nPrefix++)
+    {
+        CBigNum bnFirst = CBigNum(nVersion * 256 + nPrefix) << (8 * (KEY_VALUE_BYTES - 2));
+        vZones.push_back(CValueInterval(bnFirst, bnFirst + (CBigNum(1) << (8 * (KEY_VALUE_BYTES - 2)))));
+    }
+}
+
+// V intervals of the values of at most nMaxDigits digits starting with
+// pattern, cut to the zones.  False if a character is not base58.
+inline bool getZoneIntervals(const std::string& pattern, int nMaxDigits, const std::vector<CValueInterval>& vZones,
+                             std::vector<CValueInterval>& vIntervals)
+{
+    CBigNum bn58 = 58;
+    CBigNum bnDigits = 0;
+    CBigNum bnChar;
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        const char* p = strchr(ALPHABET, pattern[i]);
+        if (pattern[i] == '\0' || p == NULL)
+            return false;
+        bnChar.setuint(p - ALPHABET);
+        bnDigits = bnDigits * bn58 + bnChar;
+    }
+
+    CBigNum bnScale = 1;
+    CBigNum bnNext = bnDigits + 1;
+    for (int nLength = pattern.size(); nLength <= nMaxDigits; nLength++, bnScale *= bn58)
+    {
+        CBigNum bnFirst = bnDigits * bnScale;
+        CBigNum bnEnd = bnNext * bnScale;
+        for (size_t i = 0; i < vZones.size(); i++)
+            if (bnFirst < vZones[i].second && vZones[i].first < bnEnd)
+                vIntervals.push_back(CValueInterval(std::max(bnFirst, vZones[i].first), std::min(bnEnd, vZones[i].second)));
+    }
+    return true;
+}
+
+inline bool getKeyIntervals(int nVersion, const std::string& pattern, std::vector<CValueInterval>& vIntervals)
+{
+    std::vector<CValueInterval> vZones;
+    getKeyZones(nVersion, vZones);
+    return getZoneIntervals(pattern, KEY_VALUE_DIGITS, vZones, vIntervals);
+}
+
+// Probability that a key of nVersion starts with pattern.
+inline double getKeyPatternProbability(int nVersion, const std::string& pattern)
+{
+    std::vector<CValueInterval> vIntervals;
+    getKeyIntervals(nVersion, pattern, vIntervals);
+    CBigNum bnTotal = 0;
+    for (size_t i = 0; i < vIntervals.size(); i++)
+        bnTotal += vIntervals[i].second - vIntervals[i].first;
+    return bignumToDouble(bnTotal) / ldexp(1.0, 8 * (KEY_VALUE_BYTES - 2) + 1);
+}
+
+// One pattern of a public key target: version || key compared first, the
+// checksum only computed on an interval edge, as in CIntervalMatcher.
+class CKeyIntervalMatcher
+{
+protected:
+    struct CBounds
+    {
+        unsigned char pFirst[KEY_VALUE_BYTES];  // big-endian, inclusive
+        unsigned char pLast[KEY_VALUE_BYTES];
+    };
+
+    int                     nVersion;
+    std::vector<CBounds>    vBounds;
+
+public:
+    CKeyIntervalMatcher(int nVersionIn, const std::string& pattern) : nVersion(nVersionIn)
+    {
+        std::vector<CValueInterval> vIntervals;
+        getKeyIntervals(nVersion, pattern, vIntervals);
+        for (size_t i = 0; i < vIntervals.size(); i++)
+        {
+            CBounds bounds;
+            putValueBytes(bounds.pFirst, KEY_VALUE_BYTES, vIntervals[i].first);
+            putValueBytes(bounds.pLast, KEY_VALUE_BYTES, vIntervals[i].second - 1);
+            vBounds.push_back(bounds);
+        }
+    }
+
+    bool Match(const unsigned char* pKey) const
+    {
+        unsigned char p[34];
+        p[0] = (unsigned char) nVersion;
+        memcpy(p + 1, pKey, 33);
+        for (size_t i = 0; i < vBounds.size(); i++)
+        {
+            int nFirst = memcmp(p, vBounds[i].pFirst, 34);
+            if (nFirst < 0)
+                continue;
+            int nLast = memcmp(p, vBounds[i].pLast, 34);
+            if (nLast > 0)
+                continue;
+            if (nFirst > 0 && nLast < 0)
+                return true;
+
+            unsigned char pValue[KEY_VALUE_BYTES];
+            getKeyValue(nVersion, pKey, pValue);
+            if (memcmp(pValue, vBounds[i].pFirst, KEY_VALUE_BYTES) >= 0
+                && memcmp(pValue, vBounds[i].pLast, KEY_VALUE_BYTES) <= 0)
+                return true;
+        }
+        return false;
+    }
+};
+
+// Network, flag and tag of the X-addresses of a search; the account id goes
+// in between.
+struct CXAddressForm
+{
+    bool            fTestnet;
+    bool            fTag;
+    uint32          nTag;
+
+    CXAddressForm() : fTestnet(false), fTag(false), nTag(0)
+    {
+    }
+
+    // payload without the account id: 2 network bytes, then 9 after it
+    void GetPrefix(unsigned char* p2) const
+    {
+        memcpy(p2, fTestnet ? XADDRESS_TESTNET : XADDRESS_MAINNET, 2);
+    }
+
+    void GetSuffix(unsigned char* p9) const
+    {
+        memset(p9, 0, 9);
+        p9[0] = fTag ? 1 : 0;
+        for (int i = 0; i < 4; i++)
+            p9[1 + i] = (unsigned char) (nTag >> (8 * i));
+    }
+
+    // V of an account id, big-endian.
+    void GetValue(const uint160& accountID, unsigned char* p35) const
+    {
+        unsigned char hash2[32];
+        GetPrefix(p35);
+        memcpy(p35 + 2, accountID.begin(), 20);
+        GetSuffix(p35 + 22);
+        DigestSHA256d(p35, 31, hash2);
+        memcpy(p35 + 31, hash2, 4);
+    }
+
+    std::string Encode(const uint160& accountID) const
+    {
+        unsigned char p35[XADDRESS_VALUE_BYTES];
+        GetValue(accountID, p35);
+        return EncodeBase58(p35, p35 + sizeof(p35));
+    }
+};
+
+// V intervals of the X-addresses of a network starting with pattern.
+inline bool getXAddressIntervals(const CXAddressForm& form, const std::string& pattern,
+                                 std::vector<CValueInterval>& vIntervals)
+{
+    unsigned char p2[2];
+    form.GetPrefix(p2);
+    CBigNum bnFirst = CBigNum(p2[0] * 256 + p2[1]) << (8 * (XADDRESS_VALUE_BYTES - 2));
+    std::vector<CValueInterval> vZones(1, CValueInterval(bnFirst, bnFirst + (CBigNum(1) << (8 * (XADDRESS_VALUE_BYTES - 2)))));
+    return getZoneIntervals(pattern, XADDRESS_VALUE_DIGITS, vZones, vIntervals);
+}
+
+// Probability that an X-address starts with pattern: the account ids are
+// uniform and the rest of V is fixed or below one id step.
+inline double getXAddressPatternProbability(const CXAddressForm& form, const std::string& pattern)
+{
+    std::vector<CValueInterval> vIntervals;
+    getXAddressIntervals(form, pattern, vIntervals);
+    CBigNum bnTotal = 0;
+    for (size_t i = 0; i < vIntervals.size(); i++)
+        bnTotal += vIntervals[i].second - vIntervals[i].first;
+    return std::min(1.0, bignumToDouble(bnTotal) / ldexp(1.0, 8 * (XADDRESS_VALUE_BYTES - 2)));
+}
+
+// One X-address pattern as account id intervals.
+class CXAddressMatcher
+{
+protected:
+    struct CBounds
+    {
+        unsigned char pFirst[XADDRESS_VALUE_BYTES];     // big-endian, inclusive
+        unsigned char pLast[XADDRESS_VALUE_BYTES];
+    };
+
+    CXAddressForm           form;
+    std::vector<CBounds>    vBounds;
+
+public:
+    CXAddressMatcher(const CXAddressForm& formIn, const std::string& pattern) : form(formIn)
+    {
+        std::vector<CValueInterval> vIntervals;
+        getXAddressIntervals(form, pattern, vIntervals);
+        for (size_t i = 0; i < vIntervals.size(); i++)
+        {
+            CBounds bounds;
+            putValueBytes(bounds.pFirst, XADDRESS_VALUE_BYTES, vIntervals[i].first);
+            putValueBytes(bounds.pLast, XADDRESS_VALUE_BYTES, vIntervals[i].second - 1);
+            vBounds.push_back(bounds);
+        }
+    }
+
+    bool Match(const uint160& accountID) const
+    {
+        const unsigned char* p = accountID.begin();
+        for (size_t i = 0; i < vBounds.size(); i++)
+        {
+            // the network bytes are those of the bounds, cut to the zone
+            int nFirst = memcmp(p, vBounds[i].pFirst + 2, 20);
+            if (nFirst < 0)
+                continue;
+            int nLast = memcmp(p, vBounds[i].pLast + 2, 20);
+            if (nLast > 0)
+                continue;
+            if (nFirst > 0 && nLast < 0)
+                return true;
+
+            unsigned char pValue[XADDRESS_VALUE_BYTES];
+            form.GetValue(accountID, pValue);
+            if (memcmp(pValue, vBounds[i].pFirst, XADDRESS_VALUE_BYTES) >= 0
+                && memcmp(pValue, vBounds[i].pLast, XADDRESS_VALUE_BYTES) <= 0)
+                return true;
+        }
+        return false;
+    }
+};
+
+// The patterns of every target of a search, each kept with its text so a hit
+// says which one it matched.
+class CTargetPatterns
+{
+protected:
+    int                                 nTargets;
+    std::vector<std::string>            vAccountPatterns;
+    std::vector<CIntervalMatcher>       vAccountMatchers;
+    std::vector<std::string>            vPublicPatterns;
+    std::vector<CKeyIntervalMatcher>    vPublicMatchers;
+    std::vector<std::string>            vNodePatterns;
+    std::vector<CKeyIntervalMatcher>    vNodeMatchers;
+    CXAddressForm                       xform;      // tag of the X-addresses
+    std::vector<std::string>            vXAddressPatterns;
+    std::vector<CXAddressMatcher>       vXAddressMatchers;
+    double                              dAccountProbability;
+    double                              dPublicProbability;
+    double                              dNodeProbability;
+    double                              dXAddressProbability;
+
+public:
+    CTargetPatterns() : nTargets(0), dAccountProbability(0), dPublicProbability(0), dNodeProbability(0),
+                        dXAddressProbability(0)
+    {
+    }
+
+    // --x-tag, before Set
+    void SetXAddressTag(uint32 nTag)
+    {
+        xform.fTag = true;
+        xform.nTag = nTag;
+    }
+
+    // The form of the X-addresses of a pattern: "T..." for testnet.
+    CXAddressForm GetXAddressForm(const std::string& pattern) const
+    {
+        CXAddressForm form = xform;
+        form.fTestnet = !pattern.empty() && pattern[0] == 'T';
+        return form;
+    }
+
+    // Only the patterns of nSelected (0: any target) are kept, the others
+    // counted in nSkipped, so one order file can feed runs for different
+    // targets.
+    bool Set(const std::vector<std::string>& vPatterns, int nSelected, size_t& nSkipped, std::string& msg)
+    {
+        nSkipped = 0;
+        for (size_t i = 0; i < vPatterns.size(); i++)
+        {
+            const std::string& pattern = vPatterns[i];
+            int nTarget = getPatternTarget(pattern);
+            std::vector<CValueInterval> vIntervals;
+            if (nTarget == 0 || (nTarget == TARGET_ACCOUNT ? !getAccountIntervals(pattern, vIntervals)
+                                 : nTarget == TARGET_XADDRESS ? !getXAddressIntervals(GetXAddressForm(pattern), pattern, vIntervals)
+                                 : !getKeyIntervals(getKeyVersion(nTarget), pattern, vIntervals)))
+            {
+                msg = "Invalid pattern \"" + pattern + "\": not an account id (r...), account public key (a...), "
+                      "node public key (n...) or X-address (X... or T...) prefix";
+                return false;
+            }
+            if (vIntervals.empty())
+            {
+                msg = "No " + targetName(nTarget) + " starts with \"" + pattern + "\"";
+                return false;
+            }
+            if (nSelected != 0 && !(nSelected & nTarget))
+            {
+                nSkipped++;
+                continue;
+            }
+            nTargets |= nTarget;
+            if (nTarget == TARGET_ACCOUNT)
+            {
+                vAccountPatterns.push_back(pattern);
+                vAccountMatchers.push_back(CIntervalMatcher(pattern));
+            }
+            else if (nTarget == TARGET_PUBLIC)
+            {
+                vPublicPatterns.push_back(pattern);
+                vPublicMatchers.push_back(CKeyIntervalMatcher(VER_ACCOUNT_PUBLIC, pattern));
+                dPublicProbability += getKeyPatternProbability(VER_ACCOUNT_PUBLIC, pattern);
+            }
+            else if (nTarget == TARGET_XADDRESS)
+            {
+                vXAddressPatterns.push_back(pattern);
+                vXAddressMatchers.push_back(CXAddressMatcher(GetXAddressForm(pattern), pattern));
+                dXAddressProbability += getXAddressPatternProbability(GetXAddressForm(pattern), pattern);
+            }
+            else
+            {
+                vNodePatterns.push_back(pattern);
+                vNodeMatchers.push_back(CKeyIntervalMatcher(VER_NODE_PUBLIC, pattern));
+                dNodeProbability += getKeyPatternProbability(VER_NODE_PUBLIC, pattern);
+            }
+        }
+        dAccountProbability = getPatternSetProbability(vAccountPatterns);
+        if (nTargets == 0)
+        {
+            msg = "No pattern for the targets searched";
+            return false;
+        }
+        return true;
+    }
+
+    int GetTargets() const
+    {
+        return nTargets;
+    }
+
+    size_t Size() const
+    {
+        return vAccountPatterns.size() + vPublicPatterns.size() + vNodePatterns.size() + vXAddressPatterns.size();
+    }
+
+    // Probability of a hit per account searched, nAccounts per seed, node
+    // keys once per seed.  Key patterns of one target may overlap
+    // ("nHB", "nHBx"), which only makes this an upper bound.
+    double GetProbability(int nAccounts) const
+    {
+        if (!(nTargets & (TARGET_ACCOUNT | TARGET_PUBLIC | TARGET_XADDRESS)))
+            return std::min(1.0, dNodeProbability);
+        return std::min(1.0, dAccountProbability + dPublicProbability + dXAddressProbability + dNodeProbability / nAccounts);
+    }
+
+    // every hit is reported (the matcher policy of reportHit)
+    bool Claim(const unsigned char*) const
+    {
+        return true;
+    }
+
+    // The pattern a value matches, NULL for none.
+    const std::string* MatchAccount(const uint160& accountID) const
+    {
+        for (size_t i = 0; i < vAccountMatchers.size(); i++)
+            if (vAccountMatchers[i].Match(accountID))
+                return &vAccountPatterns[i];
+        return NULL;
+    }
+
+    const std::string* MatchPublic(const unsigned char* pKey) const
+    {
+        for (size_t i = 0; i < vPublicMatchers.size(); i++)
+            if (vPublicMatchers[i].Match(pKey))
+                return &vPublicPatterns[i];
+        return NULL;
+    }
+
+    const std::string* MatchXAddress(const uint160& accountID) const
+    {
+        for (size_t i = 0; i < vXAddressMatchers.size(); i++)
+            if (vXAddressMatchers[i].Match(accountID))
+                return &vXAddressPatterns[i];
+        return NULL;
+    }
+
+    const std::string* MatchNode(const unsigned char* pKey) const
+    {
+        for (size_t i = 0; i < vNodeMatchers.size(); i++)
+            if (vNodeMatchers[i].Match(pKey))
+                return &vNodePatterns[i];
+        return NULL;
+    }
+};
+
+#endif
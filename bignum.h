@@ -51,50 +51,55 @@ public:
 
 
 
-class CBigNum : public BIGNUM
+// BIGNUM is opaque since OpenSSL 1.1, so a CBigNum holds one instead of being
+// one; &bn still gives the BIGNUM* that the BN_ calls take.
+class CBigNum
 {
+	BIGNUM* pbn;
 public:
+	BIGNUM* operator&() { return pbn; }
+	const BIGNUM* operator&() const { return pbn; }
+
 	CBigNum()
 	{
-		BN_init(this);
+		pbn = BN_new();
 	}
 
 	CBigNum(const CBigNum& b)
 	{
-		BN_init(this);
-		if (!BN_copy(this, &b))
+		pbn = BN_new();
+		if (!BN_copy(pbn, &b))
 		{
-			BN_clear_free(this);
 			throw bignum_error("CBigNum::CBigNum(const CBigNum&) : BN_copy failed");
 		}
 	}
 
 	CBigNum& operator=(const CBigNum& b)
 	{
-		if (!BN_copy(this, &b))
+		if (!BN_copy(pbn, &b))
 			throw bignum_error("CBigNum::operator= : BN_copy failed");
 		return (*this);
 	}
 
 	~CBigNum()
 	{
-		BN_clear_free(this);
+		BN_clear_free(pbn);
 	}
 
-	CBigNum(char n)			 { BN_init(this); if (n >= 0) setulong(n); else setint64(n); }
-	CBigNum(short n)			{ BN_init(this); if (n >= 0) setulong(n); else setint64(n); }
-	CBigNum(int n)			  { BN_init(this); if (n >= 0) setulong(n); else setint64(n); }
-	CBigNum(long n)			 { BN_init(this); if (n >= 0) setulong(n); else setint64(n); }
-	CBigNum(int64 n)			{ BN_init(this); setint64(n); }
-	CBigNum(unsigned char n)	{ BN_init(this); setulong(n); }
-	CBigNum(unsigned short n)   { BN_init(this); setulong(n); }
-	CBigNum(unsigned int n)	 { BN_init(this); setulong(n); }
-	CBigNum(uint64 n)		   { BN_init(this); setuint64(n); }
-	explicit CBigNum(uint256 n) { BN_init(this); setuint256(n); }
+	CBigNum(char n)			 { pbn = BN_new(); if (n >= 0) setulong(n); else setint64(n); }
+	CBigNum(short n)			{ pbn = BN_new(); if (n >= 0) setulong(n); else setint64(n); }
+	CBigNum(int n)			  { pbn = BN_new(); if (n >= 0) setulong(n); else setint64(n); }
+	CBigNum(long n)			 { pbn = BN_new(); if (n >= 0) setulong(n); else setint64(n); }
+	CBigNum(int64 n)			{ pbn = BN_new(); setint64(n); }
+	CBigNum(unsigned char n)	{ pbn = BN_new(); setulong(n); }
+	CBigNum(unsigned short n)   { pbn = BN_new(); setulong(n); }
+	CBigNum(unsigned int n)	 { pbn = BN_new(); setulong(n); }
+	CBigNum(uint64 n)		   { pbn = BN_new(); setuint64(n); }
+	explicit CBigNum(uint256 n) { pbn = BN_new(); setuint256(n); }
 
 	explicit CBigNum(const std::vector<unsigned char>& vch)
 	{
-		BN_init(this);
+		pbn = BN_new();
 		setvch(vch);
 	}
 
@@ -105,13 +110,13 @@ public:
 
 	unsigned int getuint() const
 	{
-		return BN_get_word(this);
+		return BN_get_word(pbn);
 	}
 
 	int getint() const
 	{
-		unsigned long n = BN_get_word(this);
-		if (!BN_is_negative(this))
+		unsigned long n = BN_get_word(pbn);
+		if (!BN_is_negative(pbn))
 			return (n > INT_MAX ? INT_MAX : n);
 		else
 			return (n > INT_MAX ? INT_MIN : -(int)n);
@@ -149,7 +154,7 @@ public:
 		pch[1] = (nSize >> 16) & 0xff;
 		pch[2] = (nSize >> 8) & 0xff;
 		pch[3] = (nSize) & 0xff;
-		BN_mpi2bn(pch, p - pch, this);
+		BN_mpi2bn(pch, p - pch, pbn);
 	}
 
 	uint64 getuint64() const
@@ -157,13 +162,13 @@ public:
 #if (ULONG_MAX > UINT_MAX)
 		return static_cast<uint64>(getulong());
 #else
-		int len = BN_num_bytes(this);
+		int len = BN_num_bytes(pbn);
 		if (len > 8)
 			throw std::runtime_error("BN getuint64 overflow");
 
 		unsigned char buf[8];
 		memset(buf, 0, sizeof(buf));
-		BN_bn2bin(this, buf + 8 - len);
+		BN_bn2bin(pbn, buf + 8 - len);
 		return
 			static_cast<uint64>(buf[0]) << 56 | static_cast<uint64>(buf[1]) << 48 |
 			static_cast<uint64>(buf[2]) << 40 | static_cast<uint64>(buf[3]) << 32 |
@@ -186,7 +191,7 @@ public:
 		buf[5] = static_cast<unsigned char>((n >> 16) & 0xff);
 		buf[6] = static_cast<unsigned char>((n >> 8) & 0xff);
 		buf[7] = static_cast<unsigned char>((n) & 0xff);
-		BN_bin2bn(buf, 8, this);
+		BN_bin2bn(buf, 8, pbn);
 #endif
 	}
 
@@ -198,10 +203,10 @@ public:
 	uint256 getuint256()
 	{
 		uint256 ret;
-		unsigned int size = BN_num_bytes(this);
+		unsigned int size = BN_num_bytes(pbn);
 		if (size > ret.size())
 			return ret;
-		BN_bn2bin(this, ret.begin() + (ret.size() - BN_num_bytes(this)));
+		BN_bn2bin(pbn, ret.begin() + (ret.size() - BN_num_bytes(pbn)));
 		return ret;
 	}
 
@@ -217,16 +222,16 @@ public:
 		vch2[3] = (nSize >> 0) & 0xff;
 		// swap data to big endian
 		std::reverse_copy(vch.begin(), vch.end(), vch2.begin() + 4);
-		BN_mpi2bn(&vch2[0], vch2.size(), this);
+		BN_mpi2bn(&vch2[0], vch2.size(), pbn);
 	}
 
 	std::vector<unsigned char> getvch() const
 	{
-		unsigned int nSize = BN_bn2mpi(this, NULL);
+		unsigned int nSize = BN_bn2mpi(pbn, NULL);
 		if (nSize < 4)
 			return std::vector<unsigned char>();
 		std::vector<unsigned char> vch(nSize);
-		BN_bn2mpi(this, &vch[0]);
+		BN_bn2mpi(pbn, &vch[0]);
 		vch.erase(vch.begin(), vch.begin() + 4);
 		reverse(vch.begin(), vch.end());
 		return vch;
@@ -240,16 +245,16 @@ public:
 		if (nSize >= 1) vch[4] = (nCompact >> 16) & 0xff;
 		if (nSize >= 2) vch[5] = (nCompact >> 8) & 0xff;
 		if (nSize >= 3) vch[6] = (nCompact >> 0) & 0xff;
-		BN_mpi2bn(&vch[0], vch.size(), this);
+		BN_mpi2bn(&vch[0], vch.size(), pbn);
 		return *this;
 	}
 
 	unsigned int GetCompact() const
 	{
-		unsigned int nSize = BN_bn2mpi(this, NULL);
+		unsigned int nSize = BN_bn2mpi(pbn, NULL);
 		std::vector<unsigned char> vch(nSize);
 		nSize -= 4;
-		BN_bn2mpi(this, &vch[0]);
+		BN_bn2mpi(pbn, &vch[0]);
 		unsigned int nCompact = nSize << 24;
 		if (nSize >= 1) nCompact |= (vch[4] << 16);
 		if (nSize >= 2) nCompact |= (vch[5] << 8);
@@ -307,7 +312,7 @@ public:
 			unsigned int c = rem.getuint();
 			str += "0123456789abcdef"[c];
 		}
-		if (BN_is_negative(this))
+		if (BN_is_negative(pbn))
 			str += "-";
 		reverse(str.begin(), str.end());
 		return str;
@@ -340,12 +345,12 @@ public:
 
 	bool operator!() const
 	{
-		return BN_is_zero(this);
+		return BN_is_zero(pbn);
 	}
 
 	CBigNum& operator+=(const CBigNum& b)
 	{
-		if (!BN_add(this, this, &b))
+		if (!BN_add(pbn, pbn, &b))
 			throw bignum_error("CBigNum::operator+= : BN_add failed");
 		return *this;
 	}
@@ -359,7 +364,7 @@ public:
 	CBigNum& operator*=(const CBigNum& b)
 	{
 		CAutoBN_CTX pctx;
-		if (!BN_mul(this, this, &b, pctx))
+		if (!BN_mul(pbn, pbn, &b, pctx))
 			throw bignum_error("CBigNum::operator*= : BN_mul failed");
 		return *this;
 	}
@@ -378,7 +383,7 @@ public:
 
 	CBigNum& operator<<=(unsigned int shift)
 	{
-		if (!BN_lshift(this, this, shift))
+		if (!BN_lshift(pbn, pbn, shift))
 			throw bignum_error("CBigNum:operator<<= : BN_lshift failed");
 		return *this;
 	}
@@ -389,13 +394,13 @@ public:
 		//   if built on ubuntu 9.04 or 9.10, probably depends on version of openssl
 		CBigNum a = 1;
 		a <<= shift;
-		if (BN_cmp(&a, this) > 0)
+		if (BN_cmp(&a, pbn) > 0)
 		{
 			*this = 0;
 			return *this;
 		}
 
-		if (!BN_rshift(this, this, shift))
+		if (!BN_rshift(pbn, pbn, shift))
 			throw bignum_error("CBigNum:operator>>= : BN_rshift failed");
 		return *this;
 	}
@@ -404,7 +409,7 @@ public:
 	CBigNum& operator++()
 	{
 		// prefix operator
-		if (!BN_add(this, this, BN_value_one()))
+		if (!BN_add(pbn, pbn, BN_value_one()))
 			throw bignum_error("CBigNum::operator++ : BN_add failed");
 		return *this;
 	}
@@ -421,7 +426,7 @@ public:
 	{
 		// prefix operator
 		CBigNum r;
-		if (!BN_sub(&r, this, BN_value_one()))
+		if (!BN_sub(&r, pbn, BN_value_one()))
 			throw bignum_error("CBigNum::operator-- : BN_sub failed");
 		*this = r;
 		return *this;
@@ -446,13 +451,13 @@ public:
 
 	void setulong(unsigned long n)
 	{
-		if (!BN_set_word(this, n))
+		if (!BN_set_word(pbn, n))
 			throw bignum_error("CBigNum conversion from unsigned long : BN_set_word failed");
 	}
 
 	unsigned long getulong() const
 	{
-		return BN_get_word(this);
+		return BN_get_word(pbn);
 	}
 
 };
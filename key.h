@@ -4,73 +4,129 @@
 #include "uchar_vector.h"
 #include "RippleAddress.h"
 
+#include "Digest.h"
+
 #include <openssl/ec.h>
 #include <openssl/bn.h>
-#include <openssl/ecdsa.h>
-#include <openssl/pem.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
 
 #include <string>
 
+// The keys are plain EC_GROUP, EC_POINT and BIGNUM work: EC_KEY and its
+// encoders are deprecated since OpenSSL 3, and we never needed more than the
+// point arithmetic from them.
+
+// secp256k1, its order and a BN_CTX, for one thread.
+class CCurve
+{
+protected:
+    CCurve(const CCurve&); // no implementation
+    CCurve& operator=(const CCurve&); // no implementation
+
+    void Free()
+    {
+        if (order)      BN_free(order);
+        if (ctx)        BN_CTX_free(ctx);
+        if (group)      EC_GROUP_free(group);
+        order = NULL;
+        ctx = NULL;
+        group = NULL;
+    }
+
+public:
+    EC_GROUP*   group;
+    BN_CTX*     ctx;
+    BIGNUM*     order;
+
+    CCurve() : group(NULL), ctx(NULL), order(NULL)
+    {
+        group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+        ctx = BN_CTX_new();
+        order = BN_new();
+        if (!group || !ctx || !order || !EC_GROUP_get_order(group, order, ctx))
+        {
+            Free();
+            throw std::runtime_error("CCurve : curve setup failed");
+        }
+    }
+
+    ~CCurve()
+    {
+        Free();
+    }
+};
+
 // --> seed
 // <-- private root generator + public root generator
-EC_KEY* GenerateRootDeterministicKey(const uint128& seed);
-EC_KEY* GeneratePublicDeterministicKey(const uchar_vector& generator, int seq);
+bool GenerateRootDeterministicKey(CCurve& curve, const uint128& seed, BIGNUM* privKey, EC_POINT* pubKey);
+bool GeneratePublicDeterministicKey(CCurve& curve, const uchar_vector& generator, int seq, EC_POINT* pubKey);
 static BIGNUM* makeHash(const uchar_vector& generator, int seq, BIGNUM* order);
 
 class CKey
 {
 protected:
-    EC_KEY* pkey;
-    bool fSet;
+    CCurve curve;
+    EC_POINT* pubKey;
+    BIGNUM* privKey;    // NULL for a public deterministic key
+
+    CKey(const CKey&); // no implementation
+    CKey& operator=(const CKey&); // no implementation
+
+    void Free()
+    {
+        if (pubKey)     EC_POINT_free(pubKey);
+        if (privKey)    BN_clear_free(privKey);
+        pubKey = NULL;
+        privKey = NULL;
+    }
 
 public:
-    CKey(const uint128& passPhrase) : fSet(false)
+    CKey(const uint128& passPhrase) : pubKey(NULL), privKey(NULL)
     {
-        pkey = GenerateRootDeterministicKey(passPhrase);
-        fSet = true;
-        assert(pkey);
+        pubKey = EC_POINT_new(curve.group);
+        privKey = BN_new();
+        if (!pubKey || !privKey || !GenerateRootDeterministicKey(curve, passPhrase, privKey, pubKey))
+        {
+            Free();
+            throw std::runtime_error("CKey : root key derivation failed");
+        }
     }
 
-    CKey(const uchar_vector& generator, int n) : fSet(false)
+    CKey(const uchar_vector& generator, int n) : pubKey(NULL), privKey(NULL)
     { // public deterministic key
-        pkey = GeneratePublicDeterministicKey(generator, n);
-        fSet = true;
-        assert(pkey);
+        pubKey = EC_POINT_new(curve.group);
+        if (!pubKey || !GeneratePublicDeterministicKey(curve, generator, n, pubKey))
+        {
+            Free();
+            throw std::runtime_error("CKey : public key derivation failed");
+        }
     }
 
     std::vector<unsigned char> GetPubKey() const
     {
-        int nSize = i2o_ECPublicKey(pkey, NULL);
-        assert(nSize<=33);
-        if (!nSize)
-            throw std::runtime_error("CKey::GetPubKey() : i2o_ECPublicKey failed");
         std::vector<unsigned char> vchPubKey(33, 0);
-        unsigned char* pbegin = &vchPubKey[0];
-        if (i2o_ECPublicKey(pkey, &pbegin) != nSize)
-            throw std::runtime_error("CKey::GetPubKey() : i2o_ECPublicKey returned unexpected size");
-        assert(vchPubKey.size()<=33);
+        if (EC_POINT_point2oct(curve.group, pubKey, POINT_CONVERSION_COMPRESSED, &vchPubKey[0], 33, curve.ctx) != 33)
+            throw std::runtime_error("CKey::GetPubKey() : EC_POINT_point2oct failed");
         return vchPubKey;
     }
 
-	std::vector<unsigned char> GetPriKey() const
-	{
-		int nSize = i2d_ECPrivateKey(pkey, NULL);
-		printf("nSize=[%d]\n", nSize);
-		//assert(nSize<=33);
-		//if (!nSize)
-			//throw std::runtime_error("CKey::GetPriKey() : i2d_ECPrivateKey failed");
-		std::vector<unsigned char> vchPriKey(33, 0);
-		unsigned char* pbegin = &vchPriKey[0];
-		if (i2d_ECPrivateKey(pkey, &pbegin) != nSize)
-			throw std::runtime_error("CKey::GetPriKey() : i2d_ECPrivateKey returned unexpected size");
-		assert(vchPriKey.size()<=33);
-		return vchPriKey;
-	}
+    // <-- the private key, 32 bytes big-endian
+    std::vector<unsigned char> GetPriKey() const
+    {
+        if (!privKey)
+            throw std::runtime_error("CKey::GetPriKey() : public key only");
+        std::vector<unsigned char> vchPriKey(32, 0);
+        int nSize = BN_num_bytes(privKey);
+        if (nSize > 32)
+            throw std::runtime_error("CKey::GetPriKey() : private key out of range");
+        BN_bn2bin(privKey, &vchPriKey[32 - nSize]);
+        return vchPriKey;
+    }
 
     ~CKey()
     {
-        EC_KEY_free(pkey);
+        Free();
     }
 };
 
@@ -94,7 +150,7 @@ static BIGNUM* makeHash(const uchar_vector& generator, int seq, BIGNUM* order)
         subSeq++;
 
         uint256 root[2];
-        SHA512(&(s.front()), s.size(), (unsigned char *)root);
+        DigestSHA512(&(s.front()), s.size(), (unsigned char *)root);
         memset(&(s.front()), 0, s.size());
         s.clear();
 
@@ -105,132 +161,114 @@ static BIGNUM* makeHash(const uchar_vector& generator, int seq, BIGNUM* order)
     return ret;
 }
 
-// Take ripple address.
-// --> root public generator (consumes)
-// <-- root public generator in EC format
-EC_KEY* GenerateRootPubKey(BIGNUM* pubGenerator)
-{
-    if (pubGenerator == NULL)
-    {
-        assert(false);
-        return NULL;
-    }
-
-    EC_KEY* pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
-    if (!pkey)
-    {
-        BN_free(pubGenerator);
-        return NULL;
-    }
-    EC_KEY_set_conv_form(pkey, POINT_CONVERSION_COMPRESSED);
-
-    EC_POINT* pubPoint = EC_POINT_bn2point(EC_KEY_get0_group(pkey), pubGenerator, NULL, NULL);
-    BN_free(pubGenerator);
-    if(!pubPoint)
-    {
-        assert(false);
-        EC_KEY_free(pkey);
-        return NULL;
-    }
-
-    if(!EC_KEY_set_public_key(pkey, pubPoint))
-    {
-        assert(false);
-        EC_POINT_free(pubPoint);
-        EC_KEY_free(pkey);
-        return NULL;
-    }
-
-    EC_POINT_free(pubPoint);
-    return pkey;
-}
-
-EC_KEY* GeneratePublicDeterministicKey(const uchar_vector& generator, int seq)
+bool GeneratePublicDeterministicKey(CCurve& curve, const uchar_vector& generator, int seq, EC_POINT* pubKey)
 { // publicKey(n) = rootPublicKey EC_POINT_+ Hash(pubHash|seq)*point
-    BIGNUM* bngenerator = BN_bin2bn(&generator[0], generator.size(), NULL);
-    EC_KEY*         rootKey     = GenerateRootPubKey(bngenerator);
-    const EC_POINT* rootPubKey  = EC_KEY_get0_public_key(rootKey);
-    BN_CTX*         ctx         = BN_CTX_new();
-    EC_KEY*         pkey        = EC_KEY_new_by_curve_name(NID_secp256k1);
-    EC_POINT*       newPoint    = 0;
-    BIGNUM*         order       = 0;
+    EC_POINT*       rootPubKey  = EC_POINT_new(curve.group);
     BIGNUM*         hash        = 0;
     bool            success     = true;
 
-    if (!ctx || !pkey)  success = false;
-
-    if (success)
-        EC_KEY_set_conv_form(pkey, POINT_CONVERSION_COMPRESSED);
-
-    if (success) {
-        newPoint    = EC_POINT_new(EC_KEY_get0_group(pkey));
-        if(!newPoint)   success = false;
-    }
-
-    if (success) {
-        order       = BN_new();
-
-        if(!order || !EC_GROUP_get_order(EC_KEY_get0_group(pkey), order, ctx))
-            success = false;
-    }
+    // root public generator, compressed
+    if (!rootPubKey || generator.empty()
+        || !EC_POINT_oct2point(curve.group, rootPubKey, &generator[0], generator.size(), curve.ctx))
+        success = false;
 
     // Calculate the private additional key.
     if (success) {
-        hash        = makeHash(generator, seq, order);
+        hash        = makeHash(generator, seq, curve.order);
         if(!hash)   success = false;
     }
 
     if (success) {
-        // Calculate the corresponding public key.
-        EC_POINT_mul(EC_KEY_get0_group(pkey), newPoint, hash, NULL, NULL, ctx);
-
-        // Add the master public key and set.
-        EC_POINT_add(EC_KEY_get0_group(pkey), newPoint, newPoint, rootPubKey, ctx);
-        EC_KEY_set_public_key(pkey, newPoint);
+        // Calculate the corresponding public key, and add the master public
+        // key.
+        success = EC_POINT_mul(curve.group, pubKey, hash, NULL, NULL, curve.ctx)
+               && EC_POINT_add(curve.group, pubKey, pubKey, rootPubKey, curve.ctx);
     }
 
-    if (order)              BN_free(order);
     if (hash)               BN_free(hash);
-    if (newPoint)           EC_POINT_free(newPoint);
-    if (ctx)                BN_CTX_free(ctx);
-    if (rootKey)            EC_KEY_free(rootKey);
-    if (pkey && !success)   EC_KEY_free(pkey);
+    if (rootPubKey)         EC_POINT_free(rootPubKey);
 
-    return success ? pkey : NULL;
+    return success;
 }
 
-// --> seed
-// <-- private root generator + public root generator
-EC_KEY* GenerateRootDeterministicKey(const uint128& seed)
+// Account public keys of one family.
+//
+// CKey(generator, seq) sets up a curve, a BN_CTX and the group order and
+// decodes the generator for every single key.  A family keeps all of
+// that per thread and decodes the generator once per seed, so each account
+// index costs only makeHash, one k*G and one point addition.
+class CAccountFamily : protected CCurve
 {
-    BN_CTX* ctx=BN_CTX_new();
-    if(!ctx) return NULL;
+protected:
+    EC_POINT*   rootPubKey;
+    EC_POINT*   point;
+    uchar_vector generator;
+
+public:
+    CAccountFamily() : rootPubKey(NULL), point(NULL)
+    {
+        rootPubKey = EC_POINT_new(group);
+        point = EC_POINT_new(group);
+        if (!rootPubKey || !point)
+        {
+            if (point)      EC_POINT_free(point);
+            if (rootPubKey) EC_POINT_free(rootPubKey);
+            throw std::runtime_error("CAccountFamily : curve setup failed");
+        }
+    }
 
-    EC_KEY* pkey=EC_KEY_new_by_curve_name(NID_secp256k1);
-    if(!pkey)
+    ~CAccountFamily()
     {
-        BN_CTX_free(ctx);
-        return NULL;
+        if (point)      EC_POINT_free(point);
+        if (rootPubKey) EC_POINT_free(rootPubKey);
+        point = rootPubKey = NULL;
     }
-    EC_KEY_set_conv_form(pkey, POINT_CONVERSION_COMPRESSED);
 
-    BIGNUM* order=BN_new();
-    if(!order)
+    // --> family seed
+    // <-- root public generator, compressed, the family's from now on
+    bool SetSeed(const uint128& seed, std::vector<unsigned char>& vchGenerator)
     {
-        BN_CTX_free(ctx);
-        EC_KEY_free(pkey);
-        return NULL;
+        BIGNUM* privKey = BN_new();
+        bool success = privKey && GenerateRootDeterministicKey(*this, seed, privKey, rootPubKey);
+        if (privKey)
+            BN_clear_free(privKey);
+
+        vchGenerator.resize(33);
+        if (!success
+            || EC_POINT_point2oct(group, rootPubKey, POINT_CONVERSION_COMPRESSED, &vchGenerator[0], 33, ctx) != 33)
+            return false;
+        generator = vchGenerator;
+        return true;
     }
-    if(!EC_GROUP_get_order(EC_KEY_get0_group(pkey), order, ctx))
+
+    // --> root public generator, compressed
+    bool SetGenerator(const uchar_vector& generatorIn)
     {
-        assert(false);
-        BN_free(order);
-        EC_KEY_free(pkey);
-        BN_CTX_free(ctx);
-        return NULL;
+        generator = generatorIn;
+        return EC_POINT_oct2point(group, rootPubKey, &generator[0], generator.size(), ctx) == 1;
+    }
+
+    // <-- compressed public key of account seq
+    bool GetPubKey(int seq, std::vector<unsigned char>& vchPubKey)
+    { // publicKey(n) = rootPublicKey EC_POINT_+ Hash(pubHash|seq)*point
+        BIGNUM* hash = makeHash(generator, seq, order);
+        if (!hash)
+            return false;
+
+        bool success = EC_POINT_mul(group, point, hash, NULL, NULL, ctx)
+                    && EC_POINT_add(group, point, point, rootPubKey, ctx);
+        BN_free(hash);
+
+        vchPubKey.resize(33);
+        return success
+            && EC_POINT_point2oct(group, point, POINT_CONVERSION_COMPRESSED, &vchPubKey[0], 33, ctx) == 33;
     }
+};
 
-    BIGNUM *privKey=NULL;
+// --> seed
+// <-- private root generator + public root generator
+bool GenerateRootDeterministicKey(CCurve& curve, const uint128& seed, BIGNUM* privKey, EC_POINT* pubKey)
+{
     int seq=0;
     do
     { // private key must be non-zero and less than the curve's order
@@ -243,59 +281,45 @@ EC_KEY* GenerateRootDeterministicKey(const uint128& seed)
         seq++;
 
         uint256 root[2];
-        SHA512(&(s.front()), s.size(), (unsigned char *)root);
+        DigestSHA512(&(s.front()), s.size(), (unsigned char *)root);
         memset(&(s.front()), 0, s.size());
         s.clear();
 
-        privKey=BN_bin2bn((const unsigned char *) &root[0], sizeof(uint256), privKey);
-        if(privKey==NULL)
-        {
-            EC_KEY_free(pkey);
-            BN_free(order);
-            BN_CTX_free(ctx);
-        }
+        bool success = BN_bin2bn((const unsigned char *) &root[0], sizeof(uint256), privKey) != NULL;
         root[0].zero();
         root[1].zero();
-    } while(BN_is_zero(privKey) || (BN_cmp(privKey, order)>=0));
+        if (!success)
+            return false;
+    } while(BN_is_zero(privKey) || (BN_cmp(privKey, curve.order)>=0));
 
-    BN_free(order);
-
-    if(!EC_KEY_set_private_key(pkey, privKey))
-    { // set the random point as the private key
-        assert(false);
-        EC_KEY_free(pkey);
-        BN_clear_free(privKey);
-        BN_CTX_free(ctx);
-        return NULL;
-    }
-
-    EC_POINT *pubKey=EC_POINT_new(EC_KEY_get0_group(pkey));
-    if(!EC_POINT_mul(EC_KEY_get0_group(pkey), pubKey, privKey, NULL, NULL, ctx))
-    { // compute the corresponding public key point
-        assert(false);
-        BN_clear_free(privKey);
-        EC_POINT_free(pubKey);
-        EC_KEY_free(pkey);
-        BN_CTX_free(ctx);
-        return NULL;
-    }
-    BN_clear_free(privKey);
-    if(!EC_KEY_set_public_key(pkey, pubKey))
-    {
-        assert(false);
-        EC_POINT_free(pubKey);
-        EC_KEY_free(pkey);
-        BN_CTX_free(ctx);
-        return NULL;
-    }
-    EC_POINT_free(pubKey);
-
-    BN_CTX_free(ctx);
+    // compute the corresponding public key point
+    return EC_POINT_mul(curve.group, pubKey, privKey, NULL, NULL, curve.ctx) == 1;
+}
 
-#ifdef EC_DEBUG
-    assert(EC_KEY_check_key(pkey)==1); // CAUTION: This check is *very* expensive
+// --> seed of an "sEd..." seed
+// <-- Ed25519 account public key, 0xED and the 32 byte point
+// The secret key is the first half of SHA-512 of the seed; OpenSSL 1.1.1 and
+// later do the rest.
+bool GenerateEd25519Key(const uint128& seed, std::vector<unsigned char>& vchPubKey)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    uint256 secret[2];
+    DigestSHA512(seed.begin(), 16, (unsigned char *)secret);
+    EVP_PKEY* pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, secret[0].begin(), 32);
+    secret[0].zero();
+    secret[1].zero();
+    if (!pkey)
+        return false;
+
+    size_t nSize = 32;
+    vchPubKey.assign(33, 0);
+    vchPubKey[0] = 0xED;
+    bool success = EVP_PKEY_get_raw_public_key(pkey, &vchPubKey[1], &nSize) == 1 && nSize == 32;
+    EVP_PKEY_free(pkey);
+    return success;
+#else
+    return false;
 #endif
-    return pkey;
 }
 
 #endif
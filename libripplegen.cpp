@@ -0,0 +1,574 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// libripplegen.cpp
+//
+// The C ABI of ripplegen.h over the search code of ripplegen: the same crypto
+// backends, keyspace, chunk scheduler and matcher policies as LoopThread.
+//
+// Built by "make libripplegen" into libripplegen.so; see LICENSE.
+//
+
+#include "ripplegen.h"
+
+#include "RippleAddress.h"
+#include "Backend.h"
+#include "Keyspace.h"
+#include "Scheduler.h"
+#include "Matcher.h"
+#include "PatternIndex.h"
+#include "CpuTopology.h"
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#define UPDATE_ITERATIONS 1000
+
+using namespace std;
+
+const char* ALPHABET = "rpshnaf39wBUDNEGHJKLM4PQRST7VWXYZ2bcdeCg65jkm8oFqi1tuvAxyz";
+
+struct rg_deriver
+{
+    boost::scoped_ptr<CCryptoBackend> pBackend;
+};
+
+struct rg_patterns
+{
+    boost::shared_ptr<const CPatternIndex> pIndex;
+};
+
+struct rg_search
+{
+    boost::shared_ptr<const CPatternIndex> pIndex;
+    CKeyspace                   keyspace;
+    boost::scoped_ptr<CChunkScheduler> pScheduler;
+    rg_hit_callback             callback;
+    void*                       context;
+    int                         nAccounts;
+    uint64                      nMaxHits;
+    uint64                      nMaxCandidates;
+
+    boost::atomic<uint64>       nSearched;
+    boost::atomic<uint64>       nHits;
+    boost::mutex                lock;           // callbacks, one at a time, and nRunning
+    boost::condition_variable   condDone;
+    unsigned int                nRunning;
+    vector<boost::thread*>      vpThreads;
+
+    rg_search() : nSearched(0), nHits(0), nRunning(0)
+    {
+    }
+
+    // Report one hit, unless stopped or over the limit.
+    void Hit(const uint128& seed, int nIndex, const uint160& accountID)
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        if (pScheduler->IsStopped() || (nMaxHits != 0 && nHits >= nMaxHits))
+            return;
+
+        rg_hit hit;
+        memcpy(hit.seed, seed.begin(), RG_SEED_SIZE);
+        hit.index = nIndex;
+        memcpy(hit.account_id, accountID.begin(), RG_ACCOUNT_ID_SIZE);
+        vector<uint32> vPatterns;
+        pIndex->GetMatches(accountID, vPatterns);
+        hit.pattern = vPatterns.empty() ? PATTERN_INDEX_NONE : vPatterns[0];
+
+        ++nHits;
+        if (callback(context, &hit) != 0 || (nMaxHits != 0 && nHits >= nMaxHits))
+            pScheduler->Stop();
+    }
+
+    void Searched(uint64 nCount)
+    {
+        uint64 nTotal = nSearched += nCount;
+        if (nMaxCandidates != 0 && nTotal >= nMaxCandidates)
+            pScheduler->Stop();
+    }
+
+    void Done()
+    {
+        boost::unique_lock<boost::mutex> guard(lock);
+        if (--nRunning == 0)
+            condDone.notify_all();
+    }
+};
+
+static void setError(char* error, size_t size, const string& msg)
+{
+    if (error == NULL || size == 0)
+        return;
+    strncpy(error, msg.c_str(), size - 1);
+    error[size - 1] = '\0';
+}
+
+static int copyText(const string& str, char* text, size_t size)
+{
+    if (text == NULL)
+        return RG_ERROR_ARGUMENT;
+    if (str.size() + 1 > size)
+        return RG_ERROR_BUFFER;
+    memcpy(text, str.c_str(), str.size() + 1);
+    return RG_OK;
+}
+
+// LoopThread (ripplegen.cpp) with the hits going to the session callback.
+template <unsigned int BATCH>
+static void searchThread(rg_search* pSearch, unsigned int n)
+{
+    try
+    {
+        boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+        CIndexMatcher matcher(pSearch->pIndex);
+        CChunkScheduler* pscheduler = pSearch->pScheduler.get();
+
+        CChunk chunk;
+        uint64 nCounter = 0;
+        uint64 nPending = 0;
+        boost::posix_time::ptime ptChunk;
+        uint128 vSeeds[BATCH];
+        uint160 vValues[BATCH];
+        while (!pscheduler->IsStopped())
+        {
+            if (nCounter == chunk.nEnd)
+            {
+                boost::posix_time::ptime ptNow = boost::posix_time::microsec_clock::universal_time();
+                if (chunk.Size() != 0)
+                    pscheduler->Report(n, chunk.Size(), (ptNow - ptChunk).total_microseconds() / 1e6);
+                if (!pscheduler->Next(n, chunk))
+                    break;
+                nCounter = chunk.nBegin;
+                ptChunk = ptNow;
+            }
+
+            unsigned int nBatch = (unsigned int) std::min<uint64>(BATCH, chunk.nEnd - nCounter);
+            pSearch->keyspace.SeedsAt(nCounter, nBatch, vSeeds);
+            nCounter += nBatch;
+            pBackend->SetFamilies(vSeeds, nBatch);
+            matcher.Refresh();
+            for (int nIndex = 0; nIndex < pSearch->nAccounts; nIndex++)
+            {
+                CAccountIDAddress::Derive(*pBackend, nIndex, vValues);
+                for (unsigned int i = 0; i < nBatch; i++)
+                    if (matcher.Match(vValues[i]) && matcher.Claim(vValues[i]))
+                        pSearch->Hit(vSeeds[i], nIndex, vValues[i]);
+            }
+            nPending += nBatch * pSearch->nAccounts;
+            if (nPending >= UPDATE_ITERATIONS)
+            {
+                pSearch->Searched(nPending);
+                nPending = 0;
+            }
+        }
+        pSearch->Searched(nPending);
+    }
+    catch (...)
+    {
+        pSearch->pScheduler->Stop();
+    }
+    pSearch->Done();
+}
+
+extern "C" {
+
+RG_API int rg_api_version(void)
+{
+    return RG_API_VERSION;
+}
+
+RG_API const char* rg_status_string(int status)
+{
+    switch (status)
+    {
+    case RG_OK:                 return "ok";
+    case RG_ERROR_ARGUMENT:     return "invalid argument";
+    case RG_ERROR_DERIVATION:   return "key derivation failed";
+    case RG_ERROR_BUFFER:       return "buffer too small";
+    case RG_ERROR_BACKEND:      return "unknown or unsupported backend";
+    case RG_ERROR_TIMEOUT:      return "timed out";
+    case RG_ERROR_INTERNAL:     return "internal error";
+    }
+    return "unknown status";
+}
+
+RG_API int rg_set_backend(const char* name)
+{
+    string msg;
+    return SelectCryptoBackend(name ? name : "auto", msg) ? RG_OK : RG_ERROR_BACKEND;
+}
+
+RG_API const char* rg_get_backend(void)
+{
+    string msg;
+    if (SelectedCryptoBackend().empty())
+        SelectCryptoBackend("auto", msg);
+    return SelectedCryptoBackend().c_str();
+}
+
+RG_API rg_deriver* rg_deriver_new(void)
+{
+    try
+    {
+        rg_deriver* deriver = new rg_deriver;
+        deriver->pBackend.reset(NewCryptoBackend());
+        return deriver;
+    }
+    catch (...)
+    {
+        return NULL;
+    }
+}
+
+RG_API void rg_deriver_free(rg_deriver* deriver)
+{
+    delete deriver;
+}
+
+// Account index of count seeds, BACKEND_BATCH families per backend call.
+static int derive(rg_deriver* deriver, const uint8_t* seeds, size_t count, uint32_t index,
+                  uint8_t* pOut, bool fPublic)
+{
+    if (deriver == NULL || (count != 0 && (seeds == NULL || pOut == NULL)) || index > 0x7fffffff)
+        return RG_ERROR_ARGUMENT;
+    try
+    {
+        CCryptoBackend& backend = *deriver->pBackend;
+        uint128 vSeeds[BACKEND_BATCH];
+        uint160 vAccountIDs[BACKEND_BATCH];
+        for (size_t n = 0; n < count; n += BACKEND_BATCH)
+        {
+            unsigned int nBatch = (unsigned int) std::min<size_t>(BACKEND_BATCH, count - n);
+            for (unsigned int i = 0; i < nBatch; i++)
+                memcpy(vSeeds[i].begin(), seeds + RG_SEED_SIZE * (n + i), RG_SEED_SIZE);
+            if (!backend.SetSeeds(vSeeds, nBatch))
+                return RG_ERROR_DERIVATION;
+            if (fPublic)
+            {
+                if (!backend.GetAccountPublics(index, pOut + RG_PUBLIC_KEY_SIZE * n))
+                    return RG_ERROR_DERIVATION;
+                continue;
+            }
+            if (!backend.GetAccountIDs(index, vAccountIDs))
+                return RG_ERROR_DERIVATION;
+            for (unsigned int i = 0; i < nBatch; i++)
+                memcpy(pOut + RG_ACCOUNT_ID_SIZE * (n + i), vAccountIDs[i].begin(), RG_ACCOUNT_ID_SIZE);
+        }
+        return RG_OK;
+    }
+    catch (...)
+    {
+        return RG_ERROR_INTERNAL;
+    }
+}
+
+RG_API int rg_derive_account_ids(rg_deriver* deriver, const uint8_t* seeds, size_t count,
+                                 uint32_t index, uint8_t* account_ids)
+{
+    return derive(deriver, seeds, count, index, account_ids, false);
+}
+
+RG_API int rg_derive_public_keys(rg_deriver* deriver, const uint8_t* seeds, size_t count,
+                                 uint32_t index, uint8_t* public_keys)
+{
+    return derive(deriver, seeds, count, index, public_keys, true);
+}
+
+RG_API int rg_encode_account_id(const uint8_t* account_id, char* text, size_t size)
+{
+    if (account_id == NULL)
+        return RG_ERROR_ARGUMENT;
+    try
+    {
+        uint160 accountID;
+        memcpy(accountID.begin(), account_id, RG_ACCOUNT_ID_SIZE);
+        RippleAddress naAccount;
+        naAccount.setAccountID(accountID);
+        return copyText(naAccount.humanAccountID(), text, size);
+    }
+    catch (...)
+    {
+        return RG_ERROR_INTERNAL;
+    }
+}
+
+RG_API int rg_encode_seed(const uint8_t* seed, char* text, size_t size)
+{
+    if (seed == NULL)
+        return RG_ERROR_ARGUMENT;
+    try
+    {
+        uint128 seed128;
+        memcpy(seed128.begin(), seed, RG_SEED_SIZE);
+        RippleAddress naSeed;
+        naSeed.setSeed(seed128);
+        return copyText(naSeed.humanSeed(), text, size);
+    }
+    catch (...)
+    {
+        return RG_ERROR_INTERNAL;
+    }
+}
+
+RG_API int rg_decode_seed(const char* text, uint8_t* seed)
+{
+    if (text == NULL || seed == NULL)
+        return RG_ERROR_ARGUMENT;
+    try
+    {
+        string str = text;
+        uint128 seed128;
+        if (str.size() == 2 * RG_SEED_SIZE && str.find_first_not_of("0123456789abcdefABCDEF") == string::npos)
+            seed128.SetHex(str);
+        else
+        {
+            RippleAddress naSeed;
+            if (!naSeed.SetString(str, VER_FAMILY_SEED) || naSeed.vchData.size() != RG_SEED_SIZE)
+                return RG_ERROR_ARGUMENT;
+            seed128 = naSeed.getSeed();
+        }
+        memcpy(seed, seed128.begin(), RG_SEED_SIZE);
+        return RG_OK;
+    }
+    catch (...)
+    {
+        return RG_ERROR_INTERNAL;
+    }
+}
+
+RG_API rg_patterns* rg_patterns_compile(const char* const* patterns, size_t count, size_t* skipped,
+                                        char* error, size_t error_size)
+{
+    if (patterns == NULL && count != 0)
+    {
+        setError(error, error_size, "No patterns");
+        return NULL;
+    }
+    try
+    {
+        vector<string> vPatterns;
+        for (size_t i = 0; i < count; i++)
+            vPatterns.push_back(patterns[i] ? patterns[i] : "");
+
+        string msg;
+        vector<char> vBuffer;
+        uint64 nSkipped;
+        boost::shared_ptr<CPatternIndex> pIndex(new CPatternIndex());
+        if (!CPatternIndex::Build(vPatterns, vBuffer, nSkipped, msg) || !pIndex->Assign(vBuffer, msg))
+        {
+            setError(error, error_size, msg);
+            return NULL;
+        }
+        if (skipped)
+            *skipped = nSkipped;
+        rg_patterns* pPatterns = new rg_patterns;
+        pPatterns->pIndex = pIndex;
+        return pPatterns;
+    }
+    catch (std::exception& e)
+    {
+        setError(error, error_size, e.what());
+        return NULL;
+    }
+}
+
+RG_API rg_patterns* rg_patterns_open(const char* path, char* error, size_t error_size)
+{
+    if (path == NULL)
+    {
+        setError(error, error_size, "No path");
+        return NULL;
+    }
+    try
+    {
+        string msg;
+        boost::shared_ptr<const CPatternIndex> pIndex = CPatternIndex::OpenShared(path, msg);
+        if (!pIndex)
+        {
+            setError(error, error_size, msg);
+            return NULL;
+        }
+        rg_patterns* pPatterns = new rg_patterns;
+        pPatterns->pIndex = pIndex;
+        return pPatterns;
+    }
+    catch (std::exception& e)
+    {
+        setError(error, error_size, e.what());
+        return NULL;
+    }
+}
+
+RG_API void rg_patterns_free(rg_patterns* patterns)
+{
+    delete patterns;
+}
+
+RG_API size_t rg_patterns_count(const rg_patterns* patterns)
+{
+    return patterns ? patterns->pIndex->Size() : 0;
+}
+
+RG_API double rg_patterns_probability(const rg_patterns* patterns)
+{
+    return patterns ? patterns->pIndex->GetProbability() : 0;
+}
+
+RG_API int rg_patterns_get(const rg_patterns* patterns, uint32_t id, char* text, size_t size)
+{
+    if (patterns == NULL || id >= patterns->pIndex->Size())
+        return RG_ERROR_ARGUMENT;
+    return copyText(patterns->pIndex->GetPattern(id), text, size);
+}
+
+RG_API int rg_patterns_match(const rg_patterns* patterns, const uint8_t* account_ids, size_t count,
+                             uint8_t* matched)
+{
+    if (patterns == NULL || (account_ids == NULL && count != 0))
+        return RG_ERROR_ARGUMENT;
+    const CPatternIndex& index = *patterns->pIndex;
+    int nMatched = 0;
+    uint160 accountID;
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(accountID.begin(), account_ids + RG_ACCOUNT_ID_SIZE * i, RG_ACCOUNT_ID_SIZE);
+        bool fMatch = index.Match(accountID);
+        nMatched += fMatch;
+        if (matched)
+            matched[i] = fMatch;
+    }
+    return nMatched;
+}
+
+RG_API int rg_patterns_matches(const rg_patterns* patterns, const uint8_t* account_id,
+                               uint32_t* ids, size_t capacity)
+{
+    if (patterns == NULL || account_id == NULL || (ids == NULL && capacity != 0))
+        return RG_ERROR_ARGUMENT;
+    try
+    {
+        uint160 accountID;
+        memcpy(accountID.begin(), account_id, RG_ACCOUNT_ID_SIZE);
+        vector<uint32> vPatterns;
+        patterns->pIndex->GetMatches(accountID, vPatterns);
+        for (size_t i = 0; i < vPatterns.size() && i < capacity; i++)
+            ids[i] = vPatterns[i];
+        return (int) vPatterns.size();
+    }
+    catch (...)
+    {
+        return RG_ERROR_INTERNAL;
+    }
+}
+
+RG_API rg_search* rg_search_start(const rg_patterns* patterns, const rg_search_options* options,
+                                  rg_hit_callback callback, void* context,
+                                  char* error, size_t error_size)
+{
+    rg_search_options defaults;
+    memset(&defaults, 0, sizeof(defaults));
+    defaults.size = sizeof(defaults);
+    if (options == NULL)
+        options = &defaults;
+    else if (options->size < sizeof(rg_search_options))
+    {
+        // an older caller: the fields it knows about, defaults for the rest
+        memcpy(&defaults, options, std::max<size_t>(options->size, sizeof(size_t)));
+        options = &defaults;
+    }
+    if (patterns == NULL || callback == NULL || options->seed_prefix_size > RG_SEED_SIZE
+        || (options->seed_prefix == NULL && options->seed_prefix_size != 0))
+    {
+        setError(error, error_size, "Invalid argument");
+        return NULL;
+    }
+
+    rg_search* pSearch = NULL;
+    try
+    {
+        pSearch = new rg_search;
+        pSearch->pIndex = patterns->pIndex;
+        pSearch->keyspace = CKeyspace(vector<unsigned char>(options->seed_prefix, options->seed_prefix + options->seed_prefix_size));
+        pSearch->callback = callback;
+        pSearch->context = context;
+        pSearch->nAccounts = options->accounts_per_seed ? options->accounts_per_seed : 1;
+        pSearch->nMaxHits = options->max_hits;
+        pSearch->nMaxCandidates = options->max_candidates;
+
+        unsigned int nThreads = options->threads ? options->threads : GetCpuTopology().GetBudget();
+        pSearch->pScheduler.reset(new CChunkScheduler(nThreads, 0, pSearch->keyspace.Size()));
+
+        boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+        void (*pThread)(rg_search*, unsigned int) =
+            pBackend->GetBatchSize() >= BACKEND_BATCH ? searchThread<BACKEND_BATCH> : searchThread<1>;
+        boost::unique_lock<boost::mutex> guard(pSearch->lock);
+        for (unsigned int i = 0; i < nThreads; i++)
+        {
+            pSearch->vpThreads.push_back(new boost::thread(pThread, pSearch, i));
+            pSearch->nRunning++;
+        }
+        return pSearch;
+    }
+    catch (std::exception& e)
+    {
+        setError(error, error_size, e.what());
+        if (pSearch)
+            rg_search_free(pSearch);
+        return NULL;
+    }
+}
+
+RG_API int rg_search_stop(rg_search* search)
+{
+    if (search == NULL)
+        return RG_ERROR_ARGUMENT;
+    search->pScheduler->Stop();
+    return RG_OK;
+}
+
+RG_API int rg_search_wait(rg_search* search, uint32_t timeout_ms)
+{
+    if (search == NULL)
+        return RG_ERROR_ARGUMENT;
+    boost::system_time tDeadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout_ms);
+    boost::unique_lock<boost::mutex> guard(search->lock);
+    while (search->nRunning != 0)
+        if (!search->condDone.timed_wait(guard, tDeadline) && search->nRunning != 0)
+            return RG_ERROR_TIMEOUT;
+    return RG_OK;
+}
+
+RG_API int rg_search_stats(rg_search* search, uint64_t* searched, uint64_t* hits, int* finished)
+{
+    if (search == NULL)
+        return RG_ERROR_ARGUMENT;
+    if (searched)
+        *searched = search->nSearched;
+    if (hits)
+        *hits = search->nHits;
+    if (finished)
+    {
+        boost::unique_lock<boost::mutex> guard(search->lock);
+        *finished = search->nRunning == 0;
+    }
+    return RG_OK;
+}
+
+RG_API void rg_search_free(rg_search* search)
+{
+    if (search == NULL)
+        return;
+    if (search->pScheduler)
+        search->pScheduler->Stop();
+    for (size_t i = 0; i < search->vpThreads.size(); i++)
+    {
+        search->vpThreads[i]->join();
+        delete search->vpThreads[i];
+    }
+    delete search;
+}
+
+}
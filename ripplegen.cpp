@@ -29,20 +29,73 @@
 //
 
 #include "RippleAddress.h"
+#include "Keyspace.h"
+#include "Scheduler.h"
+#include "PatternSet.h"
+#include "Daemon.h"
+#include "Coordinator.h"
+#include "Derive.h"
+#include "SeedPrefix.h"
+#include "Difficulty.h"
+#include "Backend.h"
+#include "Matcher.h"
+#include "PatternIndex.h"
+#include "LivePatterns.h"
+#include "Autotune.h"
+#include "CpuTopology.h"
+#include "SplitKey.h"
+#include "Score.h"
+#include "Background.h"
+#include "Targets.h"
+#include "Harvest.h"
+#include "Profile.h"
+#include <csignal>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <stdint.h>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <openssl/rand.h>
 
 #define UPDATE_ITERATIONS 1000
+#define STATUS_SECONDS 10
+#define STATUS_PATTERNS 16
 
 using namespace std;
 
-boost::mutex mutex;
-bool fDone = false;
+boost::mutex cs_output;
+boost::atomic<bool> fDone(false);
 
 uint64_t start_time;
 uint64_t total_searched;
+uint64_t last_status;
+uint64_t total_hits;
+double search_probability;
+uint64_t set_searched;      // total_searched when the pattern set last changed
+
+// The odds of each pattern on the status line, for sets of up to
+// STATUS_PATTERNS patterns.
+struct CPatternOdds
+{
+    string      pattern;
+    double      dProbability;
+    uint64_t    nSince;     // total_searched when it joined the set
+};
+vector<CPatternOdds> pattern_odds;
+
+// stop conditions, 0 for none
+uint64_t max_hits;
+uint64_t max_candidates;
+uint64_t max_seconds;
+
+// --key-type: KEY_SECP256K1 and/or KEY_ED25519
+int key_types = KEY_SECP256K1;
+
+volatile sig_atomic_t reload_requested = 0;
+volatile sig_atomic_t stop_requested = 0;
+volatile sig_atomic_t profile_requested = 0;
 
 const char* ALPHABET = "rpshnaf39wBUDNEGHJKLM4PQRST7VWXYZ2bcdeCg65jkm8oFqi1tuvAxyz";
 
@@ -96,116 +149,247 @@ void writedatatofile(string msg)
 	fclose(fidwrite);
 }
 
-void LoopThread(unsigned int n, uint64_t eta50, string* ppattern,
-                string* pmaster_seed, string* pmaster_seed_hex, string* paccount_id, string* ppreseed)
+void writeHit(const string& msg)
+{
+	if (strOutPath.length()>0)
+	{
+		writedatatofile(msg);
+	}
+}
+
+// --background controller and --harvest sink messages
+void logMessage(const string& msg)
+{
+    boost::unique_lock<boost::mutex> lock(cs_output);
+    cout << "# " << msg << endl
+         << "#" << endl;
+}
+
+// Print and save a hit unless --max-hits is reached or the matcher turns it
+// down; claimed under the lock so quota and limit messages follow the hit
+// that triggered them.
+template <class TMatcher, class TValue>
+void reportHit(TMatcher& matcher, const TValue& value, const string& msg)
+{
+    boost::unique_lock<boost::mutex> lock(cs_output);
+    if ((max_hits != 0 && total_hits >= max_hits) || !matcher.Claim(value))
+        return;
+    total_hits++;
+    if (strOutPath.length()>0)
+    {
+        writedatatofile(msg);
+    }
+    cout << msg << endl;
+    if (total_hits == max_hits && !fDone.exchange(true))
+        cout << "#    *** " << total_hits << " hits, stopping. ***" << endl
+             << "#" << endl;
+}
+
+// --score keeps matches in the thread's top K, without a lock.
+template <class TValue>
+void reportHit(CScoreMatcher& matcher, const TValue& value, const string& msg)
+{
+    matcher.Keep(value, msg);
+}
+
+// "P(found) 12%, 50% in 3 minutes" after nSearched accounts.
+string formatOdds(double dProbability, uint64_t nSearched, double speed)
+{
+    double eta50 = getEta50(dProbability);
+    ostringstream out;
+    out << "P(found) " << 100 * getFoundProbability(dProbability, nSearched) << "%, 50% "
+        << (nSearched >= eta50 ? string("reached") : "in " + formatDuration((eta50 - nSearched) / speed));
+    return out.str();
+}
+
+// Count accounts searched by a thread, stop at --max-candidates and print the
+// status line every STATUS_SECONDS.
+void addSearched(uint64_t nCount, const string& pattern)
 {
+    boost::unique_lock<boost::mutex> lock(cs_output);
+    total_searched += nCount;
+    if (max_candidates != 0 && total_searched >= max_candidates && !fDone.exchange(true))
+        cout << "#    *** " << total_searched << " accounts searched, stopping. ***" << endl
+             << "#" << endl;
+    uint64_t nSecs = time(NULL) - start_time;
+    if (nSecs >= last_status + STATUS_SECONDS && search_probability == 0) {
+        // --score: no odds to give
+        last_status = nSecs;
+        cout << "# Searched " << total_searched << " accounts, " << (uint64_t) ((1.0 * total_searched)/nSecs) << "/second"
+             << " (" << pattern << ")" << endl
+             << "#" << endl;
+    }
+    else if (nSecs >= last_status + STATUS_SECONDS) {
+        // live odds: P(found) for the accounts searched since the pattern
+        // set last changed and the time left until the 50% mark at the
+        // current speed, for the set and for each of its patterns
+        last_status = nSecs;
+        double speed = (1.0 * total_searched)/nSecs;
+        cout << "# Searched " << total_searched << " accounts, " << (uint64_t) speed << "/second, "
+             << formatOdds(search_probability, total_searched - set_searched, speed)
+             << " (" << pattern << ")" << endl;
+        for (size_t i = 0; i < pattern_odds.size(); i++)
+            cout << "#     " << pattern_odds[i].pattern << ": "
+                 << formatOdds(pattern_odds[i].dProbability, total_searched - pattern_odds[i].nSince, speed) << endl;
+        cout << "#" << endl;
+    }
+}
+
+// The patterns searched from now on, with the probability that an account
+// matches one of them; their own odds are kept for sets of up to
+// STATUS_PATTERNS patterns, counted from when each joined the set.
+void setSearchSet(double dProbability, const vector<string>& vPatterns)
+{
+    vector<CPatternOdds> vOdds;
+    if (vPatterns.size() > 1 && vPatterns.size() <= STATUS_PATTERNS)
+        for (size_t i = 0; i < vPatterns.size(); i++)
+        {
+            CPatternOdds odds;
+            odds.pattern = vPatterns[i];
+            odds.dProbability = getPatternProbability(vPatterns[i]);
+            vOdds.push_back(odds);
+        }
+
+    boost::unique_lock<boost::mutex> lock(cs_output);
+    for (size_t i = 0; i < vOdds.size(); i++)
+    {
+        vOdds[i].nSince = total_searched;
+        for (size_t j = 0; j < pattern_odds.size(); j++)
+            if (pattern_odds[j].pattern == vOdds[i].pattern)
+                vOdds[i].nSince = pattern_odds[j].nSince;
+    }
+    pattern_odds.swap(vOdds);
+    search_probability = dProbability;
+    set_searched = total_searched;
+}
+
+// The live patterns still searched for, if few enough to list.
+vector<string> getStatusPatterns(CLivePatterns& live)
+{
+    vector<string> vPatterns;
+    if (live.Active() <= STATUS_PATTERNS)
+        live.GetActive(vPatterns);
+    return vPatterns;
+}
+
+// One instance per address type, matcher, batch size and profiler (see
+// Matcher.h and Profile.h), chosen by selectLoopThread.
+template <class TAddress, class TMatcher, class TProfiler, unsigned int BATCH>
+void LoopThread(unsigned int n, string* ppattern,
+                string* pmaster_seed, string* pmaster_seed_hex, string* paccount_id,
+                const CKeyspace* pkeyspace, CChunkScheduler* pscheduler, int nAccounts)
+{
+    boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
     RippleAddress naSeed;
-    RippleAddress naAccount;
     string        pattern = *ppattern;
     string        account_id;
-	string		  strPreSeed = *ppreseed;
+    TMatcher      matcher(pattern);
+    CPacer        pacer;
+    CHarvester    harvester;
+    TProfiler     profiler;
+    int           nCandidates = ((key_types & KEY_SECP256K1) ? nAccounts : 0) + ((key_types & KEY_ED25519) ? 1 : 0);
 
     uint64_t count = 0;
     uint64_t last_count = 0;
-	RippleAddress naGenerator;
+    CChunk chunk;
+    uint64 nCounter = 0;
+    boost::posix_time::ptime ptChunk;
+    CArenaArray<uint128> vSeeds(BATCH);
+    typename TAddress::Value vValues[BATCH];
+    unsigned int nBatch = 0;
     while(1)
 	{
-		uint128 key;
-		
-		unsigned char* p = key.begin();
-		if (strPreSeed.length()>key.size()*2)
-		{
-			strPreSeed = strPreSeed.substr(0, key.size()*2);
-		}
-		
-		char* pHex = hexstringToBytes(strPreSeed);
-		
-// 		printf("strPreSeed:[%d]\n", strPreSeed.length());
-// 		for (int i=0; i<strPreSeed.length()/2;i++)
-// 		{
-// 			printf("%02x ", pHex[i]);
-// 			if (i>1&&i%8==0)
-// 			{
-// 				printf("\n");
-// 			}
-// 		}
-// 		printf("\n");
-		
-		memcpy((char*)p, pHex, strPreSeed.length()/2);
-
-		getRand(p+strPreSeed.length()/2, key.size()-strPreSeed.length()/2);
-
-// 		unsigned char* pkey = key.begin();
-// 		printf("pkey:[%d]\n", key.size());
-// 		for (int i=0; i<key.size();i++)
-// 		{
-// 			printf("%02x", pkey[i]);
-// 			if (i>1&&i%8==0)
-// 			{
-// 				printf("\n");
-// 			}
-// 		}
-// 		printf("\n");
-
-		naSeed.setSeed(key);
-// 		if (naSeed.humanSeed().substr(0, strPreSeed.size())!=strPreSeed)
-// 		{
-// 			cout << "seed : " << naSeed.humanSeed() << endl;
-// 			continue;
-// 		}
-		
-        naGenerator = createGeneratorPublic(naSeed);
-        naAccount.setAccountPublic(naGenerator.getAccountPublic(), 0);
-        account_id = naAccount.humanAccountID();
-        count++;
-        if (count % UPDATE_ITERATIONS == 0) {
-            boost::unique_lock<boost::mutex> lock(mutex);
-            total_searched += count - last_count;
-            last_count = count;
-            uint64_t nSecs = time(NULL) - start_time;
-            double speed = (1.0 * total_searched)/nSecs;
-            const char* unit = "seconds";
-            double eta50f = eta50/speed;
-            if (eta50f > 100) {
-                unit = "minutes";
-                eta50f /= 60;
-
-                if (eta50f > 100) {
-                    unit = "hours";
-                    eta50f /= 60;
-
-                    if (eta50f > 48) {
-                        unit = "days";
-                        eta50f /= 24;
-                    }
+        if (nCounter == chunk.nEnd)
+        {
+            boost::posix_time::ptime ptNow = boost::posix_time::microsec_clock::universal_time();
+            if (chunk.Size() != 0)
+                pscheduler->Report(n, chunk.Size(), (ptNow - ptChunk).total_microseconds() / 1e6);
+            if (!pscheduler->Next(n, chunk))
+                break;
+            nCounter = chunk.nBegin;
+            ptChunk = ptNow;
+        }
+
+        // a batch of seeds from the chunk, derived together
+        nBatch = (unsigned int) std::min<uint64>(BATCH, chunk.nEnd - nCounter);
+        profiler.Begin(nBatch * nCandidates);
+        pkeyspace->SeedsAt(nCounter, nBatch, vSeeds);
+        nCounter += nBatch;
+        profiler.Mark(PROFILE_SEEDS);
+        matcher.Refresh();
+        profiler.Mark(PROFILE_MATCH);
+        if (key_types & KEY_SECP256K1)
+        {
+            pBackend->SetFamilies(vSeeds, nBatch);
+            profiler.Mark(PROFILE_FAMILY);
+        }
+        for (int nIndex = 0; nIndex < nAccounts && (key_types & KEY_SECP256K1); nIndex++)
+        {
+            if (profiler.IsSampling())
+                TAddress::Derive(*pBackend, nIndex, vValues, profiler);
+            else
+                TAddress::Derive(*pBackend, nIndex, vValues);
+            if (harvester.IsEnabled())
+            {
+                for (unsigned int i = 0; i < nBatch; i++)
+                    harvester.Add(vSeeds[i], nIndex, vValues[i]);
+                profiler.Mark(PROFILE_HARVEST);
+            }
+            for (unsigned int i = 0; i < nBatch; i++)
+            {
+                if (matcher.Match(vValues[i]))
+                {
+                    profiler.Mark(PROFILE_MATCH);
+                    naSeed.setSeed(vSeeds[i]);
+                    account_id = TAddress::ToString(vValues[i]);
+                    string strmsg1 = "master seed:		"+naSeed.humanSeed()+"\n";
+                    string strmsg2 = "master seed hex:	"+naSeed.getSeed().ToString()+"\n";
+                    string strmsg3 = "account id:		"+account_id+"\n";
+                    if (nIndex != 0)
+                        strmsg3 += "account index:	"+lexical_cast_i(nIndex)+"\n";
+                    reportHit(matcher, vValues[i], strmsg1+strmsg2+strmsg3);
+                    profiler.Mark(PROFILE_REPORT);
                 }
             }
-
-            /*cout << "# Thread " << n << ": " << count << " seeds." << endl
-                 << "#" << endl
-                 << "#           Total Speed:    " << speed << " seeds/second" << endl
-                 << "#           Total Searched: " << total_searched << endl
-                 << "#           Total Time:     " << nSecs << " seconds" << endl
-                 << "#           ETA 50%:        " << eta50f << " " << unit << endl
-                 << "#           Last:           " << account_id << endl
-                 << "#           Pattern:        " << pattern << endl
-                 << "#" << endl;*/
+            profiler.Mark(PROFILE_MATCH);
         }
-        key++;
-        boost::this_thread::yield();
-
-		if ((account_id.substr(0, pattern.size()) == pattern))
-		{
-			string strmsg1 = "master seed:		"+naSeed.humanSeed()+"\n";
-			string strmsg2 = "master seed hex:	"+naSeed.getSeed().ToString()+"\n";
-			string strmsg3 = "account id:		"+account_id+"\n";
-
-			if (strOutPath.length()>0)
-			{
-				writedatatofile(strmsg1+strmsg2+strmsg3);
-			}
-			cout << strmsg1+strmsg2+strmsg3 << endl;
-		}
+        // the ed25519 account of each seed: no family, no index
+        if (key_types & KEY_ED25519)
+        {
+            if (profiler.IsSampling())
+            {
+                unsigned char vPublics[BATCH][33];
+                pBackend->DeriveEd25519Publics(vSeeds, nBatch, vPublics[0]);
+                profiler.Mark(PROFILE_ED25519);
+                for (unsigned int i = 0; i < nBatch; i++)
+                    pBackend->Hash160(vPublics[i], 33, vValues[i].begin());
+                profiler.Mark(PROFILE_HASH160);
+            }
+            else
+                pBackend->DeriveEd25519AccountIDs(vSeeds, nBatch, vValues);
+            for (unsigned int i = 0; i < nBatch; i++)
+            {
+                if (matcher.Match(vValues[i]))
+                {
+                    profiler.Mark(PROFILE_MATCH);
+                    naSeed.setSeed(vSeeds[i]);
+                    reportHit(matcher, vValues[i],
+                              "master seed:		"+humanEd25519Seed(vSeeds[i])+"\n"
+                              "master seed hex:	"+naSeed.getSeed().ToString()+"\n"
+                              "account id:		"+TAddress::ToString(vValues[i])+"\n");
+                    profiler.Mark(PROFILE_REPORT);
+                }
+            }
+            profiler.Mark(PROFILE_MATCH);
+        }
+        profiler.End();
+        count += nBatch * nCandidates;
+        if (count - last_count >= UPDATE_ITERATIONS) {
+            addSearched(count - last_count, pattern);
+            last_count = count;
+        }
+        pacer.Pace();
+        harvester.Tick();
 
 		if (fDone)
 		{
@@ -213,14 +397,17 @@ void LoopThread(unsigned int n, uint64_t eta50, string* ppattern,
 		}
     }
 
-    boost::unique_lock<boost::mutex> lock(mutex);
+    boost::unique_lock<boost::mutex> lock(cs_output);
     if (fDone) return;
     fDone = true;
 
-    cout << "#    *** Found by thread " << n << ". ***" << endl
+    cout << "#    *** Keyspace exhausted, thread " << n << " stopping. ***" << endl
          << "#" << endl;
 
-    *pmaster_seed = naSeed.humanSeed();
+    if (count == 0) return;
+    naSeed.setSeed(vSeeds[nBatch - 1]);
+    account_id = TAddress::ToString(vValues[nBatch - 1]);
+    *pmaster_seed = (key_types & KEY_ED25519) ? humanEd25519Seed(vSeeds[nBatch - 1]) : naSeed.humanSeed();
     *pmaster_seed_hex = naSeed.getSeed().ToString();
     *paccount_id = account_id;
 
@@ -235,34 +422,260 @@ void LoopThread(unsigned int n, uint64_t eta50, string* ppattern,
 	//printf("]\n");
 }
 
+typedef void (*LoopThreadProc)(unsigned int, string*, string*, string*, string*,
+                               const CKeyspace*, CChunkScheduler*, int);
 
-// isPatternValid can be changed depending on encoding being used.
-bool isPatternValid(const string& pattern, string& msg)
+template <class TAddress, class TMatcher>
+LoopThreadProc selectLoopThreadBatch(unsigned int nBatch, bool fProfile)
 {
-    // Check for valid ripple account id.
-    // TODO: Implement it correctly
-    if (pattern.size() == 0) {
-        msg = "Pattern cannot be empty.";
-        return false;
+    if (fProfile)
+        return nBatch >= BACKEND_BATCH ? LoopThread<TAddress, TMatcher, CStageProfiler, BACKEND_BATCH>
+                                       : LoopThread<TAddress, TMatcher, CStageProfiler, 1>;
+    if (nBatch >= BACKEND_BATCH)
+        return LoopThread<TAddress, TMatcher, CNoProfiler, BACKEND_BATCH>;
+    return LoopThread<TAddress, TMatcher, CNoProfiler, 1>;
+}
+
+CTargetPatterns target_patterns;
+
+// LoopThread for --targets: the node key of every seed (its root key, before
+// any account derivation) and the account public keys and ids of its
+// indexes, each matched against the patterns of its target.
+template <unsigned int BATCH>
+void TargetThread(unsigned int n, string* ppattern, string*, string*, string*,
+                  const CKeyspace* pkeyspace, CChunkScheduler* pscheduler, int nAccounts)
+{
+    boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+    CPacer        pacer;
+    RippleAddress naSeed, naKey, naAccount;
+    string        pattern = *ppattern;
+    int           nTargets = target_patterns.GetTargets();
+    bool          fAccounts = (nTargets & (TARGET_ACCOUNT | TARGET_PUBLIC | TARGET_XADDRESS)) != 0;
+    int           nCandidates = fAccounts ? nAccounts : 1;
+
+    uint64_t count = 0;
+    uint64_t last_count = 0;
+    CChunk chunk;
+    uint64 nCounter = 0;
+    boost::posix_time::ptime ptChunk;
+    CArenaArray<uint128> vSeeds(BATCH);
+    unsigned char vPublics[BATCH][33];
+    uint160 accountID;
+    while (!fDone)
+    {
+        if (nCounter == chunk.nEnd)
+        {
+            boost::posix_time::ptime ptNow = boost::posix_time::microsec_clock::universal_time();
+            if (chunk.Size() != 0)
+                pscheduler->Report(n, chunk.Size(), (ptNow - ptChunk).total_microseconds() / 1e6);
+            if (!pscheduler->Next(n, chunk))
+                break;
+            nCounter = chunk.nBegin;
+            ptChunk = ptNow;
+        }
+
+        unsigned int nBatch = (unsigned int) std::min<uint64>(BATCH, chunk.nEnd - nCounter);
+        pkeyspace->SeedsAt(nCounter, nBatch, vSeeds);
+        nCounter += nBatch;
+        pBackend->SetFamilies(vSeeds, nBatch);
+        for (unsigned int i = 0; i < nBatch && (nTargets & TARGET_NODE); i++)
+        {
+            const unsigned char* pNode = pBackend->GetGenerator(i);
+            if (target_patterns.MatchNode(pNode) != NULL)
+            {
+                naSeed.setSeed(vSeeds[i]);
+                naKey.setNodePublic(uchar_vector(pNode, 33));
+                reportHit(target_patterns, pNode,
+                          "master seed:		"+naSeed.humanSeed()+"\n"
+                          "master seed hex:	"+naSeed.getSeed().ToString()+"\n"
+                          "node public key:	"+naKey.humanNodePublic()+"\n");
+            }
+        }
+        for (int nIndex = 0; nIndex < nAccounts && fAccounts; nIndex++)
+        {
+            pBackend->GetFamilyAccountPublics(nIndex, vPublics[0]);
+            for (unsigned int i = 0; i < nBatch; i++)
+            {
+                bool fPublic = (nTargets & TARGET_PUBLIC) && target_patterns.MatchPublic(vPublics[i]) != NULL;
+                bool fAccount = false;
+                const string* pXAddress = NULL;
+                if (nTargets & (TARGET_ACCOUNT | TARGET_XADDRESS))
+                {
+                    pBackend->Hash160(vPublics[i], 33, accountID.begin());
+                    fAccount = (nTargets & TARGET_ACCOUNT) && target_patterns.MatchAccount(accountID) != NULL;
+                    if (nTargets & TARGET_XADDRESS)
+                        pXAddress = target_patterns.MatchXAddress(accountID);
+                }
+                if (!fPublic && !fAccount && pXAddress == NULL)
+                    continue;
+                naSeed.setSeed(vSeeds[i]);
+                naKey.setAccountPublic(uchar_vector(vPublics[i], 33));
+                string strmsg = "master seed:		"+naSeed.humanSeed()+"\n"
+                                "master seed hex:	"+naSeed.getSeed().ToString()+"\n";
+                if (fPublic)
+                    strmsg += "account public key:	"+naKey.humanAccountPublic()+"\n";
+                if (pXAddress != NULL)
+                    strmsg += "x-address:		"+target_patterns.GetXAddressForm(*pXAddress).Encode(naKey.getAccountID())+"\n";
+                strmsg += "account id:		"+naKey.humanAccountID()+"\n";
+                if (nIndex != 0)
+                    strmsg += "account index:	"+lexical_cast_i(nIndex)+"\n";
+                reportHit(target_patterns, vPublics[i], strmsg);
+            }
+        }
+        count += nBatch * nCandidates;
+        if (count - last_count >= UPDATE_ITERATIONS) {
+            addSearched(count - last_count, pattern);
+            last_count = count;
+        }
+        pacer.Pace();
     }
-    if (pattern[0] != 'r') {
-        msg = "Pattern must begin with an 'r'.";
-        return false;
+
+    boost::unique_lock<boost::mutex> lock(cs_output);
+    if (fDone) return;
+    fDone = true;
+    cout << "#    *** Keyspace exhausted, thread " << n << " stopping. ***" << endl
+         << "#" << endl;
+}
+
+// "string" compares the encoded account id (the reference), "interval" (the
+// default) compares hash160 || checksum against the pattern's value intervals,
+// "index" looks it up in a compiled pattern index and "live" in the pattern
+// file followed by the search (the pattern is their path).  "score" keeps the
+// best accounts by --score.  "targets" matches the patterns of each --targets
+// target.  fProfile: the instance with the --profile stage timers.
+LoopThreadProc selectLoopThread(const string& strMatcher, unsigned int nBatch, bool fProfile)
+{
+    if (strMatcher == "targets")
+        return nBatch >= BACKEND_BATCH ? TargetThread<BACKEND_BATCH> : TargetThread<1>;
+    if (strMatcher == "score")
+        return selectLoopThreadBatch<CAccountIDAddress, CScoreMatcher>(nBatch, fProfile);
+    if (strMatcher == "index")
+        return selectLoopThreadBatch<CAccountIDAddress, CIndexMatcher>(nBatch, fProfile);
+    if (strMatcher == "live")
+        return selectLoopThreadBatch<CAccountIDAddress, CLiveMatcher>(nBatch, fProfile);
+    if (strMatcher == "string")
+        return selectLoopThreadBatch<CAccountIDAddress, CStringMatcher<CAccountIDAddress> >(nBatch, fProfile);
+    if (strMatcher.empty() || strMatcher == "auto" || strMatcher == "interval")
+        return selectLoopThreadBatch<CAccountIDAddress, CIntervalMatcher>(nBatch, fProfile);
+    return NULL;
+}
+
+#ifdef USE_NATIVE_SECP256K1
+CSplitKey split_key;
+
+// LoopThread for --split-key: the counters of the chunks are offsets of the
+// customer's public key instead of seeds.
+template <class TMatcher>
+void SplitKeyThread(unsigned int n, string* ppattern, string*, string*, string*,
+                    const CKeyspace*, CChunkScheduler* pscheduler, int)
+{
+    string        pattern = *ppattern;
+    TMatcher      matcher(pattern);
+    CPacer        pacer;
+    boost::scoped_ptr<CSplitKeyWalker> pWalker(new CSplitKeyWalker(split_key));
+
+    uint64_t count = 0;
+    uint64_t last_count = 0;
+    CChunk chunk;
+    boost::posix_time::ptime ptChunk;
+    unsigned char vPublics[SPLIT_KEY_BATCH][33];
+    uint160 accountID;
+    while (!fDone)
+    {
+        if (pWalker->GetCounter() == chunk.nEnd)
+        {
+            boost::posix_time::ptime ptNow = boost::posix_time::microsec_clock::universal_time();
+            if (chunk.Size() != 0)
+                pscheduler->Report(n, chunk.Size(), (ptNow - ptChunk).total_microseconds() / 1e6);
+            if (!pscheduler->Next(n, chunk))
+                break;
+            pWalker->Seek(chunk.nBegin);
+            ptChunk = ptNow;
+        }
+
+        uint64 nFirst = pWalker->GetCounter();
+        unsigned int nBatch = (unsigned int) std::min<uint64>(SPLIT_KEY_BATCH, chunk.nEnd - nFirst);
+        if (!pWalker->Next(nBatch, vPublics))
+            continue;
+        matcher.Refresh();
+        for (unsigned int i = 0; i < nBatch; i++)
+        {
+            CSplitKeyWalker::GetAccountID(vPublics[i], accountID);
+            if (matcher.Match(accountID))
+            {
+                RippleAddress naAccount;
+                naAccount.setAccountID(accountID);
+                reportHit(matcher, accountID,
+                          "public key:		"+split_key.GetPublicKey()+"\n"
+                          "offset:			"+split_key.GetOffsetHex(nFirst + i)+"\n"
+                          "account public key:	"+uchar_vector(vPublics[i], 33).getHex()+"\n"
+                          "account id:		"+naAccount.humanAccountID()+"\n");
+            }
+        }
+        count += nBatch;
+        if (count - last_count >= UPDATE_ITERATIONS) {
+            addSearched(count - last_count, pattern);
+            last_count = count;
+        }
+        pacer.Pace();
     }
-    return true;
+
+    boost::unique_lock<boost::mutex> lock(cs_output);
+    if (fDone) return;
+    fDone = true;
+    cout << "#    *** Offsets exhausted, thread " << n << " stopping. ***" << endl
+         << "#" << endl;
+}
+
+LoopThreadProc selectSplitKeyThread(const string& strMatcher)
+{
+    if (strMatcher == "score")
+        return SplitKeyThread<CScoreMatcher>;
+    if (strMatcher == "index")
+        return SplitKeyThread<CIndexMatcher>;
+    if (strMatcher == "live")
+        return SplitKeyThread<CLiveMatcher>;
+    if (strMatcher == "string")
+        return SplitKeyThread<CStringMatcher<CAccountIDAddress> >;
+    if (strMatcher.empty() || strMatcher == "auto" || strMatcher == "interval")
+        return SplitKeyThread<CIntervalMatcher>;
+    return NULL;
+}
+#endif
+
+void onReloadSignal(int)
+{
+    reload_requested = 1;
+}
+
+void onStopSignal(int)
+{
+    stop_requested = 1;
+}
+
+void onProfileSignal(int)
+{
+    profile_requested = 1;
 }
 
-// eta50 = ceiling(1/log_2(n/(n-1))) where n = 58^length
-//   the minimum number of iterations such that there's at
-//   least a 50% chance of finding a match.
-uint64_t getEta50(const string& pattern)
+// --score: print and save the accounts that got into the overall top K since
+// the last call.
+void reportScores()
 {
-    const uint64_t eta50[] = { 0, 0, 40, 2332, 135241, 7843997, 454951843, 26387206905ull,
-                               1530458000460ull, 8876654026661ull, 5148460713546319ull,
-                               298610721385686486ull, 17319421840369816160ull };
-    unsigned int len = pattern.size();
-    if (len > 12) return 0xffffffffffffffffull;
-    return eta50[len]; 
+    CScoreBoard& board = CScoreBoard::Instance();
+    CScoreList vNew;
+    board.Collect(vNew);
+    boost::unique_lock<boost::mutex> lock(cs_output);
+    for (size_t i = 0; i < vNew.size(); i++)
+    {
+        string msg = vNew[i].strRecord + "score:			" + (boost::format("%g") % vNew[i].dScore).str()
+                     + " (#" + lexical_cast_i(board.GetRank(vNew[i].accountID)) + " of " + lexical_cast_i(board.GetTop()) + ")\n";
+        if (strOutPath.length()>0)
+        {
+            writedatatofile(msg);
+        }
+        cout << msg << endl;
+    }
 }
 
 string readdiskfile(string path)
@@ -284,16 +697,401 @@ string readdiskfile(string path)
 	return line;
 }
 
+// Every pattern of a pattern file: the first word of each line, blank lines
+// and # comments skipped, quotas ignored.
+vector<string> readPatterns(istream& in)
+{
+    vector<string> vPatterns;
+    string strLine;
+    while (getline(in, strLine))
+    {
+        istringstream ss(strLine);
+        string strPattern;
+        if (ss >> strPattern && strPattern[0] != '#')
+            vPatterns.push_back(strPattern);
+    }
+    return vPatterns;
+}
+
+vector<string> readPatternFile(const string& path)
+{
+    ifstream file(path.c_str());
+    return readPatterns(file);
+}
+
+// The hex seed prefix (-s) is fixed, the rest of each seed comes from the keyspace.
+vector<unsigned char> parsePreSeed(string seed)
+{
+    seed = seed.substr(0, seed.find_first_of("\r\n"));
+    seed = seed.substr(0, min<size_t>(seed.length(), 2 * uint128().size()) & ~1);
+    vector<unsigned char> vchPreSeed(seed.length() / 2);
+    char* pHex = hexstringToBytes(seed);
+    if (!vchPreSeed.empty())
+        memcpy(&vchPreSeed[0], pHex, vchPreSeed.size());
+    delete[] pHex;
+    return vchPreSeed;
+}
+
+// Seeds starting with the hex prefix and, if given, whose human encoding
+// starts with strSeedPrefix.
+bool buildKeyspace(const string& seed, const string& strSeedPrefix, CKeyspace& keyspace)
+{
+    keyspace = CKeyspace(parsePreSeed(seed));
+    if (strSeedPrefix.empty())
+        return true;
+
+    uint128 first, last;
+    string msg;
+    if (!getHumanSeedInterval(strSeedPrefix, first, last, msg))
+    {
+        cout << "# " << msg << "." << endl
+             << "#" << endl;
+        return false;
+    }
+    if (!keyspace.Intersect(first, last))
+    {
+        cout << "# No seed starts with both the -s hex prefix and \"" << strSeedPrefix << "\"." << endl
+             << "#" << endl;
+        return false;
+    }
+    return true;
+}
+
+// ripplegen derive [--input=<path>] [--indexes=<list>] [--key-type=<type>] [--verify] [--threads=<n>] [--backend=<name>]
+int deriveMain(int argc, char* argv[])
+{
+    string strInput;
+    vector<int> vIndexes;
+    int nKeyTypes = KEY_SECP256K1;
+    bool fVerify = false;
+    string strBackend;
+    unsigned int threads = GetCpuTopology().GetBudget();
+
+    for (int i = 2; i < argc; i++)
+    {
+        string strArgument = argv[i];
+        if (strArgument.compare(0, 8, "--input=") == 0)
+            strInput = strArgument.substr(8);
+        else if (strArgument.compare(0, 10, "--indexes=") == 0)
+        {
+            if (!CBulkDeriver::ParseIndexes(strArgument.substr(10), vIndexes))
+            {
+                cerr << "# Bad index list: " << strArgument.substr(10) << endl;
+                return -1;
+            }
+        }
+        else if (strArgument.compare(0, 11, "--key-type=") == 0)
+        {
+            if (!ParseKeyTypes(strArgument.substr(11), nKeyTypes))
+            {
+                cerr << "# Unknown key type \"" << strArgument.substr(11) << "\", available: secp256k1 ed25519 both" << endl;
+                return -1;
+            }
+        }
+        else if (strArgument == "--verify")
+            fVerify = true;
+        else if (strArgument.compare(0, 10, "--threads=") == 0)
+            threads = strtoul(strArgument.substr(10).c_str(), NULL, 0);
+        else if (strArgument.compare(0, 10, "--backend=") == 0)
+            strBackend = strArgument.substr(10);
+        else
+        {
+            cerr << "# Unknown derive option: " << strArgument << endl;
+            return -1;
+        }
+    }
+    if (threads == 0)
+        threads = 1;
+
+    string msg;
+    if (!SelectCryptoBackend(strBackend, msg))
+    {
+        cerr << "# " << msg << endl;
+        return -1;
+    }
+
+    ifstream file;
+    if (strInput.length() > 0 && strInput != "-")
+    {
+        file.open(strInput.c_str());
+        if (!file)
+        {
+            cerr << "# Cannot open " << strInput << endl;
+            return -1;
+        }
+    }
+
+    CBulkDeriver deriver(threads, vIndexes, nKeyTypes, fVerify);
+    return deriver.Run(file.is_open() ? file : cin, cout) ? 1 : 0;
+}
+
+// ripplegen compile-patterns --input=<path> --output=<path>
+int compilePatternsMain(int argc, char* argv[])
+{
+    string strInput, strOutput;
+    for (int i = 2; i < argc; i++)
+    {
+        string strArgument = argv[i];
+        if (strArgument.compare(0, 8, "--input=") == 0)
+            strInput = strArgument.substr(8);
+        else if (strArgument.compare(0, 9, "--output=") == 0)
+            strOutput = strArgument.substr(9);
+        else
+        {
+            cerr << "# Unknown compile-patterns option: " << strArgument << endl;
+            return -1;
+        }
+    }
+    if (strOutput.empty())
+    {
+        cerr << "# compile-patterns needs --output=<path>" << endl;
+        return -1;
+    }
+
+    ifstream file;
+    if (strInput.length() > 0 && strInput != "-")
+    {
+        file.open(strInput.c_str());
+        if (!file)
+        {
+            cerr << "# Cannot open " << strInput << endl;
+            return -1;
+        }
+    }
+    istream& in = file.is_open() ? file : cin;
+
+    // one pattern per line, blank lines and # comments skipped
+    vector<string> vPatterns;
+    string strLine;
+    while (getline(in, strLine))
+    {
+        size_t nBegin = strLine.find_first_not_of(" \t\r");
+        if (nBegin == string::npos || strLine[nBegin] == '#')
+            continue;
+        vPatterns.push_back(strLine.substr(nBegin, strLine.find_last_not_of(" \t\r") + 1 - nBegin));
+    }
+
+    uint64 nSkipped;
+    string msg;
+    if (!CPatternIndex::Compile(vPatterns, strOutput, nSkipped, msg))
+    {
+        cerr << "# " << msg << endl;
+        return -1;
+    }
+    CPatternIndex index;
+    if (!index.Open(strOutput, msg))
+    {
+        cerr << "# " << msg << endl;
+        return -1;
+    }
+    cout << "# Compiled " << index.Size() << " patterns to " << strOutput
+         << (nSkipped ? ", skipped " + lexical_cast_i(nSkipped) + " invalid" : "") << endl
+         << "# Difficulty: 1 in " << (1 / index.GetProbability()) << " accounts, 50% after "
+         << getEta50(index.GetProbability()) << " accounts" << endl;
+    return 0;
+}
+
+// ripplegen harvest-key --output=<path>
+int harvestKeyMain(int argc, char* argv[])
+{
+    string strOutput;
+    for (int i = 2; i < argc; i++)
+    {
+        string strArgument = argv[i];
+        if (strArgument.compare(0, 9, "--output=") == 0)
+            strOutput = strArgument.substr(9);
+        else
+        {
+            cerr << "# Unknown harvest-key option: " << strArgument << endl;
+            return -1;
+        }
+    }
+    string msg;
+    if (strOutput.empty())
+    {
+        cerr << "# harvest-key needs --output=<path>" << endl;
+        return -1;
+    }
+    if (!CHarvestKey::Create(strOutput, msg))
+    {
+        cerr << "# " << msg << endl;
+        return -1;
+    }
+    cout << "# Harvest key written to " << strOutput << ", keep a copy: the harvested seeds are lost without it" << endl;
+    return 0;
+}
+
+// ripplegen harvest-query --dir=<path> [--key=<path>] [--input=<path>] [--count=n] [--claim]
+//
+// Orders from stock: for each pattern, up to --count harvested accounts not
+// handed out yet (0: all of them), with their seeds if the key is given, in
+// the form of search hits.  --claim marks them handed out.  Exits with 1 if
+// some pattern could not be filled, so the caller knows what to search for.
+int harvestQueryMain(int argc, char* argv[])
+{
+    string strDir, strKey, strInput;
+    size_t nCount = 1;
+    bool fClaim = false;
+    for (int i = 2; i < argc; i++)
+    {
+        string strArgument = argv[i];
+        if (strArgument.compare(0, 6, "--dir=") == 0)
+            strDir = strArgument.substr(6);
+        else if (strArgument.compare(0, 6, "--key=") == 0)
+            strKey = strArgument.substr(6);
+        else if (strArgument.compare(0, 8, "--input=") == 0)
+            strInput = strArgument.substr(8);
+        else if (strArgument.compare(0, 8, "--count=") == 0)
+            nCount = strtoul(strArgument.substr(8).c_str(), NULL, 10);
+        else if (strArgument == "--claim")
+            fClaim = true;
+        else
+        {
+            cerr << "# Unknown harvest-query option: " << strArgument << endl;
+            return -1;
+        }
+    }
+    if (strDir.empty())
+    {
+        cerr << "# harvest-query needs --dir=<path>" << endl;
+        return -1;
+    }
+    if (fClaim && strKey.empty())
+    {
+        cerr << "# --claim hands out seeds, it needs --key=<path>" << endl;
+        return -1;
+    }
+
+    string msg;
+    CHarvestStock stock;
+    CHarvestKey key;
+    if (!stock.Open(strDir, msg) || (!strKey.empty() && (!key.Load(strKey, msg) || !stock.CheckKey(key, msg)))
+        || (fClaim && !stock.Lock(msg)))
+    {
+        cerr << "# " << msg << endl;
+        return -1;
+    }
+
+    ifstream file;
+    if (strInput.length() > 0 && strInput != "-")
+    {
+        file.open(strInput.c_str());
+        if (!file)
+        {
+            cerr << "# Cannot open " << strInput << endl;
+            return -1;
+        }
+    }
+    vector<string> vPatterns = readPatterns(file.is_open() ? file : cin);
+
+    cout << "# Stock: " << stock.Size() << " accounts in " << stock.Segments() << (stock.Segments() == 1 ? " segment, " : " segments, ")
+         << stock.Claimed() << " handed out" << endl
+         << "#" << endl;
+    int nUnfilled = 0;
+    RippleAddress naSeed, naAccount;
+    for (size_t i = 0; i < vPatterns.size(); i++)
+    {
+        vector<CHarvestRecord> vFound;
+        uint64 nTotal = 0;
+        if (!stock.Find(vPatterns[i], nCount, strKey.empty() ? NULL : &key, vFound, nTotal, msg))
+        {
+            cerr << "# " << msg << endl;
+            return -1;
+        }
+        cout << "# " << vPatterns[i] << ": " << nTotal << " in stock" << endl
+             << "#" << endl;
+        if (nCount == 0 ? nTotal == 0 : vFound.size() < nCount)
+            nUnfilled++;
+        if (strKey.empty())
+            continue;
+        // claimed on disk first: a seed shown is never handed out again
+        if (fClaim && !stock.Claim(vFound, msg))
+        {
+            for (size_t j = 0; j < vFound.size(); j++)
+                vFound[j].ClearSeed();
+            cerr << "# " << msg << endl;
+            return -1;
+        }
+        for (size_t j = 0; j < vFound.size(); j++)
+        {
+            naSeed.setSeed(vFound[j].seed);
+            naAccount.setAccountID(vFound[j].accountID);
+            cout << "master seed:		" << naSeed.humanSeed() << "\n"
+                 << "master seed hex:	" << naSeed.getSeed().ToString() << "\n"
+                 << "account id:		" << naAccount.humanAccountID() << "\n"
+                 << (vFound[j].nIndex != 0 ? "account index:	" + lexical_cast_i(vFound[j].nIndex) + "\n" : "")
+                 << endl;
+            vFound[j].ClearSeed();
+        }
+    }
+    return nUnfilled ? 1 : 0;
+}
+
 int main(int argc, char* argv[])
 {
     if (argc < 2) {
         cout << "# Usage: " << argv[0] << " -s xxx.txt -f xxx.txt -o xxx.txt [threads=cpus available]" << endl
+             << "#        " << argv[0] << " ... [--seed-prefix=s...] [--backend=auto|ifma|native|openssl] [--matcher=interval|string]" << endl
+             << "#        " << argv[0] << " ... [--quota=n] [--max-hits=n] [--max-seconds=n] [--max-candidates=n]" << endl
+             << "#        " << argv[0] << " ... [--autotune[=xxx.tune] | --tuning=xxx.tune] (%h: host name)" << endl
+             << "#        " << argv[0] << " ... [--split-key=<public key hex>]" << endl
+             << "#        " << argv[0] << " -f xxx.txt [--targets=account,public,node,xaddress] [--x-tag=n] ... (r..., a..., n..., X... patterns)" << endl
+             << "#        " << argv[0] << " ... [--background[=idle|nice:n]] [--cpu-share=%] [--max-load=%] [--max-pressure=%]" << endl
+             << "#        " << argv[0] << " --score=repeat|match:<target>|words:xxx.txt [--top=n] [--max-seconds=n] ..." << endl
+             << "#        " << argv[0] << " --patterns=xxx.idx ... (instead of -f)" << endl
+             << "#        " << argv[0] << " --daemon=<socket path> [-s xxx.txt]" << endl
+             << "#        " << argv[0] << " --coordinator=<address>:<port> --cluster-key=xxx.key -f xxx.txt [-s xxx.txt] [-o xxx.txt]" << endl
+             << "#        " << argv[0] << " --worker=<host>:<port> --cluster-key=xxx.key" << endl
+             << "#        " << argv[0] << " ... [--key-type=secp256k1|ed25519|both]" << endl
+             << "#        " << argv[0] << " ... [--profile[=n]] (time one batch in n, report on SIGUSR1 and at the end)" << endl
+             << "#        " << argv[0] << " ... [--lock-memory] (keep tables, seeds and key scalars out of swap)" << endl
+             << "#        " << argv[0] << " derive [--input=xxx.txt] [--indexes=0,2-5] [--key-type=type] [--verify] [--threads=n] [--backend=name]" << endl
+             << "#        " << argv[0] << " compile-patterns [--input=xxx.txt] --output=xxx.idx" << endl
+             << "#        " << argv[0] << " ... --harvest=<dir> --harvest-filter=xxx.idx --harvest-key=xxx.key" << endl
+             << "#        " << argv[0] << " harvest-key --output=xxx.key" << endl
+             << "#        " << argv[0] << " harvest-query --dir=<dir> [--key=xxx.key] [--input=xxx.txt] [--count=n] [--claim]" << endl
              << "#" << endl;
         return 0;
     }
 
+	if (string(argv[1]) == "derive")
+		return deriveMain(argc, argv);
+	if (string(argv[1]) == "compile-patterns")
+		return compilePatternsMain(argc, argv);
+	if (string(argv[1]) == "harvest-key")
+		return harvestKeyMain(argc, argv);
+	if (string(argv[1]) == "harvest-query")
+		return harvestQueryMain(argc, argv);
+
 	string seed;
 	string pattern;
+	string strDaemonPath;
+	string strCoordinator;
+	string strCoordinatorAddress;
+	string strClusterKey;
+	string strSeedPrefix;
+	string strBackend;
+	string strMatcher;
+	string strIndexPath;
+	string strPatternPath;
+	string strTuningPath;
+	string strSplitKey;
+	string strScore;
+	string strTargets;
+	string strXTag;
+	string strHarvest, strHarvestFilter, strHarvestKey;
+	string strKeyType;
+	unsigned int nTop = 10;
+	string strBackground;
+	bool fBackground = false;
+	double dCpuShare = 100, dMaxLoad = 50, dMaxPressure = 10;
+	bool fAutotune = false;
+	bool fProfile = false;
+	bool fLockMemory = false;
+	unsigned int nProfileRate = 0;
+	uint64 nQuota = 0;
+	int nCoordinatorPort = 0;
+	int nAccounts = 1;
 	
 	for (int i=1; i<argc;i++)
 	{
@@ -307,56 +1105,631 @@ int main(int argc, char* argv[])
 		}
 		else if (strArgument.compare("-f")==0)
 		{
-			string strPatternPath = argv[i+1];
+			strPatternPath = argv[i+1];
 
 			pattern = readdiskfile(strPatternPath);
+			pattern = pattern.substr(0, pattern.find_first_of("\r\n"));
 		}
 		else if (strArgument.compare("-o")==0)
 		{
 			strOutPath = argv[i+1];
 		}
+		else if (strArgument.compare(0, 20, "--accounts-per-seed=")==0)
+		{
+			nAccounts = atoi(strArgument.substr(20).c_str());
+		}
+		else if (strArgument.compare(0, 9, "--daemon=")==0)
+		{
+			strDaemonPath = strArgument.substr(9);
+		}
+		else if (strArgument.compare(0, 14, "--coordinator=")==0)
+		{
+			// the address is required: no listening on every interface by default
+			size_t nColon = strArgument.rfind(':');
+			nCoordinatorPort = nColon != string::npos && nColon > 14 ? atoi(strArgument.substr(nColon + 1).c_str()) : 0;
+			if (nCoordinatorPort <= 0)
+				nCoordinatorPort = -1;
+			else
+				strCoordinatorAddress = strArgument.substr(14, nColon - 14);
+			if (strCoordinatorAddress.size() > 2 && strCoordinatorAddress[0] == '[' && strCoordinatorAddress[strCoordinatorAddress.size() - 1] == ']')
+				strCoordinatorAddress = strCoordinatorAddress.substr(1, strCoordinatorAddress.size() - 2);
+		}
+		else if (strArgument.compare(0, 9, "--worker=")==0)
+		{
+			strCoordinator = strArgument.substr(9);
+		}
+		else if (strArgument.compare(0, 14, "--cluster-key=")==0)
+		{
+			strClusterKey = strArgument.substr(14);
+		}
+		else if (strArgument.compare(0, 14, "--seed-prefix=")==0)
+		{
+			strSeedPrefix = strArgument.substr(14);
+		}
+		else if (strArgument.compare(0, 10, "--backend=")==0)
+		{
+			strBackend = strArgument.substr(10);
+		}
+		else if (strArgument.compare(0, 10, "--matcher=")==0)
+		{
+			strMatcher = strArgument.substr(10);
+		}
+		else if (strArgument.compare(0, 11, "--patterns=")==0)
+		{
+			strIndexPath = strArgument.substr(11);
+		}
+		else if (strArgument.compare(0, 10, "--autotune")==0)
+		{
+			fAutotune = true;
+			if (strArgument.compare(0, 11, "--autotune=")==0)
+				strTuningPath = strArgument.substr(11);
+		}
+		else if (strArgument.compare(0, 9, "--tuning=")==0)
+		{
+			strTuningPath = strArgument.substr(9);
+		}
+		else if (strArgument.compare(0, 12, "--split-key=")==0)
+		{
+			strSplitKey = strArgument.substr(12);
+		}
+		else if (strArgument.compare(0, 8, "--score=")==0)
+		{
+			strScore = strArgument.substr(8);
+		}
+		else if (strArgument.compare(0, 10, "--targets=")==0)
+		{
+			strTargets = strArgument.substr(10);
+		}
+		else if (strArgument.compare(0, 8, "--x-tag=")==0)
+		{
+			strXTag = strArgument.substr(8);
+		}
+		else if (strArgument.compare(0, 10, "--harvest=")==0)
+		{
+			strHarvest = strArgument.substr(10);
+		}
+		else if (strArgument.compare(0, 17, "--harvest-filter=")==0)
+		{
+			strHarvestFilter = strArgument.substr(17);
+		}
+		else if (strArgument.compare(0, 14, "--harvest-key=")==0)
+		{
+			strHarvestKey = strArgument.substr(14);
+		}
+		else if (strArgument.compare(0, 11, "--key-type=")==0)
+		{
+			strKeyType = strArgument.substr(11);
+		}
+		else if (strArgument.compare("--lock-memory")==0)
+		{
+			fLockMemory = true;
+		}
+		else if (strArgument.compare(0, 9, "--profile")==0)
+		{
+			fProfile = true;
+			if (strArgument.compare(0, 10, "--profile=")==0)
+				nProfileRate = strtoul(strArgument.substr(10).c_str(), NULL, 10);
+		}
+		else if (strArgument.compare(0, 6, "--top=")==0)
+		{
+			nTop = strtoul(strArgument.substr(6).c_str(), NULL, 10);
+		}
+		else if (strArgument.compare(0, 12, "--background")==0)
+		{
+			fBackground = true;
+			strBackground = strArgument.compare(0, 13, "--background=")==0 ? strArgument.substr(13) : "idle";
+		}
+		else if (strArgument.compare(0, 12, "--cpu-share=")==0)
+		{
+			fBackground = true;
+			dCpuShare = atof(strArgument.substr(12).c_str());
+		}
+		else if (strArgument.compare(0, 11, "--max-load=")==0)
+		{
+			dMaxLoad = atof(strArgument.substr(11).c_str());
+		}
+		else if (strArgument.compare(0, 15, "--max-pressure=")==0)
+		{
+			dMaxPressure = atof(strArgument.substr(15).c_str());
+		}
+		else if (strArgument.compare(0, 8, "--quota=")==0)
+		{
+			nQuota = strtoull(strArgument.substr(8).c_str(), NULL, 10);
+		}
+		else if (strArgument.compare(0, 11, "--max-hits=")==0)
+		{
+			max_hits = strtoull(strArgument.substr(11).c_str(), NULL, 10);
+		}
+		else if (strArgument.compare(0, 14, "--max-seconds=")==0)
+		{
+			max_seconds = strtoull(strArgument.substr(14).c_str(), NULL, 10);
+		}
+		else if (strArgument.compare(0, 17, "--max-candidates=")==0)
+		{
+			max_candidates = strtoull(strArgument.substr(17).c_str(), NULL, 10);
+		}
 	}
 
 //    string pattern = argv[1];
     string msg;
-	if (!isPatternValid(pattern, msg)) {
+    if (!strScore.empty()) {
+        // the score takes the place of the pattern
+        strMatcher = "score";
+        pattern = strScore;
+    }
+    // before --autotune builds the tables
+    if (fLockMemory)
+        CArena::Instance().SetLocked();
+    CCpuTopology topology = GetCpuTopology();
+    CTuning tuning;
+    bool fTuned = false;
+    if (fAutotune) {
+        CAutotuner tuner(topology, strBackend, max(nAccounts, 1));
+        tuning = tuner.Run(cout);
+        if (!strTuningPath.empty()) {
+            if (!tuning.Save(expandHostPath(strTuningPath), msg)) {
+                cout << "# " << msg << "." << endl
+                     << "#" << endl;
+                return -1;
+            }
+            cout << "# Saved to " << expandHostPath(strTuningPath) << endl
+                 << "#" << endl;
+        }
+        // on its own, --autotune only measures
+        if (strPatternPath.empty() && strIndexPath.empty() && strDaemonPath.empty() && strCoordinator.empty()
+            && nCoordinatorPort == 0 && strScore.empty())
+            return 0;
+        fTuned = true;
+    }
+    else if (!strTuningPath.empty()) {
+        if (!tuning.Load(expandHostPath(strTuningPath), msg)) {
+            cout << "# " << msg << "." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        cout << "# Tuning: " << tuning.ToString() << " (" << (uint64) tuning.dRate << " accounts/second when measured)" << endl
+             << "#" << endl;
+        fTuned = true;
+    }
+    // node and account public key patterns (or --targets) make a target
+    // search of the whole pattern file
+    int nTargets = 0;
+    size_t nOtherTargets = 0;
+    if (!strTargets.empty() && !parseTargets(strTargets, nTargets, msg)) {
+        cout << "# " << msg << "." << endl
+             << "#" << endl;
+        return -1;
+    }
+    if (!strPatternPath.empty() && strIndexPath.empty() && strDaemonPath.empty() && strCoordinator.empty()
+        && nCoordinatorPort == 0 && strScore.empty() && strSplitKey.empty()) {
+        vector<string> vPatterns = readPatternFile(strPatternPath);
+        if (!strXTag.empty()) {
+            // a destination tag is 32 bits
+            char* pEnd = NULL;
+            unsigned long long nTag = strtoull(strXTag.c_str(), &pEnd, 10);
+            if (*pEnd != '\0' || strXTag[0] == '-' || nTag > 0xffffffffULL) {
+                cout << "# --x-tag must be a destination tag from 0 to 4294967295." << endl
+                     << "#" << endl;
+                return -1;
+            }
+            target_patterns.SetXAddressTag((uint32) nTag);
+        }
+        bool fTargets = nTargets != 0;
+        for (size_t i = 0; i < vPatterns.size(); i++)
+            fTargets = fTargets || getPatternTarget(vPatterns[i]) != TARGET_ACCOUNT;
+        if (fTargets && !strMatcher.empty() && strMatcher != "auto") {
+            // the targets matcher is the only one for other targets
+            cout << "# --matcher=" << strMatcher << " only searches account ids, "
+                 << (nTargets != 0 ? string("not --targets") : "\"" + strPatternPath + "\" has patterns of other targets")
+                 << "." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        if (fTargets) {
+            if (!target_patterns.Set(vPatterns, nTargets, nOtherTargets, msg)) {
+                cout << "# " << msg << "." << endl
+                     << "#" << endl;
+                return -2;
+            }
+            strMatcher = "targets";
+            pattern = strPatternPath;
+        }
+    }
+    else if (!strTargets.empty() && strTargets != "account") {
+        cout << "# --targets only works in a plain search of a pattern file (-f)." << endl
+             << "#" << endl;
+        return -1;
+    }
+
+    boost::shared_ptr<const CPatternIndex> pIndex;
+    // a plain search follows the whole pattern file, unless a single
+    // pattern matcher is asked for
+    bool fLive = strIndexPath.empty() && strDaemonPath.empty() && strCoordinator.empty() && nCoordinatorPort == 0
+                 && !strPatternPath.empty() && (strMatcher.empty() || strMatcher == "auto" || strMatcher == "live");
+    if (!strIndexPath.empty()) {
+        // the index is the pattern: mapped here, shared by the search threads
+        pIndex = CPatternIndex::OpenShared(strIndexPath, msg);
+        if (!pIndex) {
+            cout << "# " << msg << endl
+                 << "#" << endl;
+            return -2;
+        }
+        pattern = strIndexPath;
+        strMatcher = "index";
+    }
+    else if (fLive)
+        strMatcher = "live";
+	else if (strDaemonPath.empty() && strCoordinator.empty() && strScore.empty() && strMatcher != "targets" && !isPatternValid(pattern, msg)) {
 		cout << "# " << msg << endl
 			<< "#" << endl;
 		return -2;
 	}
 
-    unsigned int cpus = boost::thread::hardware_concurrency();
-    unsigned int threads = (argc >= 8) ? strtoul(argv[7], NULL, 0) : cpus;
+    // the default thread count: what the affinity mask and cgroup quota allow
+    unsigned int cpus = topology.GetBudget();
+    // the thread count is positional (argv[7]) for compatibility, so the new
+    // --options must not be mistaken for it
+    bool fThreadsArg = argc >= 8 && strspn(argv[7], "0123456789") == strlen(argv[7]);
+    unsigned int threads = fThreadsArg ? strtoul(argv[7], NULL, 0) : cpus;
+    if (fTuned) {
+        // the tuned backend and window unless --backend says otherwise
+        if (strBackend.empty() || strBackend == "auto" || strBackend == tuning.strBackend) {
+            tuning.Apply(msg);
+            strBackend = tuning.strBackend;
+        }
+        else {
+            tuning.strBackend.clear();
+#ifdef USE_NATIVE_SECP256K1
+            SetGeneratorWindow(GENERATOR_WINDOW_DEFAULT);
+#endif
+        }
+        if (!fThreadsArg)
+            threads = tuning.nThreads;
+    }
+    if (nAccounts < 1) {
+        cout << "# --accounts-per-seed must be at least 1." << endl
+             << "#" << endl;
+        return -1;
+    }
     if (threads == 0) {
         cout << "# You must run at least one thread." << endl
              << "#" << endl;
         return -1;
     }
+    if (fLive) {
+        if (!CLivePatterns::Instance().Open(strPatternPath, nQuota, threads, msg)) {
+            cout << "# " << msg << endl
+                 << "#" << endl;
+            return -2;
+        }
+        pattern = strPatternPath;
+    }
+    if (!strScore.empty()) {
+        if (!strDaemonPath.empty() || !strCoordinator.empty() || nCoordinatorPort != 0 || nTop == 0) {
+            cout << "# --score only works in a plain search, with --top of at least 1." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        if (!CScoreBoard::Instance().Open(strScore, nTop, threads, msg)) {
+            cout << "# " << msg << "." << endl
+                 << "#" << endl;
+            return -2;
+        }
+    }
+    if (!SelectCryptoBackend(strBackend, msg)) {
+        cout << "# " << msg << "." << endl
+             << "#" << endl;
+        return -1;
+    }
+    cout << "# Crypto backend: " << SelectedCryptoBackend() << " (cpu: " << GetCpuFeatures().ToString() << ")" << endl
+         << "#" << endl
+         << "# CPU budget: " << topology.GetBudgetString() << endl
+         << "#" << endl;
+
+    if (!strKeyType.empty()) {
+        if (!ParseKeyTypes(strKeyType, key_types)) {
+            cout << "# Unknown key type \"" << strKeyType << "\", available: secp256k1 ed25519 both." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        // ed25519 accounts come from the plain search loop only
+        if (key_types != KEY_SECP256K1 && (!strDaemonPath.empty() || !strCoordinator.empty() || nCoordinatorPort != 0
+                                           || !strSplitKey.empty() || strMatcher == "targets")) {
+            cout << "# --key-type=" << strKeyType << " only works in a plain search of account ids." << endl
+                 << "#" << endl;
+            return -1;
+        }
+    }
+    LoopThreadProc pLoopThread;
+    {
+        boost::scoped_ptr<CCryptoBackend> pBackend(NewCryptoBackend());
+        unsigned int nBatch = tuning.strBackend == pBackend->GetName() ? tuning.nBatch : pBackend->GetBatchSize();
+        // ed25519 keys share one inversion per batch on every native backend
+        if ((key_types & KEY_ED25519) && strcmp(pBackend->GetName(), "openssl") != 0)
+            nBatch = BACKEND_BATCH;
+        pLoopThread = selectLoopThread(strMatcher, nBatch, fProfile);
+    }
+    // the backend has built its tables by now
+    cout << "# Memory: " << CArena::Instance().ToString() << endl
+         << "#" << endl;
+    if (!strSplitKey.empty()) {
+        if (!strDaemonPath.empty() || !strCoordinator.empty() || nCoordinatorPort != 0) {
+            cout << "# --split-key only works in a plain search." << endl
+                 << "#" << endl;
+            return -1;
+        }
+#ifdef USE_NATIVE_SECP256K1
+        if (!split_key.SetPublicKey(strSplitKey, msg)) {
+            cout << "# " << msg << "." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        if (pLoopThread != NULL)
+            pLoopThread = selectSplitKeyThread(strMatcher);
+        cout << "# Split key: " << split_key.GetPublicKey() << " (hits are offsets to add to its private key)" << endl
+             << "#" << endl;
+#else
+        cout << "# --split-key needs the native secp256k1 code of a 64-bit build." << endl
+             << "#" << endl;
+        return -1;
+#endif
+    }
+    if (pLoopThread == NULL) {
+        cout << "# Unknown matcher \"" << strMatcher << "\", available: live interval string." << endl
+             << "#" << endl;
+        return -1;
+    }
+    if (fProfile) {
+        // the stages are those of the plain search loop
+        if (!strDaemonPath.empty() || !strCoordinator.empty() || nCoordinatorPort != 0 || !strSplitKey.empty()
+            || strMatcher == "targets") {
+            cout << "# --profile only works in a plain search of account ids." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        CProfile::Instance().Start(nProfileRate);
+        cout << "# Profile: " << CProfile::Instance().ToString() << endl
+             << "#" << endl;
+    }
+    if (!strHarvest.empty()) {
+        // the seeds of account ids only, from the plain search loop
+        if (!strDaemonPath.empty() || !strCoordinator.empty() || nCoordinatorPort != 0 || !strSplitKey.empty()
+            || strMatcher == "targets" || key_types != KEY_SECP256K1) {
+            cout << "# --harvest only works in a plain search of secp256k1 account ids." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        CHarvest& harvest = CHarvest::Instance();
+        if (!harvest.Open(strHarvest, strHarvestFilter, strHarvestKey, logMessage, msg)) {
+            cout << "# " << msg << "." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        cout << "# Harvest: " << harvest.ToString() << endl
+             << "#" << endl;
+    }
+    if (fBackground) {
+        // --cpu-share alone paces threads of normal priority
+        CBackground& background = CBackground::Instance();
+        if (!background.Start(strBackground, dCpuShare / 100, dMaxLoad / 100, dMaxPressure / 100, logMessage, msg)) {
+            cout << "# " << msg << "." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        cout << "# Background: " << background.ToString() << endl
+             << "#" << endl;
+    }
+
+    if (strDaemonPath.length() > 0)
+    {
+        cout << "# CPUs detected: " << cpus << endl
+             << "#" << endl;
+
+        CKeyspace keyspace;
+        if (!buildKeyspace(seed, strSeedPrefix, keyspace))
+            return -1;
+        CVanityDaemon daemon(strDaemonPath, threads, keyspace);
+        return daemon.Run();
+    }
+
+    CChannelKey clusterKey;
+    if ((strCoordinator.length() > 0 || nCoordinatorPort != 0) && !clusterKey.Load(strClusterKey, msg))
+    {
+        cout << "# " << (strClusterKey.empty() ? "--coordinator and --worker need --cluster-key=<key file>" : msg) << "." << endl
+             << "#" << endl;
+        return -1;
+    }
+
+    if (strCoordinator.length() > 0)
+    {
+        size_t nColon = strCoordinator.rfind(':');
+        if (nColon == string::npos) {
+            cout << "# --worker expects <host>:<port>." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        cout << "# CPUs detected: " << cpus << endl
+             << "#" << endl;
+
+        CLeaseWorker worker(strCoordinator.substr(0, nColon), atoi(strCoordinator.substr(nColon + 1).c_str()), clusterKey, threads);
+        return worker.Run();
+    }
+
+    if (nCoordinatorPort != 0)
+    {
+        if (nCoordinatorPort < 0) {
+            cout << "# --coordinator expects <address>:<port>, 0.0.0.0 or [::] to listen on every interface." << endl
+                 << "#" << endl;
+            return -1;
+        }
+        CKeyspace keyspace;
+        if (!buildKeyspace(seed, strSeedPrefix, keyspace))
+            return -1;
+        CLeaseCoordinator coordinator(strCoordinatorAddress, nCoordinatorPort, clusterKey, keyspace, vector<string>(1, pattern), writeHit);
+        return coordinator.Run();
+    }
 
     cout << "# CPUs detected: " << cpus << endl
          << "#" << endl
          << "# Running " << threads << " thread" << (threads == 1 ? "" : "s") << "." << endl
          << "#" << endl
-         << "# Generating seed for pattern \"" << pattern << "\"..." << endl
+         << (!strScore.empty() ? "# Scoring accounts by \"" + strScore + "\", keeping the best " + lexical_cast_i(nTop) + "..."
+             : strMatcher == "targets" ? "# Generating seed for " + lexical_cast_i(target_patterns.Size()) + " patterns in \"" + pattern + "\" ("
+                                         + targetsToString(target_patterns.GetTargets()) + ")..."
+                                         + (nOtherTargets ? "\n#\n# Skipped " + lexical_cast_i(nOtherTargets) + " patterns of other targets." : "")
+             : pIndex ? "# Generating seed for " + lexical_cast_i(pIndex->Size()) + " patterns in \"" + pattern + "\"..."
+             : fLive ? "# Generating seed for " + lexical_cast_i(CLivePatterns::Instance().Size()) + " patterns in \"" + pattern + "\"..."
+                    : "# Generating seed for pattern \"" + pattern + "\"...") << endl
+         << "#" << endl
+         << "# Accounts per seed: " << nAccounts << endl
          << "#" << endl
+         << (key_types == KEY_SECP256K1 ? "" : "# Key type: " + KeyTypesToString(key_types) + "\n#\n")
+         << (strSeedPrefix.empty() ? "" : "# Seed prefix: \"" + strSeedPrefix + "\"\n#\n")
 		 << "# seed \"" << seed << "\"..." << endl
 		 << "#" << endl
 		 << "# out path \"" << strOutPath << "\"..." << endl
 		 << "#" << endl;
 
-    uint64_t eta50 = getEta50(pattern);
+    double dProbability = !strScore.empty() ? 0 : strMatcher == "targets" ? target_patterns.GetProbability(nAccounts)
+                         : pIndex ? pIndex->GetProbability()
+                         : fLive ? CLivePatterns::Instance().GetProbability() : getPatternProbability(pattern);
+    if (dProbability != 0)
+        cout << "# Difficulty: 1 in " << (1 / dProbability) << " accounts, 50% after "
+             << getEta50(dProbability) << " accounts" << endl
+             << "#" << endl;
+
+    CKeyspace keyspace;
+    if (!buildKeyspace(seed, strSeedPrefix, keyspace))
+        return -1;
+    // split keys walk offsets, not seeds
+    CChunkScheduler scheduler(threads, 0, strSplitKey.empty() ? keyspace.Size() : ~(uint64) 0);
+
+#if !defined(WIN32) && !defined(WIN64)
+    if (fLive)
+        signal(SIGHUP, onReloadSignal);
+#endif
+    // a scored search ends with its best whenever it is stopped
+    if (!strScore.empty())
+        signal(SIGINT, onStopSignal);
+#if !defined(WIN32) && !defined(WIN64)
+    if (fProfile)
+        signal(SIGUSR1, onProfileSignal);
+#endif
 
     start_time = time(NULL);
+    vector<string> vStatus;
+    if (fLive)
+        vStatus = getStatusPatterns(CLivePatterns::Instance());
+    else if (pIndex && pIndex->Size() <= STATUS_PATTERNS)
+        for (uint32 i = 0; i < pIndex->Size(); i++)
+            vStatus.push_back(pIndex->GetPattern(i));
+    setSearchSet(dProbability, vStatus);
     string master_seed, master_seed_hex, account_id;
     vector<boost::thread*> vpThreads;
     for (unsigned int i = 0; i < threads; i++)
-        vpThreads.push_back(new boost::thread(LoopThread, i, eta50, &pattern, &master_seed, &master_seed_hex, &account_id, &seed));
+    {
+        vpThreads.push_back(new boost::thread(pLoopThread, i, &pattern, &master_seed, &master_seed_hex, &account_id, &keyspace, &scheduler, nAccounts));
+        if (fTuned && !tuning.fSmt)
+            PinThread(*vpThreads.back(), topology.vCores[i % topology.vCores.size()]);
+    }
 
+    // the threads stop on their own at a hit or candidate limit and at the
+    // end of the keyspace; the rest is watched from here
+    CLivePatterns& live = CLivePatterns::Instance();
+    while (!fDone)
+    {
+        if (fLive)
+        {
+            vector<string> vDone;
+            live.Update(100, vDone);
+            if (!vDone.empty())
+                setSearchSet(live.GetProbability(), getStatusPatterns(live));
+            for (size_t i = 0; i < vDone.size(); i++)
+            {
+                boost::unique_lock<boost::mutex> lock(cs_output);
+                cout << "# Pattern \"" << vDone[i] << "\" reached its quota." << endl
+                     << "#" << endl;
+            }
+            if (live.Changed() || reload_requested)
+            {
+                reload_requested = 0;
+                bool fReloaded = live.Reload(msg);
+                if (fReloaded)
+                    setSearchSet(live.GetProbability(), getStatusPatterns(live));
+                boost::unique_lock<boost::mutex> lock(cs_output);
+                if (fReloaded)
+                {
+                    cout << "# Reloaded \"" << pattern << "\": " << live.Size() << " patterns, " << live.Active() << " searched, "
+                         << "difficulty 1 in " << (1 / search_probability) << " accounts" << endl
+                         << "#" << endl;
+                }
+                else
+                    cout << "# " << msg << " Keeping the current patterns." << endl
+                         << "#" << endl;
+            }
+            if (live.Active() == 0 && !fDone.exchange(true))
+            {
+                boost::unique_lock<boost::mutex> lock(cs_output);
+                cout << "#    *** Every pattern reached its quota, stopping. ***" << endl
+                     << "#" << endl;
+            }
+        }
+        else
+            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+        if (!strScore.empty())
+        {
+            reportScores();
+            if (stop_requested && !fDone.exchange(true))
+            {
+                boost::unique_lock<boost::mutex> lock(cs_output);
+                cout << "#    *** Interrupted, stopping. ***" << endl
+                     << "#" << endl;
+            }
+        }
+
+        if (profile_requested)
+        {
+            profile_requested = 0;
+            boost::unique_lock<boost::mutex> lock(cs_output);
+            CProfile::Instance().Report(cout);
+        }
+
+        if (max_seconds != 0 && (uint64_t) time(NULL) - start_time >= max_seconds && !fDone.exchange(true))
+        {
+            boost::unique_lock<boost::mutex> lock(cs_output);
+            cout << "#    *** " << max_seconds << " seconds elapsed, stopping. ***" << endl
+                 << "#" << endl;
+        }
+    }
+
+    // threads held back by --background must get to see fDone
+    CBackground::Instance().Stop();
     for (unsigned int i = 0; i < threads; i++)
         vpThreads[i]->join();
    
     for (unsigned int i = 0; i < threads; i++)
         delete vpThreads[i];
+
+    if (CProfile::Instance().IsEnabled())
+        CProfile::Instance().Report(cout);
+
+    if (CHarvest::Instance().IsEnabled())
+    {
+        CHarvest::Instance().Flush();
+        cout << "# " << CHarvest::Instance().GetStats() << "." << endl
+             << "#" << endl;
+    }
+
+    if (!strScore.empty())
+    {
+        reportScores();
+        const CScoreList& vBest = CScoreBoard::Instance().GetBest();
+        cout << "# Best " << vBest.size() << " by \"" << strScore << "\":" << endl;
+        for (size_t i = 0; i < vBest.size(); i++)
+            cout << "#    " << (boost::format("%-8g") % vBest[i].dScore).str() << " " << CAccountIDAddress::ToString(vBest[i].accountID) << endl;
+        cout << "#" << endl;
+    }
  
 //     cout << "#    master seed:     " << master_seed << endl
 //          << "#    master seed hex: " << master_seed_hex << endl
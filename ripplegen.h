@@ -0,0 +1,175 @@
+#ifndef __RIPPLEGEN_H__
+#define __RIPPLEGEN_H__
+
+/*
+ * libripplegen: the derivation and matching code of ripplegen, as a C ABI
+ * ("make libripplegen").
+ *
+ * Seeds are the 16 bytes encoded in the "s..." form (note the "master seed
+ * hex" line of the command line tool prints them reversed), account ids the
+ * 20 byte hash160 encoded in the "r..." form and public keys 33 byte
+ * compressed points.  Every output goes to a buffer of the caller's.
+ *
+ * Functions return RG_OK or a negative RG_ERROR_* unless noted.  Derivers are
+ * not thread safe: use one per thread.  Pattern sets are read only once made
+ * and may be shared by any number of threads and searches.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define RG_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define RG_API __attribute__((visibility("default")))
+#else
+#define RG_API
+#endif
+
+#define RG_API_VERSION          1
+
+#define RG_OK                   0
+#define RG_ERROR_ARGUMENT       (-1)    /* NULL pointer, bad size or text */
+#define RG_ERROR_DERIVATION     (-2)    /* key derivation failed */
+#define RG_ERROR_BUFFER         (-3)    /* output buffer too small */
+#define RG_ERROR_BACKEND        (-4)    /* unknown or unsupported backend */
+#define RG_ERROR_TIMEOUT        (-5)    /* rg_search_wait: still running */
+#define RG_ERROR_INTERNAL       (-6)
+
+#define RG_SEED_SIZE            16
+#define RG_ACCOUNT_ID_SIZE      20
+#define RG_PUBLIC_KEY_SIZE      33
+#define RG_ADDRESS_MAX          36      /* "r..." or "s..." and its NUL */
+
+/* RG_API_VERSION of the library, to check against the header. */
+RG_API int rg_api_version(void);
+
+RG_API const char* rg_status_string(int status);
+
+/*
+ * Crypto backend for every deriver made afterwards, process wide: "auto"
+ * (or NULL) for the fastest this CPU supports, "ifma", "native", "openssl".
+ */
+RG_API int rg_set_backend(const char* name);
+RG_API const char* rg_get_backend(void);
+
+/* --- batch derivation ---------------------------------------------------- */
+
+typedef struct rg_deriver rg_deriver;
+
+RG_API rg_deriver* rg_deriver_new(void);
+RG_API void rg_deriver_free(rg_deriver* deriver);
+
+/* Account index of each of count seeds, RG_ACCOUNT_ID_SIZE bytes apiece. */
+RG_API int rg_derive_account_ids(rg_deriver* deriver, const uint8_t* seeds, size_t count,
+                                 uint32_t index, uint8_t* account_ids);
+
+/* Same, as compressed public keys, RG_PUBLIC_KEY_SIZE bytes apiece. */
+RG_API int rg_derive_public_keys(rg_deriver* deriver, const uint8_t* seeds, size_t count,
+                                 uint32_t index, uint8_t* public_keys);
+
+/* NUL terminated text forms, RG_ADDRESS_MAX bytes are always enough. */
+RG_API int rg_encode_account_id(const uint8_t* account_id, char* text, size_t size);
+RG_API int rg_encode_seed(const uint8_t* seed, char* text, size_t size);
+
+/* "s..." or 32 hex digits as printed by the tool. */
+RG_API int rg_decode_seed(const char* text, uint8_t* seed);
+
+/* --- pattern sets -------------------------------------------------------- */
+
+typedef struct rg_patterns rg_patterns;
+
+/*
+ * Account id prefixes, compiled in memory.  Invalid ones are skipped and
+ * counted in *skipped (may be NULL).  NULL on failure, with a message in
+ * error (may be NULL).
+ */
+RG_API rg_patterns* rg_patterns_compile(const char* const* patterns, size_t count, size_t* skipped,
+                                        char* error, size_t error_size);
+
+/* A file from "ripplegen compile-patterns", mapped read only. */
+RG_API rg_patterns* rg_patterns_open(const char* path, char* error, size_t error_size);
+
+RG_API void rg_patterns_free(rg_patterns* patterns);
+
+RG_API size_t rg_patterns_count(const rg_patterns* patterns);
+
+/* Probability that a random account matches any pattern. */
+RG_API double rg_patterns_probability(const rg_patterns* patterns);
+
+/* Pattern text of an id, NUL terminated. */
+RG_API int rg_patterns_get(const rg_patterns* patterns, uint32_t id, char* text, size_t size);
+
+/*
+ * Test count account ids; matched[i] is set to 0 or 1 (matched may be NULL).
+ * Returns the number that match.
+ */
+RG_API int rg_patterns_match(const rg_patterns* patterns, const uint8_t* account_ids, size_t count,
+                             uint8_t* matched);
+
+/*
+ * Ids of every pattern one account id matches, innermost first.  Returns how
+ * many there are; only the first capacity are stored.
+ */
+RG_API int rg_patterns_matches(const rg_patterns* patterns, const uint8_t* account_id,
+                               uint32_t* ids, size_t capacity);
+
+/* --- search sessions ----------------------------------------------------- */
+
+typedef struct rg_hit
+{
+    uint8_t     seed[RG_SEED_SIZE];
+    uint32_t    index;                  /* account index */
+    uint8_t     account_id[RG_ACCOUNT_ID_SIZE];
+    uint32_t    pattern;                /* innermost pattern matched */
+} rg_hit;
+
+/*
+ * Called for every hit, one call at a time, from a search thread.  Return
+ * nonzero to stop the search.
+ */
+typedef int (*rg_hit_callback)(void* context, const rg_hit* hit);
+
+typedef struct rg_search_options
+{
+    size_t          size;               /* sizeof(rg_search_options) */
+    unsigned int    threads;            /* 0: the CPUs allowed, cgroup quota included */
+    uint32_t        accounts_per_seed;  /* 0: 1 */
+    const uint8_t*  seed_prefix;        /* fixed first bytes of every seed */
+    size_t          seed_prefix_size;
+    uint64_t        max_hits;           /* 0: no limit */
+    uint64_t        max_candidates;     /* accounts, 0: no limit */
+} rg_search_options;
+
+typedef struct rg_search rg_search;
+
+/*
+ * Search random seeds (from the prefix, if any) in background threads until
+ * stopped, a limit is reached or the keyspace is exhausted.  options may be
+ * NULL.  The pattern set must outlive the search.
+ */
+RG_API rg_search* rg_search_start(const rg_patterns* patterns, const rg_search_options* options,
+                                  rg_hit_callback callback, void* context,
+                                  char* error, size_t error_size);
+
+/* Ask the threads to stop; returns at once. */
+RG_API int rg_search_stop(rg_search* search);
+
+/* RG_OK once every thread is done, RG_ERROR_TIMEOUT after timeout_ms. */
+RG_API int rg_search_wait(rg_search* search, uint32_t timeout_ms);
+
+/* Any pointer may be NULL. */
+RG_API int rg_search_stats(rg_search* search, uint64_t* searched, uint64_t* hits, int* finished);
+
+/* Stops, waits and frees. */
+RG_API void rg_search_free(rg_search* search);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif